@@ -29,6 +29,7 @@
 struct fs_file;
 struct fs_dir;
 struct fs_dirent;
+struct os_mbuf;
 
 int fs_open(const char *filename, uint8_t access_flags, struct fs_file **);
 int fs_close(struct fs_file *);
@@ -38,6 +39,15 @@ int fs_seek(struct fs_file *, uint32_t offset);
 uint32_t fs_getpos(const struct fs_file *);
 int fs_filelen(const struct fs_file *, uint32_t *out_len);
 
+/*
+ * Zero-copy variants of fs_read() and fs_write().  File data is read directly
+ * into the segments of an mbuf chain, and written directly from them.
+ */
+int fs_read_mbuf(struct fs_file *, uint32_t len, struct os_mbuf *om,
+  uint32_t *out_len);
+int fs_write_mbuf(struct fs_file *, const struct os_mbuf *om, int off,
+  int len);
+
 int fs_unlink(const char *filename);
 int fs_rename(const char *from, const char *to);
 int fs_mkdir(const char *path);
@@ -49,6 +59,39 @@ int fs_dirent_name(const struct fs_dirent *, size_t max_len,
   char *out_name, uint8_t *out_name_len);
 int fs_dirent_is_dir(const struct fs_dirent *);
 
+/*
+ * Usage and wear statistics for one flash area of a file system.
+ */
+struct fs_area_info {
+    uint32_t fai_length;        /* Size of area, in bytes. */
+    uint32_t fai_live;          /* Bytes occupied by live data. */
+    uint32_t fai_dead;          /* Bytes occupied by reclaimable data. */
+    uint32_t fai_erase_cnt;     /* Number of times area has been erased. */
+    uint8_t fai_is_scratch;     /* 1 if area is reserved for gc. */
+};
+
+int fs_area_info(const char *path, int idx, struct fs_area_info *);
+
+/*
+ * Space usage of a whole file system.  All sizes are in bytes, and exclude
+ * areas reserved for garbage collection.
+ */
+struct fs_statvfs {
+    uint32_t fsv_bsize;         /* Maximum data length of a single block. */
+    uint32_t fsv_total;         /* Size of all usable areas. */
+    uint32_t fsv_free;          /* Never-written space; usable immediately. */
+    uint32_t fsv_live;          /* Occupied by live data. */
+    uint32_t fsv_dead;          /* Reclaimable by garbage collection. */
+    uint32_t fsv_avail;         /* Usable after garbage collection. */
+};
+
+int fs_statvfs(const char *path, struct fs_statvfs *);
+
+/*
+ * Newtmgr command IDs (NMGR_GROUP_ID_FS).
+ */
+#define FS_NMGR_OP_AREA         0
+
 /*
  * File access flags.
  */
@@ -56,6 +99,7 @@ int fs_dirent_is_dir(const struct fs_dirent *);
 #define FS_ACCESS_WRITE         0x02
 #define FS_ACCESS_APPEND        0x04
 #define FS_ACCESS_TRUNCATE      0x08
+#define FS_ACCESS_COMPRESS      0x10    /* Compress written data blocks. */
 
 /*
  * File access return codes.
@@ -0,0 +1,91 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __FS_ASYNC_H__
+#define __FS_ASYNC_H__
+
+#include <inttypes.h>
+#include "os/os.h"
+
+/*
+ * Asynchronous file system requests.  Requests are queued to a dedicated fs
+ * task and executed in order.  When a request completes, either its callback
+ * is executed in the context of the fs task, or its event is posted to the
+ * requester's event queue.
+ */
+struct fs_file;
+struct fs_async_req;
+
+typedef void fs_async_cb(struct fs_async_req *req, void *arg);
+
+/*
+ * Request operations.
+ */
+#define FS_ASYNC_OP_OPEN        0
+#define FS_ASYNC_OP_CLOSE       1
+#define FS_ASYNC_OP_READ        2
+#define FS_ASYNC_OP_WRITE       3
+#define FS_ASYNC_OP_UNLINK      4
+
+/*
+ * Default type of a completion event.  Change far_ev.ev_type after calling
+ * fs_async_req_init() if this collides with another event type on the
+ * destination queue.
+ */
+#define FS_ASYNC_EVENT_T_DONE   (OS_EVENT_T_PERUSER)
+
+struct fs_async_req {
+    STAILQ_ENTRY(fs_async_req) far_next;
+
+    /* Completion: exactly one of far_cb or far_evq is used. */
+    fs_async_cb *far_cb;
+    void *far_cb_arg;
+    struct os_eventq *far_evq;
+    struct os_event far_ev;     /* ev_arg points to this request. */
+
+    /* Request parameters. */
+    uint8_t far_op;
+    uint8_t far_access_flags;   /* Open. */
+    uint8_t far_pending;        /* 1 if queued or executing. */
+    const char *far_path;       /* Open, unlink. */
+    struct fs_file *far_file;   /* Set by open; read, write, close. */
+    void *far_buf;              /* Read destination or write source. */
+    uint32_t far_len;           /* Read or write length. */
+
+    /* Results. */
+    uint32_t far_out_len;       /* Number of bytes read. */
+    int far_rc;                 /* 0 on success; FS_E[...] on failure. */
+};
+
+int fs_async_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+  uint16_t batch_buf_len);
+
+void fs_async_req_init(struct fs_async_req *req, fs_async_cb *cb,
+  void *cb_arg, struct os_eventq *evq);
+
+int fs_async_open(struct fs_async_req *req, const char *path,
+  uint8_t access_flags);
+int fs_async_close(struct fs_async_req *req, struct fs_file *file);
+int fs_async_read(struct fs_async_req *req, struct fs_file *file,
+  void *out_data, uint32_t len);
+int fs_async_write(struct fs_async_req *req, struct fs_file *file,
+  const void *data, uint32_t len);
+int fs_async_unlink(struct fs_async_req *req, const char *path);
+
+#endif
@@ -30,6 +30,10 @@ struct fs_ops {
     int (*f_read)(struct fs_file *file, uint32_t len, void *out_data,
       uint32_t *out_len);
     int (*f_write)(struct fs_file *file, const void *data, int len);
+    int (*f_read_mbuf)(struct fs_file *file, uint32_t len, struct os_mbuf *om,
+      uint32_t *out_len);
+    int (*f_write_mbuf)(struct fs_file *file, const struct os_mbuf *om,
+      int off, int len);
 
     int (*f_seek)(struct fs_file *file, uint32_t offset);
     uint32_t (*f_getpos)(const struct fs_file *file);
@@ -47,12 +51,33 @@ struct fs_ops {
       char *out_name, uint8_t *out_name_len);
     int (*f_dirent_is_dir)(const struct fs_dirent *dirent);
 
+    int (*f_area_info)(int idx, struct fs_area_info *out_info);
+    int (*f_statvfs)(struct fs_statvfs *out_stat);
+
     const char *f_name;
 };
 
 /*
- * Currently allow only one type of FS, starts at root.
+ * Every file, directory and directory entry object a filesystem hands out
+ * must begin with a pointer to that filesystem's fs_ops.  Operations on open
+ * handles are routed through it, so handles from different mounts can be
+ * used side by side.
+ */
+#define FS_HANDLE_OPS(handle)   (*(const struct fs_ops * const *)(handle))
+
+#ifndef FS_MAX_MOUNTS
+#define FS_MAX_MOUNTS           4
+#endif
+
+#define FS_MOUNT_POINT_MAX_LEN  15
+
+/*
+ * Filesystems are mounted at path prefixes; a path is handled by the mount
+ * with the longest matching prefix, and the filesystem sees the remainder of
+ * the path (always starting with '/').  fs_register() mounts at the root.
  */
 int fs_register(const struct fs_ops *);
+int fs_mount(const char *mount_point, const struct fs_ops *);
+int fs_unmount(const char *mount_point);
 
 #endif
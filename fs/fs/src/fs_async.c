@@ -0,0 +1,366 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <fs/fs.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include "os/os.h"
+#include "fs/fs_async.h"
+
+static struct os_task fs_async_task;
+static struct os_eventq fs_async_evq;
+static struct os_event fs_async_ev;
+static STAILQ_HEAD(, fs_async_req) fs_async_reqs =
+    STAILQ_HEAD_INITIALIZER(fs_async_reqs);
+static int fs_async_running;
+
+/* Staging buffer used to combine consecutive writes to the same file. */
+static uint8_t *fs_async_batch_buf;
+static uint16_t fs_async_batch_buf_len;
+
+static void
+fs_async_complete(struct fs_async_req *req, int rc)
+{
+    req->far_rc = rc;
+    req->far_pending = 0;
+
+    if (req->far_cb != NULL) {
+        req->far_cb(req, req->far_cb_arg);
+    } else {
+        os_eventq_put(req->far_evq, &req->far_ev);
+    }
+}
+
+static struct fs_async_req *
+fs_async_dequeue(void)
+{
+    struct fs_async_req *req;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    req = STAILQ_FIRST(&fs_async_reqs);
+    if (req != NULL) {
+        STAILQ_REMOVE_HEAD(&fs_async_reqs, far_next);
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return req;
+}
+
+/**
+ * Removes the next queued request if it is a write to the specified file
+ * that fits in the remainder of the batch buffer.
+ */
+static struct fs_async_req *
+fs_async_dequeue_batch(const struct fs_file *file, uint32_t batch_len)
+{
+    struct fs_async_req *req;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    req = STAILQ_FIRST(&fs_async_reqs);
+    if (req != NULL &&
+        req->far_op == FS_ASYNC_OP_WRITE &&
+        req->far_file == file &&
+        batch_len + req->far_len <= fs_async_batch_buf_len) {
+
+        STAILQ_REMOVE_HEAD(&fs_async_reqs, far_next);
+    } else {
+        req = NULL;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return req;
+}
+
+/**
+ * Executes a write request.  Any writes to the same file queued immediately
+ * behind it are combined into a single fs_write() call, as long as they fit
+ * in the batch buffer.  This reduces per-write overhead in the file system
+ * (e.g., one nffs data block per call).
+ */
+static void
+fs_async_write_batch(struct fs_async_req *first)
+{
+    STAILQ_HEAD(, fs_async_req) batch;
+    struct fs_async_req *req;
+    uint32_t batch_len;
+    int rc;
+
+    STAILQ_INIT(&batch);
+    STAILQ_INSERT_TAIL(&batch, first, far_next);
+    batch_len = first->far_len;
+
+    if (batch_len <= fs_async_batch_buf_len) {
+        while ((req = fs_async_dequeue_batch(first->far_file,
+                                             batch_len)) != NULL) {
+            if (batch_len == first->far_len) {
+                memcpy(fs_async_batch_buf, first->far_buf, first->far_len);
+            }
+            memcpy(fs_async_batch_buf + batch_len, req->far_buf,
+                   req->far_len);
+            batch_len += req->far_len;
+            STAILQ_INSERT_TAIL(&batch, req, far_next);
+        }
+    }
+
+    if (STAILQ_NEXT(first, far_next) == NULL) {
+        rc = fs_write(first->far_file, first->far_buf, first->far_len);
+    } else {
+        rc = fs_write(first->far_file, fs_async_batch_buf, batch_len);
+    }
+
+    while ((req = STAILQ_FIRST(&batch)) != NULL) {
+        STAILQ_REMOVE_HEAD(&batch, far_next);
+        fs_async_complete(req, rc);
+    }
+}
+
+static void
+fs_async_process(struct fs_async_req *req)
+{
+    int rc;
+
+    switch (req->far_op) {
+    case FS_ASYNC_OP_OPEN:
+        rc = fs_open(req->far_path, req->far_access_flags, &req->far_file);
+        break;
+
+    case FS_ASYNC_OP_CLOSE:
+        rc = fs_close(req->far_file);
+        break;
+
+    case FS_ASYNC_OP_READ:
+        rc = fs_read(req->far_file, req->far_len, req->far_buf,
+                     &req->far_out_len);
+        break;
+
+    case FS_ASYNC_OP_WRITE:
+        fs_async_write_batch(req);
+        return;
+
+    case FS_ASYNC_OP_UNLINK:
+        rc = fs_unlink(req->far_path);
+        break;
+
+    default:
+        rc = FS_EINVAL;
+        break;
+    }
+
+    fs_async_complete(req, rc);
+}
+
+static void
+fs_async_task_handler(void *arg)
+{
+    struct fs_async_req *req;
+
+    while (1) {
+        os_eventq_get(&fs_async_evq);
+
+        while ((req = fs_async_dequeue()) != NULL) {
+            fs_async_process(req);
+        }
+    }
+}
+
+static int
+fs_async_submit(struct fs_async_req *req, uint8_t op)
+{
+    os_sr_t sr;
+
+    if (!fs_async_running) {
+        return FS_EUNINIT;
+    }
+
+    if (req->far_cb == NULL && req->far_evq == NULL) {
+        return FS_EINVAL;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    if (req->far_pending) {
+        OS_EXIT_CRITICAL(sr);
+        return FS_EINVAL;
+    }
+    req->far_pending = 1;
+    req->far_op = op;
+    req->far_out_len = 0;
+    req->far_rc = 0;
+    STAILQ_INSERT_TAIL(&fs_async_reqs, req, far_next);
+    OS_EXIT_CRITICAL(sr);
+
+    os_eventq_put(&fs_async_evq, &fs_async_ev);
+
+    return 0;
+}
+
+/**
+ * Initializes an asynchronous request.  A request can be reused once it has
+ * completed.
+ *
+ * @param req               The request to initialize.
+ * @param cb                The callback to execute when the request
+ *                              completes, in the context of the fs task.
+ *                              Pass null to post a completion event instead.
+ * @param cb_arg            The argument to pass to the callback.
+ * @param evq               The event queue to post the request's event
+ *                              (far_ev) to on completion; only used if cb is
+ *                              null.
+ */
+void
+fs_async_req_init(struct fs_async_req *req, fs_async_cb *cb, void *cb_arg,
+                  struct os_eventq *evq)
+{
+    memset(req, 0, sizeof *req);
+    req->far_cb = cb;
+    req->far_cb_arg = cb_arg;
+    req->far_evq = evq;
+    req->far_ev.ev_type = FS_ASYNC_EVENT_T_DONE;
+    req->far_ev.ev_arg = req;
+}
+
+/**
+ * Queues a request to open a file.  On completion, the file handle is in
+ * req->far_file.  See fs_open().
+ *
+ * @return                  0 if the request was queued;
+ *                          FS_EUNINIT if the fs task is not running;
+ *                          FS_EINVAL if the request is already pending or
+ *                              has no means of completion.
+ */
+int
+fs_async_open(struct fs_async_req *req, const char *path, uint8_t access_flags)
+{
+    req->far_path = path;
+    req->far_access_flags = access_flags;
+    req->far_file = NULL;
+
+    return fs_async_submit(req, FS_ASYNC_OP_OPEN);
+}
+
+/**
+ * Queues a request to close a file.  See fs_close().
+ *
+ * @return                  0 if the request was queued; nonzero on failure.
+ */
+int
+fs_async_close(struct fs_async_req *req, struct fs_file *file)
+{
+    req->far_file = file;
+
+    return fs_async_submit(req, FS_ASYNC_OP_CLOSE);
+}
+
+/**
+ * Queues a request to read from a file.  On completion, the number of bytes
+ * read is in req->far_out_len.  The destination buffer must remain valid until
+ * the request completes.  See fs_read().
+ *
+ * @return                  0 if the request was queued; nonzero on failure.
+ */
+int
+fs_async_read(struct fs_async_req *req, struct fs_file *file, void *out_data,
+              uint32_t len)
+{
+    req->far_file = file;
+    req->far_buf = out_data;
+    req->far_len = len;
+
+    return fs_async_submit(req, FS_ASYNC_OP_READ);
+}
+
+/**
+ * Queues a request to write to a file.  The data must remain valid until the
+ * request completes.  Consecutive writes to the same file may be combined
+ * into a single write; each such request completes with the result of the
+ * combined write.  See fs_write().
+ *
+ * @return                  0 if the request was queued; nonzero on failure.
+ */
+int
+fs_async_write(struct fs_async_req *req, struct fs_file *file,
+               const void *data, uint32_t len)
+{
+    req->far_file = file;
+    req->far_buf = (void *)data;
+    req->far_len = len;
+
+    return fs_async_submit(req, FS_ASYNC_OP_WRITE);
+}
+
+/**
+ * Queues a request to unlink a file or directory.  See fs_unlink().
+ *
+ * @return                  0 if the request was queued; nonzero on failure.
+ */
+int
+fs_async_unlink(struct fs_async_req *req, const char *path)
+{
+    req->far_path = path;
+
+    return fs_async_submit(req, FS_ASYNC_OP_UNLINK);
+}
+
+/**
+ * Starts the fs task, which executes asynchronous requests.  The task should
+ * be given a lower priority than the tasks that submit requests to it, so
+ * that they are never blocked by file system operations.
+ *
+ * @param prio              The priority of the fs task.
+ * @param stack             The task's stack.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ * @param batch_buf_len     The size of the buffer used to combine
+ *                              consecutive writes to the same file; 0
+ *                              disables combining.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+int
+fs_async_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+                   uint16_t batch_buf_len)
+{
+    int rc;
+
+    free(fs_async_batch_buf);
+    fs_async_batch_buf = NULL;
+    fs_async_batch_buf_len = 0;
+
+    if (batch_buf_len > 0) {
+        fs_async_batch_buf = malloc(batch_buf_len);
+        if (fs_async_batch_buf == NULL) {
+            return FS_ENOMEM;
+        }
+        fs_async_batch_buf_len = batch_buf_len;
+    }
+
+    os_eventq_init(&fs_async_evq);
+    memset(&fs_async_ev, 0, sizeof fs_async_ev);
+    STAILQ_INIT(&fs_async_reqs);
+
+    rc = os_task_init(&fs_async_task, "fs_async", fs_async_task_handler, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    fs_async_running = 1;
+
+    return 0;
+}
@@ -31,6 +31,8 @@ static struct shell_cmd fs_ls_struct;
 static struct shell_cmd fs_rm_struct;
 static struct shell_cmd fs_mkdir_struct;
 static struct shell_cmd fs_mv_struct;
+static struct shell_cmd fs_area_struct;
+static struct shell_cmd fs_df_struct;
 
 static void
 fs_ls_file(const char *name, struct fs_file *file)
@@ -163,6 +165,77 @@ out:
     return 0;
 }
 
+static int
+fs_area_cmd(int argc, char **argv)
+{
+    struct fs_area_info info;
+    char *path;
+    int rc;
+    int i;
+
+    switch (argc) {
+    case 1:
+        path = "/";
+        break;
+    case 2:
+        path = argv[1];
+        break;
+    default:
+        console_printf("fsarea <path>\n");
+        return 1;
+    }
+
+    console_printf("%4s %8s %8s %8s %6s\n",
+      "area", "length", "live", "dead", "erases");
+    for (i = 0; ; i++) {
+        rc = fs_area_info(path, i, &info);
+        if (rc) {
+            break;
+        }
+        console_printf("%4d %8lu %8lu %8lu %6lu%s\n", i,
+          (unsigned long)info.fai_length, (unsigned long)info.fai_live,
+          (unsigned long)info.fai_dead, (unsigned long)info.fai_erase_cnt,
+          info.fai_is_scratch ? " scratch" : "");
+    }
+    if (rc != FS_ENOENT) {
+        console_printf("Error reading area info - %d\n", rc);
+    }
+    return 0;
+}
+
+static int
+fs_df_cmd(int argc, char **argv)
+{
+    struct fs_statvfs stat;
+    char *path;
+    int rc;
+
+    switch (argc) {
+    case 1:
+        path = "/";
+        break;
+    case 2:
+        path = argv[1];
+        break;
+    default:
+        console_printf("df <path>\n");
+        return 1;
+    }
+
+    rc = fs_statvfs(path, &stat);
+    if (rc) {
+        console_printf("Error reading fs usage - %d\n", rc);
+        return 0;
+    }
+    console_printf("%8s %8s %8s %8s %8s\n",
+      "total", "free", "live", "dead", "avail");
+    console_printf("%8lu %8lu %8lu %8lu %8lu\n",
+      (unsigned long)stat.fsv_total, (unsigned long)stat.fsv_free,
+      (unsigned long)stat.fsv_live, (unsigned long)stat.fsv_dead,
+      (unsigned long)stat.fsv_avail);
+    return 0;
+}
+
 void
 fs_cli_init(void)
 {
@@ -170,5 +243,7 @@ fs_cli_init(void)
     shell_cmd_register(&fs_rm_struct, "rm", fs_rm_cmd);
     shell_cmd_register(&fs_mkdir_struct, "mkdir", fs_mkdir_cmd);
     shell_cmd_register(&fs_mv_struct, "mv", fs_mv_cmd);
+    shell_cmd_register(&fs_area_struct, "fsarea", fs_area_cmd);
+    shell_cmd_register(&fs_df_struct, "df", fs_df_cmd);
 }
 #endif /* SHELL_PRESENT */
@@ -24,47 +24,123 @@
 int
 fs_open(const char *filename, uint8_t access_flags, struct fs_file **out_file)
 {
-    return fs_root_ops->f_open(filename, access_flags, out_file);
+    const struct fs_ops *fops;
+    const char *rel_path;
+
+    fops = fs_mount_lookup(filename, &rel_path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+
+    return fops->f_open(rel_path, access_flags, out_file);
 }
 
 int
 fs_close(struct fs_file *file)
 {
-    return fs_root_ops->f_close(file);
+    if (file == NULL) {
+        return 0;
+    }
+
+    return FS_HANDLE_OPS(file)->f_close(file);
 }
 
 int
 fs_read(struct fs_file *file, uint32_t len, void *out_data, uint32_t *out_len)
 {
-    return fs_root_ops->f_read(file, len, out_data, out_len);
+    return FS_HANDLE_OPS(file)->f_read(file, len, out_data, out_len);
 }
 
 int
 fs_write(struct fs_file *file, const void *data, int len)
 {
-    return fs_root_ops->f_write(file, data, len);
+    return FS_HANDLE_OPS(file)->f_write(file, data, len);
+}
+
+/**
+ * Reads data from the specified file and appends it to the end of an mbuf
+ * chain.  The data is read directly into the chain's segments; additional
+ * mbufs are allocated from the pool of the chain's last mbuf as necessary.
+ * As with fs_read(), a short read at the end of the file is not an error.
+ *
+ * @param file              The file to read from.
+ * @param len               The number of bytes to attempt to read.
+ * @param om                The mbuf chain to append the data to.
+ * @param out_len           On success, the number of bytes actually read gets
+ *                              written here.  Pass null if you don't care.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOMEM if the mbuf pool was exhausted; the
+ *                              chain retains the data read so far;
+ *                          FS_EINVAL if the file system does not support
+ *                              this operation;
+ *                          other nonzero on failure.
+ */
+int
+fs_read_mbuf(struct fs_file *file, uint32_t len, struct os_mbuf *om,
+             uint32_t *out_len)
+{
+    if (FS_HANDLE_OPS(file)->f_read_mbuf == NULL) {
+        return FS_EINVAL;
+    }
+
+    return FS_HANDLE_OPS(file)->f_read_mbuf(file, len, om, out_len);
+}
+
+/**
+ * Writes part of an mbuf chain to the current offset of the specified file.
+ * The data is written to flash directly from the chain's segments.
+ *
+ * @param file              The file to write to.
+ * @param om                The mbuf chain containing the data to write.
+ * @param off               The offset within the chain of the first byte to
+ *                              write.
+ * @param len               The number of bytes to write.
+ *
+ * @return                  0 on success;
+ *                          FS_EINVAL if the chain contains fewer than
+ *                              off + len bytes, or if the file system does
+ *                              not support this operation;
+ *                          other nonzero on failure.
+ */
+int
+fs_write_mbuf(struct fs_file *file, const struct os_mbuf *om, int off, int len)
+{
+    if (FS_HANDLE_OPS(file)->f_write_mbuf == NULL) {
+        return FS_EINVAL;
+    }
+
+    return FS_HANDLE_OPS(file)->f_write_mbuf(file, om, off, len);
 }
 
 int
 fs_seek(struct fs_file *file, uint32_t offset)
 {
-    return fs_root_ops->f_seek(file, offset);
+    return FS_HANDLE_OPS(file)->f_seek(file, offset);
 }
 
 uint32_t
 fs_getpos(const struct fs_file *file)
 {
-    return fs_root_ops->f_getpos(file);
+    return FS_HANDLE_OPS(file)->f_getpos(file);
 }
 
 int
 fs_filelen(const struct fs_file *file, uint32_t *out_len)
 {
-    return fs_root_ops->f_filelen(file, out_len);
+    return FS_HANDLE_OPS(file)->f_filelen(file, out_len);
 }
 
 int
 fs_unlink(const char *filename)
 {
-    return fs_root_ops->f_unlink(filename);
+    const struct fs_ops *fops;
+    const char *rel_path;
+
+    fops = fs_mount_lookup(filename, &rel_path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+
+    return fops->f_unlink(rel_path);
 }
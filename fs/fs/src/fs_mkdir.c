@@ -24,11 +24,35 @@
 int
 fs_rename(const char *from, const char *to)
 {
-    return fs_root_ops->f_rename(from, to);
+    const struct fs_ops *from_fops;
+    const struct fs_ops *to_fops;
+    const char *from_rel;
+    const char *to_rel;
+
+    from_fops = fs_mount_lookup(from, &from_rel);
+    to_fops = fs_mount_lookup(to, &to_rel);
+    if (from_fops == NULL || to_fops == NULL) {
+        return FS_ENOENT;
+    }
+
+    /* Renames cannot move data between filesystems. */
+    if (from_fops != to_fops) {
+        return FS_EINVAL;
+    }
+
+    return from_fops->f_rename(from_rel, to_rel);
 }
 
 int
 fs_mkdir(const char *path)
 {
-    return fs_root_ops->f_mkdir(path);
+    const struct fs_ops *fops;
+    const char *rel_path;
+
+    fops = fs_mount_lookup(path, &rel_path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+
+    return fops->f_mkdir(rel_path);
 }
@@ -16,23 +16,197 @@
  * specific language governing permissions and limitations
  * under the License.
  */
+#include <string.h>
 #include <fs/fs.h>
 #include <fs/fs_if.h>
 #include "fs_priv.h"
 
-const struct fs_ops *fs_root_ops = NULL;
+struct fs_mount {
+    char fm_prefix[FS_MOUNT_POINT_MAX_LEN + 1]; /* "" for the root. */
+    uint8_t fm_prefix_len;
+    const struct fs_ops *fm_ops;
+};
 
+/** Sorted by descending prefix length, so the first match is the longest. */
+static struct fs_mount fs_mounts[FS_MAX_MOUNTS];
+static int fs_num_mounts;
+
+/** Set once the shell and newtmgr commands have been registered. */
+static int fs_mount_cmds_registered;
+
+/**
+ * Converts a mount point to its stored prefix form: no trailing slash, and
+ * the root is the empty string.
+ *
+ * @return                      The length of the prefix;
+ *                              -1 if the mount point is invalid.
+ */
+static int
+fs_mount_prefix_len(const char *mount_point)
+{
+    int len;
+
+    if (mount_point == NULL || mount_point[0] != '/') {
+        return -1;
+    }
+
+    len = strlen(mount_point);
+    if (len == 1) {
+        return 0;
+    }
+    if (len > FS_MOUNT_POINT_MAX_LEN || mount_point[len - 1] == '/') {
+        return -1;
+    }
+
+    return len;
+}
+
+static int
+fs_mount_find_exact(const char *mount_point, int prefix_len)
+{
+    int i;
+
+    for (i = 0; i < fs_num_mounts; i++) {
+        if (fs_mounts[i].fm_prefix_len == prefix_len &&
+            memcmp(fs_mounts[i].fm_prefix, mount_point, prefix_len) == 0) {
+
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Mounts a filesystem at the specified path prefix.  Paths under the prefix
+ * are passed to the filesystem with the prefix removed; e.g., with a
+ * filesystem mounted at "/tmp", fs_open("/tmp/a") opens "/a" in it.
+ *
+ * @param mount_point           An absolute path without a trailing slash, or
+ *                                  "/" for the root.
+ * @param fops                  The filesystem to mount.
+ *
+ * @return                      0 on success;
+ *                              FS_EINVAL if the mount point is malformed;
+ *                              FS_EEXIST if something is already mounted
+ *                                  there;
+ *                              FS_ENOMEM if the mount table is full.
+ */
 int
-fs_register(const struct fs_ops *fops)
+fs_mount(const char *mount_point, const struct fs_ops *fops)
 {
-    if (fs_root_ops) {
+    struct fs_mount *fm;
+    int prefix_len;
+    int i;
+
+    prefix_len = fs_mount_prefix_len(mount_point);
+    if (prefix_len == -1) {
+        return FS_EINVAL;
+    }
+    if (fs_mount_find_exact(mount_point, prefix_len) != -1) {
         return FS_EEXIST;
     }
-    fs_root_ops = fops;
+    if (fs_num_mounts >= FS_MAX_MOUNTS) {
+        return FS_ENOMEM;
+    }
+
+    for (i = fs_num_mounts; i > 0; i--) {
+        if (fs_mounts[i - 1].fm_prefix_len >= prefix_len) {
+            break;
+        }
+        fs_mounts[i] = fs_mounts[i - 1];
+    }
+    fm = fs_mounts + i;
+    memcpy(fm->fm_prefix, mount_point, prefix_len);
+    fm->fm_prefix[prefix_len] = '\0';
+    fm->fm_prefix_len = prefix_len;
+    fm->fm_ops = fops;
+
+    fs_num_mounts++;
 
+    /* The commands outlive any one mount; register them only once, even if
+     * everything is later unmounted and mounted again.
+     */
+    if (!fs_mount_cmds_registered) {
+        fs_mount_cmds_registered = 1;
 #ifdef SHELL_PRESENT
-    fs_cli_init();
+        fs_cli_init();
 #endif
 
+#ifdef NEWTMGR_PRESENT
+        fs_nmgr_register();
+#endif
+    }
+
+    return FS_EOK;
+}
+
+/**
+ * Removes a filesystem from the mount table.  All handles opened through the
+ * mount must be closed first.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if nothing is mounted there.
+ */
+int
+fs_unmount(const char *mount_point)
+{
+    int prefix_len;
+    int idx;
+
+    prefix_len = fs_mount_prefix_len(mount_point);
+    if (prefix_len == -1) {
+        return FS_EINVAL;
+    }
+    idx = fs_mount_find_exact(mount_point, prefix_len);
+    if (idx == -1) {
+        return FS_ENOENT;
+    }
+
+    fs_num_mounts--;
+    memmove(fs_mounts + idx, fs_mounts + idx + 1,
+            (fs_num_mounts - idx) * sizeof fs_mounts[0]);
+
     return FS_EOK;
 }
+
+int
+fs_register(const struct fs_ops *fops)
+{
+    return fs_mount("/", fops);
+}
+
+/**
+ * Finds the filesystem responsible for the specified path.
+ *
+ * @param path                  The absolute path to look up.
+ * @param out_rel_path          On success, points to the path relative to the
+ *                                  mount point; always starts with '/'.
+ *
+ * @return                      The mounted filesystem;
+ *                              NULL if no mount covers the path.
+ */
+const struct fs_ops *
+fs_mount_lookup(const char *path, const char **out_rel_path)
+{
+    const struct fs_mount *fm;
+    int i;
+
+    for (i = 0; i < fs_num_mounts; i++) {
+        fm = fs_mounts + i;
+        if (strncmp(path, fm->fm_prefix, fm->fm_prefix_len) == 0 &&
+            (path[fm->fm_prefix_len] == '\0' ||
+             path[fm->fm_prefix_len] == '/' ||
+             fm->fm_prefix_len == 0)) {
+
+            if (path[fm->fm_prefix_len] == '\0' && fm->fm_prefix_len != 0) {
+                *out_rel_path = "/";
+            } else {
+                *out_rel_path = path + fm->fm_prefix_len;
+            }
+            return fm->fm_ops;
+        }
+    }
+
+    return NULL;
+}
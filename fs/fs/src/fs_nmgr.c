@@ -0,0 +1,125 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifdef NEWTMGR_PRESENT
+
+#include <string.h>
+
+#include <newtmgr/newtmgr.h>
+#include <json/json.h>
+
+#include "fs/fs.h"
+#include "fs_priv.h"
+
+static int fs_nmgr_area_read(struct nmgr_jbuf *);
+
+static const struct nmgr_handler fs_nmgr_handlers[] = {
+    [FS_NMGR_OP_AREA] = { fs_nmgr_area_read, fs_nmgr_area_read }
+};
+
+static struct nmgr_group fs_nmgr_group = {
+    .ng_handlers = (struct nmgr_handler *)fs_nmgr_handlers,
+    .ng_handlers_count = 1,
+    .ng_group_id = NMGR_GROUP_ID_FS
+};
+
+/*
+ * Request:
+ * {
+ *      "path":<path on the file system; optional, default "/">,
+ *      "idx":<area index>
+ * }
+ *
+ * Response:
+ * {
+ *      "rc":<error code>,
+ *      "len":<area length>,
+ *      "live":<bytes of live data>,
+ *      "dead":<bytes of reclaimable data>,
+ *      "erases":<erase count>,
+ *      "scratch":<true if scratch area>
+ * }
+ *
+ * Areas are numbered from 0; a client walks them until a nonzero "rc" is
+ * returned.
+ */
+static int
+fs_nmgr_area_read(struct nmgr_jbuf *njb)
+{
+    struct fs_area_info info;
+    char path[64];
+    int idx;
+    const struct json_attr_t attr[3] = {
+        [0] = {
+            .attribute = "idx",
+            .type = t_integer,
+            .addr.integer = &idx
+        },
+        [1] = {
+            .attribute = "path",
+            .type = t_string,
+            .addr.string = path,
+            .len = sizeof(path)
+        },
+        [2] = {
+            .attribute = NULL
+        }
+    };
+    struct json_value jv;
+    int rc;
+
+    rc = json_read_object(&njb->njb_buf, attr);
+    if (rc) {
+        return OS_EINVAL;
+    }
+
+    if (path[0] == '\0') {
+        strcpy(path, "/");
+    }
+
+    rc = fs_area_info(path, idx, &info);
+    if (rc) {
+        nmgr_jbuf_setoerr(njb, NMGR_ERR_EINVAL);
+        return 0;
+    }
+
+    json_encode_object_start(&njb->njb_enc);
+    JSON_VALUE_INT(&jv, NMGR_ERR_EOK);
+    json_encode_object_entry(&njb->njb_enc, "rc", &jv);
+    JSON_VALUE_UINT(&jv, info.fai_length);
+    json_encode_object_entry(&njb->njb_enc, "len", &jv);
+    JSON_VALUE_UINT(&jv, info.fai_live);
+    json_encode_object_entry(&njb->njb_enc, "live", &jv);
+    JSON_VALUE_UINT(&jv, info.fai_dead);
+    json_encode_object_entry(&njb->njb_enc, "dead", &jv);
+    JSON_VALUE_UINT(&jv, info.fai_erase_cnt);
+    json_encode_object_entry(&njb->njb_enc, "erases", &jv);
+    JSON_VALUE_BOOL(&jv, info.fai_is_scratch);
+    json_encode_object_entry(&njb->njb_enc, "scratch", &jv);
+    json_encode_object_finish(&njb->njb_enc);
+
+    return 0;
+}
+
+int
+fs_nmgr_register(void)
+{
+    return nmgr_group_register(&fs_nmgr_group);
+}
+#endif
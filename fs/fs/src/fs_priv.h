@@ -20,10 +20,16 @@
 #define __FS_PRIV_H__
 
 struct fs_ops;
-extern const struct fs_ops *fs_root_ops;
+
+const struct fs_ops *fs_mount_lookup(const char *path,
+                                     const char **out_rel_path);
 
 #ifdef SHELL_PRESENT
 void fs_cli_init(void);
 #endif /* SHELL_PRESENT */
 
+#ifdef NEWTMGR_PRESENT
+int fs_nmgr_register(void);
+#endif /* NEWTMGR_PRESENT */
+
 #endif
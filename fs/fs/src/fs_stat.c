@@ -0,0 +1,91 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <fs/fs.h>
+#include <fs/fs_if.h>
+
+#include "fs_priv.h"
+
+/**
+ * Retrieves usage and wear statistics for one of the flash areas backing a
+ * file system.  Areas are numbered consecutively from 0; callers can iterate
+ * through them until FS_ENOENT is returned.
+ *
+ * @param path                  Any path on the file system to query; e.g.,
+ *                                  its mount point.
+ * @param idx                   The index of the area to query.
+ * @param out_info              On success, the area statistics get written
+ *                                  here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if there is no area with the
+ *                                  specified index, or no file system is
+ *                                  mounted at the path;
+ *                              FS_EINVAL if the file system does not
+ *                                  support this operation;
+ *                              other nonzero on failure.
+ */
+int
+fs_area_info(const char *path, int idx, struct fs_area_info *out_info)
+{
+    const struct fs_ops *fops;
+    const char *rel_path;
+
+    fops = fs_mount_lookup(path, &rel_path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+    if (fops->f_area_info == NULL) {
+        return FS_EINVAL;
+    }
+
+    return fops->f_area_info(idx, out_info);
+}
+
+/**
+ * Retrieves a file system's space usage.  The totals are maintained as the
+ * file system is modified, so this call is inexpensive; it can be used to
+ * decide whether there is room for a large write before attempting it.
+ *
+ * @param path                  Any path on the file system to query; e.g.,
+ *                                  its mount point.
+ * @param out_stat              On success, the usage totals get written here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if no file system is mounted at the
+ *                                  path;
+ *                              FS_EINVAL if the file system does not
+ *                                  support this operation;
+ *                              other nonzero on failure.
+ */
+int
+fs_statvfs(const char *path, struct fs_statvfs *out_stat)
+{
+    const struct fs_ops *fops;
+    const char *rel_path;
+
+    fops = fs_mount_lookup(path, &rel_path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+    if (fops->f_statvfs == NULL) {
+        return FS_EINVAL;
+    }
+
+    return fops->f_statvfs(out_stat);
+}
@@ -22,6 +22,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include "os/os.h"
 
 #define NFFS_FILENAME_MAX_LEN   256  /* Does not require null terminator. */
 #define NFFS_MAX_AREAS          256
@@ -30,7 +31,10 @@ struct nffs_config {
     /** Maximum number of inodes; default=1024. */
     uint32_t nc_num_inodes;
 
-    /** Maximum number of data blocks; default=4096. */
+    /**
+     * Maximum number of data blocks; default=4096.  The sum of nc_num_inodes
+     * and nc_num_blocks must be less than 65535.
+     */
     uint32_t nc_num_blocks;
 
     /** Maximum number of open files; default=4. */
@@ -44,6 +48,25 @@ struct nffs_config {
 
     /** Data block cache size; default=64. */
     uint32_t nc_num_cache_blocks;
+
+    /** Full filename cache size; 0=disabled; default=0. */
+    uint32_t nc_num_cache_names;
+
+    /**
+     * Data content cache size, in bytes; 0=disabled; default=0.  Rounded down
+     * to a whole number of maximum-size blocks.
+     */
+    uint32_t nc_data_cache_bytes;
+
+    /** Objects processed per incremental gc step; default=16. */
+    uint32_t nc_gc_step_objs;
+
+    /**
+     * Maximum data block length, in bytes; default=2048.  Larger blocks
+     * reduce per-block overhead for big sequential files.  The effective
+     * limit is also bounded by 32768 and by half the smallest area.
+     */
+    uint32_t nc_block_max_data_sz;
 };
 
 extern struct nffs_config nffs_config;
@@ -54,10 +77,19 @@ struct nffs_area_desc {
     uint8_t nad_flash_id;   /* Logical flash id */
 };
 
+/**
+ * A CRC16-CCITT implementation: polynomial 0x1021, most significant bit first,
+ * no final xor.
+ */
+typedef uint16_t nffs_crc16_func_t(uint16_t initial_crc, const void *buf,
+                                   int len);
+
 int nffs_init(void);
 int nffs_detect(const struct nffs_area_desc *area_descs);
 int nffs_format(const struct nffs_area_desc *area_descs);
 int nffs_ready(void);
+int nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size);
+void nffs_crc16_set_hw(nffs_crc16_func_t *func);
 
 
 #endif
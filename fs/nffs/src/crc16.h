@@ -50,6 +50,12 @@
 
 #include <inttypes.h>
 
-unsigned short crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+typedef uint16_t crc16_func_t(uint16_t initial_crc, const void *buf, int len);
+
+extern crc16_func_t *crc16_ccitt_hw;
+
+uint16_t crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+uint16_t crc16_ccitt_sw(uint16_t initial_crc, const void *buf, int len);
+uint16_t crc16_ccitt_bytewise(uint16_t initial_crc, const void *buf, int len);
 
 #endif /* _CRC16_H_ */
@@ -33,6 +33,7 @@ struct nffs_area *nffs_areas;
 uint8_t nffs_num_areas;
 uint8_t nffs_scratch_area_idx;
 uint16_t nffs_block_max_data_sz;
+uint8_t nffs_block_lz_ok;
 
 struct os_mempool nffs_file_pool;
 struct os_mempool nffs_dir_pool;
@@ -40,25 +41,49 @@ struct os_mempool nffs_inode_entry_pool;
 struct os_mempool nffs_block_entry_pool;
 struct os_mempool nffs_cache_inode_pool;
 struct os_mempool nffs_cache_block_pool;
+struct os_mempool nffs_cache_name_pool;
+struct os_mempool nffs_cache_data_pool;
 
 void *nffs_file_mem;
 void *nffs_inode_mem;
 void *nffs_block_entry_mem;
 void *nffs_cache_inode_mem;
 void *nffs_cache_block_mem;
+void *nffs_cache_name_mem;
+void *nffs_cache_data_mem;
 void *nffs_dir_mem;
 
+/* Scratch space for compressed blocks; allocated on first use. */
+uint8_t *nffs_block_lz_buf;
+uint8_t *nffs_block_lz_raw;
+
+struct nffs_file_lock *nffs_file_locks;
+
 struct nffs_inode_entry *nffs_root_dir;
 struct nffs_inode_entry *nffs_lost_found_dir;
 
+/* The index lock: protects the RAM index, caches, and area state. */
 static struct os_mutex nffs_mutex;
 
+static struct os_task nffs_gc_task;
+static struct os_sem nffs_gc_sem;
+static int nffs_gc_task_running;
+
+/* Set when the gc task has been signalled but has not yet run; protected by
+ * the nffs lock.
+ */
+static int nffs_gc_task_pending;
+
 static int nffs_open(const char *path, uint8_t access_flags,
   struct fs_file **out_file);
 static int nffs_close(struct fs_file *fs_file);
 static int nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
   uint32_t *out_len);
 static int nffs_write(struct fs_file *fs_file, const void *data, int len);
+static int nffs_read_mbuf(struct fs_file *fs_file, uint32_t len,
+  struct os_mbuf *om, uint32_t *out_len);
+static int nffs_write_mbuf(struct fs_file *fs_file, const struct os_mbuf *om,
+  int off, int len);
 static int nffs_seek(struct fs_file *fs_file, uint32_t offset);
 static uint32_t nffs_getpos(const struct fs_file *fs_file);
 static int nffs_file_len(const struct fs_file *fs_file, uint32_t *out_len);
@@ -71,12 +96,16 @@ static int nffs_closedir(struct fs_dir *dir);
 static int nffs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
   char *out_name, uint8_t *out_name_len);
 static int nffs_dirent_is_dir(const struct fs_dirent *fs_dirent);
+static int nffs_area_info(int idx, struct fs_area_info *out_info);
+static int nffs_statvfs(struct fs_statvfs *out_stat);
 
 static const struct fs_ops nffs_ops = {
     .f_open = nffs_open,
     .f_close = nffs_close,
     .f_read = nffs_read,
     .f_write = nffs_write,
+    .f_read_mbuf = nffs_read_mbuf,
+    .f_write_mbuf = nffs_write_mbuf,
 
     .f_seek = nffs_seek,
     .f_getpos = nffs_getpos,
@@ -93,6 +122,9 @@ static const struct fs_ops nffs_ops = {
     .f_dirent_name = nffs_dirent_name,
     .f_dirent_is_dir = nffs_dirent_is_dir,
 
+    .f_area_info = nffs_area_info,
+    .f_statvfs = nffs_statvfs,
+
     .f_name = "nffs"
 };
 
@@ -114,6 +146,92 @@ nffs_unlock(void)
     assert(rc == 0 || rc == OS_NOT_STARTED);
 }
 
+/**
+ * Associates a newly-opened file handle with the I/O lock of its file.  All
+ * handles to the same file share a single lock.  This must be called with
+ * the index lock held.
+ */
+static void
+nffs_file_lock_attach(struct nffs_file *file)
+{
+    struct nffs_file_lock *free_lock;
+    struct nffs_file_lock *lock;
+    int i;
+
+    free_lock = NULL;
+    for (i = 0; i < nffs_config.nc_num_files; i++) {
+        lock = nffs_file_locks + i;
+        if (lock->nfl_inode_entry == file->nf_inode_entry) {
+            lock->nfl_refcnt++;
+            file->nf_lock = lock;
+            return;
+        }
+        if (free_lock == NULL && lock->nfl_inode_entry == NULL) {
+            free_lock = lock;
+        }
+    }
+
+    /* There is one slot per file handle, so a free slot always exists. */
+    assert(free_lock != NULL);
+
+    free_lock->nfl_inode_entry = file->nf_inode_entry;
+    free_lock->nfl_refcnt = 1;
+    file->nf_lock = free_lock;
+}
+
+/**
+ * Detaches a file handle from its I/O lock prior to closing the handle.  This
+ * must be called with the index lock held.
+ */
+static void
+nffs_file_lock_detach(struct nffs_file *file)
+{
+    struct nffs_file_lock *lock;
+
+    lock = file->nf_lock;
+    assert(lock->nfl_refcnt > 0);
+
+    lock->nfl_refcnt--;
+    if (lock->nfl_refcnt == 0) {
+        lock->nfl_inode_entry = NULL;
+    }
+    file->nf_lock = NULL;
+}
+
+static void
+nffs_lock_file(const struct nffs_file *file)
+{
+    int rc;
+
+    rc = os_mutex_pend(&file->nf_lock->nfl_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static void
+nffs_unlock_file(const struct nffs_file *file)
+{
+    int rc;
+
+    rc = os_mutex_release(&file->nf_lock->nfl_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+/**
+ * Wakes the garbage collection task if the file system would benefit from
+ * garbage collection.  This must be called with the nffs lock held.
+ */
+static void
+nffs_gc_task_wakeup(void)
+{
+    if (nffs_gc_task_running &&
+        !nffs_gc_task_pending &&
+        nffs_gc_incr_needed()) {
+
+        nffs_gc_task_pending = 1;
+        os_sem_release(&nffs_gc_sem);
+    }
+}
+
 /**
  * Opens a file at the specified path.  The result of opening a nonexistent
  * file depends on the access flags specified.  All intermediate directories
@@ -128,6 +246,11 @@ nffs_unlock(void)
  *   "a"  -  FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *   "a+" -  FS_ACCESS_READ | FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *
+ * FS_ACCESS_COMPRESS may be combined with any writable mode.  Blocks written
+ * through the handle are stored compressed when that saves space; reads are
+ * unaffected, as compressed blocks are decompressed transparently regardless
+ * of the flags they are read with.
+ *
  * @param path              The path of the file to open.
  * @param access_flags      Flags controlling file access; see above table.
  * @param out_file          On success, a pointer to the newly-created file
@@ -152,6 +275,8 @@ nffs_open(const char *path, uint8_t access_flags, struct fs_file **out_fs_file)
     if (rc != 0) {
         goto done;
     }
+    nffs_file_lock_attach(out_file);
+    out_file->nf_fops = &nffs_ops;
     *out_fs_file = (struct fs_file *)out_file;
 done:
     nffs_unlock();
@@ -181,6 +306,7 @@ nffs_close(struct fs_file *fs_file)
     }
 
     nffs_lock();
+    nffs_file_lock_detach(file);
     rc = nffs_file_close(file);
     nffs_unlock();
 
@@ -203,9 +329,11 @@ nffs_seek(struct fs_file *fs_file, uint32_t offset)
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
+    nffs_lock_file(file);
     nffs_lock();
     rc = nffs_file_seek(file, offset);
     nffs_unlock();
+    nffs_unlock_file(file);
 
     return rc;
 }
@@ -269,13 +397,42 @@ static int
 nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
           uint32_t *out_len)
 {
+    uint32_t bytes_read;
+    uint32_t chunk_len;
+    uint32_t total;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
-    rc = nffs_file_read(file, len, out_data, out_len);
-    nffs_unlock();
+    /* The file lock keeps the read atomic with respect to other handles to
+     * this file.  The index lock is released after each block so that other
+     * files remain accessible during a long read.
+     */
+    nffs_lock_file(file);
+
+    total = 0;
+    do {
+        chunk_len = len - total;
+        if (chunk_len > nffs_block_max_data_sz) {
+            chunk_len = nffs_block_max_data_sz;
+        }
+
+        nffs_lock();
+        rc = nffs_file_read(file, chunk_len, (uint8_t *)out_data + total,
+                            &bytes_read);
+        nffs_unlock();
+        if (rc != 0) {
+            goto done;
+        }
+
+        total += bytes_read;
+    } while (bytes_read == chunk_len && total < len);
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
 
+done:
+    nffs_unlock_file(file);
     return rc;
 }
 
@@ -291,25 +448,217 @@ nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
 static int
 nffs_write(struct fs_file *fs_file, const void *data, int len)
 {
+    const uint8_t *data_ptr;
+    int chunk_len;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
+    /* As with reads, the file lock is held for the whole write, and the
+     * index lock is only held while one block is written.
+     */
+    nffs_lock_file(file);
+
+    data_ptr = data;
+    do {
+        chunk_len = len;
+        if (chunk_len > nffs_block_max_data_sz) {
+            chunk_len = nffs_block_max_data_sz;
+        }
+
+        nffs_lock();
+
+        if (!nffs_ready()) {
+            rc = FS_EUNINIT;
+        } else {
+            rc = nffs_write_to_file(file, data_ptr, chunk_len);
+            if (rc == 0) {
+                nffs_gc_task_wakeup();
+            }
+        }
+
+        nffs_unlock();
+        if (rc != 0) {
+            goto done;
+        }
+
+        data_ptr += chunk_len;
+        len -= chunk_len;
+    } while (len > 0);
 
-    if (!nffs_ready()) {
-        rc = FS_EUNINIT;
-        goto done;
+    rc = 0;
+
+done:
+    nffs_unlock_file(file);
+    return rc;
+}
+
+/**
+ * Reads data from the specified file and appends it to an mbuf chain.  Flash
+ * data is read directly into the trailing space of the chain's last segment,
+ * and into new segments allocated from that segment's pool.  If more data is
+ * requested than remains in the file, all available data is retrieved.
+ *
+ * Only bytes that were actually read are added to the chain, so on failure
+ * the chain holds whatever was read before the error.
+ *
+ * @param file              The file to read from.
+ * @param len               The number of bytes to attempt to read.
+ * @param om                The mbuf chain to append to.
+ * @param out_len           The number of bytes actually appended gets written
+ *                              here, even on failure.  Pass null if you
+ *                              don't care.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOMEM if an mbuf could not be allocated;
+ *                          other nonzero on failure.
+ */
+static int
+nffs_read_mbuf(struct fs_file *fs_file, uint32_t len, struct os_mbuf *om,
+               uint32_t *out_len)
+{
+    struct os_mbuf *last;
+    struct os_mbuf *new;
+    uint32_t bytes_read;
+    uint32_t chunk_len;
+    uint32_t total;
+    uint8_t *dst;
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    last = om;
+    while (SLIST_NEXT(last, om_next) != NULL) {
+        last = SLIST_NEXT(last, om_next);
     }
 
-    rc = nffs_write_to_file(file, data, len);
-    if (rc != 0) {
-        goto done;
+    nffs_lock_file(file);
+
+    total = 0;
+    rc = 0;
+    while (total < len) {
+        /* Fill the last segment's trailing space before allocating a new
+         * segment.
+         */
+        if (OS_MBUF_TRAILINGSPACE(last) > 0) {
+            new = NULL;
+            dst = last->om_data + last->om_len;
+            chunk_len = OS_MBUF_TRAILINGSPACE(last);
+        } else {
+            new = os_mbuf_get(last->om_omp, 0);
+            if (new == NULL) {
+                rc = FS_ENOMEM;
+                break;
+            }
+            dst = new->om_data;
+            chunk_len = OS_MBUF_TRAILINGSPACE(new);
+        }
+
+        if (chunk_len > len - total) {
+            chunk_len = len - total;
+        }
+        if (chunk_len > nffs_block_max_data_sz) {
+            chunk_len = nffs_block_max_data_sz;
+        }
+
+        nffs_lock();
+        rc = nffs_file_read(file, chunk_len, dst, &bytes_read);
+        nffs_unlock();
+        if (rc != 0) {
+            bytes_read = 0;
+        }
+
+        if (new == NULL) {
+            /* The data is already in place; this cannot fail. */
+            os_mbuf_extend(om, bytes_read);
+        } else if (bytes_read > 0) {
+            new->om_len = bytes_read;
+            os_mbuf_concat(om, new);
+            last = new;
+        } else {
+            os_mbuf_free(new);
+        }
+        total += bytes_read;
+
+        if (rc != 0 || bytes_read < chunk_len) {
+            /* Error or end of file. */
+            break;
+        }
     }
 
+    nffs_unlock_file(file);
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return rc;
+}
+
+/**
+ * Writes part of an mbuf chain to the current offset of the specified file
+ * handle.  The data is written to flash directly from the chain's segments.
+ *
+ * @param file              The file to write to.
+ * @param om                The mbuf chain containing the data to write.
+ * @param off               The chain offset of the first byte to write.
+ * @param len               The number of bytes to write.
+ *
+ * @return                  0 on success;
+ *                          FS_EINVAL if the chain is too short;
+ *                          other nonzero on failure.
+ */
+static int
+nffs_write_mbuf(struct fs_file *fs_file, const struct os_mbuf *om, int off,
+                int len)
+{
+    const struct os_mbuf *cur;
+    int chain_len;
+    int chunk_len;
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    if (off < 0 || len < 0) {
+        return FS_EINVAL;
+    }
+
+    chain_len = 0;
+    for (cur = om; cur != NULL; cur = SLIST_NEXT(cur, om_next)) {
+        chain_len += cur->om_len;
+    }
+    if (off + len > chain_len) {
+        return FS_EINVAL;
+    }
+
+    nffs_lock_file(file);
+
+    do {
+        chunk_len = len;
+        if (chunk_len > nffs_block_max_data_sz) {
+            chunk_len = nffs_block_max_data_sz;
+        }
+
+        nffs_lock();
+
+        if (!nffs_ready()) {
+            rc = FS_EUNINIT;
+        } else {
+            rc = nffs_write_mbuf_to_file(file, om, off, chunk_len);
+            if (rc == 0) {
+                nffs_gc_task_wakeup();
+            }
+        }
+
+        nffs_unlock();
+        if (rc != 0) {
+            goto done;
+        }
+
+        off += chunk_len;
+        len -= chunk_len;
+    } while (len > 0);
+
     rc = 0;
 
 done:
-    nffs_unlock();
+    nffs_unlock_file(file);
     return rc;
 }
 
@@ -340,6 +689,8 @@ nffs_unlink(const char *path)
         goto done;
     }
 
+    nffs_gc_task_wakeup();
+
     rc = 0;
 
 done:
@@ -380,6 +731,8 @@ nffs_rename(const char *from, const char *to)
         goto done;
     }
 
+    nffs_gc_task_wakeup();
+
     rc = 0;
 
 done:
@@ -449,6 +802,10 @@ nffs_opendir(const char *path, struct fs_dir **out_fs_dir)
     }
 
     rc = nffs_dir_open(path, out_dir);
+    if (rc == 0) {
+        (*out_dir)->nd_fops = &nffs_ops;
+        (*out_dir)->nd_dirent.nde_fops = &nffs_ops;
+    }
 
 done:
     nffs_unlock();
@@ -560,6 +917,94 @@ nffs_dirent_is_dir(const struct fs_dirent *fs_dirent)
     return nffs_hash_id_is_dir(id);
 }
 
+/**
+ * Retrieves usage and wear statistics for the specified nffs area.
+ *
+ * @param idx               The index of the area to query.
+ * @param out_info          On success, the area statistics get written here.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOENT if there is no such area;
+ *                          other nonzero on failure.
+ */
+static int
+nffs_area_info(int idx, struct fs_area_info *out_info)
+{
+    const struct nffs_area *area;
+    int rc;
+
+    nffs_lock();
+
+    if (!nffs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    if (idx < 0 || idx >= nffs_num_areas) {
+        rc = FS_ENOENT;
+        goto done;
+    }
+
+    area = nffs_areas + idx;
+    out_info->fai_length = area->na_length;
+    out_info->fai_live = nffs_area_live_space(area);
+    out_info->fai_dead = area->na_obsolete;
+    out_info->fai_erase_cnt = nffs_area_erase_cnt(area);
+    out_info->fai_is_scratch = idx == nffs_scratch_area_idx;
+
+    rc = 0;
+
+done:
+    nffs_unlock();
+    return rc;
+}
+
+/**
+ * Retrieves the space usage of the file system.  Each area's write offset and
+ * obsolete byte count are kept current as objects are written, superseded,
+ * and garbage collected, so this only sums a few counters per area.
+ *
+ * @param out_stat          On success, the usage totals get written here.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_statvfs(struct fs_statvfs *out_stat)
+{
+    const struct nffs_area *area;
+    int rc;
+    int i;
+
+    nffs_lock();
+
+    if (!nffs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    memset(out_stat, 0, sizeof *out_stat);
+    out_stat->fsv_bsize = nffs_block_max_data_sz;
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i == nffs_scratch_area_idx) {
+            continue;
+        }
+
+        area = nffs_areas + i;
+        out_stat->fsv_total += area->na_length;
+        out_stat->fsv_free += nffs_area_free_space(area);
+        out_stat->fsv_live += nffs_area_live_space(area);
+        out_stat->fsv_dead += area->na_obsolete;
+    }
+    out_stat->fsv_avail = out_stat->fsv_free + out_stat->fsv_dead;
+
+    rc = 0;
+
+done:
+    nffs_unlock();
+    return rc;
+}
+
 /**
  * Erases all the specified areas and initializes them with a clean nffs
  * file system.
@@ -628,16 +1073,31 @@ int
 nffs_init(void)
 {
     int rc;
+    int i;
 
     nffs_config_init();
 
     nffs_cache_clear();
+    nffs_cache_data_clear();
 
     rc = os_mutex_init(&nffs_mutex);
     if (rc != 0) {
         return FS_EOS;
     }
 
+    free(nffs_file_locks);
+    nffs_file_locks = malloc(
+        nffs_config.nc_num_files * sizeof (struct nffs_file_lock));
+    if (nffs_file_locks == NULL) {
+        return FS_ENOMEM;
+    }
+    for (i = 0; i < nffs_config.nc_num_files; i++) {
+        rc = os_mutex_init(&nffs_file_locks[i].nfl_mutex);
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    }
+
     free(nffs_file_mem);
     nffs_file_mem = malloc(
         OS_MEMPOOL_BYTES(nffs_config.nc_num_files, sizeof (struct nffs_file)));
@@ -677,6 +1137,28 @@ nffs_init(void)
         return FS_ENOMEM;
     }
 
+    free(nffs_cache_name_mem);
+    nffs_cache_name_mem = NULL;
+    if (nffs_config.nc_num_cache_names > 0) {
+        nffs_cache_name_mem = malloc(
+            OS_MEMPOOL_BYTES(nffs_config.nc_num_cache_names,
+                             sizeof (struct nffs_cache_name)));
+        if (nffs_cache_name_mem == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
+    free(nffs_cache_data_mem);
+    nffs_cache_data_mem = NULL;
+    if (nffs_cache_data_num_entries() > 0) {
+        nffs_cache_data_mem = malloc(
+            OS_MEMPOOL_BYTES(nffs_cache_data_num_entries(),
+                             nffs_cache_data_entry_sz()));
+        if (nffs_cache_data_mem == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
     free(nffs_dir_mem);
     nffs_dir_mem = malloc(
         OS_MEMPOOL_BYTES(nffs_config.nc_num_dirs,
@@ -685,6 +1167,10 @@ nffs_init(void)
         return FS_ENOMEM;
     }
 
+    free(nffs_block_lz_buf);
+    nffs_block_lz_buf = NULL;
+    nffs_block_lz_raw = NULL;
+
     rc = nffs_misc_reset();
     if (rc != 0) {
         return rc;
@@ -693,3 +1179,67 @@ nffs_init(void)
     fs_register(&nffs_ops);
     return 0;
 }
+
+static void
+nffs_gc_task_handler(void *arg)
+{
+    int done;
+    int rc;
+
+    while (1) {
+        os_sem_pend(&nffs_gc_sem, OS_TIMEOUT_NEVER);
+
+        nffs_lock();
+        nffs_gc_task_pending = 0;
+        nffs_unlock();
+
+        /* Release the lock between steps so that file system operations are
+         * only delayed by a single step.
+         */
+        do {
+            nffs_lock();
+            if (nffs_ready()) {
+                rc = nffs_gc_incr_step(&done);
+            } else {
+                rc = 0;
+                done = 1;
+            }
+            nffs_unlock();
+        } while (rc == 0 && !done);
+    }
+}
+
+/**
+ * Starts the nffs garbage collection task.  This task reclaims space in the
+ * background, one bounded step at a time, so that writes are less likely to
+ * block on a full garbage collection cycle.  The task should be given a low
+ * (idle) priority.  Calling this function is optional; without it, garbage
+ * collection is only performed when a write cannot otherwise be satisfied.
+ *
+ * @param prio              The priority of the garbage collection task.
+ * @param stack             The task's stack.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+int
+nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size)
+{
+    int rc;
+
+    rc = os_sem_init(&nffs_gc_sem, 0);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_task_init(&nffs_gc_task, "nffs_gc", nffs_gc_task_handler, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    nffs_gc_task_pending = 0;
+    nffs_gc_task_running = 1;
+
+    return 0;
+}
@@ -54,8 +54,9 @@ nffs_area_to_disk(const struct nffs_area *area,
     memset(out_disk_area, 0, sizeof *out_disk_area);
     nffs_area_set_magic(out_disk_area);
     out_disk_area->nda_length = area->na_length;
-    out_disk_area->nda_ver = NFFS_AREA_VER;
+    out_disk_area->nda_ver = area->na_ver;
     out_disk_area->nda_gc_seq = area->na_gc_seq;
+    out_disk_area->nda_gc_seq_hi = area->na_gc_seq_hi;
     out_disk_area->nda_id = area->na_id;
 }
 
@@ -65,6 +66,135 @@ nffs_area_free_space(const struct nffs_area *area)
     return area->na_length - area->na_cur;
 }
 
+/**
+ * Retrieves the number of times the specified area has been erased by the
+ * garbage collector since the file system was formatted.  The count is
+ * persisted in the area header: the garbage collection sequence number is the
+ * lower byte, and the upper byte occupies the header's reserved space.  The
+ * count wraps at 65536.
+ */
+uint16_t
+nffs_area_erase_cnt(const struct nffs_area *area)
+{
+    return (area->na_gc_seq_hi << 8) | area->na_gc_seq;
+}
+
+/**
+ * Calculates the number of bytes in an area that are occupied by objects which
+ * are still in use.  These bytes must be copied if the area is garbage
+ * collected.
+ */
+uint32_t
+nffs_area_live_space(const struct nffs_area *area)
+{
+    uint32_t used;
+
+    if (area->na_cur <= sizeof (struct nffs_disk_area)) {
+        return 0;
+    }
+
+    used = area->na_cur - sizeof (struct nffs_disk_area);
+    if (area->na_obsolete >= used) {
+        return 0;
+    }
+
+    return used - area->na_obsolete;
+}
+
+/**
+ * Records that the object at the specified flash location has been
+ * superseded or deleted.  The object's bytes can be reclaimed the next time
+ * its area is garbage collected.
+ *
+ * @param flash_loc             The location of the obsolete object.
+ * @param len                   The size of the object, in bytes, including
+ *                                  its header.
+ */
+void
+nffs_area_add_obsolete(uint32_t flash_loc, uint32_t len)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+
+    if (flash_loc == NFFS_FLASH_LOC_NONE) {
+        return;
+    }
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    if (area_idx < nffs_num_areas) {
+        nffs_areas[area_idx].na_obsolete += len;
+    }
+}
+
+/**
+ * Recalculates the number of obsolete bytes in each area from scratch.  The
+ * bytes written to an area which are not occupied by an object in the RAM
+ * representation are obsolete.  This is done after the file system is
+ * restored from flash, since superseded objects are discarded without being
+ * accounted for.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_area_calc_obsolete(void)
+{
+    struct nffs_disk_inode disk_inode;
+    struct nffs_disk_block disk_block;
+    struct nffs_hash_entry *entry;
+    struct nffs_area *area;
+    uint32_t area_offset;
+    uint32_t obj_len;
+    uint8_t area_idx;
+    int rc;
+    int i;
+
+    /* Start by treating every written byte as obsolete. */
+    for (i = 0; i < nffs_num_areas; i++) {
+        area = nffs_areas + i;
+        if (i == nffs_scratch_area_idx ||
+            area->na_cur <= sizeof (struct nffs_disk_area)) {
+
+            area->na_obsolete = 0;
+        } else {
+            area->na_obsolete = area->na_cur - sizeof (struct nffs_disk_area);
+        }
+    }
+
+    /* Subtract the size of each live object. */
+    NFFS_HASH_FOREACH(entry, i) {
+        if (entry->nhe_flash_loc == NFFS_FLASH_LOC_NONE) {
+            continue;
+        }
+
+        /* Read the object headers directly rather than constructing full
+         * objects; the latter populates the caches.
+         */
+        nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+        if (nffs_hash_id_is_inode(entry->nhe_id)) {
+            rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
+            if (rc != 0) {
+                return rc;
+            }
+            obj_len = sizeof disk_inode + disk_inode.ndi_filename_len;
+        } else {
+            rc = nffs_block_read_disk(area_idx, area_offset, &disk_block);
+            if (rc != 0) {
+                return rc;
+            }
+            obj_len = sizeof disk_block + disk_block.ndb_data_len;
+        }
+
+        area = nffs_areas + area_idx;
+        if (area->na_obsolete >= obj_len) {
+            area->na_obsolete -= obj_len;
+        } else {
+            area->na_obsolete = 0;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Finds a corrupt scratch area.  An area is indentified as a corrupt scratch
  * area if it and another area share the same ID.  Among two areas with the
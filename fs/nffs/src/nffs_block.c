@@ -18,6 +18,7 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include "testutil/testutil.h"
@@ -65,7 +66,7 @@ nffs_block_read_disk(uint8_t area_idx, uint32_t area_offset,
     if (rc != 0) {
         return rc;
     }
-    if (out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC) {
+    if (!nffs_block_magic_is_valid(out_disk_block->ndb_magic)) {
         return FS_EUNEXP;
     }
 
@@ -73,71 +74,63 @@ nffs_block_read_disk(uint8_t area_idx, uint32_t area_offset,
 }
 
 /**
- * Writes the specified data block to a suitable location in flash.
+ * Indicates whether the specified value is a data block magic number.
  *
- * @param disk_block            Points to the disk block to write.
- * @param data                  The contents of the data block.
- * @param out_area_idx          On success, contains the index of the area
- *                                  written to.
- * @param out_area_offset       On success, contains the offset within the area
- *                                  written to.
- *
- * @return                      0 on success; nonzero on failure.
+ * @return                      1 if the magic identifies a raw or compressed
+ *                                  data block; 0 otherwise.
  */
 int
-nffs_block_write_disk(const struct nffs_disk_block *disk_block,
-                      const void *data,
-                      uint8_t *out_area_idx, uint32_t *out_area_offset)
+nffs_block_magic_is_valid(uint32_t magic)
 {
-    uint32_t area_offset;
-    uint8_t area_idx;
+    return magic == NFFS_BLOCK_MAGIC || magic == NFFS_BLOCK_MAGIC_LZ;
+}
+
+static int
+nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
+                             const struct nffs_disk_block *disk_block,
+                             uint8_t area_idx, uint32_t area_offset)
+{
+    uint8_t buf[NFFS_BLOCK_LZ_HDR_SZ];
     int rc;
 
-    rc = nffs_misc_reserve_space(sizeof *disk_block + disk_block->ndb_data_len,
-                                &area_idx, &area_offset);
-    if (rc != 0) {
-        return rc;
+    out_block->nb_seq = disk_block->ndb_seq;
+    out_block->nb_inode_entry = NULL;
+    out_block->nb_prev = NULL;
+    out_block->nb_disk_len = disk_block->ndb_data_len;
+
+    if (disk_block->ndb_magic != NFFS_BLOCK_MAGIC_LZ) {
+        out_block->nb_flags = 0;
+        out_block->nb_data_len = disk_block->ndb_data_len;
+        return 0;
     }
 
-    rc = nffs_flash_write(area_idx, area_offset, disk_block,
-                         sizeof *disk_block);
+    /* Compressed block; the uncompressed length precedes the stream. */
+    if (disk_block->ndb_data_len < NFFS_BLOCK_LZ_HDR_SZ) {
+        return FS_ECORRUPT;
+    }
+    rc = nffs_flash_read(area_idx, area_offset + sizeof *disk_block,
+                         buf, sizeof buf);
     if (rc != 0) {
         return rc;
     }
-
-    if (disk_block->ndb_data_len > 0) {
-        rc = nffs_flash_write(area_idx, area_offset + sizeof *disk_block,
-                             data, disk_block->ndb_data_len);
-        if (rc != 0) {
-            return rc;
-        }
-    }
-
-    *out_area_idx = area_idx;
-    *out_area_offset = area_offset;
-
-    ASSERT_IF_TEST(nffs_crc_disk_block_validate(disk_block, area_idx,
-                                               area_offset) == 0);
+    out_block->nb_flags = NFFS_BLOCK_F_LZ;
+    out_block->nb_data_len = buf[0] | (buf[1] << 8);
 
     return 0;
 }
 
-static void
-nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
-                             const struct nffs_disk_block *disk_block)
-{
-    out_block->nb_seq = disk_block->ndb_seq;
-    out_block->nb_inode_entry = NULL;
-    out_block->nb_prev = NULL;
-    out_block->nb_data_len = disk_block->ndb_data_len;
-}
-
 static int
 nffs_block_from_disk(struct nffs_block *out_block,
                      const struct nffs_disk_block *disk_block,
                      uint8_t area_idx, uint32_t area_offset)
 {
-    nffs_block_from_disk_no_ptrs(out_block, disk_block);
+    int rc;
+
+    rc = nffs_block_from_disk_no_ptrs(out_block, disk_block,
+                                      area_idx, area_offset);
+    if (rc != 0) {
+        return rc;
+    }
 
     out_block->nb_inode_entry = nffs_hash_find_inode(disk_block->ndb_inode_id);
     if (out_block->nb_inode_entry == NULL) {
@@ -166,7 +159,11 @@ nffs_block_to_disk(const struct nffs_block *block,
 {
     assert(block->nb_inode_entry != NULL);
 
-    out_disk_block->ndb_magic = NFFS_BLOCK_MAGIC;
+    if (block->nb_flags & NFFS_BLOCK_F_LZ) {
+        out_disk_block->ndb_magic = NFFS_BLOCK_MAGIC_LZ;
+    } else {
+        out_disk_block->ndb_magic = NFFS_BLOCK_MAGIC;
+    }
     out_disk_block->ndb_id = block->nb_hash_entry->nhe_id;
     out_disk_block->ndb_seq = block->nb_seq;
     out_disk_block->ndb_inode_id =
@@ -176,7 +173,7 @@ nffs_block_to_disk(const struct nffs_block *block,
     } else {
         out_disk_block->ndb_prev_id = block->nb_prev->nhe_id;
     }
-    out_disk_block->ndb_data_len = block->nb_data_len;
+    out_disk_block->ndb_data_len = block->nb_disk_len;
 }
 
 /**
@@ -198,9 +195,15 @@ nffs_block_delete_from_ram(struct nffs_hash_entry *block_entry)
     }
 
     assert(block.nb_inode_entry != NULL);
-    if (block.nb_inode_entry->nie_last_block_entry == block_entry) {
-        block.nb_inode_entry->nie_last_block_entry = block.nb_prev;
+    if (nffs_inode_last_block(block.nb_inode_entry) == block_entry) {
+        nffs_inode_set_last_block(block.nb_inode_entry, block.nb_prev);
     }
+    block.nb_inode_entry->nie_data_len -= block.nb_data_len;
+    block.nb_inode_entry->nie_block_cnt--;
+
+    nffs_area_add_obsolete(block_entry->nhe_flash_loc,
+                           sizeof (struct nffs_disk_block) + block.nb_disk_len);
+    nffs_cache_data_delete(block_entry->nhe_flash_loc);
 
     nffs_hash_remove(block_entry);
     nffs_block_entry_free(block_entry);
@@ -238,7 +241,11 @@ nffs_block_from_hash_entry_no_ptrs(struct nffs_block *out_block,
     }
 
     out_block->nb_hash_entry = block_entry;
-    nffs_block_from_disk_no_ptrs(out_block, &disk_block);
+    rc = nffs_block_from_disk_no_ptrs(out_block, &disk_block,
+                                      area_idx, area_offset);
+    if (rc != 0) {
+        return rc;
+    }
 
     return 0;
 }
@@ -279,6 +286,97 @@ nffs_block_from_hash_entry(struct nffs_block *out_block,
     return 0;
 }
 
+/**
+ * Allocates the scratch buffers used for compressed blocks, unless they
+ * already exist.  Each holds one block of the configured maximum size:
+ * nffs_block_lz_buf receives decompressed data and compressed payloads;
+ * nffs_block_lz_raw holds uncompressed data while a block is rebuilt or
+ * compressed.  File systems that never compress never allocate them.
+ *
+ * @return                      0 on success; FS_ENOMEM on heap exhaustion.
+ */
+int
+nffs_block_lz_alloc(void)
+{
+    uint16_t sz;
+
+    if (nffs_block_lz_buf != NULL) {
+        return 0;
+    }
+
+    sz = nffs_misc_cfg_block_max_data_sz();
+    nffs_block_lz_buf = malloc(2 * sz);
+    if (nffs_block_lz_buf == NULL) {
+        return FS_ENOMEM;
+    }
+    nffs_block_lz_raw = nffs_block_lz_buf + sz;
+
+    return 0;
+}
+
+/**
+ * Reads a range of a compressed block's uncompressed data.  The stream is
+ * decompressed from its start up to the end of the requested range.  A range
+ * at the start of the block is decompressed straight into the destination;
+ * this is how the data cache loads a whole block.  Any other range is
+ * decompressed into nffs_block_lz_buf first.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOMEM if the block is larger than the
+ *                                  configured maximum block size or the
+ *                                  scratch buffers cannot be allocated;
+ *                              other nonzero on failure.
+ */
+static int
+nffs_block_read_data_lz(const struct nffs_block *block, uint16_t offset,
+                        uint16_t length, void *dst)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
+                         &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block) + NFFS_BLOCK_LZ_HDR_SZ;
+
+    if (offset == 0) {
+        return nffs_lz_decompress_flash(area_idx, area_offset,
+                                        block->nb_disk_len -
+                                            NFFS_BLOCK_LZ_HDR_SZ,
+                                        dst, length);
+    }
+
+    if (offset + length > nffs_misc_cfg_block_max_data_sz()) {
+        return FS_ENOMEM;
+    }
+
+    rc = nffs_block_lz_alloc();
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_lz_decompress_flash(area_idx, area_offset,
+                                  block->nb_disk_len - NFFS_BLOCK_LZ_HDR_SZ,
+                                  nffs_block_lz_buf, offset + length);
+    if (rc != 0) {
+        return rc;
+    }
+
+    memcpy(dst, nffs_block_lz_buf + offset, length);
+    return 0;
+}
+
+/**
+ * Reads a range of a data block's contents.  Offsets are relative to the
+ * block's uncompressed data.
+ *
+ * @param block                 The block to read from.
+ * @param offset                The offset within the block's data.
+ * @param length                The number of bytes to read.
+ * @param dst                   On success, the data gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 int
 nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
                      uint16_t length, void *dst)
@@ -287,6 +385,12 @@ nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
     uint8_t area_idx;
     int rc;
 
+    assert(offset + length <= block->nb_data_len);
+
+    if (block->nb_flags & NFFS_BLOCK_F_LZ) {
+        return nffs_block_read_data_lz(block, offset, length, dst);
+    }
+
     nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
                          &area_idx, &area_offset);
     area_offset += sizeof (struct nffs_disk_block);
@@ -26,6 +26,14 @@ TAILQ_HEAD(nffs_cache_inode_list, nffs_cache_inode);
 static struct nffs_cache_inode_list nffs_cache_inode_list =
     TAILQ_HEAD_INITIALIZER(nffs_cache_inode_list);
 
+TAILQ_HEAD(nffs_cache_name_list, nffs_cache_name);
+static struct nffs_cache_name_list nffs_cache_name_list =
+    TAILQ_HEAD_INITIALIZER(nffs_cache_name_list);
+
+TAILQ_HEAD(nffs_cache_data_list, nffs_cache_data);
+static struct nffs_cache_data_list nffs_cache_data_list =
+    TAILQ_HEAD_INITIALIZER(nffs_cache_data_list);
+
 static void nffs_cache_collect_blocks(void);
 
 static struct nffs_cache_block *
@@ -152,12 +160,6 @@ nffs_cache_inode_populate(struct nffs_cache_inode *cache_inode,
         return rc;
     }
 
-    rc = nffs_inode_calc_data_length(cache_inode->nci_inode.ni_inode_entry,
-                                     &cache_inode->nci_file_size);
-    if (rc != 0) {
-        return rc;
-    }
-
     return 0;
 }
 
@@ -245,6 +247,23 @@ nffs_cache_inode_delete(const struct nffs_inode_entry *inode_entry)
     nffs_cache_inode_free(entry);
 }
 
+/**
+ * Frees the cached blocks belonging to the specified inode, but retains the
+ * cached inode itself.  This is used when the inode's block chain is rebuilt
+ * underneath the cache (e.g., by garbage collection), so that a caller
+ * holding the cached inode can continue to use it.
+ */
+void
+nffs_cache_inode_delete_blocks(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_inode *entry;
+
+    entry = nffs_cache_inode_find(inode_entry);
+    if (entry != NULL) {
+        nffs_cache_inode_free_blocks(entry);
+    }
+}
+
 int
 nffs_cache_inode_ensure(struct nffs_cache_inode **out_cache_inode,
                         struct nffs_inode_entry *inode_entry)
@@ -321,7 +340,7 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
     int rc;
 
     /* Empty files have no blocks that can be cached. */
-    if (cache_inode->nci_file_size == 0) {
+    if (cache_inode->nci_inode.ni_inode_entry->nie_data_len == 0) {
         return FS_ENOENT;
     }
 
@@ -346,8 +365,8 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
          */
         cache_block = NULL;
         block_entry =
-            cache_inode->nci_inode.ni_inode_entry->nie_last_block_entry;
-        block_end = cache_inode->nci_file_size;
+            nffs_inode_last_block(cache_inode->nci_inode.ni_inode_entry);
+        block_end = cache_inode->nci_inode.ni_inode_entry->nie_data_len;
     }
 
     /* Scan backwards until we find the block containing the seek offest. */
@@ -434,15 +453,377 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
 }
 
 /**
- * Frees all cached inodes and blocks.
+ * Searches the filename cache for the specified inode.  A cached name is only
+ * returned if it was read from the inode's current disk record; names
+ * belonging to superseded records are ignored.  A hit is moved to the front
+ * of the LRU list.
+ *
+ * @param inode_entry           The inode whose name is sought.
+ *
+ * @return                      The cached name on success; null if the name
+ *                                  is not cached.
+ */
+struct nffs_cache_name *
+nffs_cache_name_find(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_name *cur;
+
+    TAILQ_FOREACH(cur, &nffs_cache_name_list, ncn_link) {
+        if (cur->ncn_inode_entry == inode_entry) {
+            if (cur->ncn_flash_loc !=
+                inode_entry->nie_hash_entry.nhe_flash_loc) {
+
+                return NULL;
+            }
+
+            if (cur != TAILQ_FIRST(&nffs_cache_name_list)) {
+                TAILQ_REMOVE(&nffs_cache_name_list, cur, ncn_link);
+                TAILQ_INSERT_HEAD(&nffs_cache_name_list, cur, ncn_link);
+            }
+            return cur;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Retrieves the cached full filename of the specified inode, reading it from
+ * flash if it is not already cached.  If the cache is full, the
+ * least-recently-used name is evicted.  The filename cache must be enabled
+ * (nc_num_cache_names > 0).
+ *
+ * @param out_cache_name        On success, the cached name gets written here.
+ * @param inode_entry           The inode whose name is sought.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_cache_name_ensure(struct nffs_cache_name **out_cache_name,
+                       struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_name *cache_name;
+    struct nffs_disk_inode disk_inode;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    cache_name = nffs_cache_name_find(inode_entry);
+    if (cache_name != NULL) {
+        *out_cache_name = cache_name;
+        return 0;
+    }
+
+    /* Reuse a stale entry for this inode if there is one; otherwise allocate
+     * a new entry, evicting the least-recently-used name if necessary.
+     */
+    TAILQ_FOREACH(cache_name, &nffs_cache_name_list, ncn_link) {
+        if (cache_name->ncn_inode_entry == inode_entry) {
+            break;
+        }
+    }
+
+    if (cache_name != NULL) {
+        TAILQ_REMOVE(&nffs_cache_name_list, cache_name, ncn_link);
+    } else {
+        cache_name = os_memblock_get(&nffs_cache_name_pool);
+        if (cache_name == NULL) {
+            cache_name = TAILQ_LAST(&nffs_cache_name_list,
+                                    nffs_cache_name_list);
+            assert(cache_name != NULL);
+            TAILQ_REMOVE(&nffs_cache_name_list, cache_name, ncn_link);
+        }
+    }
+
+    nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
+                          &area_idx, &area_offset);
+    rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
+    if (rc == 0) {
+        rc = nffs_flash_read(area_idx, area_offset + sizeof disk_inode,
+                             cache_name->ncn_name,
+                             disk_inode.ndi_filename_len);
+    }
+    if (rc != 0) {
+        os_memblock_put(&nffs_cache_name_pool, cache_name);
+        return rc;
+    }
+
+    cache_name->ncn_inode_entry = inode_entry;
+    cache_name->ncn_flash_loc = inode_entry->nie_hash_entry.nhe_flash_loc;
+    cache_name->ncn_name_len = disk_inode.ndi_filename_len;
+    TAILQ_INSERT_HEAD(&nffs_cache_name_list, cache_name, ncn_link);
+
+    *out_cache_name = cache_name;
+    return 0;
+}
+
+/**
+ * Removes the specified inode's filename from the cache, if present.  This
+ * must be called before an inode entry is freed.
+ */
+void
+nffs_cache_name_delete(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_name *cur;
+
+    TAILQ_FOREACH(cur, &nffs_cache_name_list, ncn_link) {
+        if (cur->ncn_inode_entry == inode_entry) {
+            TAILQ_REMOVE(&nffs_cache_name_list, cur, ncn_link);
+            os_memblock_put(&nffs_cache_name_pool, cur);
+            return;
+        }
+    }
+}
+
+/**
+ * Frees all cached inodes, blocks, and filenames.
  */
 void
 nffs_cache_clear(void)
 {
     struct nffs_cache_inode *entry;
+    struct nffs_cache_name *cache_name;
 
     while ((entry = TAILQ_FIRST(&nffs_cache_inode_list)) != NULL) {
         TAILQ_REMOVE(&nffs_cache_inode_list, entry, nci_link);
         nffs_cache_inode_free(entry);
     }
+
+    while ((cache_name = TAILQ_FIRST(&nffs_cache_name_list)) != NULL) {
+        TAILQ_REMOVE(&nffs_cache_name_list, cache_name, ncn_link);
+        os_memblock_put(&nffs_cache_name_pool, cache_name);
+    }
+}
+
+/**
+ * @return                      The size of a data content cache entry.  Each
+ *                                  entry can hold a block of the configured
+ *                                  maximum size.
+ */
+uint32_t
+nffs_cache_data_entry_sz(void)
+{
+    return sizeof (struct nffs_cache_data) +
+           nffs_misc_cfg_block_max_data_sz();
+}
+
+/**
+ * @return                      The number of entries in the data content
+ *                                  cache pool; nc_data_cache_bytes rounded
+ *                                  down to a whole number of entries.
+ */
+int
+nffs_cache_data_num_entries(void)
+{
+    return nffs_config.nc_data_cache_bytes / nffs_cache_data_entry_sz();
+}
+
+/**
+ * @return                      1 if the data content cache has at least one
+ *                                  entry; 0 otherwise.
+ */
+int
+nffs_cache_data_enabled(void)
+{
+    return nffs_cache_data_pool.mp_num_blocks > 0;
+}
+
+static void
+nffs_cache_data_free(struct nffs_cache_data *cache_data)
+{
+    TAILQ_REMOVE(&nffs_cache_data_list, cache_data, ncd_link);
+    os_memblock_put(&nffs_cache_data_pool, cache_data);
+}
+
+/**
+ * Searches the data content cache for the block record at the specified
+ * location.  A hit is moved to the front of the LRU list.
+ *
+ * @param flash_loc             The location of the block's disk record.
+ *
+ * @return                      The cached contents on success; null if the
+ *                                  block is not cached.
+ */
+struct nffs_cache_data *
+nffs_cache_data_find(uint32_t flash_loc)
+{
+    struct nffs_cache_data *cur;
+
+    TAILQ_FOREACH(cur, &nffs_cache_data_list, ncd_link) {
+        if (cur->ncd_flash_loc == flash_loc) {
+            if (cur != TAILQ_FIRST(&nffs_cache_data_list)) {
+                TAILQ_REMOVE(&nffs_cache_data_list, cur, ncd_link);
+                TAILQ_INSERT_HEAD(&nffs_cache_data_list, cur, ncd_link);
+            }
+            return cur;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the full contents of the specified data block into the data content
+ * cache.  If every entry is in use, the least-recently-used block is evicted.
+ * If the block is larger than an entry (it was written with a greater maximum
+ * block size), nothing is cached and null is reported.
+ *
+ * @param block                 The data block to cache.
+ * @param out_cache_data        On success, the cached contents, or null, get
+ *                                  written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_cache_data_load(const struct nffs_block *block,
+                     struct nffs_cache_data **out_cache_data)
+{
+    struct nffs_cache_data *cache_data;
+    int rc;
+
+    *out_cache_data = NULL;
+
+    if (sizeof *cache_data + block->nb_data_len > nffs_cache_data_entry_sz()) {
+        return 0;
+    }
+
+    cache_data = os_memblock_get(&nffs_cache_data_pool);
+    if (cache_data == NULL) {
+        cache_data = TAILQ_LAST(&nffs_cache_data_list, nffs_cache_data_list);
+        assert(cache_data != NULL);
+        TAILQ_REMOVE(&nffs_cache_data_list, cache_data, ncd_link);
+    }
+
+    rc = nffs_block_read_data(block, 0, block->nb_data_len,
+                              cache_data->ncd_data);
+    if (rc != 0) {
+        os_memblock_put(&nffs_cache_data_pool, cache_data);
+        return rc;
+    }
+
+    cache_data->ncd_flash_loc = block->nb_hash_entry->nhe_flash_loc;
+    cache_data->ncd_data_len = block->nb_data_len;
+    TAILQ_INSERT_HEAD(&nffs_cache_data_list, cache_data, ncd_link);
+
+    *out_cache_data = cache_data;
+    return 0;
+}
+
+/**
+ * Reads data from the specified block, using the data content cache if it is
+ * enabled.  On a miss, the entire block is read into the cache.
+ *
+ * @param block                 The data block to read from.
+ * @param offset                The offset within the block's data to read.
+ * @param length                The number of bytes to read.
+ * @param dst                   On success, the data gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_cache_data_read(const struct nffs_block *block, uint16_t offset,
+                     uint16_t length, void *dst)
+{
+    struct nffs_cache_data *cache_data;
+    int rc;
+
+    if (!nffs_cache_data_enabled()) {
+        return nffs_block_read_data(block, offset, length, dst);
+    }
+
+    cache_data = nffs_cache_data_find(block->nb_hash_entry->nhe_flash_loc);
+    if (cache_data == NULL) {
+        rc = nffs_cache_data_load(block, &cache_data);
+        if (rc != 0) {
+            return rc;
+        }
+        if (cache_data == NULL) {
+            return nffs_block_read_data(block, offset, length, dst);
+        }
+    }
+
+    assert(offset + length <= cache_data->ncd_data_len);
+    memcpy(dst, cache_data->ncd_data + offset, length);
+
+    return 0;
+}
+
+/**
+ * Ensures the contents of the specified block are in the data content cache.
+ * This is used to read ahead of a sequential reader.
+ *
+ * @param block                 The data block to cache.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_cache_data_prefetch(const struct nffs_block *block)
+{
+    struct nffs_cache_data *cache_data;
+
+    if (!nffs_cache_data_enabled()) {
+        return 0;
+    }
+
+    cache_data = nffs_cache_data_find(block->nb_hash_entry->nhe_flash_loc);
+    if (cache_data != NULL) {
+        return 0;
+    }
+
+    return nffs_cache_data_load(block, &cache_data);
+}
+
+/**
+ * Removes the block record at the specified location from the data content
+ * cache, if present.  This is called when a block is superseded or deleted.
+ */
+void
+nffs_cache_data_delete(uint32_t flash_loc)
+{
+    struct nffs_cache_data *cur;
+
+    TAILQ_FOREACH(cur, &nffs_cache_data_list, ncd_link) {
+        if (cur->ncd_flash_loc == flash_loc) {
+            nffs_cache_data_free(cur);
+            return;
+        }
+    }
+}
+
+/**
+ * Removes every cached block belonging to the specified area.  This must be
+ * called whenever an area is erased, as its locations will be reused.
+ */
+void
+nffs_cache_data_delete_area(uint8_t area_idx)
+{
+    struct nffs_cache_data *cur;
+    struct nffs_cache_data *next;
+    uint32_t area_offset;
+    uint8_t cur_area_idx;
+
+    cur = TAILQ_FIRST(&nffs_cache_data_list);
+    while (cur != NULL) {
+        next = TAILQ_NEXT(cur, ncd_link);
+
+        nffs_flash_loc_expand(cur->ncd_flash_loc, &cur_area_idx, &area_offset);
+        if (cur_area_idx == area_idx) {
+            nffs_cache_data_free(cur);
+        }
+
+        cur = next;
+    }
+}
+
+/**
+ * Frees all cached data contents.
+ */
+void
+nffs_cache_data_clear(void)
+{
+    struct nffs_cache_data *cache_data;
+
+    while ((cache_data = TAILQ_FIRST(&nffs_cache_data_list)) != NULL) {
+        nffs_cache_data_free(cache_data);
+    }
 }
@@ -27,7 +27,11 @@ const struct nffs_config nffs_config_dflt = {
     .nc_num_files = 4,
     .nc_num_cache_inodes = 4,
     .nc_num_cache_blocks = 64,
+    .nc_num_cache_names = 0,
+    .nc_data_cache_bytes = 0,
     .nc_num_dirs = 4,
+    .nc_gc_step_objs = 16,
+    .nc_block_max_data_sz = 2048,
 };
 
 void
@@ -51,4 +55,11 @@ nffs_config_init(void)
     if (nffs_config.nc_num_dirs == 0) {
         nffs_config.nc_num_dirs = nffs_config_dflt.nc_num_dirs;
     }
+    if (nffs_config.nc_gc_step_objs == 0) {
+        nffs_config.nc_gc_step_objs = nffs_config_dflt.nc_gc_step_objs;
+    }
+    if (nffs_config.nc_block_max_data_sz == 0) {
+        nffs_config.nc_block_max_data_sz =
+            nffs_config_dflt.nc_block_max_data_sz;
+    }
 }
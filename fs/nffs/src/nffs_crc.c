@@ -174,3 +174,18 @@ nffs_crc_disk_inode_fill(struct nffs_disk_inode *disk_inode,
 
     disk_inode->ndi_crc16 = crc16;
 }
+
+/**
+ * Installs a hardware CRC implementation.  BSPs with a CRC peripheral can call
+ * this before the file system is used to offload checksum calculation.  The
+ * supplied function must produce results identical to the software
+ * implementation.
+ *
+ * @param func                  The CRC implementation to use; null to revert
+ *                                  to the software implementation.
+ */
+void
+nffs_crc16_set_hw(nffs_crc16_func_t *func)
+{
+    crc16_ccitt_hw = func;
+}
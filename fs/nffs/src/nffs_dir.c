@@ -87,9 +87,9 @@ nffs_dir_read(struct nffs_dir *dir, struct nffs_dirent **out_dirent)
     int rc;
 
     if (dir->nd_dirent.nde_inode_entry == NULL) {
-        child = SLIST_FIRST(&dir->nd_parent_inode_entry->nie_child_list);
+        child = nffs_inode_first_child(dir->nd_parent_inode_entry);
     } else {
-        child = SLIST_NEXT(dir->nd_dirent.nde_inode_entry, nie_sibling_next);
+        child = nffs_inode_next_sibling(dir->nd_dirent.nde_inode_entry);
         rc = nffs_inode_dec_refcnt(dir->nd_dirent.nde_inode_entry);
         if (rc != 0) {
             /* XXX: Need to clean up anything? */
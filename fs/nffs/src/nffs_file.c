@@ -160,7 +160,8 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
         rc = FS_EINVAL;
         goto err;
     }
-    if (access_flags & (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE) &&
+    if (access_flags &
+        (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE | FS_ACCESS_COMPRESS) &&
         !(access_flags & FS_ACCESS_WRITE)) {
 
         rc = FS_EINVAL;
@@ -297,6 +298,7 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
                uint32_t *out_len)
 {
     uint32_t bytes_read;
+    int sequential;
     int rc;
 
     if (!nffs_ready()) {
@@ -307,6 +309,8 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
         return FS_EACCESS;
     }
 
+    sequential = file->nf_offset == file->nf_read_end;
+
     rc = nffs_inode_read(file->nf_inode_entry, file->nf_offset, len, out_data,
                         &bytes_read);
     if (rc != 0) {
@@ -314,6 +318,14 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
     }
 
     file->nf_offset += bytes_read;
+    file->nf_read_end = file->nf_offset;
+
+    /* The file is being read in order; fetch the upcoming data before it is
+     * requested.  A read-ahead failure does not affect this read.
+     */
+    if (sequential && bytes_read > 0) {
+        nffs_inode_read_ahead(file->nf_inode_entry, file->nf_offset);
+    }
     if (out_len != NULL) {
         *out_len = bytes_read;
     }
@@ -25,6 +25,9 @@
 /** A buffer used for flash reads; shared across all of nffs. */
 uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
 
+/** Running total of bytes written to flash; for measuring write overhead. */
+uint32_t nffs_flash_bytes_written;
+
 /**
  * Reads a chunk of data from flash.
  *
@@ -102,6 +105,7 @@ nffs_flash_write(uint8_t area_idx, uint32_t area_offset, const void *data,
     }
 
     area->na_cur = area_offset + len;
+    nffs_flash_bytes_written += len;
 
     return 0;
 }
@@ -71,11 +71,21 @@ nffs_format_area(uint8_t area_idx, int is_scratch)
 
     area = nffs_areas + area_idx;
 
+    /* Cached block contents from this area are about to become invalid. */
+    nffs_cache_data_delete_area(area_idx);
+
     rc = hal_flash_erase(area->na_flash_id, area->na_offset, area->na_length);
     if (rc != 0) {
         return rc;
     }
     area->na_cur = 0;
+    area->na_obsolete = 0;
+
+    /* A freshly erased area is always written in the current format.  Blocks
+     * stay within the version 0 limit until every area has been upgraded and
+     * the file system is restored (see nffs_misc_set_max_block_data_len()).
+     */
+    area->na_ver = NFFS_AREA_VER;
 
     nffs_area_to_disk(area, &disk_area);
 
@@ -137,7 +147,9 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
         nffs_areas[i].na_length = area_descs[i].nad_length;
         nffs_areas[i].na_flash_id = area_descs[i].nad_flash_id;
         nffs_areas[i].na_cur = 0;
+        nffs_areas[i].na_obsolete = 0;
         nffs_areas[i].na_gc_seq = 0;
+        nffs_areas[i].na_gc_seq_hi = 0;
 
         if (i == nffs_scratch_area_idx) {
             nffs_areas[i].na_id = NFFS_AREA_ID_NONE;
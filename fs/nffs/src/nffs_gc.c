@@ -24,6 +24,28 @@
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
 
+/**
+ * Index of the area being collected by an incremental garbage collection
+ * cycle; NFFS_AREA_ID_NONE if no incremental cycle is in progress.
+ */
+uint8_t nffs_gc_incr_area_idx;
+
+/**
+ * Number of garbage collection cycles completed.  A caller that reserves space
+ * while holding block state can compare this before and after to detect that
+ * the state may have been moved or collated.
+ */
+uint32_t nffs_gc_cycle_cnt;
+
+/** Handle of the next inode to process in the current incremental cycle. */
+static int nffs_gc_incr_handle;
+
+/**
+ * Number of objects read or copied; used to bound the amount of work done by
+ * a single incremental step.
+ */
+static uint32_t nffs_gc_obj_cnt;
+
 static int
 nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
                     uint8_t to_area_idx)
@@ -44,6 +66,7 @@ nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
     }
 
     entry->nhe_flash_loc = nffs_flash_loc(to_area_idx, to_area_offset);
+    nffs_gc_obj_cnt++;
 
     return 0;
 }
@@ -71,39 +94,146 @@ nffs_gc_copy_inode(struct nffs_inode_entry *inode_entry, uint8_t to_area_idx)
 }
 
 /**
- * Selects the most appropriate area for garbage collection.
+ * Compares two areas by the benefit of garbage collecting them.  An area's
+ * benefit is the ratio of the space it would yield to the cost of collecting
+ * it.  Each live byte must be read from the source area and written to the
+ * destination area, so the cost is twice the number of live bytes.
+ *
+ * @return                  A positive value if area a is the better choice;
+ *                          a negative value if area b is the better choice;
+ *                          0 if they are equally good.
+ */
+static int
+nffs_gc_cmp_benefit(const struct nffs_area *a, const struct nffs_area *b)
+{
+    uint64_t a_benefit;
+    uint64_t b_benefit;
+
+    /* Compare obsolete_a / cost_a with obsolete_b / cost_b without
+     * dividing.  One is added to each cost to avoid dividing by zero when an
+     * area contains no live data.
+     */
+    a_benefit = (uint64_t)a->na_obsolete * (2 * nffs_area_live_space(b) + 1);
+    b_benefit = (uint64_t)b->na_obsolete * (2 * nffs_area_live_space(a) + 1);
+
+    if (a_benefit > b_benefit) {
+        return 1;
+    } else if (a_benefit < b_benefit) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ * Finds an area that has been erased far fewer times than average.  Such an
+ * area probably contains static data, so it rarely contains enough garbage to
+ * be selected on cost-benefit grounds.  Collecting it moves its static data
+ * into the more worn scratch area and puts the less worn area into
+ * circulation.
+ *
+ * @param length            Only areas of this length are considered.
+ *
+ * @return                  The index of the least worn area, or
+ *                              NFFS_AREA_ID_NONE if no area is far enough
+ *                              below average.
+ */
+static uint8_t
+nffs_gc_select_static_area(uint32_t length)
+{
+    uint32_t erase_cnt;
+    uint32_t best_cnt;
+    uint32_t total;
+    uint32_t mean;
+    uint8_t best_area_idx;
+    int i;
+
+    total = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        total += nffs_area_erase_cnt(nffs_areas + i);
+    }
+    mean = total / nffs_num_areas;
+
+    best_area_idx = NFFS_AREA_ID_NONE;
+    best_cnt = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i == nffs_scratch_area_idx || nffs_areas[i].na_length != length) {
+            continue;
+        }
+
+        erase_cnt = nffs_area_erase_cnt(nffs_areas + i);
+        if (erase_cnt + NFFS_GC_WEAR_THRESHOLD < mean &&
+            (best_area_idx == NFFS_AREA_ID_NONE || erase_cnt < best_cnt)) {
+
+            best_area_idx = i;
+            best_cnt = erase_cnt;
+        }
+    }
+
+    return best_area_idx;
+}
+
+/**
+ * Selects the most appropriate area for garbage collection.  The source area
+ * becomes the new scratch area, so only the longest areas are eligible.  Among
+ * these:
+ *     o An area whose erase count is far below average is selected first
+ *       (see nffs_gc_select_static_area()).
+ *     o Otherwise, the area with the greatest cost-benefit ratio is selected
+ *       (see nffs_gc_cmp_benefit()).
+ *     o Ties are broken by preferring the area with the lowest garbage
+ *       collection sequence number; this ensures the areas rotate evenly when
+ *       none of them contains any garbage.
  *
  * @return                  The ID of the area to garbage collect.
  */
 static uint16_t
 nffs_gc_select_area(void)
 {
+    const struct nffs_area *best;
     const struct nffs_area *area;
+    uint32_t length;
     uint8_t best_area_idx;
     int8_t diff;
+    int cmp;
     int i;
 
-    best_area_idx = 0;
-    for (i = 1; i < nffs_num_areas; i++) {
-        if (i == nffs_scratch_area_idx) {
-            continue;
+    length = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx && nffs_areas[i].na_length > length) {
+            length = nffs_areas[i].na_length;
         }
+    }
+
+    best_area_idx = nffs_gc_select_static_area(length);
+    if (best_area_idx != NFFS_AREA_ID_NONE) {
+        return best_area_idx;
+    }
 
+    for (i = 0; i < nffs_num_areas; i++) {
         area = nffs_areas + i;
-        if (area->na_length > nffs_areas[best_area_idx].na_length) {
+        if (i == nffs_scratch_area_idx || area->na_length != length) {
+            continue;
+        }
+
+        if (best_area_idx == NFFS_AREA_ID_NONE) {
             best_area_idx = i;
-        } else if (best_area_idx == nffs_scratch_area_idx) {
+            continue;
+        }
+
+        best = nffs_areas + best_area_idx;
+        cmp = nffs_gc_cmp_benefit(area, best);
+        if (cmp == 0) {
+            diff = area->na_gc_seq - best->na_gc_seq;
+            cmp = -diff;
+        }
+
+        if (cmp > 0) {
             best_area_idx = i;
-        } else {
-            diff = nffs_areas[i].na_gc_seq -
-                   nffs_areas[best_area_idx].na_gc_seq;
-            if (diff < 0) {
-                best_area_idx = i;
-            }
         }
     }
 
-    assert(best_area_idx != nffs_scratch_area_idx);
+    assert(best_area_idx != NFFS_AREA_ID_NONE);
 
     return best_area_idx;
 }
@@ -129,7 +259,7 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
             return rc;
         }
 
-        copy_len = sizeof (struct nffs_disk_block) + block.nb_data_len;
+        copy_len = sizeof (struct nffs_disk_block) + block.nb_disk_len;
         rc = nffs_gc_copy_object(entry, copy_len, to_area_idx);
         if (rc != 0) {
             return rc;
@@ -149,14 +279,6 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
  * @param last_entry            The last block entry in the chain.
  * @param data_len              The total length of data to collate.
  * @param to_area_idx           The index of the area to copy to.
- * @param inout_next            This parameter is only necessary if you are
- *                                  calling this function during an iteration
- *                                  of the entire hash table; pass null
- *                                  otherwise.
- *                              On input, this points to the next hash entry
- *                                  you plan on processing.
- *                              On output, this points to the next hash entry
- *                                  that should be processed.
  *
  * @return                      0 on success;
  *                              FS_ENOMEM if there is insufficient heap;
@@ -164,8 +286,7 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
  */
 static int
 nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
-                            uint32_t data_len, uint8_t to_area_idx,
-                            struct nffs_hash_entry **inout_next)
+                            uint32_t data_len, uint8_t to_area_idx)
 {
     struct nffs_disk_block disk_block;
     struct nffs_hash_entry *entry;
@@ -174,6 +295,8 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
     uint32_t to_area_offset;
     uint32_t from_area_offset;
     uint32_t data_offset;
+    uint32_t last_seq;
+    uint16_t last_data_len;
     uint8_t *data;
     uint8_t from_area_idx;
     int rc;
@@ -186,6 +309,8 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
 
     to_area = nffs_areas + to_area_idx;
 
+    last_data_len = 0;
+    last_seq = 0;
     entry = last_entry;
     data_offset = data_len;
     while (data_offset > 0) {
@@ -194,6 +319,10 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
             goto done;
         }
         data_offset -= block.nb_data_len;
+        if (entry == last_entry) {
+            last_data_len = block.nb_data_len;
+            last_seq = block.nb_seq;
+        }
 
         nffs_flash_loc_expand(block.nb_hash_entry->nhe_flash_loc,
                               &from_area_idx, &from_area_offset);
@@ -204,19 +333,24 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
             goto done;
         }
 
+        nffs_gc_obj_cnt++;
+
         if (entry != last_entry) {
-            if (inout_next != NULL && *inout_next == entry) {
-                *inout_next = SLIST_NEXT(entry, nhe_next);
-            }
             nffs_block_delete_from_ram(entry);
         }
         entry = block.nb_prev;
     }
 
+    /* The cached copies of the chain refer to the deleted entries. */
+    nffs_cache_inode_delete_blocks(block.nb_inode_entry);
+
     memset(&disk_block, 0, sizeof disk_block);
     disk_block.ndb_magic = NFFS_BLOCK_MAGIC;
-    disk_block.ndb_id = block.nb_hash_entry->nhe_id;
-    disk_block.ndb_seq = block.nb_seq + 1;
+    /* The collated block replaces the last block in the chain; the next block
+     * in the file refers to it by that ID.
+     */
+    disk_block.ndb_id = last_entry->nhe_id;
+    disk_block.ndb_seq = last_seq + 1;
     disk_block.ndb_inode_id = block.nb_inode_entry->nie_hash_entry.nhe_id;
     if (entry == NULL) {
         disk_block.ndb_prev_id = NFFS_ID_NONE;
@@ -241,6 +375,11 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
 
     last_entry->nhe_flash_loc = nffs_flash_loc(to_area_idx, to_area_offset);
 
+    /* The deleted predecessors were subtracted from the inode's totals; their
+     * data now lives in the collated block.
+     */
+    block.nb_inode_entry->nie_data_len += data_len - last_data_len;
+
     rc = 0;
 
     ASSERT_IF_TEST(nffs_crc_disk_block_validate(&disk_block, to_area_idx,
@@ -261,21 +400,12 @@ done:
  * @param multiple_blocks       0=single block; 1=more than one block.
  * @param data_len              The total length of data to collate.
  * @param to_area_idx           The index of the area to copy to.
- * @param inout_next            This parameter is only necessary if you are
- *                                  calling this function during an iteration
- *                                  of the entire hash table; pass null
- *                                  otherwise.
- *                              On input, this points to the next hash entry
- *                                  you plan on processing.
- *                              On output, this points to the next hash entry
- *                                  that should be processed.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
 nffs_gc_block_chain(struct nffs_hash_entry *last_entry, int multiple_blocks,
-                    uint32_t data_len, uint8_t to_area_idx,
-                    struct nffs_hash_entry **inout_next)
+                    uint32_t data_len, uint8_t to_area_idx)
 {
     int rc;
 
@@ -285,8 +415,7 @@ nffs_gc_block_chain(struct nffs_hash_entry *last_entry, int multiple_blocks,
          */
         rc = nffs_gc_block_chain_copy(last_entry, data_len, to_area_idx);
     } else {
-        rc = nffs_gc_block_chain_collate(last_entry, data_len, to_area_idx,
-                                         inout_next);
+        rc = nffs_gc_block_chain_collate(last_entry, data_len, to_area_idx);
         if (rc == FS_ENOMEM) {
             /* Insufficient heap for collation; just copy each block one by
              * one.
@@ -300,8 +429,7 @@ nffs_gc_block_chain(struct nffs_hash_entry *last_entry, int multiple_blocks,
 
 static int
 nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
-                     uint8_t from_area_idx, uint8_t to_area_idx,
-                     struct nffs_hash_entry **inout_next)
+                     uint8_t from_area_idx, uint8_t to_area_idx)
 {
     struct nffs_hash_entry *last_entry;
     struct nffs_hash_entry *entry;
@@ -318,12 +446,13 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     data_len = 0;
     last_entry = NULL;
     multiple_blocks = 0;
-    entry = inode_entry->nie_last_block_entry;
+    entry = nffs_inode_last_block(inode_entry);
     while (entry != NULL) {
         rc = nffs_block_from_hash_entry(&block, entry);
         if (rc != 0) {
             return rc;
         }
+        nffs_gc_obj_cnt++;
 
         nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
         if (area_idx == from_area_idx) {
@@ -331,6 +460,29 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
                 last_entry = entry;
             }
 
+            /* Compressed blocks are moved as they are rather than collated;
+             * each one ends the current run.
+             */
+            if (block.nb_flags & NFFS_BLOCK_F_LZ) {
+                if (last_entry != entry) {
+                    rc = nffs_gc_block_chain(last_entry, multiple_blocks,
+                                             data_len, to_area_idx);
+                    if (rc != 0) {
+                        return rc;
+                    }
+                }
+                rc = nffs_gc_block_chain(entry, 0, block.nb_data_len,
+                                         to_area_idx);
+                if (rc != 0) {
+                    return rc;
+                }
+                last_entry = NULL;
+                data_len = 0;
+                multiple_blocks = 0;
+                entry = block.nb_prev;
+                continue;
+            }
+
             prospective_data_len = data_len + block.nb_data_len;
             if (prospective_data_len <= nffs_block_max_data_sz) {
                 data_len = prospective_data_len;
@@ -339,7 +491,7 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
                 }
             } else {
                 rc = nffs_gc_block_chain(last_entry, multiple_blocks, data_len,
-                                         to_area_idx, inout_next);
+                                         to_area_idx);
                 if (rc != 0) {
                     return rc;
                 }
@@ -350,7 +502,7 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
         } else {
             if (last_entry != NULL) {
                 rc = nffs_gc_block_chain(last_entry, multiple_blocks, data_len,
-                                         to_area_idx, inout_next);
+                                         to_area_idx);
                 if (rc != 0) {
                     return rc;
                 }
@@ -366,7 +518,7 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
 
     if (last_entry != NULL) {
         rc = nffs_gc_block_chain(last_entry, multiple_blocks, data_len,
-                                 to_area_idx, inout_next);
+                                 to_area_idx);
         if (rc != 0) {
             return rc;
         }
@@ -375,12 +527,121 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     return 0;
 }
 
+/**
+ * Begins a garbage collection cycle by transforming the scratch area into the
+ * destination area for the specified source area.
+ *
+ * @param from_area_idx     The index of the area being collected.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_begin(uint8_t from_area_idx)
+{
+    return nffs_format_from_scratch_area(nffs_scratch_area_idx,
+                                         nffs_areas[from_area_idx].na_id);
+}
+
+/**
+ * Copies the specified inode and its data blocks to the destination area
+ * (i.e., the current scratch area), if they are resident in the source area.
+ *
+ * @param handle            The handle of the inode to process.
+ * @param from_area_idx     The index of the area being collected.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_inode(uint16_t handle, uint8_t from_area_idx)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    entry = nffs_hash_live_entry(handle);
+    if (entry == NULL) {
+        return 0;
+    }
+    inode_entry = (struct nffs_inode_entry *)entry;
+
+    /* The inode gets copied if it is in the source area. */
+    nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+    if (area_idx == from_area_idx) {
+        rc = nffs_gc_copy_inode(inode_entry, nffs_scratch_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    /* If the inode is a file, all constituent data blocks that are resident
+     * in the source area get copied.
+     */
+    if (nffs_hash_id_is_file(entry->nhe_id)) {
+        rc = nffs_gc_inode_blocks(inode_entry, from_area_idx,
+                                  nffs_scratch_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Completes a garbage collection cycle.  The source area is reformatted and
+ * becomes the new scratch area.
+ *
+ * @param from_area_idx     The index of the area being collected.
+ * @param out_area_idx      On success, the index of the destination area
+ *                              gets written here.  Pass null if you do not
+ *                              need this information.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_finish(uint8_t from_area_idx, uint8_t *out_area_idx)
+{
+    struct nffs_area *from_area;
+    struct nffs_area *to_area;
+    int rc;
+
+    from_area = nffs_areas + from_area_idx;
+    to_area = nffs_areas + nffs_scratch_area_idx;
+
+    /* The amount of written data should never increase as a result of a gc
+     * cycle.
+     */
+    assert(to_area->na_cur <= from_area->na_cur);
+
+    /* Turn the source area into the new scratch area. */
+    from_area->na_gc_seq++;
+    if (from_area->na_gc_seq == 0) {
+        from_area->na_gc_seq_hi++;
+    }
+    rc = nffs_format_area(from_area_idx, 1);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (out_area_idx != NULL) {
+        *out_area_idx = nffs_scratch_area_idx;
+    }
+
+    nffs_scratch_area_idx = from_area_idx;
+    nffs_gc_cycle_cnt++;
+
+    return 0;
+}
+
 /**
  * Triggers a garbage collection cycle.  This is implemented as follows:
  *
- *  (1) The non-scratch area with the lowest garbage collection sequence
- *      number is selected as the "source area."  If there are other areas
- *      with the same sequence number, the first one encountered is selected.
+ *  (1) The non-scratch area with the greatest cost-benefit ratio is selected
+ *      as the "source area" (see nffs_gc_select_area()).  If an incremental
+ *      cycle is already in progress, its source area is used instead, and the
+ *      cycle is completed.
  *
  *  (2) The source area's ID is written to the scratch area's header,
  *      transforming it into a non-scratch ID.  The former scratch area is now
@@ -414,78 +675,137 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
 int
 nffs_gc(uint8_t *out_area_idx)
 {
-    struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *next;
-    struct nffs_area *from_area;
-    struct nffs_area *to_area;
-    struct nffs_inode_entry *inode_entry;
-    uint32_t area_offset;
     uint8_t from_area_idx;
-    uint8_t area_idx;
     int rc;
     int i;
 
-    from_area_idx = nffs_gc_select_area();
-    from_area = nffs_areas + from_area_idx;
-    to_area = nffs_areas + nffs_scratch_area_idx;
+    if (nffs_gc_incr_area_idx != NFFS_AREA_ID_NONE) {
+        /* Finish the incremental cycle that is already underway. */
+        from_area_idx = nffs_gc_incr_area_idx;
+        i = nffs_gc_incr_handle;
+        nffs_gc_incr_area_idx = NFFS_AREA_ID_NONE;
+    } else {
+        from_area_idx = nffs_gc_select_area();
+        rc = nffs_gc_begin(from_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+        i = 1;
+    }
 
-    rc = nffs_format_from_scratch_area(nffs_scratch_area_idx,
-                                       from_area->na_id);
-    if (rc != 0) {
-        return rc;
+    for (; i <= nffs_hash_max_inode_handle; i++) {
+        rc = nffs_gc_inode(i, from_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        entry = SLIST_FIRST(nffs_hash + i);
-        while (entry != NULL) {
-            next = SLIST_NEXT(entry, nhe_next);
+    return nffs_gc_finish(from_area_idx, out_area_idx);
+}
 
-            if (nffs_hash_id_is_inode(entry->nhe_id)) {
-                /* The inode gets copied if it is in the source area. */
-                nffs_flash_loc_expand(entry->nhe_flash_loc,
-                                      &area_idx, &area_offset);
-                inode_entry = (struct nffs_inode_entry *)entry;
-                if (area_idx == from_area_idx) {
-                    rc = nffs_gc_copy_inode(inode_entry,
-                                            nffs_scratch_area_idx);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
+/**
+ * Indicates whether an incremental garbage collection step should be
+ * performed.  This is the case if an incremental cycle is already in
+ * progress, or if both of the following are true:
+ *     o Less than one area's worth of free space remains.
+ *     o The best garbage collection candidate contains at least one
+ *       maximum-sized block's worth of garbage.
+ *
+ * @return                      1 if garbage collection is warranted;
+ *                              0 otherwise.
+ */
+int
+nffs_gc_incr_needed(void)
+{
+    const struct nffs_area *area;
+    uint32_t free_space;
+    int i;
 
-                /* If the inode is a file, all constituent data blocks that are
-                 * resident in the source area get copied.
-                 */
-                if (nffs_hash_id_is_file(entry->nhe_id)) {
-                    rc = nffs_gc_inode_blocks(inode_entry, from_area_idx,
-                                              nffs_scratch_area_idx, &next);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
-            }
+    if (nffs_gc_incr_area_idx != NFFS_AREA_ID_NONE) {
+        return 1;
+    }
 
-            entry = next;
+    if (nffs_scratch_area_idx == NFFS_AREA_ID_NONE) {
+        /* File system not initialized. */
+        return 0;
+    }
+
+    free_space = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx) {
+            free_space += nffs_area_free_space(nffs_areas + i);
         }
     }
+    if (free_space >= nffs_areas[nffs_scratch_area_idx].na_length) {
+        return 0;
+    }
 
-    /* The amount of written data should never increase as a result of a gc
-     * cycle.
-     */
-    assert(to_area->na_cur <= from_area->na_cur);
+    area = nffs_areas + nffs_gc_select_area();
+    return area->na_obsolete >=
+           sizeof (struct nffs_disk_block) + nffs_block_max_data_sz;
+}
 
-    /* Turn the source area into the new scratch area. */
-    from_area->na_gc_seq++;
-    rc = nffs_format_area(from_area_idx, 1);
-    if (rc != 0) {
-        return rc;
+/**
+ * Performs a bounded amount of garbage collection work.  A single step
+ * processes whole inodes until at least
+ * nffs_config.nc_gc_step_objs objects have been read or copied.  If no
+ * incremental cycle is in progress and one is warranted (see
+ * nffs_gc_incr_needed()), a new cycle is started.  While a cycle is in
+ * progress, its source area is not used for new writes.
+ *
+ * This function must not be called while a caller holds pointers into the
+ * block cache; block collation frees the affected inodes' cached blocks.
+ *
+ * @param out_done              On success, this gets set to 1 if no further
+ *                                  garbage collection is warranted; 0 if
+ *                                  another step should be performed.
+ *
+ * @return                      0 on success; nonzero on error.
+ */
+int
+nffs_gc_incr_step(int *out_done)
+{
+    uint8_t from_area_idx;
+    int rc;
+
+    if (nffs_gc_incr_area_idx == NFFS_AREA_ID_NONE) {
+        if (!nffs_gc_incr_needed()) {
+            *out_done = 1;
+            return 0;
+        }
+
+        from_area_idx = nffs_gc_select_area();
+        rc = nffs_gc_begin(from_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+
+        nffs_gc_incr_area_idx = from_area_idx;
+        nffs_gc_incr_handle = 1;
     }
 
-    if (out_area_idx != NULL) {
-        *out_area_idx = nffs_scratch_area_idx;
+    nffs_gc_obj_cnt = 0;
+    while (nffs_gc_incr_handle <= nffs_hash_max_inode_handle &&
+           nffs_gc_obj_cnt < nffs_config.nc_gc_step_objs) {
+
+        rc = nffs_gc_inode(nffs_gc_incr_handle, nffs_gc_incr_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+        nffs_gc_incr_handle++;
     }
 
-    nffs_scratch_area_idx = from_area_idx;
+    if (nffs_gc_incr_handle > nffs_hash_max_inode_handle) {
+        from_area_idx = nffs_gc_incr_area_idx;
+        nffs_gc_incr_area_idx = NFFS_AREA_ID_NONE;
+
+        rc = nffs_gc_finish(from_area_idx, NULL);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    *out_done = !nffs_gc_incr_needed();
 
     return 0;
 }
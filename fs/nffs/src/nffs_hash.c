@@ -23,12 +23,37 @@
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
 
-struct nffs_hash_list *nffs_hash;
+/**
+ * The hash table.  Inode and block entries live in their respective memory
+ * pools and are referred to by 16-bit handles:
+ *     1 ... nffs_hash_max_inode_handle:              inode entries
+ *     nffs_hash_max_inode_handle + 1 ... _max_handle: block entries
+ *
+ * The table is open-addressed with linear probing; each slot holds a handle,
+ * or NFFS_HANDLE_NONE if empty.  Removal shifts subsequent entries back rather
+ * than leaving tombstones, so lookup cost does not degrade over time.  Since
+ * entries may move between slots, the table is never iterated directly;
+ * instead, a bitmap records which handles are present (see
+ * NFFS_HASH_FOREACH).
+ */
+uint16_t *nffs_hash;
+int nffs_hash_num_slots;
+
+/** One bit per handle; set if the handle's entry is in the hash table. */
+static uint8_t *nffs_hash_live;
+
+uint16_t nffs_hash_max_inode_handle;
+uint16_t nffs_hash_max_handle;
 
 uint32_t nffs_hash_next_dir_id;
 uint32_t nffs_hash_next_file_id;
 uint32_t nffs_hash_next_block_id;
 
+#define NFFS_HASH_INODE_ENTRY_SZ \
+    OS_MEMPOOL_BYTES(1, sizeof (struct nffs_inode_entry))
+#define NFFS_HASH_BLOCK_ENTRY_SZ \
+    OS_MEMPOOL_BYTES(1, sizeof (struct nffs_hash_entry))
+
 int
 nffs_hash_id_is_dir(uint32_t id)
 {
@@ -56,35 +81,129 @@ nffs_hash_id_is_block(uint32_t id)
 static int
 nffs_hash_fn(uint32_t id)
 {
-    return id % NFFS_HASH_SIZE;
+    /* IDs are allocated sequentially; multiplicative hashing spreads runs of
+     * consecutive IDs across the table.
+     */
+    return (id * 2654435761u) % nffs_hash_num_slots;
 }
 
+/**
+ * Converts a handle to a pointer to the entry it refers to.
+ *
+ * @param handle                The handle to convert.
+ *
+ * @return                      The corresponding entry;
+ *                              NULL if the handle is NFFS_HANDLE_NONE.
+ */
 struct nffs_hash_entry *
-nffs_hash_find(uint32_t id)
+nffs_hash_entry_from_handle(uint16_t handle)
 {
-    struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *prev;
-    struct nffs_hash_list *list;
-    int idx;
+    uint8_t *base;
+
+    if (handle == NFFS_HANDLE_NONE) {
+        return NULL;
+    }
+
+    assert(handle <= nffs_hash_max_handle);
+
+    if (handle <= nffs_hash_max_inode_handle) {
+        base = nffs_inode_mem;
+        return (void *)(base + (handle - 1) * NFFS_HASH_INODE_ENTRY_SZ);
+    } else {
+        base = nffs_block_entry_mem;
+        return (void *)(base + (handle - nffs_hash_max_inode_handle - 1) *
+                               NFFS_HASH_BLOCK_ENTRY_SZ);
+    }
+}
 
-    idx = nffs_hash_fn(id);
-    list = nffs_hash + idx;
+/**
+ * Calculates the handle that refers to the specified entry.  The entry must
+ * have been allocated from the inode or block entry pool.
+ *
+ * @param entry                 The entry to convert; may be NULL.
+ *
+ * @return                      The entry's handle;
+ *                              NFFS_HANDLE_NONE if the entry is NULL.
+ */
+uint16_t
+nffs_hash_handle(const struct nffs_hash_entry *entry)
+{
+    const uint8_t *base;
+    uint32_t off;
+
+    if (entry == NULL) {
+        return NFFS_HANDLE_NONE;
+    }
+
+    if (nffs_hash_id_is_inode(entry->nhe_id)) {
+        base = nffs_inode_mem;
+        off = (const uint8_t *)entry - base;
+        assert(off % NFFS_HASH_INODE_ENTRY_SZ == 0);
+        off /= NFFS_HASH_INODE_ENTRY_SZ;
+        assert(off < nffs_hash_max_inode_handle);
+        return off + 1;
+    } else {
+        base = nffs_block_entry_mem;
+        off = (const uint8_t *)entry - base;
+        assert(off % NFFS_HASH_BLOCK_ENTRY_SZ == 0);
+        off /= NFFS_HASH_BLOCK_ENTRY_SZ;
+        assert(off < nffs_hash_max_handle - nffs_hash_max_inode_handle);
+        return off + nffs_hash_max_inode_handle + 1;
+    }
+}
+
+/**
+ * Retrieves the entry with the specified handle if it is currently in the
+ * hash table.
+ *
+ * @param handle                The handle of the entry to retrieve.
+ *
+ * @return                      The entry if it is in the hash table;
+ *                              NULL otherwise.
+ */
+struct nffs_hash_entry *
+nffs_hash_live_entry(uint16_t handle)
+{
+    if (!(nffs_hash_live[handle / 8] & (1 << (handle % 8)))) {
+        return NULL;
+    }
 
-    prev = NULL;
-    SLIST_FOREACH(entry, list, nhe_next) {
+    return nffs_hash_entry_from_handle(handle);
+}
+
+static int
+nffs_hash_find_slot(uint32_t id)
+{
+    struct nffs_hash_entry *entry;
+    int slot;
+
+    slot = nffs_hash_fn(id);
+    while (nffs_hash[slot] != NFFS_HANDLE_NONE) {
+        entry = nffs_hash_entry_from_handle(nffs_hash[slot]);
         if (entry->nhe_id == id) {
-            /* Put entry at the front of the list. */
-            if (prev != NULL) {
-                SLIST_NEXT(prev, nhe_next) = SLIST_NEXT(entry, nhe_next);
-                SLIST_INSERT_HEAD(list, entry, nhe_next);
-            }
-            return entry;
+            return slot;
+        }
+
+        slot++;
+        if (slot == nffs_hash_num_slots) {
+            slot = 0;
         }
+    }
+
+    return -1;
+}
 
-        prev = entry;
+struct nffs_hash_entry *
+nffs_hash_find(uint32_t id)
+{
+    int slot;
+
+    slot = nffs_hash_find_slot(id);
+    if (slot == -1) {
+        return NULL;
     }
 
-    return NULL;
+    return nffs_hash_entry_from_handle(nffs_hash[slot]);
 }
 
 struct nffs_inode_entry *
@@ -112,43 +231,116 @@ nffs_hash_find_block(uint32_t id)
 void
 nffs_hash_insert(struct nffs_hash_entry *entry)
 {
-    struct nffs_hash_list *list;
-    int idx;
+    uint16_t handle;
+    int slot;
 
-    idx = nffs_hash_fn(entry->nhe_id);
-    list = nffs_hash + idx;
+    handle = nffs_hash_handle(entry);
 
-    SLIST_INSERT_HEAD(list, entry, nhe_next);
+    /* The table has more slots than there are handles, so an empty slot is
+     * always found.
+     */
+    slot = nffs_hash_fn(entry->nhe_id);
+    while (nffs_hash[slot] != NFFS_HANDLE_NONE) {
+        slot++;
+        if (slot == nffs_hash_num_slots) {
+            slot = 0;
+        }
+    }
+
+    nffs_hash[slot] = handle;
+    nffs_hash_live[handle / 8] |= 1 << (handle % 8);
 }
 
 void
 nffs_hash_remove(struct nffs_hash_entry *entry)
 {
-    struct nffs_hash_list *list;
-    int idx;
+    struct nffs_hash_entry *cur;
+    uint16_t handle;
+    int home;
+    int hole;
+    int slot;
+
+    handle = nffs_hash_handle(entry);
+
+    slot = nffs_hash_fn(entry->nhe_id);
+    while (nffs_hash[slot] != handle) {
+        assert(nffs_hash[slot] != NFFS_HANDLE_NONE);
+        slot++;
+        if (slot == nffs_hash_num_slots) {
+            slot = 0;
+        }
+    }
 
-    idx = nffs_hash_fn(entry->nhe_id);
-    list = nffs_hash + idx;
+    nffs_hash_live[handle / 8] &= ~(1 << (handle % 8));
 
-    SLIST_REMOVE(list, entry, nffs_hash_entry, nhe_next);
+    /* Close the gap: move back each subsequent entry in the probe run whose
+     * home slot does not lie cyclically within (hole, slot].
+     */
+    hole = slot;
+    while (1) {
+        nffs_hash[hole] = NFFS_HANDLE_NONE;
+        while (1) {
+            slot++;
+            if (slot == nffs_hash_num_slots) {
+                slot = 0;
+            }
+            if (nffs_hash[slot] == NFFS_HANDLE_NONE) {
+                return;
+            }
+
+            cur = nffs_hash_entry_from_handle(nffs_hash[slot]);
+            home = nffs_hash_fn(cur->nhe_id);
+            if (hole <= slot) {
+                if (home <= hole || home > slot) {
+                    break;
+                }
+            } else {
+                if (home <= hole && home > slot) {
+                    break;
+                }
+            }
+        }
+
+        nffs_hash[hole] = nffs_hash[slot];
+        hole = slot;
+    }
 }
 
 int
 nffs_hash_init(void)
 {
-    int i;
+    int num_handles;
 
     free(nffs_hash);
+    nffs_hash = NULL;
+    free(nffs_hash_live);
+    nffs_hash_live = NULL;
+    nffs_hash_num_slots = 0;
+    nffs_hash_max_inode_handle = 0;
+    nffs_hash_max_handle = 0;
+
+    /* Every inode and block entry needs a distinct nonzero 16-bit handle. */
+    num_handles = nffs_config.nc_num_inodes + nffs_config.nc_num_blocks;
+    if (num_handles >= NFFS_HANDLE_MAX) {
+        return FS_EINVAL;
+    }
 
-    nffs_hash = malloc(NFFS_HASH_SIZE * sizeof *nffs_hash);
+    /* Keep the load factor at or below 0.8. */
+    nffs_hash_num_slots = num_handles + num_handles / 4 + 1;
+    nffs_hash = malloc(nffs_hash_num_slots * sizeof *nffs_hash);
     if (nffs_hash == NULL) {
         return FS_ENOMEM;
     }
+    memset(nffs_hash, 0, nffs_hash_num_slots * sizeof *nffs_hash);
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        SLIST_INIT(nffs_hash + i);
+    nffs_hash_live = malloc(num_handles / 8 + 1);
+    if (nffs_hash_live == NULL) {
+        return FS_ENOMEM;
     }
+    memset(nffs_hash_live, 0, num_handles / 8 + 1);
+
+    nffs_hash_max_inode_handle = nffs_config.nc_num_inodes;
+    nffs_hash_max_handle = num_handles;
 
     return 0;
 }
-
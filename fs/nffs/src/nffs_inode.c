@@ -34,8 +34,19 @@ static uint8_t *nffs_inode_filename_buf0 = nffs_flash_buf;
 static uint8_t *nffs_inode_filename_buf1 =
     nffs_flash_buf + NFFS_INODE_FILENAME_BUF_SZ;
 
-/** A list of directory inodes with pending unlink operations. */
-static struct nffs_hash_list nffs_inode_unlink_list;
+/**
+ * A list of directory inodes with pending unlink operations.  The list is
+ * threaded through the entries' sibling handles; a directory is detached from
+ * its parent before it is unlinked, so the sibling handle is free for reuse.
+ */
+static uint16_t nffs_inode_unlink_list;
+
+/** Set while the unlink list is being processed. */
+static uint8_t nffs_inode_unlink_busy;
+
+static int nffs_inode_process_unlink_list(void);
+static int nffs_inode_name_hash_flash(const struct nffs_inode *inode,
+                                      uint8_t *out_hash);
 
 struct nffs_inode_entry *
 nffs_inode_entry_alloc(void)
@@ -55,6 +66,7 @@ nffs_inode_entry_free(struct nffs_inode_entry *inode_entry)
 {
     if (inode_entry != NULL) {
         assert(nffs_hash_id_is_inode(inode_entry->nie_hash_entry.nhe_id));
+        nffs_cache_name_delete(inode_entry);
         os_memblock_put(&nffs_inode_entry_pool, inode_entry);
     }
 }
@@ -122,7 +134,7 @@ nffs_inode_calc_data_length(struct nffs_inode_entry *inode_entry,
 
     *out_len = 0;
 
-    cur = inode_entry->nie_last_block_entry;
+    cur = nffs_inode_last_block(inode_entry);
     while (cur != NULL) {
         rc = nffs_block_from_hash_entry(&block, cur);
         if (rc != 0) {
@@ -137,18 +149,22 @@ nffs_inode_calc_data_length(struct nffs_inode_entry *inode_entry,
     return 0;
 }
 
+/**
+ * Retrieves the length of the specified file.  The length is maintained in
+ * the RAM inode entry as blocks are added and removed, so this does not
+ * require a walk of the block chain.
+ *
+ * @param inode_entry           The file inode to query.
+ * @param out_len               On success, the file length gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 int
 nffs_inode_data_len(struct nffs_inode_entry *inode_entry, uint32_t *out_len)
 {
-    struct nffs_cache_inode *cache_inode;
-    int rc;
-
-    rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
-    if (rc != 0) {
-        return rc;
-    }
+    assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
 
-    *out_len = cache_inode->nci_file_size;
+    *out_len = inode_entry->nie_data_len;
 
     return 0;
 }
@@ -213,8 +229,8 @@ nffs_inode_delete_blocks_from_ram(struct nffs_inode_entry *inode_entry)
 
     assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
 
-    while (inode_entry->nie_last_block_entry != NULL) {
-        rc = nffs_block_delete_from_ram(inode_entry->nie_last_block_entry);
+    while (inode_entry->nie_last_block != NFFS_HANDLE_NONE) {
+        rc = nffs_block_delete_from_ram(nffs_inode_last_block(inode_entry));
         if (rc != 0) {
             return rc;
         }
@@ -223,11 +239,49 @@ nffs_inode_delete_blocks_from_ram(struct nffs_inode_entry *inode_entry)
     return 0;
 }
 
+/**
+ * Records the specified inode's disk record as obsolete.  The inode header is
+ * read directly from flash rather than through the inode cache.
+ *
+ * @param inode_entry           The inode entry being deleted.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_inode_add_obsolete(struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_disk_inode disk_inode;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    if (inode_entry->nie_hash_entry.nhe_flash_loc == NFFS_FLASH_LOC_NONE) {
+        return 0;
+    }
+
+    nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
+                          &area_idx, &area_offset);
+    rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_area_add_obsolete(inode_entry->nie_hash_entry.nhe_flash_loc,
+                           sizeof disk_inode + disk_inode.ndi_filename_len);
+
+    return 0;
+}
+
 static int
 nffs_inode_delete_from_ram(struct nffs_inode_entry *inode_entry)
 {
     int rc;
 
+    rc = nffs_inode_add_obsolete(inode_entry);
+    if (rc != 0) {
+        return rc;
+    }
+
     if (nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id)) {
         rc = nffs_inode_delete_blocks_from_ram(inode_entry);
         if (rc != 0) {
@@ -243,9 +297,9 @@ nffs_inode_delete_from_ram(struct nffs_inode_entry *inode_entry)
 }
 
 /**
- * Inserts the specified inode entry into the unlink list.  Because a hash
- * entry only has a single 'next' pointer, this function removes the entry from
- * the hash table prior to inserting it into the unlink list.
+ * Inserts the specified inode entry into the unlink list.  The entry is
+ * removed from the hash table so that it can no longer be looked up while its
+ * descendants are being unlinked.
  *
  * @param inode_entry           The inode entry to insert.
  */
@@ -253,8 +307,8 @@ static void
 nffs_inode_insert_unlink_list(struct nffs_inode_entry *inode_entry)
 {
     nffs_hash_remove(&inode_entry->nie_hash_entry);
-    SLIST_INSERT_HEAD(&nffs_inode_unlink_list, &inode_entry->nie_hash_entry,
-                      nhe_next);
+    inode_entry->nie_sibling_next = nffs_inode_unlink_list;
+    nffs_inode_unlink_list = nffs_hash_handle(&inode_entry->nie_hash_entry);
 }
 
 /**
@@ -279,6 +333,10 @@ nffs_inode_dec_refcnt(struct nffs_inode_entry *inode_entry)
             }
         } else {
             nffs_inode_insert_unlink_list(inode_entry);
+            rc = nffs_inode_process_unlink_list();
+            if (rc != 0) {
+                return rc;
+            }
         }
     }
 
@@ -292,43 +350,37 @@ nffs_inode_dec_refcnt(struct nffs_inode_entry *inode_entry)
  *     o Each descendant file has its reference count decremented (and deleted
  *       from RAM if its reference count reaches zero).
  *
- * @param inout_next            This parameter is only necessary if you are
- *                                  calling this function during an iteration
- *                                  of the entire hash table; pass null
- *                                  otherwise.
- *                              On input, this points to the next hash entry
- *                                  you plan on processing.
- *                              On output, this points to the next hash entry
- *                                  that should be processed.
+ * If the list is already being processed further up the call stack, this
+ * function returns immediately; the outer call picks up the new entries.
  */
 static int
-nffs_inode_process_unlink_list(struct nffs_hash_entry **inout_next)
+nffs_inode_process_unlink_list(void)
 {
     struct nffs_inode_entry *inode_entry;
     struct nffs_inode_entry *child_next;
     struct nffs_inode_entry *child;
-    struct nffs_hash_entry *hash_entry;
     int rc;
 
-    while ((hash_entry = SLIST_FIRST(&nffs_inode_unlink_list)) != NULL) {
-        assert(nffs_hash_id_is_dir(hash_entry->nhe_id));
+    if (nffs_inode_unlink_busy) {
+        return 0;
+    }
+    nffs_inode_unlink_busy = 1;
 
-        SLIST_REMOVE_HEAD(&nffs_inode_unlink_list, nhe_next);
+    while (nffs_inode_unlink_list != NFFS_HANDLE_NONE) {
+        inode_entry = (struct nffs_inode_entry *)
+            nffs_hash_entry_from_handle(nffs_inode_unlink_list);
+        assert(nffs_hash_id_is_dir(inode_entry->nie_hash_entry.nhe_id));
 
-        inode_entry = (struct nffs_inode_entry *)hash_entry;
+        nffs_inode_unlink_list = inode_entry->nie_sibling_next;
 
         /* Recursively unlink each child. */
-        child = SLIST_FIRST(&inode_entry->nie_child_list);
+        child = nffs_inode_first_child(inode_entry);
         while (child != NULL) {
-            child_next = SLIST_NEXT(child, nie_sibling_next);
-
-            if (inout_next != NULL && *inout_next == &child->nie_hash_entry) {
-                *inout_next = &child_next->nie_hash_entry;
-            }
+            child_next = nffs_inode_next_sibling(child);
 
             rc = nffs_inode_dec_refcnt(child);
             if (rc != 0) {
-                return rc;
+                goto done;
             }
 
             child = child_next;
@@ -337,10 +389,18 @@ nffs_inode_process_unlink_list(struct nffs_hash_entry **inout_next)
         /* The directory is already removed from the hash table; just free its
          * memory.
          */
+        rc = nffs_inode_add_obsolete(inode_entry);
+        if (rc != 0) {
+            goto done;
+        }
         nffs_inode_entry_free(inode_entry);
     }
 
-    return 0;
+    rc = 0;
+
+done:
+    nffs_inode_unlink_busy = 0;
+    return rc;
 }
 
 int
@@ -373,6 +433,12 @@ nffs_inode_delete_from_disk(struct nffs_inode *inode)
         return rc;
     }
 
+    /* The deletion record is not referenced by the RAM representation, so it
+     * does not survive garbage collection.
+     */
+    nffs_area_add_obsolete(nffs_flash_loc(area_idx, offset),
+                           sizeof disk_inode);
+
     return 0;
 }
 
@@ -393,19 +459,6 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         return rc;
     }
 
-    if (inode.ni_parent != new_parent) {
-        if (inode.ni_parent != NULL) {
-            nffs_inode_remove_child(&inode);
-        }
-        if (new_parent != NULL) {
-            rc = nffs_inode_add_child(new_parent, inode.ni_inode_entry);
-            if (rc != 0) {
-                return rc;
-            }
-        }
-        inode.ni_parent = new_parent;
-    }
-
     if (new_filename != NULL) {
         filename_len = strlen(new_filename);
     } else {
@@ -431,7 +484,11 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
     disk_inode.ndi_magic = NFFS_INODE_MAGIC;
     disk_inode.ndi_id = inode_entry->nie_hash_entry.nhe_id;
     disk_inode.ndi_seq = inode.ni_seq + 1;
-    disk_inode.ndi_parent_id = nffs_inode_parent_id(&inode);
+    if (new_parent == NULL) {
+        disk_inode.ndi_parent_id = NFFS_ID_NONE;
+    } else {
+        disk_inode.ndi_parent_id = new_parent->nie_hash_entry.nhe_id;
+    }
     disk_inode.ndi_filename_len = filename_len;
     nffs_crc_disk_inode_fill(&disk_inode, new_filename);
 
@@ -441,9 +498,24 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         return rc;
     }
 
+    nffs_area_add_obsolete(inode_entry->nie_hash_entry.nhe_flash_loc,
+                           sizeof disk_inode + inode.ni_filename_len);
     inode_entry->nie_hash_entry.nhe_flash_loc =
         nffs_flash_loc(area_idx, area_offset);
 
+    /* Reinsert the inode now that its new name is on disk; this keeps the
+     * parent's child list sorted and the name hash current.
+     */
+    if (inode.ni_parent != NULL) {
+        nffs_inode_remove_child(&inode);
+    }
+    if (new_parent != NULL) {
+        rc = nffs_inode_add_child(new_parent, inode_entry);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
     return 0;
 }
 
@@ -514,48 +586,251 @@ nffs_inode_read_filename(struct nffs_inode_entry *inode_entry, size_t max_len,
     return 0;
 }
 
+/**
+ * Compares the filenames of two inode entries.  A name in the filename cache
+ * is compared from RAM; otherwise the entry's disk record is read.
+ *
+ * @param entry1                The first inode entry.
+ * @param entry2                The second inode entry.
+ * @param result                On success, the result of the comparison gets
+ *                                  written here; <0, 0, or >0 as with
+ *                                  strcmp().
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_inode_filename_cmp_entries(struct nffs_inode_entry *entry1,
+                                struct nffs_inode_entry *entry2,
+                                int *result)
+{
+    struct nffs_cache_name *cache_name;
+    struct nffs_inode inode1;
+    struct nffs_inode inode2;
+    int rc;
+
+    cache_name = nffs_cache_name_find(entry2);
+    if (cache_name != NULL) {
+        return nffs_inode_filename_cmp_entry(entry1, cache_name->ncn_name,
+                                             cache_name->ncn_name_len,
+                                             result);
+    }
+
+    rc = nffs_inode_from_entry(&inode1, entry1);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = nffs_inode_from_entry(&inode2, entry2);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return nffs_inode_filename_cmp_flash(&inode1, &inode2, result);
+}
+
+/**
+ * Inserts an inode into its parent directory's sorted list of children.  The
+ * child's name hash is recomputed, so this must be called after the child's
+ * current disk record has been written.
+ *
+ * If the filename cache is enabled, the child's name is held in RAM so that
+ * each sibling comparison requires at most one flash record to be read, and
+ * none for siblings whose names are cached.
+ *
+ * @param parent                The directory to insert into.
+ * @param child                 The inode to insert.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 int
 nffs_inode_add_child(struct nffs_inode_entry *parent,
                      struct nffs_inode_entry *child)
 {
+    struct nffs_cache_name *child_name;
     struct nffs_inode_entry *prev;
     struct nffs_inode_entry *cur;
     struct nffs_inode child_inode;
-    struct nffs_inode cur_inode;
+    uint16_t handle;
     int cmp;
     int rc;
 
     assert(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
 
-    rc = nffs_inode_from_entry(&child_inode, child);
-    if (rc != 0) {
-        return rc;
+    if (nffs_config.nc_num_cache_names > 0) {
+        rc = nffs_cache_name_ensure(&child_name, child);
+        if (rc != 0) {
+            return rc;
+        }
+        child->nie_name_hash = nffs_inode_name_hash(child_name->ncn_name,
+                                                    child_name->ncn_name_len);
+    } else {
+        child_name = NULL;
+        rc = nffs_inode_from_entry(&child_inode, child);
+        if (rc != 0) {
+            return rc;
+        }
+        rc = nffs_inode_name_hash_flash(&child_inode, &child->nie_name_hash);
+        if (rc != 0) {
+            return rc;
+        }
     }
 
     prev = NULL;
-    SLIST_FOREACH(cur, &parent->nie_child_list, nie_sibling_next) {
+    NFFS_INODE_FOREACH_CHILD(parent, cur) {
         assert(cur != child);
-        rc = nffs_inode_from_entry(&cur_inode, cur);
-        if (rc != 0) {
-            return rc;
+        if (child_name != NULL) {
+            rc = nffs_inode_filename_cmp_entry(cur, child_name->ncn_name,
+                                               child_name->ncn_name_len,
+                                               &cmp);
+        } else {
+            rc = nffs_inode_filename_cmp_entries(cur, child, &cmp);
         }
-
-        rc = nffs_inode_filename_cmp_flash(&child_inode, &cur_inode, &cmp);
         if (rc != 0) {
             return rc;
         }
 
-        if (cmp < 0) {
+        if (cmp > 0) {
             break;
         }
 
         prev = cur;
     }
 
+    handle = nffs_hash_handle(&child->nie_hash_entry);
     if (prev == NULL) {
-        SLIST_INSERT_HEAD(&parent->nie_child_list, child, nie_sibling_next);
+        child->nie_sibling_next = parent->nie_first_child;
+        parent->nie_first_child = handle;
+    } else {
+        child->nie_sibling_next = prev->nie_sibling_next;
+        prev->nie_sibling_next = handle;
+    }
+
+    return 0;
+}
+
+/**
+ * Inserts an inode at the head of its parent directory's list of children
+ * without regard to order.  This is used while restoring, when inodes are
+ * discovered in flash order; afterwards, nffs_inode_sort_children() puts each
+ * directory in order with O(n log n) comparisons rather than the O(n^2) that
+ * sorted insertion would cost.  Path lookups must not be performed on the
+ * directory until it is sorted.
+ *
+ * @param parent                The directory to insert into.
+ * @param child                 The inode to insert.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_prepend_child(struct nffs_inode_entry *parent,
+                         struct nffs_inode_entry *child)
+{
+    struct nffs_inode child_inode;
+    int rc;
+
+    assert(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
+
+    rc = nffs_inode_from_entry(&child_inode, child);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = nffs_inode_name_hash_flash(&child_inode, &child->nie_name_hash);
+    if (rc != 0) {
+        return rc;
+    }
+
+    child->nie_sibling_next = parent->nie_first_child;
+    parent->nie_first_child = nffs_hash_handle(&child->nie_hash_entry);
+
+    return 0;
+}
+
+/**
+ * Sorts a directory's list of children by filename.  This is a bottom-up
+ * merge sort, so it needs no recursion or extra memory.
+ *
+ * @param dir                   The directory to sort.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_sort_children(struct nffs_inode_entry *dir)
+{
+    struct nffs_inode_entry *head;
+    struct nffs_inode_entry *tail;
+    struct nffs_inode_entry *elem;
+    struct nffs_inode_entry *p;
+    struct nffs_inode_entry *q;
+    int num_merges;
+    int run_len;
+    int p_len;
+    int q_len;
+    int cmp;
+    int rc;
+
+    assert(nffs_hash_id_is_dir(dir->nie_hash_entry.nhe_id));
+
+    head = nffs_inode_first_child(dir);
+    run_len = 1;
+    do {
+        p = head;
+        head = NULL;
+        tail = NULL;
+        num_merges = 0;
+
+        while (p != NULL) {
+            num_merges++;
+
+            /* Merge the run starting at p with the one that follows it. */
+            q = p;
+            for (p_len = 0; p_len < run_len && q != NULL; p_len++) {
+                q = nffs_inode_next_sibling(q);
+            }
+            q_len = run_len;
+
+            while (p_len > 0 || (q_len > 0 && q != NULL)) {
+                if (p_len == 0) {
+                    cmp = 1;
+                } else if (q_len == 0 || q == NULL) {
+                    cmp = -1;
+                } else {
+                    rc = nffs_inode_filename_cmp_entries(p, q, &cmp);
+                    if (rc != 0) {
+                        return rc;
+                    }
+                }
+
+                if (cmp <= 0) {
+                    elem = p;
+                    p = nffs_inode_next_sibling(p);
+                    p_len--;
+                } else {
+                    elem = q;
+                    q = nffs_inode_next_sibling(q);
+                    q_len--;
+                }
+
+                if (tail == NULL) {
+                    head = elem;
+                } else {
+                    tail->nie_sibling_next =
+                        nffs_hash_handle(&elem->nie_hash_entry);
+                }
+                tail = elem;
+            }
+
+            p = q;
+        }
+
+        if (tail != NULL) {
+            tail->nie_sibling_next = NFFS_HANDLE_NONE;
+        }
+        run_len *= 2;
+    } while (num_merges > 1);
+
+    if (head == NULL) {
+        dir->nie_first_child = NFFS_HANDLE_NONE;
     } else {
-        SLIST_INSERT_AFTER(prev, child, nie_sibling_next);
+        dir->nie_first_child = nffs_hash_handle(&head->nie_hash_entry);
     }
 
     return 0;
@@ -565,13 +840,64 @@ void
 nffs_inode_remove_child(struct nffs_inode *child)
 {
     struct nffs_inode_entry *parent;
+    struct nffs_inode_entry *cur;
+    uint16_t handle;
 
     parent = child->ni_parent;
     assert(parent != NULL);
     assert(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
-    SLIST_REMOVE(&parent->nie_child_list, child->ni_inode_entry,
-                 nffs_inode_entry, nie_sibling_next);
-    SLIST_NEXT(child->ni_inode_entry, nie_sibling_next) = NULL;
+
+    handle = nffs_hash_handle(&child->ni_inode_entry->nie_hash_entry);
+    if (parent->nie_first_child == handle) {
+        parent->nie_first_child = child->ni_inode_entry->nie_sibling_next;
+    } else {
+        cur = nffs_inode_first_child(parent);
+        while (cur->nie_sibling_next != handle) {
+            cur = nffs_inode_next_sibling(cur);
+            assert(cur != NULL);
+        }
+        cur->nie_sibling_next = child->ni_inode_entry->nie_sibling_next;
+    }
+    child->ni_inode_entry->nie_sibling_next = NFFS_HANDLE_NONE;
+}
+
+/**
+ * @return                      The first child of the specified directory;
+ *                              NULL if the directory is empty.
+ */
+struct nffs_inode_entry *
+nffs_inode_first_child(const struct nffs_inode_entry *inode_entry)
+{
+    return (struct nffs_inode_entry *)
+        nffs_hash_entry_from_handle(inode_entry->nie_first_child);
+}
+
+/**
+ * @return                      The next entry in the inode's parent
+ *                                  directory; NULL if this is the last child.
+ */
+struct nffs_inode_entry *
+nffs_inode_next_sibling(const struct nffs_inode_entry *inode_entry)
+{
+    return (struct nffs_inode_entry *)
+        nffs_hash_entry_from_handle(inode_entry->nie_sibling_next);
+}
+
+/**
+ * @return                      The last data block in the specified file;
+ *                              NULL if the file is empty.
+ */
+struct nffs_hash_entry *
+nffs_inode_last_block(const struct nffs_inode_entry *inode_entry)
+{
+    return nffs_hash_entry_from_handle(inode_entry->nie_last_block);
+}
+
+void
+nffs_inode_set_last_block(struct nffs_inode_entry *inode_entry,
+                          struct nffs_hash_entry *block_entry)
+{
+    inode_entry->nie_last_block = nffs_hash_handle(block_entry);
 }
 
 int
@@ -626,6 +952,149 @@ nffs_inode_filename_cmp_ram(const struct nffs_inode *inode,
     return 0;
 }
 
+/**
+ * Compares the filename of the specified inode entry with the given string.
+ * The comparison is performed entirely in RAM if the entry's name is in the
+ * filename cache; otherwise, the inode's disk record is read.
+ *
+ * @param inode_entry           The inode whose name is compared.
+ * @param name                  The string to compare against.
+ * @param name_len              The length of the string; no null terminator
+ *                                  is required.
+ * @param result                On success, the result of the comparison gets
+ *                                  written here; <0, 0, or >0 as with
+ *                                  strcmp().
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_filename_cmp_entry(struct nffs_inode_entry *inode_entry,
+                              const char *name, int name_len,
+                              int *result)
+{
+    struct nffs_cache_name *cache_name;
+    struct nffs_inode inode;
+    int short_len;
+    int rc;
+
+    cache_name = nffs_cache_name_find(inode_entry);
+    if (cache_name != NULL) {
+        if (name_len < cache_name->ncn_name_len) {
+            short_len = name_len;
+        } else {
+            short_len = cache_name->ncn_name_len;
+        }
+
+        *result = strncmp(cache_name->ncn_name, name, short_len);
+        if (*result == 0) {
+            *result = cache_name->ncn_name_len - name_len;
+        }
+
+        return 0;
+    }
+
+    rc = nffs_inode_from_entry(&inode, inode_entry);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return nffs_inode_filename_cmp_ram(&inode, name, name_len, result);
+}
+
+/* 32-bit FNV-1a, folded into a single byte. */
+#define NFFS_INODE_NAME_HASH_INIT   2166136261UL
+
+static uint32_t
+nffs_inode_name_hash_update(uint32_t hash, const char *name, int name_len)
+{
+    int i;
+
+    for (i = 0; i < name_len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+static uint8_t
+nffs_inode_name_hash_fold(uint32_t hash)
+{
+    return hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24);
+}
+
+/**
+ * Calculates the 8-bit hash of a filename that is stored in each inode entry.
+ * Directory lookups compare this hash before comparing names, so most
+ * non-matching siblings are skipped without a flash read.
+ *
+ * @param name                  The filename to hash.
+ * @param name_len              The length of the filename.
+ *
+ * @return                      The filename hash.
+ */
+uint8_t
+nffs_inode_name_hash(const char *name, int name_len)
+{
+    uint32_t hash;
+
+    hash = nffs_inode_name_hash_update(NFFS_INODE_NAME_HASH_INIT, name,
+                                       name_len);
+    return nffs_inode_name_hash_fold(hash);
+}
+
+/**
+ * Calculates the filename hash of the specified inode, reading the part of
+ * the name that is not held in the inode's short filename from flash.
+ *
+ * @param inode                 The inode whose name gets hashed.
+ * @param out_hash              On success, the hash gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_inode_name_hash_flash(const struct nffs_inode *inode, uint8_t *out_hash)
+{
+    uint32_t hash;
+    int chunk_len;
+    int rem_len;
+    int off;
+    int rc;
+
+    if (inode->ni_filename_len <= NFFS_SHORT_FILENAME_LEN) {
+        chunk_len = inode->ni_filename_len;
+    } else {
+        chunk_len = NFFS_SHORT_FILENAME_LEN;
+    }
+    hash = nffs_inode_name_hash_update(NFFS_INODE_NAME_HASH_INIT,
+                                       (char *)inode->ni_filename, chunk_len);
+
+    off = chunk_len;
+    while (off < inode->ni_filename_len) {
+        rem_len = inode->ni_filename_len - off;
+        if (rem_len > NFFS_INODE_FILENAME_BUF_SZ) {
+            chunk_len = NFFS_INODE_FILENAME_BUF_SZ;
+        } else {
+            chunk_len = rem_len;
+        }
+
+        rc = nffs_inode_read_filename_chunk(inode, off,
+                                            nffs_inode_filename_buf0,
+                                            chunk_len);
+        if (rc != 0) {
+            return rc;
+        }
+
+        hash = nffs_inode_name_hash_update(hash,
+                                           (char *)nffs_inode_filename_buf0,
+                                           chunk_len);
+        off += chunk_len;
+    }
+
+    *out_hash = nffs_inode_name_hash_fold(hash);
+    return 0;
+}
+
 int
 nffs_inode_filename_cmp_flash(const struct nffs_inode *inode1,
                               const struct nffs_inode *inode2,
@@ -705,7 +1174,6 @@ int
 nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
                 uint32_t length, struct nffs_seek_info *out_seek_info)
 {
-    struct nffs_cache_inode *cache_inode;
     struct nffs_hash_entry *cur_entry;
     struct nffs_block block;
     uint32_t block_start;
@@ -716,27 +1184,22 @@ nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
     assert(length > 0);
     assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
 
-    rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
-    if (rc != 0) {
-        return rc;
-    }
-
-    if (offset > cache_inode->nci_file_size) {
+    if (offset > inode_entry->nie_data_len) {
         return FS_ERANGE;
     }
-    if (offset == cache_inode->nci_file_size) {
+    if (offset == inode_entry->nie_data_len) {
         memset(&out_seek_info->nsi_last_block, 0,
                sizeof out_seek_info->nsi_last_block);
         out_seek_info->nsi_last_block.nb_hash_entry = NULL;
         out_seek_info->nsi_block_file_off = 0;
-        out_seek_info->nsi_file_len = cache_inode->nci_file_size;
+        out_seek_info->nsi_file_len = inode_entry->nie_data_len;
         return 0;
     }
 
     seek_end = offset + length;
 
-    cur_entry = inode_entry->nie_last_block_entry;
-    cur_offset = cache_inode->nci_file_size;
+    cur_entry = nffs_inode_last_block(inode_entry);
+    cur_offset = inode_entry->nie_data_len;
 
     while (1) {
         rc = nffs_block_from_hash_entry(&block, cur_entry);
@@ -748,7 +1211,7 @@ nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
         if (seek_end > block_start) {
             out_seek_info->nsi_last_block = block;
             out_seek_info->nsi_block_file_off = block_start;
-            out_seek_info->nsi_file_len = cache_inode->nci_file_size;
+            out_seek_info->nsi_file_len = inode_entry->nie_data_len;
             return 0;
         }
 
@@ -798,8 +1261,8 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
     }
 
     src_end = offset + len;
-    if (src_end > cache_inode->nci_file_size) {
-        src_end = cache_inode->nci_file_size;
+    if (src_end > inode_entry->nie_data_len) {
+        src_end = inode_entry->nie_data_len;
     }
 
     /* Initialize variables for the first iteration. */
@@ -835,8 +1298,8 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         dst_off -= chunk_sz;
         src_off -= chunk_sz;
 
-        rc = nffs_block_read_data(&cache_block->ncb_block, block_off, chunk_sz,
-                                  dptr + dst_off);
+        rc = nffs_cache_data_read(&cache_block->ncb_block, block_off, chunk_sz,
+                                   dptr + dst_off);
         if (rc != 0) {
             return rc;
         }
@@ -851,9 +1314,61 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
     return 0;
 }
 
+/**
+ * Reads ahead of a sequential reader.  The block containing the specified
+ * offset and the block following it are loaded into the data content cache,
+ * so that the reader's next request can be served from RAM.
+ *
+ * @param inode_entry           The file inode being read.
+ * @param offset                The file offset the next read will start at.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_read_ahead(struct nffs_inode_entry *inode_entry, uint32_t offset)
+{
+    struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_block *cache_block;
+    uint32_t next_offset;
+    int rc;
+
+    if (!nffs_cache_data_enabled() ||
+        offset >= inode_entry->nie_data_len) {
+
+        return 0;
+    }
+
+    rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_cache_seek(cache_inode, offset, &cache_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_cache_data_prefetch(&cache_block->ncb_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    next_offset = cache_block->ncb_file_offset +
+                  cache_block->ncb_block.nb_data_len;
+    if (next_offset >= inode_entry->nie_data_len) {
+        return 0;
+    }
+
+    rc = nffs_cache_seek(cache_inode, next_offset, &cache_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return nffs_cache_data_prefetch(&cache_block->ncb_block);
+}
+
 int
-nffs_inode_unlink_from_ram(struct nffs_inode *inode,
-                           struct nffs_hash_entry **out_next)
+nffs_inode_unlink_from_ram(struct nffs_inode *inode)
 {
     int rc;
 
@@ -861,12 +1376,10 @@ nffs_inode_unlink_from_ram(struct nffs_inode *inode,
         nffs_inode_remove_child(inode);
     }
 
-    if (nffs_hash_id_is_dir(inode->ni_inode_entry->nie_hash_entry.nhe_id)) {
-        nffs_inode_insert_unlink_list(inode->ni_inode_entry);
-        rc = nffs_inode_process_unlink_list(out_next);
-    } else {
-        rc = nffs_inode_dec_refcnt(inode->ni_inode_entry);
-    }
+    /* An inode that is still held open (e.g., a directory being read) remains
+     * in RAM until its last reference is released.
+     */
+    rc = nffs_inode_dec_refcnt(inode->ni_inode_entry);
     if (rc != 0) {
         return rc;
     }
@@ -900,7 +1413,7 @@ nffs_inode_unlink(struct nffs_inode *inode)
         return rc;
     }
 
-    rc = nffs_inode_unlink_from_ram(inode, NULL);
+    rc = nffs_inode_unlink_from_ram(inode);
     if (rc != 0) {
         return rc;
     }
@@ -0,0 +1,429 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * A small LZ77 codec for compressed data blocks.  The stream format follows
+ * LZ4's block format: a sequence of
+ *
+ *     token      (high nibble: literal count; low nibble: match length - 4)
+ *     [literal count extension bytes]
+ *     literals
+ *     offset     (16 bits, little endian; absent in the final sequence)
+ *     [match length extension bytes]
+ *
+ * A nibble value of 15 is followed by extension bytes which are added to it;
+ * each extension byte of 255 is followed by another.  The final sequence
+ * contains only literals and ends with the input.
+ *
+ * The compressor's only working memory is a fixed hash table of recent
+ * positions (NFFS_LZ_HASH_SIZE entries), so compression needs no heap beyond
+ * the output buffer.  Decompression needs no working memory at all; a stream
+ * in flash is read in small pieces rather than all at once.
+ */
+
+#include <string.h>
+#include "nffs/nffs.h"
+#include "nffs_priv.h"
+
+#define NFFS_LZ_MIN_MATCH       4
+#define NFFS_LZ_HASH_BITS       9
+#define NFFS_LZ_HASH_SIZE       (1 << NFFS_LZ_HASH_BITS)
+#define NFFS_LZ_MAX_OFFSET      0xffff
+
+/** Position + 1 of the last occurrence of each hashed 4-byte sequence. */
+static uint16_t nffs_lz_hash_tbl[NFFS_LZ_HASH_SIZE];
+
+static int
+nffs_lz_hash(const uint8_t *p)
+{
+    uint32_t val;
+
+    val = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (val * 2654435761u) >> (32 - NFFS_LZ_HASH_BITS);
+}
+
+/**
+ * Writes a length extension: a series of 255s followed by the remainder.
+ *
+ * @return                      The new output offset;
+ *                              -1 if the output buffer is too small.
+ */
+static int
+nffs_lz_put_len(uint8_t *dst, int dst_off, int dst_cap, int len)
+{
+    while (len >= 255) {
+        if (dst_off >= dst_cap) {
+            return -1;
+        }
+        dst[dst_off++] = 255;
+        len -= 255;
+    }
+    if (dst_off >= dst_cap) {
+        return -1;
+    }
+    dst[dst_off++] = len;
+
+    return dst_off;
+}
+
+/**
+ * Writes a single sequence.  A match_len of 0 indicates the final sequence,
+ * which has no match.
+ *
+ * @return                      The new output offset;
+ *                              -1 if the output buffer is too small.
+ */
+static int
+nffs_lz_put_seq(uint8_t *dst, int dst_off, int dst_cap,
+                const uint8_t *lits, int lit_len, int offset, int match_len)
+{
+    uint8_t token;
+    int token_off;
+
+    token_off = dst_off;
+    if (dst_off >= dst_cap) {
+        return -1;
+    }
+    dst_off++;
+
+    if (lit_len >= 15) {
+        token = 15 << 4;
+        dst_off = nffs_lz_put_len(dst, dst_off, dst_cap, lit_len - 15);
+        if (dst_off == -1) {
+            return -1;
+        }
+    } else {
+        token = lit_len << 4;
+    }
+
+    if (dst_off + lit_len > dst_cap) {
+        return -1;
+    }
+    memcpy(dst + dst_off, lits, lit_len);
+    dst_off += lit_len;
+
+    if (match_len != 0) {
+        if (dst_off + 2 > dst_cap) {
+            return -1;
+        }
+        dst[dst_off++] = offset;
+        dst[dst_off++] = offset >> 8;
+
+        match_len -= NFFS_LZ_MIN_MATCH;
+        if (match_len >= 15) {
+            token |= 15;
+            dst_off = nffs_lz_put_len(dst, dst_off, dst_cap, match_len - 15);
+            if (dst_off == -1) {
+                return -1;
+            }
+        } else {
+            token |= match_len;
+        }
+    }
+
+    dst[token_off] = token;
+
+    return dst_off;
+}
+
+/**
+ * Compresses a buffer.
+ *
+ * @param src                   The data to compress.
+ * @param src_len               The length of the data to compress.
+ * @param dst                   The compressed stream gets written here.
+ * @param dst_cap               The size of the destination buffer.
+ *
+ * @return                      The length of the compressed stream;
+ *                              -1 if it does not fit in dst_cap bytes.
+ */
+int
+nffs_lz_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap)
+{
+    int match_len;
+    int anchor;
+    int dst_off;
+    int ref;
+    int ip;
+    int h;
+
+    memset(nffs_lz_hash_tbl, 0, sizeof nffs_lz_hash_tbl);
+
+    dst_off = 0;
+    anchor = 0;
+    ip = 0;
+    while (ip + NFFS_LZ_MIN_MATCH <= src_len) {
+        h = nffs_lz_hash(src + ip);
+        ref = nffs_lz_hash_tbl[h] - 1;
+        nffs_lz_hash_tbl[h] = ip + 1;
+
+        if (ref < 0 || ip - ref > NFFS_LZ_MAX_OFFSET ||
+            memcmp(src + ref, src + ip, NFFS_LZ_MIN_MATCH) != 0) {
+
+            ip++;
+            continue;
+        }
+
+        match_len = NFFS_LZ_MIN_MATCH;
+        while (ip + match_len < src_len &&
+               src[ref + match_len] == src[ip + match_len]) {
+
+            match_len++;
+        }
+
+        dst_off = nffs_lz_put_seq(dst, dst_off, dst_cap, src + anchor,
+                                  ip - anchor, ip - ref, match_len);
+        if (dst_off == -1) {
+            return -1;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    return nffs_lz_put_seq(dst, dst_off, dst_cap, src + anchor,
+                           src_len - anchor, 0, 0);
+}
+
+/** Input side of the decompressor: a buffer, optionally refilled from flash. */
+struct nffs_lz_in {
+    const uint8_t *buf;     /* Buffered stream bytes. */
+    int buf_len;            /* Number of bytes in buf. */
+    int buf_off;            /* Offset of the next unread byte in buf. */
+    int flash_left;         /* Stream bytes still in flash. */
+    uint32_t area_offset;   /* Flash location of the bytes still in flash. */
+    uint8_t area_idx;
+};
+
+/**
+ * Ensures at least one unread stream byte is buffered, refilling the buffer
+ * from flash if necessary.
+ *
+ * @return                      0 on success;
+ *                              FS_ECORRUPT if the stream is exhausted;
+ *                              other nonzero on flash read failure.
+ */
+static int
+nffs_lz_in_fill(struct nffs_lz_in *in)
+{
+    int chunk_len;
+    int rc;
+
+    if (in->buf_off < in->buf_len) {
+        return 0;
+    }
+    if (in->flash_left == 0) {
+        return FS_ECORRUPT;
+    }
+
+    chunk_len = in->flash_left;
+    if (chunk_len > sizeof nffs_flash_buf) {
+        chunk_len = sizeof nffs_flash_buf;
+    }
+    rc = nffs_flash_read(in->area_idx, in->area_offset, nffs_flash_buf,
+                         chunk_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    in->buf = nffs_flash_buf;
+    in->buf_len = chunk_len;
+    in->buf_off = 0;
+    in->area_offset += chunk_len;
+    in->flash_left -= chunk_len;
+
+    return 0;
+}
+
+static int
+nffs_lz_in_byte(struct nffs_lz_in *in, uint8_t *out_byte)
+{
+    int rc;
+
+    rc = nffs_lz_in_fill(in);
+    if (rc != 0) {
+        return rc;
+    }
+    *out_byte = in->buf[in->buf_off++];
+
+    return 0;
+}
+
+static int
+nffs_lz_in_copy(struct nffs_lz_in *in, uint8_t *dst, int len)
+{
+    int chunk_len;
+    int rc;
+
+    while (len > 0) {
+        rc = nffs_lz_in_fill(in);
+        if (rc != 0) {
+            return rc;
+        }
+
+        chunk_len = in->buf_len - in->buf_off;
+        if (chunk_len > len) {
+            chunk_len = len;
+        }
+        memcpy(dst, in->buf + in->buf_off, chunk_len);
+        in->buf_off += chunk_len;
+        dst += chunk_len;
+        len -= chunk_len;
+    }
+
+    return 0;
+}
+
+static int
+nffs_lz_get_len(struct nffs_lz_in *in, int *len)
+{
+    uint8_t b;
+    int rc;
+
+    do {
+        rc = nffs_lz_in_byte(in, &b);
+        if (rc != 0) {
+            return rc;
+        }
+        *len += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+static int
+nffs_lz_decode(struct nffs_lz_in *in, uint8_t *dst, int dst_len)
+{
+    uint8_t token;
+    uint8_t b[2];
+    int match_len;
+    int lit_len;
+    int dst_off;
+    int offset;
+    int rc;
+
+    dst_off = 0;
+    while (dst_off < dst_len) {
+        rc = nffs_lz_in_byte(in, &token);
+        if (rc != 0) {
+            return rc;
+        }
+
+        lit_len = token >> 4;
+        if (lit_len == 15) {
+            rc = nffs_lz_get_len(in, &lit_len);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        if (lit_len > dst_len - dst_off) {
+            lit_len = dst_len - dst_off;
+        }
+        rc = nffs_lz_in_copy(in, dst + dst_off, lit_len);
+        if (rc != 0) {
+            return rc;
+        }
+        dst_off += lit_len;
+
+        if (dst_off == dst_len) {
+            break;
+        }
+        rc = nffs_lz_in_copy(in, b, sizeof b);
+        if (rc != 0) {
+            return rc;
+        }
+        offset = b[0] | (b[1] << 8);
+        if (offset == 0 || offset > dst_off) {
+            return FS_ECORRUPT;
+        }
+
+        match_len = token & 0x0f;
+        if (match_len == 15) {
+            rc = nffs_lz_get_len(in, &match_len);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        match_len += NFFS_LZ_MIN_MATCH;
+        if (match_len > dst_len - dst_off) {
+            match_len = dst_len - dst_off;
+        }
+
+        /* Matches may overlap their own output; copy a byte at a time. */
+        while (match_len-- > 0) {
+            dst[dst_off] = dst[dst_off - offset];
+            dst_off++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Decompresses a stream produced by nffs_lz_compress().  Decompression stops
+ * once dst_len bytes have been produced, so a prefix of the original data can
+ * be recovered without decompressing the rest.
+ *
+ * @param src                   The compressed stream.
+ * @param src_len               The length of the compressed stream.
+ * @param dst                   The decompressed data gets written here.
+ * @param dst_len               The number of bytes to produce.
+ *
+ * @return                      0 on success;
+ *                              FS_ECORRUPT if the stream is malformed or
+ *                                  decompresses to fewer than dst_len bytes.
+ */
+int
+nffs_lz_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_len)
+{
+    struct nffs_lz_in in = {
+        .buf = src,
+        .buf_len = src_len,
+    };
+
+    return nffs_lz_decode(&in, dst, dst_len);
+}
+
+/**
+ * Decompresses a stream stored in flash.  The stream is read through
+ * nffs_flash_buf a piece at a time, so no buffer is needed for it.
+ *
+ * @param area_idx              The index of the area containing the stream.
+ * @param area_offset           The area offset of the start of the stream.
+ * @param src_len               The length of the compressed stream.
+ * @param dst                   The decompressed data gets written here.
+ * @param dst_len               The number of bytes to produce.
+ *
+ * @return                      0 on success;
+ *                              FS_ECORRUPT if the stream is malformed or
+ *                                  decompresses to fewer than dst_len bytes;
+ *                              other nonzero on flash read failure.
+ */
+int
+nffs_lz_decompress_flash(uint8_t area_idx, uint32_t area_offset, int src_len,
+                         uint8_t *dst, int dst_len)
+{
+    struct nffs_lz_in in = {
+        .flash_left = src_len,
+        .area_offset = area_offset,
+        .area_idx = area_idx,
+    };
+
+    return nffs_lz_decode(&in, dst, dst_len);
+}
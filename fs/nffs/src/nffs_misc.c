@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "os/os_malloc.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
@@ -138,9 +139,12 @@ nffs_misc_reserve_space(uint16_t space,
     int rc;
     int i;
 
-    /* Find the first area with sufficient free space. */
+    /* Find the first area with sufficient free space.  An area that is in the
+     * middle of an incremental garbage collection cycle is about to be erased;
+     * don't write anything new to it.
+     */
     for (i = 0; i < nffs_num_areas; i++) {
-        if (i != nffs_scratch_area_idx) {
+        if (i != nffs_scratch_area_idx && i != nffs_gc_incr_area_idx) {
             rc = nffs_misc_reserve_space_area(i, space, out_area_offset);
             if (rc == 0) {
                 *out_area_idx = i;
@@ -210,14 +214,33 @@ nffs_misc_area_capacity_two(uint32_t area_length)
            sizeof (struct nffs_disk_block);
 }
 
+/**
+ * @return                      The configured maximum block data length,
+ *                                  capped at NFFS_BLOCK_MAX_DATA_SZ_MAX.
+ *                                  Buffers that must hold a whole block are
+ *                                  sized with this.
+ */
+uint32_t
+nffs_misc_cfg_block_max_data_sz(void)
+{
+    if (nffs_config.nc_block_max_data_sz > NFFS_BLOCK_MAX_DATA_SZ_MAX) {
+        return NFFS_BLOCK_MAX_DATA_SZ_MAX;
+    }
+    return nffs_config.nc_block_max_data_sz;
+}
+
 /**
  * Calculates and sets the maximum block data length that the system supports.
  * The result of the calculation is the greatest number which satisfies all of
  * the following restrictions:
  *     o No more than half the size of the smallest area.
- *     o No more than 2048.
+ *     o No more than the configured maximum (nc_block_max_data_sz).
+ *     o No more than 2048 if any area is in the version 0 format.
  *     o No smaller than the data length of any existing data block.
  *
+ * This also determines whether compressed blocks may be written; they are
+ * only written once every area is in the current format.
+ *
  * @param min_size              The minimum allowed data length.  This is the
  *                                  data length of the largest block currently
  *                                  in the file system.
@@ -229,13 +252,29 @@ nffs_misc_set_max_block_data_len(uint16_t min_data_len)
 {
     uint32_t smallest_area;
     uint32_t half_smallest;
+    uint32_t limit;
     int i;
 
+    limit = nffs_misc_cfg_block_max_data_sz();
+    nffs_block_lz_ok = 1;
+
     smallest_area = -1;
     for (i = 0; i < nffs_num_areas; i++) {
         if (nffs_areas[i].na_length < smallest_area) {
             smallest_area = nffs_areas[i].na_length;
         }
+
+        /* Older code may not be able to read large blocks. */
+        if (nffs_areas[i].na_ver == NFFS_AREA_VER_0 &&
+            limit > NFFS_BLOCK_MAX_DATA_SZ_V0) {
+
+            limit = NFFS_BLOCK_MAX_DATA_SZ_V0;
+        }
+
+        /* Older code cannot read compressed blocks. */
+        if (nffs_areas[i].na_ver < NFFS_AREA_VER) {
+            nffs_block_lz_ok = 0;
+        }
     }
 
     /* Don't allow a data block size bigger than the smallest area. */
@@ -244,10 +283,10 @@ nffs_misc_set_max_block_data_len(uint16_t min_data_len)
     }
 
     half_smallest = nffs_misc_area_capacity_two(smallest_area);
-    if (half_smallest < NFFS_BLOCK_MAX_DATA_SZ_MAX) {
+    if (half_smallest < limit) {
         nffs_block_max_data_sz = half_smallest;
     } else {
-        nffs_block_max_data_sz = NFFS_BLOCK_MAX_DATA_SZ_MAX;
+        nffs_block_max_data_sz = limit;
     }
 
     if (nffs_block_max_data_sz < min_data_len) {
@@ -286,8 +325,10 @@ int
 nffs_misc_reset(void)
 {
     int rc;
+    int i;
 
     nffs_cache_clear();
+    nffs_cache_data_clear();
 
     rc = os_mempool_init(&nffs_file_pool, nffs_config.nc_num_files,
                          sizeof (struct nffs_file), nffs_file_mem,
@@ -326,6 +367,28 @@ nffs_misc_reset(void)
         return FS_EOS;
     }
 
+    if (nffs_config.nc_num_cache_names > 0) {
+        rc = os_mempool_init(&nffs_cache_name_pool,
+                             nffs_config.nc_num_cache_names,
+                             sizeof (struct nffs_cache_name),
+                             nffs_cache_name_mem, "nffs_cache_name_pool");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    }
+
+    if (nffs_cache_data_mem != NULL) {
+        rc = os_mempool_init(&nffs_cache_data_pool,
+                             nffs_cache_data_num_entries(),
+                             nffs_cache_data_entry_sz(),
+                             nffs_cache_data_mem, "nffs_cache_data_pool");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    } else {
+        memset(&nffs_cache_data_pool, 0, sizeof nffs_cache_data_pool);
+    }
+
     rc = os_mempool_init(&nffs_dir_pool,
                          nffs_config.nc_num_dirs,
                          sizeof (struct nffs_dir),
@@ -334,6 +397,12 @@ nffs_misc_reset(void)
         return FS_EOS;
     }
 
+    /* All file handles have been invalidated; detach them from their locks. */
+    for (i = 0; i < nffs_config.nc_num_files; i++) {
+        nffs_file_locks[i].nfl_inode_entry = NULL;
+        nffs_file_locks[i].nfl_refcnt = 0;
+    }
+
     rc = nffs_hash_init();
     if (rc != 0) {
         return rc;
@@ -346,6 +415,7 @@ nffs_misc_reset(void)
     nffs_root_dir = NULL;
     nffs_lost_found_dir = NULL;
     nffs_scratch_area_idx = NFFS_AREA_ID_NONE;
+    nffs_gc_incr_area_idx = NFFS_AREA_ID_NONE;
 
     nffs_hash_next_file_id = NFFS_ID_FILE_MIN;
     nffs_hash_next_dir_id = NFFS_ID_DIR_MIN;
@@ -70,23 +70,34 @@ nffs_path_find_child(struct nffs_inode_entry *parent,
                      const char *name, int name_len,
                      struct nffs_inode_entry **out_inode_entry)
 {
+    struct nffs_cache_name *cache_name;
     struct nffs_inode_entry *cur;
-    struct nffs_inode inode;
+    uint8_t hash;
     int cmp;
     int rc;
 
-    SLIST_FOREACH(cur, &parent->nie_child_list, nie_sibling_next) {
-        rc = nffs_inode_from_entry(&inode, cur);
-        if (rc != 0) {
-            return rc;
+    hash = nffs_inode_name_hash(name, name_len);
+
+    NFFS_INODE_FOREACH_CHILD(parent, cur) {
+        /* A child with a different hash cannot have the requested name. */
+        if (cur->nie_name_hash != hash) {
+            continue;
         }
 
-        rc = nffs_inode_filename_cmp_ram(&inode, name, name_len, &cmp);
+        rc = nffs_inode_filename_cmp_entry(cur, name, name_len, &cmp);
         if (rc != 0) {
             return rc;
         }
 
         if (cmp == 0) {
+            /* Remember the name so that the next lookup avoids flash. */
+            if (nffs_config.nc_num_cache_names > 0) {
+                rc = nffs_cache_name_ensure(&cache_name, cur);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+
             *out_inode_entry = cur;
             return 0;
         }
@@ -23,10 +23,14 @@
 #include <inttypes.h>
 #include "os/queue.h"
 #include "os/os_mempool.h"
+#include "os/os_mutex.h"
+#include "os/os_mbuf.h"
 #include "nffs/nffs.h"
 #include "fs/fs.h"
 
-#define NFFS_HASH_SIZE               256
+/** Handle value that refers to no entry. */
+#define NFFS_HANDLE_NONE             0
+#define NFFS_HANDLE_MAX              0xffff
 
 #define NFFS_ID_DIR_MIN              0
 #define NFFS_ID_DIR_MAX              0x10000000
@@ -43,23 +47,35 @@
 #define NFFS_AREA_MAGIC2             0xace08253
 #define NFFS_AREA_MAGIC3             0xb185fc8e
 #define NFFS_BLOCK_MAGIC             0x53ba23b9
+#define NFFS_BLOCK_MAGIC_LZ          0x53ba23ba
 #define NFFS_INODE_MAGIC             0x925f8bc0
 
 #define NFFS_AREA_ID_NONE            0xff
-#define NFFS_AREA_VER                0
+/**
+ * On-disk format version.  Version 0 areas hold blocks of at most
+ * NFFS_BLOCK_MAX_DATA_SZ_V0 bytes; version 1 lifts that limit.  Version 2
+ * adds compressed blocks (NFFS_BLOCK_MAGIC_LZ).
+ */
+#define NFFS_AREA_VER_0              0
+#define NFFS_AREA_VER_1              1
+#define NFFS_AREA_VER                2
 #define NFFS_AREA_OFFSET_ID          23
 
 #define NFFS_SHORT_FILENAME_LEN      3
 
-#define NFFS_BLOCK_MAX_DATA_SZ_MAX   2048
+#define NFFS_BLOCK_MAX_DATA_SZ_V0    2048
+#define NFFS_BLOCK_MAX_DATA_SZ_MAX   32768   /* Object sizes fit in 16 bits. */
+
+/** An area this many erases below average is rotated regardless of garbage. */
+#define NFFS_GC_WEAR_THRESHOLD       32
 
 /** On-disk representation of an area header. */
 struct nffs_disk_area {
     uint32_t nda_magic[4];  /* NFFS_AREA_MAGIC{0,1,2,3} */
     uint32_t nda_length;    /* Total size of area, in bytes. */
-    uint8_t nda_ver;        /* Current nffs version: 0 */
+    uint8_t nda_ver;        /* Current nffs version: 2 */
     uint8_t nda_gc_seq;     /* Garbage collection count. */
-    uint8_t reserved8;
+    uint8_t nda_gc_seq_hi;  /* Upper byte of 16-bit erase count. */
     uint8_t nda_id;         /* 0xff if scratch area. */
 };
 
@@ -88,34 +104,36 @@ struct nffs_disk_block {
                                NFFS_ID_NONE if this is the first block. */
     uint16_t ndb_data_len;  /* Length of data contents, in bytes. */
     uint16_t ndb_crc16;     /* Covers rest of header and data. */
-    /* Followed by 'ndb_data_len' bytes of data. */
+    /* Followed by 'ndb_data_len' bytes of data.  If the magic is
+     * NFFS_BLOCK_MAGIC_LZ, the data is a 16-bit uncompressed length followed
+     * by an nffs_lz stream.
+     */
 };
 
 #define NFFS_DISK_BLOCK_OFFSET_CRC  20
 
 /**
  * What gets stored in the hash table.  Each entry represents a data block or
- * an inode.
+ * an inode.  Entries are referred to by 16-bit handles rather than pointers
+ * (see nffs_hash.c); a data block entry consists of nothing more than this.
  */
 struct nffs_hash_entry {
-    SLIST_ENTRY(nffs_hash_entry) nhe_next;
     uint32_t nhe_id;        /* 0 - 0x7fffffff if inode; else if block. */
     uint32_t nhe_flash_loc; /* Upper-byte = area idx; rest = area offset. */
 };
 
-
-SLIST_HEAD(nffs_hash_list, nffs_hash_entry);
-SLIST_HEAD(nffs_inode_list, nffs_inode_entry);
-
 /** Each inode hash entry is actually one of these. */
 struct nffs_inode_entry {
     struct nffs_hash_entry nie_hash_entry;
-    SLIST_ENTRY(nffs_inode_entry) nie_sibling_next;
+    uint16_t nie_sibling_next;              /* Handle of next sibling. */
     union {
-        struct nffs_inode_list nie_child_list;           /* If directory */
-        struct nffs_hash_entry *nie_last_block_entry;    /* If file */
+        uint16_t nie_first_child;           /* If directory; handle. */
+        uint16_t nie_last_block;            /* If file; handle. */
     };
+    uint32_t nie_data_len;      /* If file; sum of block data lengths. */
+    uint16_t nie_block_cnt;     /* If file; number of blocks in chain. */
     uint8_t nie_refcnt;
+    uint8_t nie_name_hash;      /* Filename hash; for lookups in parent. */
 };
 
 /** Full inode representation; not stored permanently RAM. */
@@ -135,13 +153,34 @@ struct nffs_block {
                                                 supersedes lesser. */
     struct nffs_inode_entry *nb_inode_entry; /* Owning inode. */
     struct nffs_hash_entry *nb_prev;         /* Previous block in file. */
-    uint16_t nb_data_len;                    /* # of data bytes in block. */
-    uint16_t reserved16;
+    uint16_t nb_data_len;                    /* # of data bytes in block;
+                                                uncompressed. */
+    uint16_t nb_disk_len;                    /* # of data bytes on disk. */
+    uint8_t nb_flags;                        /* NFFS_BLOCK_F_[...] */
+};
+
+#define NFFS_BLOCK_F_LZ              0x01    /* Data is compressed. */
+
+/** Size of the uncompressed length prefix of a compressed block's data. */
+#define NFFS_BLOCK_LZ_HDR_SZ         2
+
+/**
+ * Serializes data I/O on a single file.  Every open handle to the same file
+ * shares one of these; a read or write holds it for the duration of the call,
+ * while the index lock is only held for one block at a time.
+ */
+struct nffs_file_lock {
+    struct os_mutex nfl_mutex;
+    struct nffs_inode_entry *nfl_inode_entry;  /* Null if slot is free. */
+    uint8_t nfl_refcnt;                        /* # of attached handles. */
 };
 
 struct nffs_file {
+    const struct fs_ops *nf_fops;   /* Must be first; see FS_HANDLE_OPS. */
     struct nffs_inode_entry *nf_inode_entry;
+    struct nffs_file_lock *nf_lock;
     uint32_t nf_offset;
+    uint32_t nf_read_end;       /* End of previous read; for read-ahead. */
     uint8_t nf_access_flags;
 };
 
@@ -149,9 +188,12 @@ struct nffs_area {
     uint32_t na_offset;
     uint32_t na_length;
     uint32_t na_cur;
+    uint32_t na_obsolete;   /* Bytes occupied by superseded objects. */
     uint16_t na_id;
     uint8_t na_gc_seq;
+    uint8_t na_gc_seq_hi;
     uint8_t na_flash_id;
+    uint8_t na_ver;         /* On-disk format version of the area header. */
 };
 
 struct nffs_disk_object {
@@ -199,14 +241,36 @@ struct nffs_cache_inode {
     TAILQ_ENTRY(nffs_cache_inode) nci_link;        /* Sorted; LRU at tail. */
     struct nffs_inode nci_inode;                   /* Full inode. */
     struct nffs_cache_block_list nci_block_list;   /* List of cached blocks. */
-    uint32_t nci_file_size;                        /* Total file size. */
+};
+
+/** Represents a single cached filename. */
+struct nffs_cache_name {
+    TAILQ_ENTRY(nffs_cache_name) ncn_link;      /* Sorted; LRU at tail. */
+    struct nffs_inode_entry *ncn_inode_entry;   /* Owning inode. */
+    uint32_t ncn_flash_loc;                     /* Inode record name is from. */
+    uint16_t ncn_name_len;                      /* # chars in filename. */
+    char ncn_name[NFFS_FILENAME_MAX_LEN];       /* Full filename. */
+};
+
+/**
+ * Represents the cached contents of a single data block.  Data blocks are
+ * never modified in place, so the contents are identified by the location of
+ * the block's disk record.
+ */
+struct nffs_cache_data {
+    TAILQ_ENTRY(nffs_cache_data) ncd_link;      /* Sorted; LRU at tail. */
+    uint32_t ncd_flash_loc;                     /* Location of block record. */
+    uint16_t ncd_data_len;                      /* # of data bytes cached. */
+    uint8_t ncd_data[];                         /* Block contents. */
 };
 
 struct nffs_dirent {
+    const struct fs_ops *nde_fops;  /* Must be first; see FS_HANDLE_OPS. */
     struct nffs_inode_entry *nde_inode_entry;
 };
 
 struct nffs_dir {
+    const struct fs_ops *nd_fops;   /* Must be first; see FS_HANDLE_OPS. */
     struct nffs_inode_entry *nd_parent_inode_entry;
     struct nffs_dirent nd_dirent;
 };
@@ -216,6 +280,8 @@ extern void *nffs_block_entry_mem;
 extern void *nffs_inode_mem;
 extern void *nffs_cache_inode_mem;
 extern void *nffs_cache_block_mem;
+extern void *nffs_cache_name_mem;
+extern void *nffs_cache_data_mem;
 extern void *nffs_dir_mem;
 extern struct os_mempool nffs_file_pool;
 extern struct os_mempool nffs_dir_pool;
@@ -223,18 +289,30 @@ extern struct os_mempool nffs_inode_entry_pool;
 extern struct os_mempool nffs_block_entry_pool;
 extern struct os_mempool nffs_cache_inode_pool;
 extern struct os_mempool nffs_cache_block_pool;
+extern struct os_mempool nffs_cache_name_pool;
+extern struct os_mempool nffs_cache_data_pool;
+extern struct nffs_file_lock *nffs_file_locks;
 extern uint32_t nffs_hash_next_file_id;
 extern uint32_t nffs_hash_next_dir_id;
 extern uint32_t nffs_hash_next_block_id;
+extern uint16_t nffs_hash_max_inode_handle;
+extern uint16_t nffs_hash_max_handle;
 extern struct nffs_area *nffs_areas;
 extern uint8_t nffs_num_areas;
 extern uint8_t nffs_scratch_area_idx;
+extern uint8_t nffs_gc_incr_area_idx;
+extern uint32_t nffs_gc_cycle_cnt;
 extern uint16_t nffs_block_max_data_sz;
+extern uint8_t nffs_block_lz_ok;
+extern uint8_t *nffs_block_lz_buf;
+extern uint8_t *nffs_block_lz_raw;
 
 #define NFFS_FLASH_BUF_SZ        256
 extern uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
+extern uint32_t nffs_flash_bytes_written;
 
-extern struct nffs_hash_list *nffs_hash;
+extern uint16_t *nffs_hash;
+extern int nffs_hash_num_slots;
 extern struct nffs_inode_entry *nffs_root_dir;
 extern struct nffs_inode_entry *nffs_lost_found_dir;
 
@@ -244,6 +322,10 @@ int nffs_area_is_scratch(const struct nffs_disk_area *disk_area);
 void nffs_area_to_disk(const struct nffs_area *area,
                        struct nffs_disk_area *out_disk_area);
 uint32_t nffs_area_free_space(const struct nffs_area *area);
+uint32_t nffs_area_live_space(const struct nffs_area *area);
+uint16_t nffs_area_erase_cnt(const struct nffs_area *area);
+void nffs_area_add_obsolete(uint32_t flash_loc, uint32_t len);
+int nffs_area_calc_obsolete(void);
 int nffs_area_find_corrupt_scratch(uint16_t *out_good_idx,
                                    uint16_t *out_bad_idx);
 
@@ -252,9 +334,6 @@ struct nffs_hash_entry *nffs_block_entry_alloc(void);
 void nffs_block_entry_free(struct nffs_hash_entry *entry);
 int nffs_block_read_disk(uint8_t area_idx, uint32_t area_offset,
                          struct nffs_disk_block *out_disk_block);
-int nffs_block_write_disk(const struct nffs_disk_block *disk_block,
-                          const void *data,
-                          uint8_t *out_area_idx, uint32_t *out_area_offset);
 int nffs_block_delete_from_ram(struct nffs_hash_entry *entry);
 void nffs_block_delete_list_from_ram(struct nffs_block *first,
                                      struct nffs_block *last);
@@ -268,15 +347,34 @@ int nffs_block_from_hash_entry(struct nffs_block *out_block,
                                struct nffs_hash_entry *entry);
 int nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
                          uint16_t length, void *dst);
+int nffs_block_magic_is_valid(uint32_t magic);
+int nffs_block_lz_alloc(void);
 
 /* @cache */
 void nffs_cache_inode_delete(const struct nffs_inode_entry *inode_entry);
+void nffs_cache_inode_delete_blocks(
+    const struct nffs_inode_entry *inode_entry);
 int nffs_cache_inode_ensure(struct nffs_cache_inode **out_entry,
                             struct nffs_inode_entry *inode_entry);
 void nffs_cache_inode_range(const struct nffs_cache_inode *cache_inode,
                             uint32_t *out_start, uint32_t *out_end);
 int nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t to,
                     struct nffs_cache_block **out_cache_block);
+struct nffs_cache_name *
+nffs_cache_name_find(const struct nffs_inode_entry *inode_entry);
+int nffs_cache_name_ensure(struct nffs_cache_name **out_cache_name,
+                           struct nffs_inode_entry *inode_entry);
+void nffs_cache_name_delete(const struct nffs_inode_entry *inode_entry);
+uint32_t nffs_cache_data_entry_sz(void);
+int nffs_cache_data_num_entries(void);
+int nffs_cache_data_enabled(void);
+struct nffs_cache_data *nffs_cache_data_find(uint32_t flash_loc);
+int nffs_cache_data_read(const struct nffs_block *block, uint16_t offset,
+                         uint16_t length, void *dst);
+int nffs_cache_data_prefetch(const struct nffs_block *block);
+void nffs_cache_data_delete(uint32_t flash_loc);
+void nffs_cache_data_delete_area(uint8_t area_idx);
+void nffs_cache_data_clear(void);
 void nffs_cache_clear(void);
 
 /* @crc */
@@ -319,6 +417,8 @@ int nffs_format_full(const struct nffs_area_desc *area_descs);
 /* @gc */
 int nffs_gc(uint8_t *out_area_idx);
 int nffs_gc_until(uint32_t space, uint8_t *out_area_idx);
+int nffs_gc_incr_needed(void);
+int nffs_gc_incr_step(int *out_done);
 
 /* @flash */
 struct nffs_area *nffs_flash_find_area(uint16_t logical_id);
@@ -343,6 +443,9 @@ struct nffs_inode_entry *nffs_hash_find_inode(uint32_t id);
 struct nffs_hash_entry *nffs_hash_find_block(uint32_t id);
 void nffs_hash_insert(struct nffs_hash_entry *entry);
 void nffs_hash_remove(struct nffs_hash_entry *entry);
+struct nffs_hash_entry *nffs_hash_entry_from_handle(uint16_t handle);
+uint16_t nffs_hash_handle(const struct nffs_hash_entry *entry);
+struct nffs_hash_entry *nffs_hash_live_entry(uint16_t handle);
 int nffs_hash_init(void);
 
 /* @inode */
@@ -368,9 +471,20 @@ int nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
                           const char *filename, uint8_t area_idx,
                           uint32_t offset);
 int nffs_inode_dec_refcnt(struct nffs_inode_entry *inode_entry);
+int nffs_inode_prepend_child(struct nffs_inode_entry *parent,
+                             struct nffs_inode_entry *child);
+int nffs_inode_sort_children(struct nffs_inode_entry *dir);
 int nffs_inode_add_child(struct nffs_inode_entry *parent,
                          struct nffs_inode_entry *child);
 void nffs_inode_remove_child(struct nffs_inode *child);
+struct nffs_inode_entry *
+nffs_inode_first_child(const struct nffs_inode_entry *inode_entry);
+struct nffs_inode_entry *
+nffs_inode_next_sibling(const struct nffs_inode_entry *inode_entry);
+struct nffs_hash_entry *
+nffs_inode_last_block(const struct nffs_inode_entry *inode_entry);
+void nffs_inode_set_last_block(struct nffs_inode_entry *inode_entry,
+                               struct nffs_hash_entry *block_entry);
 int nffs_inode_is_root(const struct nffs_disk_inode *disk_inode);
 int nffs_inode_read_filename(struct nffs_inode_entry *inode_entry,
                              size_t max_len, char *out_name,
@@ -378,19 +492,32 @@ int nffs_inode_read_filename(struct nffs_inode_entry *inode_entry,
 int nffs_inode_filename_cmp_ram(const struct nffs_inode *inode,
                                 const char *name, int name_len,
                                 int *result);
+int nffs_inode_filename_cmp_entry(struct nffs_inode_entry *inode_entry,
+                                  const char *name, int name_len,
+                                  int *result);
+uint8_t nffs_inode_name_hash(const char *name, int name_len);
 int nffs_inode_filename_cmp_flash(const struct nffs_inode *inode1,
                                   const struct nffs_inode *inode2,
                                   int *result);
 int nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t len, void *data, uint32_t *out_len);
+int nffs_inode_read_ahead(struct nffs_inode_entry *inode_entry,
+                          uint32_t offset);
 int nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t length, struct nffs_seek_info *out_seek_info);
 int nffs_inode_from_entry(struct nffs_inode *out_inode,
                           struct nffs_inode_entry *entry);
-int nffs_inode_unlink_from_ram(struct nffs_inode *inode,
-                               struct nffs_hash_entry **out_next);
+int nffs_inode_unlink_from_ram(struct nffs_inode *inode);
 int nffs_inode_unlink(struct nffs_inode *inode);
 
+/* @lz */
+int nffs_lz_compress(const uint8_t *src, int src_len, uint8_t *dst,
+                     int dst_cap);
+int nffs_lz_decompress(const uint8_t *src, int src_len, uint8_t *dst,
+                       int dst_len);
+int nffs_lz_decompress_flash(uint8_t area_idx, uint32_t area_offset,
+                             int src_len, uint8_t *dst, int dst_len);
+
 /* @misc */
 int nffs_misc_reserve_space(uint16_t space,
                             uint8_t *out_area_idx, uint32_t *out_area_offset);
@@ -399,6 +526,7 @@ int nffs_misc_validate_root_dir(void);
 int nffs_misc_validate_scratch(void);
 int nffs_misc_create_lost_found_dir(void);
 int nffs_misc_set_max_block_data_len(uint16_t min_data_len);
+uint32_t nffs_misc_cfg_block_max_data_sz(void);
 int nffs_misc_reset(void);
 
 /* @path */
@@ -419,11 +547,23 @@ int nffs_restore_full(const struct nffs_area_desc *area_descs);
 
 /* @write */
 int nffs_write_to_file(struct nffs_file *file, const void *data, int len);
+int nffs_write_mbuf_to_file(struct nffs_file *file, const struct os_mbuf *om,
+                            uint32_t off, int len);
 
 
-#define NFFS_HASH_FOREACH(entry, i)                                      \
-    for ((i) = 0; (i) < NFFS_HASH_SIZE; (i)++)                 \
-        SLIST_FOREACH((entry), &nffs_hash[i], nhe_next)
+/**
+ * Iterates every entry in the hash table in handle order.  Entries may be
+ * inserted or removed during the iteration; an entry removed before its
+ * handle is reached is skipped.
+ */
+#define NFFS_HASH_FOREACH(entry, i)                                     \
+    for ((i) = 1; (i) <= nffs_hash_max_handle; (i)++)                   \
+        if (((entry) = nffs_hash_live_entry(i)) != NULL)
+
+#define NFFS_INODE_FOREACH_CHILD(parent, child)                         \
+    for ((child) = nffs_inode_first_child(parent);                      \
+         (child) != NULL;                                               \
+         (child) = nffs_inode_next_sibling(child))
 
 #define NFFS_FLASH_LOC_NONE  nffs_flash_loc(NFFS_AREA_ID_NONE, 0)
 
@@ -34,26 +34,32 @@
 static uint16_t nffs_restore_largest_block_data_len;
 
 /**
- * Checks that each block a chain of data blocks was properly restored.
+ * Checks that each block in a file's chain of data blocks was properly
+ * restored.  If the chain is intact, the inode's cached data length and block
+ * count are set to reflect the restored blocks.
  *
- * @param last_block_entry      The entry corresponding to the last block in
- *                                  the chain.
+ * @param inode_entry           The file inode whose block chain is to be
+ *                                  checked.
  *
  * @return                      0 if the block chain is OK;
  *                              FS_ECORRUPT if corruption is detected;
  *                              nonzero on other error.
  */
 static int
-nffs_restore_validate_block_chain(struct nffs_hash_entry *last_block_entry)
+nffs_restore_validate_block_chain(struct nffs_inode_entry *inode_entry)
 {
     struct nffs_disk_block disk_block;
     struct nffs_hash_entry *cur;
     struct nffs_block block;
     uint32_t area_offset;
+    uint32_t data_len;
+    uint16_t block_cnt;
     uint8_t area_idx;
     int rc;
 
-    cur = last_block_entry;
+    data_len = 0;
+    block_cnt = 0;
+    cur = nffs_inode_last_block(inode_entry);
 
     while (cur != NULL) {
         nffs_flash_loc_expand(cur->nhe_flash_loc, &area_idx, &area_offset);
@@ -68,9 +74,15 @@ nffs_restore_validate_block_chain(struct nffs_hash_entry *last_block_entry)
             return rc;
         }
 
+        data_len += block.nb_data_len;
+        block_cnt++;
+
         cur = block.nb_prev;
     }
 
+    inode_entry->nie_data_len = data_len;
+    inode_entry->nie_block_cnt = block_cnt;
+
     return 0;
 }
 
@@ -126,7 +138,7 @@ nffs_restore_migrate_orphan_children(struct nffs_inode_entry *inode_entry)
         return 0;
     }
 
-    if (SLIST_EMPTY(&inode_entry->nie_child_list)) {
+    if (inode_entry->nie_first_child == NFFS_HANDLE_NONE) {
         /* No children to migrate. */
         return 0;
     }
@@ -143,7 +155,7 @@ nffs_restore_migrate_orphan_children(struct nffs_inode_entry *inode_entry)
     }
 
     /* Move each child into the new subdirectory. */
-    while ((child_entry = SLIST_FIRST(&inode_entry->nie_child_list)) != NULL) {
+    while ((child_entry = nffs_inode_first_child(inode_entry)) != NULL) {
         rc = nffs_inode_rename(child_entry, lost_found_sub, NULL);
         if (rc != 0) {
             return rc;
@@ -194,8 +206,7 @@ nffs_restore_should_sweep_inode_entry(struct nffs_inode_entry *inode_entry,
      * present.
      */
     if (nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id)) {
-        rc = nffs_restore_validate_block_chain(
-                inode_entry->nie_last_block_entry);
+        rc = nffs_restore_validate_block_chain(inode_entry);
         if (rc == FS_ECORRUPT) {
             *out_should_sweep = 1;
             return 0;
@@ -236,8 +247,6 @@ nffs_restore_sweep(void)
 {
     struct nffs_inode_entry *inode_entry;
     struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *next;
-    struct nffs_hash_list *list;
     struct nffs_inode inode;
     int del;
     int rc;
@@ -246,53 +255,68 @@ nffs_restore_sweep(void)
     /* Iterate through every object in the hash table, deleting all inodes that
      * should be removed.
      */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        list = nffs_hash + i;
+    NFFS_HASH_FOREACH(entry, i) {
+        if (!nffs_hash_id_is_inode(entry->nhe_id)) {
+            continue;
+        }
+        inode_entry = (struct nffs_inode_entry *)entry;
 
-        entry = SLIST_FIRST(list);
-        while (entry != NULL) {
-            next = SLIST_NEXT(entry, nhe_next);
-            if (nffs_hash_id_is_inode(entry->nhe_id)) {
-                inode_entry = (struct nffs_inode_entry *)entry;
+        /* If this is a dummy inode directory, the file system is corrupted.
+         * Move the directory's children inodes to the lost+found directory.
+         */
+        rc = nffs_restore_migrate_orphan_children(inode_entry);
+        if (rc != 0) {
+            return rc;
+        }
 
-                /* If this is a dummy inode directory, the file system is
-                 * corrupted.  Move the directory's children inodes to the
-                 * lost+found directory.
-                 */
-                rc = nffs_restore_migrate_orphan_children(inode_entry);
-                if (rc != 0) {
-                    return rc;
-                }
+        /* Determine if this inode needs to be deleted. */
+        rc = nffs_restore_should_sweep_inode_entry(inode_entry, &del);
+        if (rc != 0) {
+            return rc;
+        }
+
+        if (del) {
+            if (inode_entry->nie_hash_entry.nhe_flash_loc ==
+                NFFS_FLASH_LOC_NONE) {
 
-                /* Determine if this inode needs to be deleted. */
-                rc = nffs_restore_should_sweep_inode_entry(inode_entry, &del);
+                nffs_restore_inode_from_dummy_entry(&inode, inode_entry);
+            } else {
+                rc = nffs_inode_from_entry(&inode, inode_entry);
                 if (rc != 0) {
                     return rc;
                 }
+            }
 
-                if (del) {
-                    if (inode_entry->nie_hash_entry.nhe_flash_loc ==
-                        NFFS_FLASH_LOC_NONE) {
-
-                        nffs_restore_inode_from_dummy_entry(&inode,
-                                                           inode_entry);
-                    } else {
-                        rc = nffs_inode_from_entry(&inode, inode_entry);
-                        if (rc != 0) {
-                            return rc;
-                        }
-                    }
-
-                    /* Remove the inode and all its children from RAM. */
-                    rc = nffs_inode_unlink_from_ram(&inode, &next);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                    next = SLIST_FIRST(list);
-                }
+            /* Remove the inode and all its children from RAM. */
+            rc = nffs_inode_unlink_from_ram(&inode);
+            if (rc != 0) {
+                return rc;
             }
+        }
+    }
 
-            entry = next;
+    return 0;
+}
+
+/**
+ * Sorts the children of every directory by name.  While areas are being read,
+ * inodes are added to their parents unsorted (see nffs_inode_prepend_child()).
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_restore_sort_dirs(void)
+{
+    struct nffs_hash_entry *entry;
+    int rc;
+    int i;
+
+    NFFS_HASH_FOREACH(entry, i) {
+        if (nffs_hash_id_is_dir(entry->nhe_id)) {
+            rc = nffs_inode_sort_children((struct nffs_inode_entry *)entry);
+            if (rc != 0) {
+                return rc;
+            }
         }
     }
 
@@ -465,7 +489,8 @@ nffs_restore_inode(const struct nffs_disk_inode *disk_inode, uint8_t area_idx,
                 }
             }
 
-            rc = nffs_inode_add_child(parent, inode_entry);
+            /* Directories are sorted once all areas have been read. */
+            rc = nffs_inode_prepend_child(parent, inode_entry);
             if (rc != 0) {
                 goto err;
             }
@@ -550,6 +575,7 @@ nffs_restore_block(const struct nffs_disk_block *disk_block, uint8_t area_idx,
                    uint32_t area_offset)
 {
     struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *last_entry;
     struct nffs_hash_entry *entry;
     struct nffs_block block;
     int do_replace;
@@ -605,10 +631,14 @@ nffs_restore_block(const struct nffs_disk_block *disk_block, uint8_t area_idx,
         }
     }
 
-    if (inode_entry->nie_last_block_entry == NULL ||
-        inode_entry->nie_last_block_entry->nhe_id == disk_block->ndb_prev_id) {
-
-        inode_entry->nie_last_block_entry = entry;
+    /* Block IDs increase along a file's chain: appended blocks get new IDs,
+     * while overwritten and collated blocks keep the ID of the block they
+     * replace.  The block with the greatest ID is therefore the last one,
+     * regardless of the order in which blocks are found in flash.
+     */
+    last_entry = nffs_inode_last_block(inode_entry);
+    if (last_entry == NULL || last_entry->nhe_id < disk_block->ndb_id) {
+        nffs_inode_set_last_block(inode_entry, entry);
     }
 
     nffs_hash_insert(entry);
@@ -618,10 +648,15 @@ nffs_restore_block(const struct nffs_disk_block *disk_block, uint8_t area_idx,
     }
 
     /* Make sure the maximum block data size is not set lower than the size of
-     * an existing block.
+     * an existing block.  A compressed block's uncompressed length is what
+     * counts.
      */
-    if (disk_block->ndb_data_len > nffs_restore_largest_block_data_len) {
-        nffs_restore_largest_block_data_len = disk_block->ndb_data_len;
+    rc = nffs_block_from_hash_entry_no_ptrs(&block, entry);
+    if (rc != 0) {
+        return rc;
+    }
+    if (block.nb_data_len > nffs_restore_largest_block_data_len) {
+        nffs_restore_largest_block_data_len = block.nb_data_len;
     }
 
     return 0;
@@ -698,6 +733,7 @@ nffs_restore_disk_object(int area_idx, uint32_t area_offset,
         break;
 
     case NFFS_BLOCK_MAGIC:
+    case NFFS_BLOCK_MAGIC_LZ:
         out_disk_object->ndo_type = NFFS_OBJECT_TYPE_BLOCK;
         rc = nffs_block_read_disk(area_idx, area_offset,
                                  &out_disk_object->ndo_disk_block);
@@ -798,7 +834,10 @@ nffs_restore_area_contents(int area_idx)
  * @param area_offset           The flash offset of the start of the area.
  *
  * @return                      0 on success;
- *                              nonzero on failure.
+ *                              FS_ECORRUPT if the area is not an nffs area;
+ *                              FS_EUNEXP if the area was written by a newer,
+ *                                  incompatible version of nffs;
+ *                              other nonzero on failure.
  */
 static int
 nffs_restore_detect_one_area(uint8_t flash_id, uint32_t area_offset,
@@ -816,6 +855,11 @@ nffs_restore_detect_one_area(uint8_t flash_id, uint32_t area_offset,
         return FS_ECORRUPT;
     }
 
+    /* Don't touch an area written in a format this code doesn't know. */
+    if (out_disk_area->nda_ver > NFFS_AREA_VER) {
+        return FS_EUNEXP;
+    }
+
     return 0;
 }
 
@@ -831,7 +875,6 @@ nffs_restore_corrupt_scratch(void)
 {
     struct nffs_inode_entry *inode_entry;
     struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *next;
     uint32_t area_offset;
     uint16_t good_idx;
     uint16_t bad_idx;
@@ -855,26 +898,18 @@ nffs_restore_corrupt_scratch(void)
     }
 
     /* Invalidate all objects resident in the bad area. */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        entry = SLIST_FIRST(&nffs_hash[i]);
-        while (entry != NULL) {
-            next = SLIST_NEXT(entry, nhe_next);
-
-            nffs_flash_loc_expand(entry->nhe_flash_loc,
-                                 &area_idx, &area_offset);
-            if (area_idx == bad_idx) {
-                if (nffs_hash_id_is_block(entry->nhe_id)) {
-                    rc = nffs_block_delete_from_ram(entry);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                } else {
-                    inode_entry = (struct nffs_inode_entry *)entry;
-                    inode_entry->nie_refcnt = 0;
+    NFFS_HASH_FOREACH(entry, i) {
+        nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+        if (area_idx == bad_idx) {
+            if (nffs_hash_id_is_block(entry->nhe_id)) {
+                rc = nffs_block_delete_from_ram(entry);
+                if (rc != 0) {
+                    return rc;
                 }
+            } else {
+                inode_entry = (struct nffs_inode_entry *)entry;
+                inode_entry->nie_refcnt = 0;
             }
-
-            entry = next;
         }
     }
 
@@ -970,7 +1005,10 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
             nffs_areas[cur_area_idx].na_length = area_descs[i].nad_length;
             nffs_areas[cur_area_idx].na_flash_id = area_descs[i].nad_flash_id;
             nffs_areas[cur_area_idx].na_gc_seq = disk_area.nda_gc_seq;
+            nffs_areas[cur_area_idx].na_gc_seq_hi = disk_area.nda_gc_seq_hi;
+            nffs_areas[cur_area_idx].na_ver = disk_area.nda_ver;
             nffs_areas[cur_area_idx].na_id = disk_area.nda_id;
+            nffs_areas[cur_area_idx].na_obsolete = 0;
 
             if (disk_area.nda_id == NFFS_AREA_ID_NONE) {
                 nffs_areas[cur_area_idx].na_cur = NFFS_AREA_OFFSET_ID;
@@ -1004,6 +1042,14 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
         goto err;
     }
 
+    /* Inodes were added to their parents in flash order; sort each directory
+     * before any paths are looked up.
+     */
+    rc = nffs_restore_sort_dirs();
+    if (rc != 0) {
+        goto err;
+    }
+
     /* Make sure the file system contains a valid root directory. */
     rc = nffs_misc_validate_root_dir();
     if (rc != 0) {
@@ -1029,6 +1075,12 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
         goto err;
     }
 
+    /* Determine how much garbage each area contains. */
+    rc = nffs_area_calc_obsolete();
+    if (rc != 0) {
+        goto err;
+    }
+
     return 0;
 
 err:
@@ -18,16 +18,337 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "testutil/testutil.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
 #include "crc16.h"
 
+/**
+ * The source of the data being written: either a flat buffer or a range of an
+ * mbuf chain.  Chain data is checksummed and written to flash directly from
+ * the chain's segments, so a block may be assembled from several segments.
+ */
+struct nffs_write_src {
+    const uint8_t *nws_data;        /* Flat buffer; null if chain. */
+    const struct os_mbuf *nws_om;   /* Mbuf chain; null if flat buffer. */
+    uint32_t nws_om_off;            /* Chain offset of the source's byte 0. */
+    uint8_t nws_compress;           /* 1 if blocks should be compressed. */
+};
+
+/**
+ * Locates a byte within a write source's mbuf chain.
+ *
+ * @param src                   The chain-backed source.
+ * @param src_off               The offset within the source.
+ * @param out_seg_off           On success, the offset of the byte within the
+ *                                  returned segment gets written here.
+ *
+ * @return                      The segment containing the specified byte.
+ */
+static const struct os_mbuf *
+nffs_write_src_seg(const struct nffs_write_src *src, uint32_t src_off,
+                   uint16_t *out_seg_off)
+{
+    const struct os_mbuf *om;
+    uint32_t off;
+
+    off = src->nws_om_off + src_off;
+    om = src->nws_om;
+    while (off >= om->om_len) {
+        off -= om->om_len;
+        om = SLIST_NEXT(om, om_next);
+        assert(om != NULL);
+    }
+
+    *out_seg_off = off;
+    return om;
+}
+
+/**
+ * Accumulates a range of a write source into a CRC16.
+ */
+static uint16_t
+nffs_write_src_crc16(uint16_t crc16, const struct nffs_write_src *src,
+                     uint32_t src_off, uint16_t len)
+{
+    const struct os_mbuf *om;
+    uint16_t seg_off;
+    uint16_t chunk_len;
+
+    if (src->nws_om == NULL) {
+        return crc16_ccitt(crc16, src->nws_data + src_off, len);
+    }
+
+    if (len == 0) {
+        return crc16;
+    }
+
+    om = nffs_write_src_seg(src, src_off, &seg_off);
+    while (len > 0) {
+        chunk_len = om->om_len - seg_off;
+        if (chunk_len > len) {
+            chunk_len = len;
+        }
+
+        crc16 = crc16_ccitt(crc16, om->om_data + seg_off, chunk_len);
+
+        len -= chunk_len;
+        seg_off = 0;
+        om = SLIST_NEXT(om, om_next);
+    }
+
+    return crc16;
+}
+
+/**
+ * Writes a range of a write source to flash.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_src_flash(const struct nffs_write_src *src, uint32_t src_off,
+                     uint16_t len, uint8_t area_idx, uint32_t area_offset)
+{
+    const struct os_mbuf *om;
+    uint16_t seg_off;
+    uint16_t chunk_len;
+    int rc;
+
+    if (src->nws_om == NULL) {
+        return nffs_flash_write(area_idx, area_offset, src->nws_data + src_off,
+                                len);
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    om = nffs_write_src_seg(src, src_off, &seg_off);
+    while (len > 0) {
+        chunk_len = om->om_len - seg_off;
+        if (chunk_len > len) {
+            chunk_len = len;
+        }
+
+        rc = nffs_flash_write(area_idx, area_offset, om->om_data + seg_off,
+                              chunk_len);
+        if (rc != 0) {
+            return rc;
+        }
+
+        area_offset += chunk_len;
+        len -= chunk_len;
+        seg_off = 0;
+        om = SLIST_NEXT(om, om_next);
+    }
+
+    return 0;
+}
+
+/**
+ * Copies a range of a write source into a flat buffer.
+ */
+static void
+nffs_write_src_copy(const struct nffs_write_src *src, uint32_t src_off,
+                    uint16_t len, uint8_t *dst)
+{
+    int rc;
+
+    if (src->nws_om == NULL) {
+        memcpy(dst, src->nws_data + src_off, len);
+    } else {
+        rc = os_mbuf_copydata(src->nws_om, src->nws_om_off + src_off, len,
+                              dst);
+        assert(rc == 0);
+    }
+}
+
+/**
+ * Compresses a block's worth of source data into nffs_block_lz_buf.  The
+ * result is the block's on-disk data: the uncompressed length followed by the
+ * compressed stream.  The scratch buffers must already be allocated.
+ *
+ * @param src                   The source of the block's data.
+ * @param src_off               The offset within the source of the data.
+ * @param len                   The uncompressed length of the data.
+ *
+ * @return                      The length of the compressed data; 0 if
+ *                                  compression would not save space.
+ */
+static uint16_t
+nffs_write_compress(const struct nffs_write_src *src, uint32_t src_off,
+                    uint16_t len)
+{
+    const uint8_t *raw;
+    int stream_len;
+
+    /* Not worth trying unless the stream can be smaller than the data. */
+    if (len <= NFFS_BLOCK_LZ_HDR_SZ + 1) {
+        return 0;
+    }
+
+    if (src->nws_om == NULL) {
+        raw = src->nws_data + src_off;
+    } else {
+        nffs_write_src_copy(src, src_off, len, nffs_block_lz_raw);
+        raw = nffs_block_lz_raw;
+    }
+
+    stream_len = nffs_lz_compress(raw, len,
+                                  nffs_block_lz_buf + NFFS_BLOCK_LZ_HDR_SZ,
+                                  len - NFFS_BLOCK_LZ_HDR_SZ - 1);
+    if (stream_len == -1) {
+        return 0;
+    }
+
+    nffs_block_lz_buf[0] = len;
+    nffs_block_lz_buf[1] = len >> 8;
+    return NFFS_BLOCK_LZ_HDR_SZ + stream_len;
+}
+
+/**
+ * Writes a new data block to flash.  If the source requests compression and
+ * the data compresses, the block is written in compressed form.  Compression
+ * is best effort: if its scratch buffers cannot be allocated, the block is
+ * written plain.
+ *
+ * @param disk_block            The header of the block to write; the ID,
+ *                                  sequence number, inode ID, and previous
+ *                                  block ID must already be filled in.  On
+ *                                  success, the remaining fields are filled
+ *                                  in.
+ * @param src                   The source of the block's data.
+ * @param src_off               The offset within the source of the data.
+ * @param len                   The uncompressed length of the data.
+ * @param out_area_idx          On success, the index of the area the block
+ *                                  was written to gets written here.
+ * @param out_area_offset       On success, the block's offset within the area
+ *                                  gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_block(struct nffs_disk_block *disk_block,
+                 const struct nffs_write_src *src, uint32_t src_off,
+                 uint16_t len, uint8_t *out_area_idx,
+                 uint32_t *out_area_offset)
+{
+    struct nffs_write_src lz_src;
+    uint16_t payload_len;
+    int rc;
+
+    payload_len = 0;
+    if (src->nws_compress && nffs_block_lz_ok &&
+        len <= nffs_misc_cfg_block_max_data_sz() &&
+        nffs_block_lz_alloc() == 0) {
+
+        payload_len = nffs_write_compress(src, src_off, len);
+    }
+
+    if (payload_len != 0) {
+        lz_src.nws_data = nffs_block_lz_buf;
+        lz_src.nws_om = NULL;
+        lz_src.nws_om_off = 0;
+        lz_src.nws_compress = 0;
+
+        src = &lz_src;
+        src_off = 0;
+        len = payload_len;
+        disk_block->ndb_magic = NFFS_BLOCK_MAGIC_LZ;
+    } else {
+        disk_block->ndb_magic = NFFS_BLOCK_MAGIC;
+    }
+
+    disk_block->ndb_data_len = len;
+    disk_block->ndb_crc16 = nffs_write_src_crc16(
+        nffs_crc_disk_block_hdr(disk_block), src, src_off, len);
+
+    rc = nffs_misc_reserve_space(sizeof *disk_block + len,
+                                 out_area_idx, out_area_offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_flash_write(*out_area_idx, *out_area_offset, disk_block,
+                          sizeof *disk_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_write_src_flash(src, src_off, len, *out_area_idx,
+                              *out_area_offset + sizeof *disk_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    ASSERT_IF_TEST(nffs_crc_disk_block_validate(disk_block, *out_area_idx,
+                                                *out_area_offset) == 0);
+
+    return 0;
+}
+
+/**
+ * Overwrites part of a data block by rewriting the block from RAM.  This is
+ * necessary when either the old or the new version of the block is
+ * compressed, since a compressed block's data cannot be copied piecewise
+ * between flash locations.  The block is rebuilt in nffs_block_lz_raw; the
+ * caller must ensure the scratch buffers are allocated and large enough.
+ *
+ * @param block                 The block being overwritten; its sequence
+ *                                  number has already been incremented.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_over_block_ram(struct nffs_block *block, uint16_t left_copy_len,
+                          uint16_t right_copy_len,
+                          const struct nffs_write_src *src, uint32_t src_off,
+                          uint16_t new_data_len, uint8_t *out_area_idx,
+                          uint32_t *out_area_offset)
+{
+    struct nffs_disk_block disk_block;
+    struct nffs_write_src flat_src;
+    uint16_t data_len;
+    uint8_t *data;
+    int rc;
+
+    data_len = left_copy_len + new_data_len + right_copy_len;
+    data = nffs_block_lz_raw;
+
+    rc = nffs_block_read_data(block, 0, left_copy_len, data);
+    if (rc != 0) {
+        return rc;
+    }
+    nffs_write_src_copy(src, src_off, new_data_len, data + left_copy_len);
+
+    /* If the new data extends the block, nothing follows it. */
+    if (right_copy_len > 0) {
+        rc = nffs_block_read_data(block, left_copy_len + new_data_len,
+                                  right_copy_len,
+                                  data + left_copy_len + new_data_len);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    nffs_block_to_disk(block, &disk_block);
+
+    flat_src.nws_data = data;
+    flat_src.nws_om = NULL;
+    flat_src.nws_om_off = 0;
+    flat_src.nws_compress = src->nws_compress;
+
+    return nffs_write_block(&disk_block, &flat_src, 0, data_len,
+                            out_area_idx, out_area_offset);
+}
+
 static int
 nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
                                 uint8_t src_area_idx, uint32_t src_area_offset,
                                 uint16_t left_copy_len, uint16_t right_copy_len,
-                                const void *new_data, uint16_t new_data_len)
+                                const struct nffs_write_src *src,
+                                uint32_t src_off, uint16_t new_data_len)
 {
     uint16_t block_off;
     uint16_t crc16;
@@ -53,7 +374,7 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
     /* Write the new data into the data block.  This may extend the block's
      * length beyond its old value.
      */
-    crc16 = crc16_ccitt(crc16, new_data, new_data_len);
+    crc16 = nffs_write_src_crc16(crc16, src, src_off, new_data_len);
     block_off += new_data_len;
 
     /* Copy data from the end of the old block, in case the new data doesn't
@@ -82,7 +403,8 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
  * @param entry                 The data block to overwrite.
  * @param left_copy_len         The number of bytes of existing data to retain
  *                                  before the new data begins.
- * @param new_data              The new data to write to the block.
+ * @param src                   The source of the new data.
+ * @param src_off               The offset within the source of the new data.
  * @param new_data_len          The number of new bytes to write to the block.
  *                                  If this value plus left_copy_len is less
  *                                  than the existing block's data length,
@@ -93,16 +415,20 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
  */
 static int
 nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
-                      const void *new_data, uint16_t new_data_len)
+                      const struct nffs_write_src *src, uint32_t src_off,
+                      uint16_t new_data_len)
 {
     struct nffs_disk_block disk_block;
     struct nffs_block block;
     uint32_t src_area_offset;
     uint32_t dst_area_offset;
     uint16_t right_copy_len;
+    uint16_t old_disk_len;
     uint16_t block_off;
+    uint16_t data_len;
     uint8_t src_area_idx;
     uint8_t dst_area_idx;
+    int use_ram;
     int rc;
 
     rc = nffs_block_from_hash_entry(&block, entry);
@@ -122,8 +448,41 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
         right_copy_len = block.nb_data_len - left_copy_len - new_data_len;
     }
 
+    old_disk_len = block.nb_disk_len;
     block.nb_seq++;
+
+    /* A compressed block can only be rebuilt in RAM.  A plain block is only
+     * rebuilt there to compress it, and only if the scratch buffers are
+     * available; otherwise it is copied on flash as usual.
+     */
+    data_len = left_copy_len + new_data_len + right_copy_len;
+    if (block.nb_flags & NFFS_BLOCK_F_LZ) {
+        if (data_len > nffs_misc_cfg_block_max_data_sz()) {
+            return FS_ENOMEM;
+        }
+        rc = nffs_block_lz_alloc();
+        if (rc != 0) {
+            return rc;
+        }
+        use_ram = 1;
+    } else {
+        use_ram = src->nws_compress && nffs_block_lz_ok &&
+                  data_len <= nffs_misc_cfg_block_max_data_sz() &&
+                  nffs_block_lz_alloc() == 0;
+    }
+
+    if (use_ram) {
+        rc = nffs_write_over_block_ram(&block, left_copy_len, right_copy_len,
+                                       src, src_off, new_data_len,
+                                       &dst_area_idx, &dst_area_offset);
+        if (rc != 0) {
+            return rc;
+        }
+        goto done;
+    }
+
     block.nb_data_len = left_copy_len + new_data_len + right_copy_len;
+    block.nb_disk_len = block.nb_data_len;
     nffs_block_to_disk(&block, &disk_block);
 
     nffs_flash_loc_expand(entry->nhe_flash_loc,
@@ -132,7 +491,7 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
     rc = nffs_write_fill_crc16_overwrite(&disk_block,
                                          src_area_idx, src_area_offset,
                                          left_copy_len, right_copy_len,
-                                         new_data, new_data_len);
+                                         src, src_off, new_data_len);
     if (rc != 0) {
         return rc;
     }
@@ -169,8 +528,8 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
     /* Write the new data into the data block.  This may extend the block's
      * length beyond its old value.
      */
-    rc = nffs_flash_write(dst_area_idx, dst_area_offset + block_off,
-                          new_data, new_data_len);
+    rc = nffs_write_src_flash(src, src_off, new_data_len,
+                              dst_area_idx, dst_area_offset + block_off);
     if (rc != 0) {
         return rc;
     }
@@ -191,11 +550,16 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
 
     assert(block_off == sizeof disk_block + block.nb_data_len);
 
-    entry->nhe_flash_loc = nffs_flash_loc(dst_area_idx, dst_area_offset);
-
     ASSERT_IF_TEST(nffs_crc_disk_block_validate(&disk_block, dst_area_idx,
                                                 dst_area_offset) == 0);
 
+done:
+    /* The old version of the block is now garbage. */
+    nffs_area_add_obsolete(entry->nhe_flash_loc,
+                           sizeof disk_block + old_disk_len);
+    nffs_cache_data_delete(entry->nhe_flash_loc);
+    entry->nhe_flash_loc = nffs_flash_loc(dst_area_idx, dst_area_offset);
+
     return 0;
 }
 
@@ -203,16 +567,19 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
  * Appends a new block to an inode block chain.
  *
  * @param inode_entry           The inode to append a block to.
- * @param data                  The contents of the new block.
+ * @param src                   The source of the new block's contents.
+ * @param src_off               The offset within the source of the data.
  * @param len                   The number of bytes of data to write.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
-nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
-                 uint16_t len)
+nffs_write_append(struct nffs_cache_inode *cache_inode,
+                  const struct nffs_write_src *src, uint32_t src_off,
+                  uint16_t len)
 {
     struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *last_entry;
     struct nffs_hash_entry *entry;
     struct nffs_disk_block disk_block;
     uint32_t area_offset;
@@ -226,19 +593,18 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
 
     inode_entry = cache_inode->nci_inode.ni_inode_entry;
 
-    disk_block.ndb_magic = NFFS_BLOCK_MAGIC;
     disk_block.ndb_id = nffs_hash_next_block_id++;
     disk_block.ndb_seq = 0;
     disk_block.ndb_inode_id = inode_entry->nie_hash_entry.nhe_id;
-    if (inode_entry->nie_last_block_entry == NULL) {
+    last_entry = nffs_inode_last_block(inode_entry);
+    if (last_entry == NULL) {
         disk_block.ndb_prev_id = NFFS_ID_NONE;
     } else {
-        disk_block.ndb_prev_id = inode_entry->nie_last_block_entry->nhe_id;
+        disk_block.ndb_prev_id = last_entry->nhe_id;
     }
-    disk_block.ndb_data_len = len;
-    nffs_crc_disk_block_fill(&disk_block, data);
 
-    rc = nffs_block_write_disk(&disk_block, data, &area_idx, &area_offset);
+    rc = nffs_write_block(&disk_block, src, src_off, len,
+                          &area_idx, &area_offset);
     if (rc != 0) {
         return rc;
     }
@@ -247,13 +613,14 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
     entry->nhe_flash_loc = nffs_flash_loc(area_idx, area_offset);
     nffs_hash_insert(entry);
 
-    inode_entry->nie_last_block_entry = entry;
+    nffs_inode_set_last_block(inode_entry, entry);
 
-    /* Update cached inode with the new file size. */
-    cache_inode->nci_file_size += len;
+    /* Update the inode with the new file size. */
+    inode_entry->nie_data_len += len;
+    inode_entry->nie_block_cnt++;
 
     /* Add appended block to the cache. */
-    nffs_cache_seek(cache_inode, cache_inode->nci_file_size - 1, NULL);
+    nffs_cache_seek(cache_inode, inode_entry->nie_data_len - 1, NULL);
 
     return 0;
 }
@@ -265,29 +632,38 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
  *
  * @param write_info            Describes the write operation being perfomred.
  * @param inode_entry           The file inode to write to.
- * @param data                  The new data to write.
+ * @param src                   The source of the new data.
+ * @param src_off               The offset within the source of the new data.
  * @param data_len              The number of bytes of new data to write.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
 nffs_write_chunk(struct nffs_cache_inode *cache_inode, uint32_t file_offset,
-                const void *data, uint16_t data_len)
+                 const struct nffs_write_src *src, uint32_t src_off,
+                 uint16_t data_len)
 {
+    struct nffs_inode_entry *inode_entry;
     struct nffs_cache_block *cache_block;
+    uint32_t gc_cycle_cnt;
+    uint32_t area_offset;
     uint32_t append_len;
     uint32_t data_offset;
     uint32_t block_end;
     uint32_t dst_off;
+    uint16_t new_block_len;
     uint16_t chunk_off;
     uint16_t chunk_sz;
+    uint8_t area_idx;
     int rc;
 
     assert(data_len <= nffs_block_max_data_sz);
 
+    inode_entry = cache_inode->nci_inode.ni_inode_entry;
+
     /** Handle the simple append case first. */
-    if (file_offset == cache_inode->nci_file_size) {
-        rc = nffs_write_append(cache_inode, data, data_len);
+    if (file_offset == inode_entry->nie_data_len) {
+        rc = nffs_write_append(cache_inode, src, src_off, data_len);
         return rc;
     }
 
@@ -295,64 +671,97 @@ nffs_write_chunk(struct nffs_cache_inode *cache_inode, uint32_t file_offset,
 
     dst_off = file_offset + data_len;
     data_offset = data_len;
-    cache_block = NULL;
 
-    if (dst_off > cache_inode->nci_file_size) {
-        append_len = dst_off - cache_inode->nci_file_size;
+    if (dst_off > inode_entry->nie_data_len) {
+        append_len = dst_off - inode_entry->nie_data_len;
     } else {
         append_len = 0;
     }
 
     do {
-        if (cache_block == NULL) {
+        /* Reserving space for the new version of the block may trigger
+         * garbage collection, which can move the block or collate it with its
+         * neighbors.  Make room before writing, and look the block up again
+         * if a collection cycle ran in the meantime.
+         */
+        do {
+            gc_cycle_cnt = nffs_gc_cycle_cnt;
+
             rc = nffs_cache_seek(cache_inode, dst_off - 1, &cache_block);
             if (rc != 0) {
                 return rc;
             }
-        }
 
-        if (cache_block->ncb_file_offset < file_offset) {
-            chunk_off = file_offset - cache_block->ncb_file_offset;
-        } else {
-            chunk_off = 0;
-        }
+            if (cache_block->ncb_file_offset < file_offset) {
+                chunk_off = file_offset - cache_block->ncb_file_offset;
+            } else {
+                chunk_off = 0;
+            }
 
-        chunk_sz = cache_block->ncb_block.nb_data_len - chunk_off;
-        block_end = cache_block->ncb_file_offset +
-                    cache_block->ncb_block.nb_data_len;
-        if (block_end != dst_off) {
-            chunk_sz += (int)(dst_off - block_end);
-        }
+            chunk_sz = cache_block->ncb_block.nb_data_len - chunk_off;
+            block_end = cache_block->ncb_file_offset +
+                        cache_block->ncb_block.nb_data_len;
+            if (block_end != dst_off) {
+                chunk_sz += (int)(dst_off - block_end);
+            }
+
+            new_block_len = chunk_off + chunk_sz;
+            if (new_block_len < cache_block->ncb_block.nb_data_len) {
+                new_block_len = cache_block->ncb_block.nb_data_len;
+            }
+
+            rc = nffs_misc_reserve_space(sizeof (struct nffs_disk_block) +
+                                         new_block_len,
+                                         &area_idx, &area_offset);
+            if (rc != 0) {
+                return rc;
+            }
+        } while (nffs_gc_cycle_cnt != gc_cycle_cnt);
 
         data_offset = cache_block->ncb_file_offset + chunk_off - file_offset;
         rc = nffs_write_over_block(cache_block->ncb_block.nb_hash_entry,
-                                   chunk_off, data + data_offset, chunk_sz);
+                                   chunk_off, src, src_off + data_offset,
+                                   chunk_sz);
         if (rc != 0) {
             return rc;
         }
 
+        /* The cached copy describes the superseded version of the block,
+         * whose length and encoding may differ from the new one's.
+         */
+        rc = nffs_block_from_hash_entry(&cache_block->ncb_block,
+                                        cache_block->ncb_block.nb_hash_entry);
+        if (rc != 0) {
+            return rc;
+        }
+
+        /* The file may have grown; the cache derives block offsets from the
+         * file length if it needs to be repopulated.
+         */
+        inode_entry->nie_data_len += append_len;
+        append_len = 0;
+
         dst_off -= chunk_sz;
-        cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list, ncb_link);
     } while (data_offset > 0);
 
-    cache_inode->nci_file_size += append_len;
     return 0;
 }
 
 /**
- * Writes a chunk of contiguous data to a file.
+ * Writes data from the specified source to a file.
  *
  * @param file                  The file to write to.
- * @param data                  The data to write.
+ * @param src                   The source of the data to write.
  * @param len                   The length of data to write.
  *
  * @return                      0 on success; nonzero on failure.
  */
-int
-nffs_write_to_file(struct nffs_file *file, const void *data, int len)
+static int
+nffs_write_src_to_file(struct nffs_file *file,
+                       const struct nffs_write_src *src, int len)
 {
     struct nffs_cache_inode *cache_inode;
-    const uint8_t *data_ptr;
+    uint32_t src_off;
     uint16_t chunk_size;
     int rc;
 
@@ -373,11 +782,11 @@ nffs_write_to_file(struct nffs_file *file, const void *data, int len)
      * seek position.
      */
     if (file->nf_access_flags & FS_ACCESS_APPEND) {
-        file->nf_offset = cache_inode->nci_file_size;
+        file->nf_offset = file->nf_inode_entry->nie_data_len;
     }
 
     /* Write data as a sequence of blocks. */
-    data_ptr = data;
+    src_off = 0;
     while (len > 0) {
         if (len > nffs_block_max_data_sz) {
             chunk_size = nffs_block_max_data_sz;
@@ -385,16 +794,64 @@ nffs_write_to_file(struct nffs_file *file, const void *data, int len)
             chunk_size = len;
         }
 
-        rc = nffs_write_chunk(cache_inode, file->nf_offset, data_ptr,
+        rc = nffs_write_chunk(cache_inode, file->nf_offset, src, src_off,
                               chunk_size);
         if (rc != 0) {
             return rc;
         }
 
         len -= chunk_size;
-        data_ptr += chunk_size;
+        src_off += chunk_size;
         file->nf_offset += chunk_size;
     }
 
     return 0;
 }
+
+/**
+ * Writes a chunk of contiguous data to a file.
+ *
+ * @param file                  The file to write to.
+ * @param data                  The data to write.
+ * @param len                   The length of data to write.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_write_to_file(struct nffs_file *file, const void *data, int len)
+{
+    struct nffs_write_src src;
+
+    src.nws_data = data;
+    src.nws_om = NULL;
+    src.nws_om_off = 0;
+    src.nws_compress = (file->nf_access_flags & FS_ACCESS_COMPRESS) != 0;
+
+    return nffs_write_src_to_file(file, &src, len);
+}
+
+/**
+ * Writes part of an mbuf chain to a file.  The data is written to flash
+ * directly from the chain's segments; a block may span several segments.
+ *
+ * @param file                  The file to write to.
+ * @param om                    The mbuf chain containing the data to write.
+ * @param off                   The chain offset of the first byte to write.
+ * @param len                   The length of data to write.  The chain must
+ *                                  contain at least off + len bytes.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_write_mbuf_to_file(struct nffs_file *file, const struct os_mbuf *om,
+                        uint32_t off, int len)
+{
+    struct nffs_write_src src;
+
+    src.nws_data = NULL;
+    src.nws_om = om;
+    src.nws_om_off = off;
+    src.nws_compress = (file->nf_access_flags & FS_ACCESS_COMPRESS) != 0;
+
+    return nffs_write_src_to_file(file, &src, len);
+}
@@ -23,12 +23,15 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "hal/hal_flash.h"
+#include "os/os.h"
 #include "testutil/testutil.h"
 #include "fs/fs.h"
+#include "fs/fs_async.h"
 #include "nffs/nffs.h"
 #include "nffs/nffs_test.h"
 #include "nffs_test_priv.h"
 #include "nffs_priv.h"
+#include "crc16.h"
 
 int flash_native_memset(uint32_t offset, uint8_t c, uint32_t len);
 
@@ -79,17 +82,37 @@ nffs_test_util_assert_cache_is_sane(const char *filename)
 {
     struct nffs_cache_inode *cache_inode;
     struct nffs_cache_block *cache_block;
+    struct nffs_hash_entry *entry;
+    struct nffs_block block;
     struct fs_file *fs_file;
     struct nffs_file *file;
     uint32_t cache_start;
     uint32_t cache_end;
     uint32_t block_end;
+    uint32_t data_len;
+    int block_cnt;
     int rc;
 
     rc = fs_open(filename, FS_ACCESS_READ, &fs_file);
     TEST_ASSERT(rc == 0);
 
     file = (struct nffs_file *)fs_file;
+
+    /* Ensure the inode's length and block count agree with its chain. */
+    rc = nffs_inode_calc_data_length(file->nf_inode_entry, &data_len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(file->nf_inode_entry->nie_data_len == data_len);
+
+    block_cnt = 0;
+    entry = nffs_inode_last_block(file->nf_inode_entry);
+    while (entry != NULL) {
+        block_cnt++;
+        rc = nffs_block_from_hash_entry(&block, entry);
+        TEST_ASSERT(rc == 0);
+        entry = block.nb_prev;
+    }
+    TEST_ASSERT(file->nf_inode_entry->nie_block_cnt == block_cnt);
+
     rc = nffs_cache_inode_ensure(&cache_inode, file->nf_inode_entry);
     TEST_ASSERT(rc == 0);
 
@@ -164,7 +187,7 @@ nffs_test_util_block_count(const char *filename)
 
     file = (struct nffs_file *)fs_file;
     count = 0;
-    entry = file->nf_inode_entry->nie_last_block_entry;
+    entry = nffs_inode_last_block(file->nf_inode_entry);
     while (entry != NULL) {
         count++;
         rc = nffs_block_from_hash_entry(&block, entry);
@@ -435,7 +458,7 @@ nffs_test_assert_branch_touched(struct nffs_inode_entry *inode_entry)
     nffs_test_touched_entries[i] = NULL;
 
     if (nffs_hash_id_is_dir(inode_entry->nie_hash_entry.nhe_id)) {
-        SLIST_FOREACH(child, &inode_entry->nie_child_list, nie_sibling_next) {
+        NFFS_INODE_FOREACH_CHILD(inode_entry, child) {
             nffs_test_assert_branch_touched(child);
         }
     }
@@ -456,7 +479,7 @@ nffs_test_assert_child_inode_present(struct nffs_inode_entry *child)
     TEST_ASSERT(parent != NULL);
     TEST_ASSERT(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
 
-    SLIST_FOREACH(inode_entry, &parent->nie_child_list, nie_sibling_next) {
+    NFFS_INODE_FOREACH_CHILD(parent, inode_entry) {
         if (inode_entry == child) {
             return;
         }
@@ -480,7 +503,7 @@ nffs_test_assert_block_present(struct nffs_hash_entry *block_entry)
     TEST_ASSERT(inode_entry != NULL);
     TEST_ASSERT(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
 
-    cur = inode_entry->nie_last_block_entry;
+    cur = nffs_inode_last_block(inode_entry);
     while (cur != NULL) {
         if (cur == block_entry) {
             return;
@@ -505,8 +528,7 @@ nffs_test_assert_children_sorted(struct nffs_inode_entry *inode_entry)
     int rc;
 
     prev_entry = NULL;
-    SLIST_FOREACH(child_entry, &inode_entry->nie_child_list,
-                  nie_sibling_next) {
+    NFFS_INODE_FOREACH_CHILD(inode_entry, child_entry) {
         rc = nffs_inode_from_entry(&child_inode, child_entry);
         TEST_ASSERT(rc == 0);
 
@@ -1603,7 +1625,7 @@ TEST_CASE(nffs_test_long_filename)
 
 TEST_CASE(nffs_test_large_write)
 {
-    static char data[NFFS_BLOCK_MAX_DATA_SZ_MAX * 5];
+    static char data[NFFS_BLOCK_MAX_DATA_SZ_V0 * 5];
     int rc;
     int i;
 
@@ -1629,14 +1651,14 @@ TEST_CASE(nffs_test_large_write)
      * blocks.
      */
     TEST_ASSERT(nffs_test_util_block_count("/myfile.txt") ==
-           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_MAX);
+           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_V0);
 
     /* Garbage collect and then ensure the large file is still properly divided
      * according to max data block size.
      */
     nffs_gc(NULL);
     TEST_ASSERT(nffs_test_util_block_count("/myfile.txt") ==
-           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_MAX);
+           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_V0);
 
     struct nffs_test_file_desc *expected_system =
         (struct nffs_test_file_desc[]) { {
@@ -1654,6 +1676,132 @@ TEST_CASE(nffs_test_large_write)
     nffs_test_assert_system(expected_system, area_descs_two);
 }
 
+/** Seven 128 kB areas; large enough for 256 kB files and 32 kB blocks. */
+static const struct nffs_area_desc nffs_test_large_area_descs[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0x00080000, 128 * 1024 },
+        { 0x000a0000, 128 * 1024 },
+        { 0x000c0000, 128 * 1024 },
+        { 0x000e0000, 128 * 1024 },
+        { 0, 0 },
+};
+
+TEST_CASE(nffs_test_large_blocks)
+{
+    static char data[256 * 1024];
+    struct fs_file *file;
+    int rc;
+    int i;
+
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i * 13;
+    }
+
+    /*** Large writes are split into large blocks. */
+    nffs_config.nc_block_max_data_sz = 16 * 1024;
+    rc = nffs_format(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == 16 * 1024);
+
+    nffs_test_util_create_file("/big", data, sizeof data);
+    nffs_test_util_assert_contents("/big", data, sizeof data);
+    TEST_ASSERT(nffs_test_util_block_count("/big") == 16);
+
+    /*** Overwrite across a block boundary. */
+    memset(data + 16 * 1024 - 100, 'x', 200);
+    rc = fs_open("/big", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 16 * 1024 - 100);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data + 16 * 1024 - 100, 200);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/big", data, sizeof data);
+
+    /*** Large blocks survive garbage collection and restore. */
+    for (i = 0; i < 7; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT(rc == 0);
+    }
+    nffs_test_util_assert_contents("/big", data, sizeof data);
+
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == 16 * 1024);
+    nffs_test_util_assert_contents("/big", data, sizeof data);
+
+    /*** Small appends are collated into a large block. */
+    rc = nffs_format(nffs_test_large_area_descs + 5);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/log", "", 0);
+    for (i = 0; i < 20; i++) {
+        nffs_test_util_append_file("/log", data + i * 500, 500);
+    }
+    TEST_ASSERT(nffs_test_util_block_count("/log") == 20);
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_block_count("/log") == 1);
+
+    nffs_test_util_append_file("/log", data + 10000, 500);
+    rc = nffs_detect(nffs_test_large_area_descs + 5);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_block_count("/log") == 2);
+    nffs_test_util_assert_contents("/log", data, 10500);
+
+    /*** Blocks are limited to half the smallest area. */
+    nffs_config.nc_block_max_data_sz = NFFS_BLOCK_MAX_DATA_SZ_MAX;
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz ==
+                (16 * 1024 - sizeof (struct nffs_disk_area)) / 2 -
+                sizeof (struct nffs_disk_block));
+
+    /*** A version 0 file system keeps the old limit. */
+    rc = nffs_format(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; nffs_test_large_area_descs[i].nad_length != 0; i++) {
+        flash_native_memset(nffs_test_large_area_descs[i].nad_offset +
+                            offsetof(struct nffs_disk_area, nda_ver),
+                            NFFS_AREA_VER_0, 1);
+    }
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == NFFS_BLOCK_MAX_DATA_SZ_V0);
+
+    nffs_test_util_create_file("/old", data, 10000);
+    TEST_ASSERT(nffs_test_util_block_count("/old") ==
+                (10000 + NFFS_BLOCK_MAX_DATA_SZ_V0 - 1) /
+                NFFS_BLOCK_MAX_DATA_SZ_V0);
+
+    /* Areas erased by the garbage collector are upgraded. */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == NFFS_BLOCK_MAX_DATA_SZ_V0);
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (nffs_areas[i].na_ver == NFFS_AREA_VER) {
+            break;
+        }
+    }
+    TEST_ASSERT(i < nffs_num_areas);
+
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/old", data, 10000);
+
+    /*** An area from a newer format is not touched. */
+    flash_native_memset(nffs_test_large_area_descs[0].nad_offset +
+                        offsetof(struct nffs_disk_area, nda_ver),
+                        NFFS_AREA_VER + 1, 1);
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT(rc == FS_EUNEXP);
+
+    nffs_config.nc_block_max_data_sz = NFFS_BLOCK_MAX_DATA_SZ_V0;
+}
+
 TEST_CASE(nffs_test_many_children)
 {
     int rc;
@@ -1708,6 +1856,329 @@ TEST_CASE(nffs_test_many_children)
     nffs_test_assert_system(expected_system, nffs_area_descs);
 }
 
+TEST_CASE(nffs_test_hash)
+{
+    struct nffs_hash_entry *entry;
+    struct fs_file *file;
+    uint32_t num_inodes;
+    uint32_t num_blocks;
+    char filename[16];
+    int num_entries;
+    int rc;
+    int i;
+
+    num_inodes = nffs_config.nc_num_inodes;
+    num_blocks = nffs_config.nc_num_blocks;
+
+    /*** Too many objects to be referenced by 16-bit handles. */
+    nffs_config.nc_num_inodes = 0x8000;
+    nffs_config.nc_num_blocks = 0x8000;
+    rc = nffs_init();
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    /*** Small pools, so that the table is nearly full. */
+    nffs_config.nc_num_inodes = 64;
+    nffs_config.nc_num_blocks = 64;
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_hash_num_slots == 161);
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < 60; i++) {
+        snprintf(filename, sizeof filename, "/f%d", i);
+        nffs_test_util_create_file(filename, "x", 1);
+    }
+
+    /* Removals shift colliding entries; each survivor must remain
+     * reachable.
+     */
+    for (i = 0; i < 60; i += 2) {
+        snprintf(filename, sizeof filename, "/f%d", i);
+        rc = fs_unlink(filename);
+        TEST_ASSERT(rc == 0);
+    }
+
+    num_entries = 0;
+    NFFS_HASH_FOREACH(entry, i) {
+        TEST_ASSERT(nffs_hash_handle(entry) == i);
+        TEST_ASSERT(nffs_hash_entry_from_handle(i) == entry);
+        TEST_ASSERT(nffs_hash_find(entry->nhe_id) == entry);
+        num_entries++;
+    }
+
+    /* Root, lost+found, and 30 files of one block each. */
+    TEST_ASSERT(num_entries == 2 + 30 * 2);
+
+    for (i = 0; i < 60; i++) {
+        snprintf(filename, sizeof filename, "/f%d", i);
+        rc = fs_open(filename, FS_ACCESS_READ, &file);
+        if (i % 2 == 0) {
+            TEST_ASSERT(rc == FS_ENOENT);
+        } else {
+            TEST_ASSERT(rc == 0);
+            TEST_ASSERT(fs_close(file) == 0);
+        }
+    }
+
+    /*** Restore rebuilds the same set of entries. */
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    num_entries = 0;
+    NFFS_HASH_FOREACH(entry, i) {
+        TEST_ASSERT(nffs_hash_find(entry->nhe_id) == entry);
+        num_entries++;
+    }
+    TEST_ASSERT(num_entries == 2 + 30 * 2);
+
+    nffs_config.nc_num_inodes = num_inodes;
+    nffs_config.nc_num_blocks = num_blocks;
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+}
+
+/**
+ * Counts the compressed blocks in a file and sums the space its data occupies
+ * on disk.
+ */
+static int
+nffs_test_util_lz_blocks(const char *filename, uint32_t *out_disk_len)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_block block;
+    struct nffs_file *file;
+    struct fs_file *fs_file;
+    int count;
+    int rc;
+
+    rc = fs_open(filename, FS_ACCESS_READ, &fs_file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    file = (struct nffs_file *)fs_file;
+    count = 0;
+    *out_disk_len = 0;
+    entry = nffs_inode_last_block(file->nf_inode_entry);
+    while (entry != NULL) {
+        rc = nffs_block_from_hash_entry(&block, entry);
+        TEST_ASSERT_FATAL(rc == 0);
+        if (block.nb_flags & NFFS_BLOCK_F_LZ) {
+            TEST_ASSERT(block.nb_disk_len < block.nb_data_len);
+            count++;
+        } else {
+            TEST_ASSERT(block.nb_disk_len == block.nb_data_len);
+        }
+        *out_disk_len += block.nb_disk_len;
+        entry = block.nb_prev;
+    }
+
+    rc = fs_close(fs_file);
+    TEST_ASSERT(rc == 0);
+
+    return count;
+}
+
+static void
+nffs_test_util_write_at(const char *filename, uint8_t access_flags,
+                        uint32_t offset, const void *data, int len)
+{
+    struct fs_file *file;
+    int rc;
+
+    rc = fs_open(filename, access_flags, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    if (!(access_flags & FS_ACCESS_APPEND)) {
+        rc = fs_seek(file, offset);
+        TEST_ASSERT(rc == 0);
+    }
+
+    rc = fs_write(file, data, len);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(nffs_test_compress)
+{
+    static char data[8000];
+    static uint8_t noise[3000];
+    static uint8_t stream[1024];
+    static uint8_t out[1024];
+    char grow[150];
+    struct fs_file *file;
+    uint32_t plain_disk_len;
+    uint32_t lz_disk_len;
+    uint32_t bytes_read;
+    uint32_t seed;
+    char buf[64];
+    int stream_len;
+    int data_len;
+    int off;
+    int rc;
+    int i;
+
+    data_len = 0;
+    for (i = 0; data_len < 5000; i++) {
+        data_len += sprintf(data + data_len, "record %04d: temp=%d ok\n",
+                            i, 20 + i % 7);
+    }
+    data_len = 5000;
+
+    seed = 1;
+    for (i = 0; i < sizeof noise; i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = seed >> 16;
+    }
+
+    /*** Codec round trip, including a partial prefix. */
+    stream_len = nffs_lz_compress((uint8_t *)data, 1000, stream,
+                                  sizeof stream);
+    TEST_ASSERT_FATAL(stream_len > 0 && stream_len < 500);
+    rc = nffs_lz_decompress(stream, stream_len, out, 1000);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(out, data, 1000) == 0);
+    memset(out, 0, sizeof out);
+    rc = nffs_lz_decompress(stream, stream_len, out, 123);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(out, data, 123) == 0);
+    TEST_ASSERT(out[123] == 0);
+
+    /* Truncated stream; incompressible input. */
+    rc = nffs_lz_decompress(stream, stream_len / 2, out, 1000);
+    TEST_ASSERT(rc == FS_ECORRUPT);
+    rc = nffs_lz_compress(noise, 1000, stream, 997);
+    TEST_ASSERT(rc == -1);
+
+    /*** Same data, with and without compression. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_open("/lz", FS_ACCESS_READ | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    nffs_test_util_create_file("/plain", data, data_len);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 0,
+                            data, data_len);
+    nffs_test_util_assert_contents("/plain", data, data_len);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    TEST_ASSERT(nffs_test_util_lz_blocks("/plain", &plain_disk_len) == 0);
+    TEST_ASSERT(nffs_test_util_lz_blocks("/lz", &lz_disk_len) ==
+                nffs_test_util_block_count("/lz"));
+    TEST_ASSERT(plain_disk_len == data_len);
+    TEST_ASSERT(lz_disk_len < plain_disk_len / 2);
+
+    /*** Seek into the middle of a compressed block. */
+    rc = fs_open("/lz", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (off = 0; off < data_len; off += 997) {
+        rc = fs_seek(file, off);
+        TEST_ASSERT(rc == 0);
+        rc = fs_read(file, sizeof buf, buf, &bytes_read);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(bytes_read == sizeof buf || off + bytes_read == data_len);
+        TEST_ASSERT(memcmp(buf, data + off, bytes_read) == 0);
+    }
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Overwrite through a compressing handle. */
+    memcpy(data + 100, "OVERWRITTEN", 11);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 100,
+                            "OVERWRITTEN", 11);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    /*** Grow a file by overwriting the end of its last block. */
+    nffs_test_util_write_at("/grow", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 0,
+                            data, 100);
+    nffs_test_util_write_at("/grow", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 50,
+                            data + 200, 100);
+    memcpy(grow, data, 50);
+    memcpy(grow + 50, data + 200, 100);
+    nffs_test_util_assert_contents("/grow", grow, 150);
+
+    /* The same through a plain handle, over a compressed last block. */
+    memcpy(data + data_len - 20, data + 3000, 60);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE, data_len - 20,
+                            data + data_len - 20, 60);
+    data_len += 40;
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    /*** Overwrite spanning blocks through a plain handle. */
+    memcpy(data + 1900, noise, 300);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE, 1900, noise, 300);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    /*** Append compressible and incompressible data. */
+    memcpy(data + data_len, data, 1000);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_APPEND |
+                                   FS_ACCESS_COMPRESS, 0, data, 1000);
+    data_len += 1000;
+    memcpy(data + data_len, noise, 1500);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_APPEND |
+                                   FS_ACCESS_COMPRESS, 0, noise, 1500);
+    data_len += 1500;
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    /* Incompressible data is stored as is. */
+    nffs_test_util_write_at("/noise", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 0,
+                            noise, sizeof noise);
+    TEST_ASSERT(nffs_test_util_lz_blocks("/noise", &lz_disk_len) == 0);
+    TEST_ASSERT(lz_disk_len == sizeof noise);
+
+    /*** Restore and garbage collection preserve compressed blocks. */
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    nffs_test_util_assert_contents("/lz", data, data_len);
+    TEST_ASSERT(nffs_test_util_lz_blocks("/lz", &lz_disk_len) > 0);
+
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+    nffs_test_util_assert_contents("/noise", (char *)noise, sizeof noise);
+
+    /*** Areas in an older format get no compressed blocks until upgraded. */
+    rc = nffs_format(nffs_test_large_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; nffs_test_large_area_descs[i].nad_length != 0; i++) {
+        flash_native_memset(nffs_test_large_area_descs[i].nad_offset +
+                            offsetof(struct nffs_disk_area, nda_ver),
+                            NFFS_AREA_VER_1, 1);
+    }
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(!nffs_block_lz_ok);
+
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 0,
+                            data, data_len);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+    TEST_ASSERT(nffs_test_util_lz_blocks("/lz", &lz_disk_len) == 0);
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    rc = nffs_detect(nffs_test_large_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_block_lz_ok);
+
+    rc = fs_unlink("/lz");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_write_at("/lz", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, 0,
+                            data, data_len);
+    nffs_test_util_assert_contents("/lz", data, data_len);
+    TEST_ASSERT(nffs_test_util_lz_blocks("/lz", &lz_disk_len) > 0);
+}
+
 TEST_CASE(nffs_test_gc)
 {
     int rc;
@@ -1755,71 +2226,540 @@ TEST_CASE(nffs_test_gc)
     nffs_test_util_assert_block_count("/myfile.txt", 1);
 }
 
-TEST_CASE(nffs_test_wear_level)
+TEST_CASE(nffs_test_gc_select)
 {
+    uint32_t obsolete[3];
+    char data[1500];
     int rc;
     int i;
-    int j;
 
-    static const struct nffs_area_desc area_descs_uniform[] = {
-        { 0x00000000, 2 * 1024 },
-        { 0x00020000, 2 * 1024 },
-        { 0x00040000, 2 * 1024 },
-        { 0x00060000, 2 * 1024 },
-        { 0x00080000, 2 * 1024 },
+    static const struct nffs_area_desc area_descs_three[] = {
+        { 0x00000000, 4 * 1024 },
+        { 0x00004000, 4 * 1024 },
+        { 0x00008000, 4 * 1024 },
         { 0, 0 },
     };
 
-
     /*** Setup. */
-    rc = nffs_format(area_descs_uniform);
+    rc = nffs_format(area_descs_three);
     TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 0);
 
-    /* Ensure areas rotate properly. */
-    for (i = 0; i < 255; i++) {
-        for (j = 0; j < nffs_num_areas; j++) {
-            nffs_test_assert_area_seqs(i, nffs_num_areas - j, i + 1, j);
-            nffs_gc(NULL);
-        }
-    }
+    memset(data, 'a', sizeof data);
+    nffs_test_util_create_file("/a", data, sizeof data);
+    memset(data, 'b', sizeof data);
+    nffs_test_util_create_file("/b", data, sizeof data);
 
-    /* Ensure proper rollover of sequence numbers. */
-    for (j = 0; j < nffs_num_areas; j++) {
-        nffs_test_assert_area_seqs(255, nffs_num_areas - j, 0, j);
-        nffs_gc(NULL);
+    /* The third file's data doesn't fit in area 1; it goes to area 2. */
+    memset(data, 'c', sizeof data);
+    nffs_test_util_create_file("/c", data, sizeof data);
+
+    /* Deleting the third file makes area 2 mostly garbage. */
+    rc = fs_unlink("/c");
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_areas[2].na_obsolete >=
+                sizeof (struct nffs_disk_block) + sizeof data);
+    TEST_ASSERT(nffs_areas[2].na_obsolete > nffs_areas[1].na_obsolete);
+
+    /* Ensure the accounting survives a restore. */
+    for (i = 0; i < 3; i++) {
+        obsolete[i] = nffs_areas[i].na_obsolete;
     }
-    for (j = 0; j < nffs_num_areas; j++) {
-        nffs_test_assert_area_seqs(0, nffs_num_areas - j, 1, j);
-        nffs_gc(NULL);
+    rc = nffs_detect(area_descs_three);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 3; i++) {
+        TEST_ASSERT(nffs_areas[i].na_obsolete == obsolete[i]);
     }
+
+    /* Area 2 has the better cost-benefit ratio, even though area 1 comes
+     * first.
+     */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 2);
+    TEST_ASSERT(nffs_areas[0].na_obsolete == 0);
+
+    memset(data, 'a', sizeof data);
+    nffs_test_util_assert_contents("/a", data, sizeof data);
+    memset(data, 'b', sizeof data);
+    nffs_test_util_assert_contents("/b", data, sizeof data);
 }
 
-TEST_CASE(nffs_test_corrupt_scratch)
+TEST_CASE(nffs_test_gc_incr)
 {
-    int non_scratch_id;
-    int scratch_id;
+    uint32_t step_objs;
+    char data[1900];
+    int steps;
+    int done;
     int rc;
 
-    static const struct nffs_area_desc area_descs_two[] = {
-        { 0x00020000, 128 * 1024 },
-        { 0x00040000, 128 * 1024 },
+    static const struct nffs_area_desc area_descs_three[] = {
+        { 0x00000000, 4 * 1024 },
+        { 0x00004000, 4 * 1024 },
+        { 0x00008000, 4 * 1024 },
         { 0, 0 },
     };
 
-
     /*** Setup. */
-    rc = nffs_format(area_descs_two);
+    rc = nffs_format(area_descs_three);
     TEST_ASSERT(rc == 0);
 
-    nffs_test_util_create_file("/myfile.txt", "contents", 8);
+    /* Nothing to do in an empty file system. */
+    TEST_ASSERT(!nffs_gc_incr_needed());
+    rc = nffs_gc_incr_step(&done);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(done);
+    TEST_ASSERT(nffs_gc_incr_area_idx == NFFS_AREA_ID_NONE);
 
-    /* Copy the current contents of the non-scratch area to the scratch area.
-     * This will make the scratch area look like it only partially participated
-     * in a garbage collection cycle.
+    /* Fill area 1, then rewrite both files so that area 1 is mostly
+     * garbage.
      */
-    scratch_id = nffs_scratch_area_idx;
-    non_scratch_id = scratch_id ^ 1;
-    nffs_test_copy_area(area_descs_two + non_scratch_id,
+    memset(data, 'a', sizeof data);
+    nffs_test_util_create_file("/a", data, sizeof data);
+    memset(data, 'b', sizeof data);
+    nffs_test_util_create_file("/b", data, sizeof data);
+    memset(data, 'A', sizeof data);
+    nffs_test_util_create_file("/a", data, sizeof data);
+    memset(data, 'B', sizeof data);
+    nffs_test_util_create_file("/b", data, sizeof data);
+
+    TEST_ASSERT(nffs_gc_incr_needed());
+
+    /* Perform the cycle one small step at a time. */
+    step_objs = nffs_config.nc_gc_step_objs;
+    nffs_config.nc_gc_step_objs = 1;
+
+    steps = 0;
+    do {
+        rc = nffs_gc_incr_step(&done);
+        TEST_ASSERT(rc == 0);
+        steps++;
+
+        if (steps == 1) {
+            TEST_ASSERT(nffs_gc_incr_area_idx == 1);
+
+            /* Writes are allowed mid-cycle, but not to the source area. */
+            nffs_test_util_create_file("/c", "cccc", 4);
+        }
+    } while (!done);
+
+    nffs_config.nc_gc_step_objs = step_objs;
+
+    TEST_ASSERT(steps > 1);
+    TEST_ASSERT(nffs_gc_incr_area_idx == NFFS_AREA_ID_NONE);
+    TEST_ASSERT(nffs_scratch_area_idx == 1);
+    TEST_ASSERT(!nffs_gc_incr_needed());
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "a",
+                .contents = data,
+                .contents_len = sizeof data,
+            }, {
+                .filename = "c",
+                .contents = "cccc",
+                .contents_len = 4,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    rc = fs_unlink("/b");
+    TEST_ASSERT(rc == 0);
+    memset(data, 'A', sizeof data);
+    nffs_test_assert_system(expected_system, area_descs_three);
+}
+
+TEST_CASE(nffs_test_gc_overwrite)
+{
+    struct nffs_test_block_desc blocks[8];
+    struct fs_file *filler_file;
+    struct fs_file *file;
+    struct nffs_area *area;
+    static char data[8];
+    char filler[512];
+    uint32_t space;
+    uint32_t len;
+    uint32_t bytes_read;
+    char buf[8];
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00000000, 4 * 1024 },
+        { 0x00004000, 4 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 0);
+    area = nffs_areas + 1;
+
+    for (i = 0; i < 8; i++) {
+        data[i] = '1' + i;
+        blocks[i].data = data + i;
+        blocks[i].data_len = 1;
+    }
+    nffs_test_util_create_file_blocks("/myfile.txt", blocks, 8);
+
+    /* Read the file so that all of its blocks are cached. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 8);
+
+    /* Fill the area so that the next overwrite must garbage collect it.  The
+     * collection collates the cached blocks into one.
+     */
+    memset(filler, 'f', sizeof filler);
+    rc = fs_open("/filler", FS_ACCESS_WRITE, &filler_file);
+    TEST_ASSERT(rc == 0);
+    while (1) {
+        space = area->na_length - area->na_cur;
+        if (space <= sizeof (struct nffs_disk_block) + 4) {
+            break;
+        }
+
+        len = space - sizeof (struct nffs_disk_block) - 4;
+        if (len > sizeof filler) {
+            len = sizeof filler;
+        }
+        rc = fs_write(filler_file, filler, len);
+        TEST_ASSERT(rc == 0);
+    }
+    rc = fs_close(filler_file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_seek(file, 7);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "x", 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 1);
+
+    /* The cache must not refer to the collated blocks. */
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "y", 1);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_assert_contents("/myfile.txt", "y234567x", 8);
+
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", "y234567x", 8);
+}
+
+TEST_CASE(nffs_test_wear_level)
+{
+    int rc;
+    int i;
+    int j;
+
+    static const struct nffs_area_desc area_descs_uniform[] = {
+        { 0x00000000, 2 * 1024 },
+        { 0x00020000, 2 * 1024 },
+        { 0x00040000, 2 * 1024 },
+        { 0x00060000, 2 * 1024 },
+        { 0x00080000, 2 * 1024 },
+        { 0, 0 },
+    };
+
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_uniform);
+    TEST_ASSERT(rc == 0);
+
+    /* Ensure areas rotate properly. */
+    for (i = 0; i < 255; i++) {
+        for (j = 0; j < nffs_num_areas; j++) {
+            nffs_test_assert_area_seqs(i, nffs_num_areas - j, i + 1, j);
+            nffs_gc(NULL);
+        }
+    }
+
+    /* Ensure proper rollover of sequence numbers. */
+    for (j = 0; j < nffs_num_areas; j++) {
+        nffs_test_assert_area_seqs(255, nffs_num_areas - j, 0, j);
+        nffs_gc(NULL);
+    }
+    for (j = 0; j < nffs_num_areas; j++) {
+        nffs_test_assert_area_seqs(0, nffs_num_areas - j, 1, j);
+        nffs_gc(NULL);
+    }
+}
+
+TEST_CASE(nffs_test_wear_stats)
+{
+    struct fs_area_info info;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00000000, 2 * 1024 },
+        { 0x00020000, 2 * 1024 },
+        { 0, 0 },
+    };
+
+    static const struct nffs_area_desc area_descs_three[] = {
+        { 0x00000000, 4 * 1024 },
+        { 0x00004000, 4 * 1024 },
+        { 0x00008000, 4 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Ensure erase counts carry past the 8-bit sequence number. */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < 512; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT(rc == 0);
+    }
+
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 2; i++) {
+        rc = fs_area_info("/", i, &info);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(info.fai_length == 2 * 1024);
+        TEST_ASSERT(info.fai_erase_cnt == 256);
+        TEST_ASSERT(info.fai_is_scratch == (i == nffs_scratch_area_idx));
+    }
+    rc = fs_area_info("/", 2, &info);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /*** Ensure a lightly worn area holding static data gets rotated. */
+    rc = nffs_format(area_descs_three);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 0);
+
+    /* Area 1 holds static data; area 2 holds garbage. */
+    nffs_test_util_create_file("/static", "abcdefgh", 8);
+    nffs_areas[2].na_obsolete = 1024;
+
+    /* Pretend the other two areas have seen heavy use. */
+    nffs_areas[0].na_gc_seq_hi = 1;
+    nffs_areas[2].na_gc_seq_hi = 1;
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 1);
+    TEST_ASSERT(nffs_area_erase_cnt(nffs_areas + 1) == 1);
+
+    rc = fs_area_info("/", 0, &info);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(!info.fai_is_scratch);
+    TEST_ASSERT(info.fai_live ==
+                sizeof (struct nffs_disk_inode) * 3 + strlen("lost+found") +
+                strlen("static") + sizeof (struct nffs_disk_block) + 8);
+    TEST_ASSERT(info.fai_dead == 0);
+
+    nffs_test_util_assert_contents("/static", "abcdefgh", 8);
+}
+
+/**
+ * Ensures the incrementally maintained space totals match a full
+ * recalculation from the objects in RAM.
+ */
+static void
+nffs_test_assert_statvfs_exact(struct fs_statvfs *out_stat)
+{
+    struct fs_statvfs recalc;
+    int rc;
+
+    rc = fs_statvfs("/", out_stat);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(out_stat->fsv_bsize == nffs_block_max_data_sz);
+    TEST_ASSERT(out_stat->fsv_avail ==
+                out_stat->fsv_free + out_stat->fsv_dead);
+
+    rc = nffs_area_calc_obsolete();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_statvfs("/", &recalc);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(memcmp(out_stat, &recalc, sizeof recalc) == 0);
+}
+
+TEST_CASE(nffs_test_statvfs)
+{
+    static char data[3000];
+    struct fs_statvfs prev;
+    struct fs_statvfs stat;
+    struct fs_area_info info;
+    uint32_t total;
+    uint32_t live;
+    int rc;
+    int i;
+
+    /* A single data area, so one garbage collection cycle reclaims all dead
+     * space.
+     */
+    static const struct nffs_area_desc area_descs[] = {
+        { 0x00000000, 8 * 1024 },
+        { 0x00004000, 8 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+
+    /*** Totals agree with the per-area statistics. */
+    nffs_test_assert_statvfs_exact(&stat);
+    total = 0;
+    live = 0;
+    for (i = 0; fs_area_info("/", i, &info) == 0; i++) {
+        if (!info.fai_is_scratch) {
+            total += info.fai_length;
+            live += info.fai_live;
+        }
+    }
+    TEST_ASSERT(stat.fsv_total == 8 * 1024);
+    TEST_ASSERT(stat.fsv_total == total);
+    TEST_ASSERT(stat.fsv_live == live);
+    TEST_ASSERT(stat.fsv_free + stat.fsv_live + stat.fsv_dead ==
+                total - sizeof (struct nffs_disk_area));
+    TEST_ASSERT(stat.fsv_dead == 0);
+
+    /*** Writes consume free space and add live data. */
+    prev = stat;
+    nffs_test_util_create_file("/a", data, sizeof data);
+    nffs_test_assert_statvfs_exact(&stat);
+    TEST_ASSERT(stat.fsv_live >= prev.fsv_live + sizeof data);
+    TEST_ASSERT(stat.fsv_free == prev.fsv_free - (stat.fsv_live -
+                                                  prev.fsv_live));
+    TEST_ASSERT(stat.fsv_dead == 0);
+
+    /*** Overwrites and renames leave dead data behind. */
+    prev = stat;
+    nffs_test_util_create_file("/a", data, 100);
+    rc = fs_rename("/a", "/b");
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_statvfs_exact(&stat);
+    TEST_ASSERT(stat.fsv_dead >= sizeof data);
+    TEST_ASSERT(stat.fsv_live < prev.fsv_live);
+
+    /*** Unlinked data is dead. */
+    prev = stat;
+    rc = fs_unlink("/b");
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_statvfs_exact(&stat);
+    TEST_ASSERT(stat.fsv_dead > prev.fsv_dead);
+    TEST_ASSERT(stat.fsv_live < prev.fsv_live);
+
+    /*** Garbage collection turns dead data into free space. */
+    prev = stat;
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_statvfs_exact(&stat);
+    TEST_ASSERT(stat.fsv_dead == 0);
+    TEST_ASSERT(stat.fsv_live <= prev.fsv_live);
+    TEST_ASSERT(stat.fsv_free >= prev.fsv_avail);
+
+    /*** Totals survive a restore from flash. */
+    prev = stat;
+    rc = nffs_detect(area_descs);
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_statvfs_exact(&stat);
+    TEST_ASSERT(memcmp(&stat, &prev, sizeof stat) == 0);
+}
+
+TEST_CASE(nffs_test_cached_len)
+{
+    struct fs_file *file;
+    char buf[200];
+    int rc;
+    int i;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < sizeof buf; i++) {
+        buf[i] = i;
+    }
+
+    /*** Build a file from several small blocks. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 4; i++) {
+        rc = fs_write(file, buf + i * 25, 25);
+        TEST_ASSERT(rc == 0);
+        nffs_test_util_assert_file_len(file, (i + 1) * 25);
+    }
+
+    /*** Overwrite the tail, extending the file past its old end. */
+    rc = fs_seek(file, 90);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, buf + 90, 30);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_file_len(file, 120);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", buf, 120);
+    nffs_test_util_assert_block_count("/myfile.txt", 4);
+
+    /*** Ensure garbage collection leaves the totals intact. */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", buf, 120);
+
+    /*** Ensure the totals are rebuilt on restore. */
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", buf, 120);
+
+    nffs_test_util_append_file("/myfile.txt", buf + 120, 80);
+    nffs_test_util_assert_contents("/myfile.txt", buf, 200);
+
+    /*** Truncation resets the totals. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_file_len(file, 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/myfile.txt", 0);
+}
+
+TEST_CASE(nffs_test_corrupt_scratch)
+{
+    int non_scratch_id;
+    int scratch_id;
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_create_file("/myfile.txt", "contents", 8);
+
+    /* Copy the current contents of the non-scratch area to the scratch area.
+     * This will make the scratch area look like it only partially participated
+     * in a garbage collection cycle.
+     */
+    scratch_id = nffs_scratch_area_idx;
+    non_scratch_id = scratch_id ^ 1;
+    nffs_test_copy_area(area_descs_two + non_scratch_id,
                        area_descs_two + nffs_scratch_area_idx);
 
     /* Add some more data to the non-scratch area. */
@@ -1889,7 +2829,7 @@ TEST_CASE(nffs_test_incomplete_block)
     file = (struct nffs_file *)fs_file;
 
     rc = nffs_block_from_hash_entry(&block,
-                                   file->nf_inode_entry->nie_last_block_entry);
+                                   nffs_inode_last_block(file->nf_inode_entry));
     TEST_ASSERT(rc == 0);
 
     nffs_flash_loc_expand(block.nb_hash_entry->nhe_flash_loc, &area_idx,
@@ -1967,7 +2907,7 @@ TEST_CASE(nffs_test_corrupt_block)
     file = (struct nffs_file *)fs_file;
 
     rc = nffs_block_from_hash_entry(&block,
-                                   file->nf_inode_entry->nie_last_block_entry);
+                                   nffs_inode_last_block(file->nf_inode_entry));
     TEST_ASSERT(rc == 0);
 
     nffs_flash_loc_expand(block.nb_hash_entry->nhe_flash_loc, &area_idx,
@@ -2190,7 +3130,7 @@ TEST_CASE(nffs_test_lost_found)
 
 TEST_CASE(nffs_test_cache_large_file)
 {
-    static char data[NFFS_BLOCK_MAX_DATA_SZ_MAX * 5];
+    static char data[NFFS_BLOCK_MAX_DATA_SZ_V0 * 5];
     struct fs_file *file;
     uint8_t b;
     int rc;
@@ -2257,14 +3197,180 @@ TEST_CASE(nffs_test_cache_large_file)
     TEST_ASSERT(rc == 0);
 }
 
-TEST_CASE(nffs_test_readdir)
+/**
+ * Retrieves the flash locations of a file's data blocks, in file order.
+ */
+static int
+nffs_test_util_block_locs(const char *filename, uint32_t *out_locs,
+                          int max_locs)
 {
-    struct fs_dirent *dirent;
-    struct fs_dir *dir;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    struct nffs_block block;
+    int count;
     int rc;
+    int i;
 
-    /*** Setup. */
-    rc = nffs_format(nffs_area_descs);
+    rc = nffs_path_find_inode_entry(filename, &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    count = inode_entry->nie_block_cnt;
+    TEST_ASSERT_FATAL(count <= max_locs);
+
+    i = count;
+    entry = nffs_inode_last_block(inode_entry);
+    while (entry != NULL) {
+        out_locs[--i] = entry->nhe_flash_loc;
+        rc = nffs_block_from_hash_entry(&block, entry);
+        TEST_ASSERT_FATAL(rc == 0);
+        entry = block.nb_prev;
+    }
+    TEST_ASSERT(i == 0);
+
+    return count;
+}
+
+TEST_CASE(nffs_test_cache_data)
+{
+    static const struct nffs_test_block_desc blocks[] = { {
+        .data = "0000000000",
+        .data_len = 10,
+    }, {
+        .data = "1111111111",
+        .data_len = 10,
+    }, {
+        .data = "2222222222",
+        .data_len = 10,
+    }, {
+        .data = "3333333333",
+        .data_len = 10,
+    } };
+    struct fs_file *file;
+    uint32_t locs[4];
+    uint32_t area_offset;
+    uint8_t area_idx;
+    char buf[40];
+    int rc;
+    int i;
+
+    /* The cache is sized when nffs is initialized. */
+    nffs_config.nc_data_cache_bytes = 4 * nffs_cache_data_entry_sz();
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_cache_data_num_entries() == 4);
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_create_file_blocks("/myfile.txt", blocks, 4);
+    nffs_cache_data_clear();
+    nffs_test_util_block_locs("/myfile.txt", locs, 4);
+
+    /*** A sequential read caches the block read and reads ahead. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_read(file, 5, buf, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(buf, "00000", 5) == 0);
+    TEST_ASSERT(nffs_cache_data_find(locs[0]) != NULL);
+    TEST_ASSERT(nffs_cache_data_find(locs[1]) != NULL);
+    TEST_ASSERT(nffs_cache_data_find(locs[2]) == NULL);
+
+    rc = fs_read(file, 10, buf, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(buf, "0000011111", 10) == 0);
+    TEST_ASSERT(nffs_cache_data_find(locs[2]) != NULL);
+    TEST_ASSERT(nffs_cache_data_find(locs[3]) == NULL);
+
+    /*** A random read does not trigger read-ahead. */
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 1, buf, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_cache_data_find(locs[3]) == NULL);
+
+    /*** Overwriting a block invalidates its cached contents. */
+    rc = fs_seek(file, 12);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "x", 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_cache_data_find(locs[1]) == NULL);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt",
+                                   "0000000000"
+                                   "11x1111111"
+                                   "2222222222"
+                                   "3333333333", 40);
+
+    /*** Ensure the cache size is respected. */
+    nffs_config.nc_data_cache_bytes = 2 * nffs_cache_data_entry_sz() - 1;
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_cache_data_num_entries() == 1);
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_util_block_locs("/myfile.txt", locs, 4);
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof buf, buf, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(buf, "000000000011x111111122222222223333333333",
+                       40) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Blocks are read last to first; only the first remains cached. */
+    TEST_ASSERT(nffs_cache_data_find(locs[0]) != NULL);
+    for (i = 1; i < 4; i++) {
+        TEST_ASSERT(nffs_cache_data_find(locs[i]) == NULL);
+    }
+
+    /*** Garbage collection invalidates blocks in the erased area. */
+    nffs_config.nc_data_cache_bytes = 4 * nffs_cache_data_entry_sz();
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt",
+                                   "0000000000"
+                                   "11x1111111"
+                                   "2222222222"
+                                   "3333333333", 40);
+
+    rc = nffs_gc(&area_idx);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 4; i++) {
+        nffs_flash_loc_expand(locs[i], &area_idx, &area_offset);
+        if (area_idx == nffs_scratch_area_idx) {
+            TEST_ASSERT(nffs_cache_data_find(locs[i]) == NULL);
+        }
+    }
+
+    nffs_test_util_assert_contents("/myfile.txt",
+                                   "0000000000"
+                                   "11x1111111"
+                                   "2222222222"
+                                   "3333333333", 40);
+
+    nffs_config.nc_data_cache_bytes = 0;
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(!nffs_cache_data_enabled());
+}
+
+TEST_CASE(nffs_test_readdir)
+{
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    int rc;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
     TEST_ASSERT_FATAL(rc == 0);
 
     rc = fs_mkdir("/mydir");
@@ -2361,6 +3467,840 @@ TEST_CASE(nffs_test_readdir)
     TEST_ASSERT(rc == FS_ENOENT);
 }
 
+static void
+nffs_test_util_assert_dir_sorted(const char *path, int expected_count)
+{
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    char prev[NFFS_FILENAME_MAX_LEN + 1];
+    char name[NFFS_FILENAME_MAX_LEN + 1];
+    uint8_t name_len;
+    int count;
+    int rc;
+
+    rc = fs_opendir(path, &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    prev[0] = '\0';
+    count = 0;
+    while (fs_readdir(dir, &dirent) == 0) {
+        rc = fs_dirent_name(dirent, sizeof name, name, &name_len);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(strcmp(prev, name) < 0);
+        strcpy(prev, name);
+        count++;
+    }
+    TEST_ASSERT(count == expected_count);
+
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(nffs_test_dir_lookup)
+{
+    struct fs_file *file;
+    char path[32];
+    char name0[16];
+    char name1[16];
+    int rc;
+    int i;
+    int j;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_mkdir("/dir");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Create more children than the filename cache can hold. */
+    for (i = 0; i < 40; i++) {
+        sprintf(path, "/dir/f%02d", i);
+        nffs_test_util_create_file(path, path, strlen(path));
+    }
+    for (i = 0; i < 40; i++) {
+        sprintf(path, "/dir/f%02d", i);
+        nffs_test_util_assert_contents(path, path, strlen(path));
+    }
+    nffs_test_util_assert_dir_sorted("/dir", 40);
+
+    /*** Ensure children with colliding name hashes are distinguished. */
+    for (i = 1; ; i++) {
+        sprintf(name1, "c%03d", i);
+        for (j = 0; j < i; j++) {
+            sprintf(name0, "c%03d", j);
+            if (nffs_inode_name_hash(name0, 4) ==
+                nffs_inode_name_hash(name1, 4)) {
+                break;
+            }
+        }
+        if (j < i) {
+            break;
+        }
+    }
+    sprintf(path, "/dir/%s", name0);
+    nffs_test_util_create_file(path, name0, 4);
+    sprintf(path, "/dir/%s", name1);
+    nffs_test_util_create_file(path, name1, 4);
+
+    sprintf(path, "/dir/%s", name0);
+    nffs_test_util_assert_contents(path, name0, 4);
+    sprintf(path, "/dir/%s", name1);
+    nffs_test_util_assert_contents(path, name1, 4);
+
+    /*** Rename within a directory; order and lookups must follow the name. */
+    rc = fs_rename("/dir/f05", "/dir/zz");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/dir/f05", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    nffs_test_util_assert_contents("/dir/zz", "/dir/f05", 8);
+    nffs_test_util_assert_dir_sorted("/dir", 42);
+
+    /*** Replace a file; the old name must not resolve to the new inode. */
+    rc = fs_unlink("/dir/f10");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/dir/a", "a", 1);
+    rc = fs_open("/dir/f10", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    nffs_test_util_assert_contents("/dir/a", "a", 1);
+
+    /*** Ensure the hashes are rebuilt on restore. */
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_assert_dir_sorted("/dir", 42);
+    nffs_test_util_assert_contents("/dir/zz", "/dir/f05", 8);
+    nffs_test_util_assert_contents("/dir/f39", "/dir/f39", 8);
+    sprintf(path, "/dir/%s", name1);
+    nffs_test_util_assert_contents(path, name1, 4);
+}
+
+#define NFFS_TEST_MBUF_BUF_SIZE     128
+#define NFFS_TEST_MBUF_NUM_BUFS     160
+
+static os_membuf_t nffs_test_mbuf_mem[
+    OS_MEMPOOL_SIZE(NFFS_TEST_MBUF_NUM_BUFS, NFFS_TEST_MBUF_BUF_SIZE)];
+static struct os_mempool nffs_test_mbuf_mempool;
+static struct os_mbuf_pool nffs_test_mbuf_pool;
+
+static struct os_mbuf *
+nffs_test_mbuf_chain(const void *data, int len)
+{
+    struct os_mbuf *om;
+    int rc;
+
+    om = os_mbuf_get_pkthdr(&nffs_test_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+
+    rc = os_mbuf_append(om, data, len);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    return om;
+}
+
+static int
+nffs_test_mbuf_seg_count(const struct os_mbuf *om)
+{
+    int count;
+
+    count = 0;
+    for (; om != NULL; om = SLIST_NEXT(om, om_next)) {
+        TEST_ASSERT(om->om_len > 0);
+        count++;
+    }
+
+    return count;
+}
+
+TEST_CASE(nffs_test_mbuf)
+{
+    static char data[5003];
+    static char expected[5000];
+    struct fs_file *file;
+    struct os_mbuf *hold;
+    struct os_mbuf *om;
+    uint32_t bytes_read;
+    int seg_count;
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    rc = os_mempool_init(&nffs_test_mbuf_mempool, NFFS_TEST_MBUF_NUM_BUFS,
+                         NFFS_TEST_MBUF_BUF_SIZE, nffs_test_mbuf_mem,
+                         "nffs_test_mbuf_pool");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_pool_init(&nffs_test_mbuf_pool, &nffs_test_mbuf_mempool,
+                           NFFS_TEST_MBUF_BUF_SIZE, NFFS_TEST_MBUF_NUM_BUFS);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Three bytes of "header" precede the file data. */
+    memcpy(data, "hdr", 3);
+    for (i = 3; i < sizeof data; i++) {
+        data[i] = i * 7;
+    }
+    memcpy(expected, data + 3, sizeof expected);
+
+    /*** Write a chain spanning many segments. */
+    om = nffs_test_mbuf_chain(data, sizeof data);
+    TEST_ASSERT(nffs_test_mbuf_seg_count(om) > 10);
+
+    rc = fs_open("/mbuf.bin", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_write_mbuf(file, om, 4, sizeof expected);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    rc = fs_write_mbuf(file, om, 3, sizeof expected);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    os_mbuf_free_chain(om);
+
+    nffs_test_util_assert_contents("/mbuf.bin", expected, sizeof expected);
+
+    /* Segments are combined into full-sized blocks. */
+    TEST_ASSERT(nffs_test_util_block_count("/mbuf.bin") ==
+                (sizeof expected + nffs_block_max_data_sz - 1) /
+                nffs_block_max_data_sz);
+
+    /*** Overwrite the middle of the file from a chain. */
+    for (i = 0; i < 3000; i++) {
+        data[i] = 'x' + i % 3;
+    }
+    memcpy(expected + 1000, data, 3000);
+    om = nffs_test_mbuf_chain(data, 3000);
+
+    rc = fs_open("/mbuf.bin", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 1000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write_mbuf(file, om, 0, 3000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    os_mbuf_free_chain(om);
+
+    nffs_test_util_assert_contents("/mbuf.bin", expected, sizeof expected);
+
+    /*** Read into a chain that already contains a header. */
+    om = nffs_test_mbuf_chain("hdr", 3);
+
+    rc = fs_open("/mbuf.bin", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 10);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_read_mbuf(file, 6000, om, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == sizeof expected - 10);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 3 + sizeof expected - 10);
+    TEST_ASSERT(os_mbuf_memcmp(om, 0, "hdr", 3) == 0);
+    TEST_ASSERT(os_mbuf_memcmp(om, 3, expected + 10,
+                               sizeof expected - 10) == 0);
+
+    /*** Reading at the end of the file leaves the chain unchanged. */
+    seg_count = nffs_test_mbuf_seg_count(om);
+    rc = fs_read_mbuf(file, 100, om, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 0);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 3 + sizeof expected - 10);
+    TEST_ASSERT(nffs_test_mbuf_seg_count(om) == seg_count);
+    os_mbuf_free_chain(om);
+
+    /*** Running out of mbufs; the partial read is reported and kept. */
+    om = nffs_test_mbuf_chain("hdr", 3);
+    hold = os_mbuf_get(&nffs_test_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(hold != NULL);
+    while (nffs_test_mbuf_mempool.mp_num_free > 2) {
+        os_mbuf_concat(hold, os_mbuf_get(&nffs_test_mbuf_pool, 0));
+    }
+
+    rc = fs_seek(file, 10);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_mbuf(file, 6000, om, &bytes_read);
+    TEST_ASSERT(rc == FS_ENOMEM);
+    TEST_ASSERT(bytes_read > 0 && bytes_read < sizeof expected - 10);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 3 + bytes_read);
+    TEST_ASSERT(os_mbuf_memcmp(om, 3, expected + 10, bytes_read) == 0);
+    TEST_ASSERT(fs_getpos(file) == 10 + bytes_read);
+    os_mbuf_free_chain(hold);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    os_mbuf_free_chain(om);
+
+    TEST_ASSERT(nffs_test_mbuf_mempool.mp_num_free ==
+                NFFS_TEST_MBUF_NUM_BUFS);
+}
+
+/**
+ * Bit-at-a-time CRC16-CCITT; used to verify the table-driven implementations.
+ */
+static uint16_t
+nffs_test_crc16_ref(uint16_t crc, const uint8_t *buf, int len)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i] << 8;
+        for (j = 0; j < 8; j++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+
+    return crc;
+}
+
+static void
+nffs_test_crc16_fill(uint8_t *buf, int len)
+{
+    uint32_t x;
+    int i;
+
+    x = 12345;
+    for (i = 0; i < len; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = x >> 16;
+    }
+}
+
+static int nffs_test_crc16_hw_calls;
+
+static uint16_t
+nffs_test_crc16_hw(uint16_t initial_crc, const void *buf, int len)
+{
+    nffs_test_crc16_hw_calls++;
+    return crc16_ccitt_bytewise(initial_crc, buf, len);
+}
+
+TEST_CASE(nffs_test_crc16)
+{
+    static const uint16_t initial_crcs[] = { 0x0000, 0xffff, 0x1d0f };
+    static uint8_t buf[NFFS_BLOCK_MAX_DATA_SZ_V0 + 8];
+    uint16_t expected;
+    int len;
+    int off;
+    int rc;
+    int i;
+
+    /*** Known answers (CRC-16/XMODEM and CRC-16/CCITT-FALSE). */
+    TEST_ASSERT(crc16_ccitt(0, "123456789", 9) == 0x31c3);
+    TEST_ASSERT(crc16_ccitt(0xffff, "123456789", 9) == 0x29b1);
+
+    /*** Ensure all implementations agree for every alignment and length. */
+    nffs_test_crc16_fill(buf, sizeof buf);
+    for (i = 0; i < sizeof initial_crcs / sizeof initial_crcs[0]; i++) {
+        for (off = 0; off < 8; off++) {
+            for (len = 0; len <= NFFS_BLOCK_MAX_DATA_SZ_V0;
+                 len += (len < 64) ? 1 : 61) {
+
+                expected = nffs_test_crc16_ref(initial_crcs[i], buf + off,
+                                               len);
+                TEST_ASSERT(crc16_ccitt_sw(initial_crcs[i], buf + off,
+                                           len) == expected);
+                TEST_ASSERT(crc16_ccitt_bytewise(initial_crcs[i], buf + off,
+                                                 len) == expected);
+            }
+        }
+    }
+
+    /*** Ensure a hardware implementation gets used when installed. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    nffs_crc16_set_hw(nffs_test_crc16_hw);
+    nffs_test_crc16_hw_calls = 0;
+    nffs_test_util_create_file("/crc.bin", (char *)buf, 1000);
+    TEST_ASSERT(nffs_test_crc16_hw_calls > 0);
+    nffs_crc16_set_hw(NULL);
+
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/crc.bin", (char *)buf, 1000);
+}
+
+/*** Concurrency: multiple tasks accessing the file system at once. */
+
+#define NFFS_TEST_CONC_STACK_SIZE   OS_STACK_ALIGN(4096)
+#define NFFS_TEST_CONC_READER_PRIO  2
+#define NFFS_TEST_CONC_LOG_B_PRIO   3
+#define NFFS_TEST_CONC_LOG_A_PRIO   4
+
+#define NFFS_TEST_CONC_REC_LEN      5000
+#define NFFS_TEST_CONC_A_RECS       8
+#define NFFS_TEST_CONC_B_RECS       4
+#define NFFS_TEST_CONC_SMALL_LEN    100
+
+static struct os_task nffs_test_conc_reader_task;
+static struct os_task nffs_test_conc_log_a_task;
+static struct os_task nffs_test_conc_log_b_task;
+static os_stack_t nffs_test_conc_reader_stack[NFFS_TEST_CONC_STACK_SIZE];
+static os_stack_t nffs_test_conc_log_a_stack[NFFS_TEST_CONC_STACK_SIZE];
+static os_stack_t nffs_test_conc_log_b_stack[NFFS_TEST_CONC_STACK_SIZE];
+static struct os_sem nffs_test_conc_reader_sem;
+static struct os_sem nffs_test_conc_log_b_sem;
+
+static char nffs_test_conc_small[NFFS_TEST_CONC_SMALL_LEN];
+static int nffs_test_conc_kick;
+static int nffs_test_conc_reads_during_write;
+static int nffs_test_conc_done;
+
+/**
+ * Installed as the CRC16 hardware hook.  The first CRC that logger A
+ * computes during each of its appends wakes the other tasks, so that they
+ * become ready while A is in the middle of a multi-block write.
+ */
+static uint16_t
+nffs_test_conc_crc16(uint16_t initial_crc, const void *buf, int len)
+{
+    if (nffs_test_conc_kick &&
+        os_sched_get_current_task() == &nffs_test_conc_log_a_task) {
+
+        nffs_test_conc_kick = 0;
+        os_sem_release(&nffs_test_conc_reader_sem);
+        os_sem_release(&nffs_test_conc_log_b_sem);
+    }
+
+    return crc16_ccitt_sw(initial_crc, buf, len);
+}
+
+static void
+nffs_test_conc_append_rec(struct fs_file *file, char c)
+{
+    static char rec_a[NFFS_TEST_CONC_REC_LEN];
+    static char rec_b[NFFS_TEST_CONC_REC_LEN];
+    char *rec;
+    int rc;
+
+    rec = c == 'a' ? rec_a : rec_b;
+    memset(rec, c, NFFS_TEST_CONC_REC_LEN);
+
+    rc = fs_write(file, rec, NFFS_TEST_CONC_REC_LEN);
+    TEST_ASSERT(rc == 0);
+}
+
+/**
+ * Reads a small file each time logger A starts an append.  A log length that
+ * is not a whole number of records indicates that the read completed in the
+ * middle of A's append; with a single global lock, it would have to wait for
+ * the entire append.
+ */
+static void
+nffs_test_conc_reader_handler(void *arg)
+{
+    char buf[NFFS_TEST_CONC_SMALL_LEN];
+    struct fs_file *small;
+    struct fs_file *log;
+    uint32_t bytes_read;
+    uint32_t log_len;
+    int rc;
+
+    rc = fs_open("/small", FS_ACCESS_READ, &small);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_open("/log", FS_ACCESS_READ, &log);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    while (1) {
+        os_sem_pend(&nffs_test_conc_reader_sem, OS_TIMEOUT_NEVER);
+        if (nffs_test_conc_done) {
+            break;
+        }
+
+        rc = fs_seek(small, 0);
+        TEST_ASSERT(rc == 0);
+        rc = fs_read(small, sizeof buf, buf, &bytes_read);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(bytes_read == sizeof buf);
+        TEST_ASSERT(memcmp(buf, nffs_test_conc_small, sizeof buf) == 0);
+
+        rc = fs_filelen(log, &log_len);
+        TEST_ASSERT(rc == 0);
+        if (log_len % NFFS_TEST_CONC_REC_LEN != 0) {
+            nffs_test_conc_reads_during_write++;
+        }
+    }
+
+    rc = fs_close(log);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(small);
+    TEST_ASSERT(rc == 0);
+
+    while (1) {
+        os_sem_pend(&nffs_test_conc_reader_sem, OS_TIMEOUT_NEVER);
+    }
+}
+
+/**
+ * Appends a record to the log through its own file handle each time logger A
+ * starts an append.  The record must not be interleaved with A's.
+ */
+static void
+nffs_test_conc_log_b_handler(void *arg)
+{
+    struct fs_file *file;
+    int rc;
+    int i;
+
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < NFFS_TEST_CONC_B_RECS; i++) {
+        os_sem_pend(&nffs_test_conc_log_b_sem, OS_TIMEOUT_NEVER);
+        nffs_test_conc_append_rec(file, 'b');
+    }
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    while (1) {
+        os_sem_pend(&nffs_test_conc_log_b_sem, OS_TIMEOUT_NEVER);
+    }
+}
+
+static void
+nffs_test_conc_log_a_handler(void *arg)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t len;
+    char *buf;
+    int num_b;
+    int rc;
+    int i;
+    int j;
+
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < NFFS_TEST_CONC_A_RECS; i++) {
+        nffs_test_conc_kick = 1;
+        nffs_test_conc_append_rec(file, 'a');
+    }
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_conc_done = 1;
+    os_sem_release(&nffs_test_conc_reader_sem);
+    nffs_crc16_set_hw(NULL);
+
+    /* The reader was never held up for a whole append. */
+    TEST_ASSERT(nffs_test_conc_reads_during_write == NFFS_TEST_CONC_A_RECS);
+
+    /* Each append is atomic: the log consists of whole, uninterleaved
+     * records.
+     */
+    rc = fs_open("/log", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_filelen(file, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == (NFFS_TEST_CONC_A_RECS + NFFS_TEST_CONC_B_RECS) *
+                       NFFS_TEST_CONC_REC_LEN);
+
+    buf = malloc(len);
+    TEST_ASSERT_FATAL(buf != NULL);
+
+    rc = fs_read(file, len, buf, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == len);
+
+    num_b = 0;
+    for (i = 0; i < len; i += NFFS_TEST_CONC_REC_LEN) {
+        TEST_ASSERT(buf[i] == 'a' || buf[i] == 'b');
+        for (j = 1; j < NFFS_TEST_CONC_REC_LEN; j++) {
+            if (buf[i + j] != buf[i]) {
+                break;
+            }
+        }
+        TEST_ASSERT(j == NFFS_TEST_CONC_REC_LEN);
+
+        if (buf[i] == 'b') {
+            num_b++;
+        }
+    }
+    TEST_ASSERT(num_b == NFFS_TEST_CONC_B_RECS);
+
+    free(buf);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_assert_contents("/small", nffs_test_conc_small,
+                                   sizeof nffs_test_conc_small);
+
+    tu_restart();
+}
+
+TEST_CASE(nffs_test_concurrent)
+{
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < sizeof nffs_test_conc_small; i++) {
+        nffs_test_conc_small[i] = i;
+    }
+    nffs_test_util_create_file("/small", nffs_test_conc_small,
+                               sizeof nffs_test_conc_small);
+    nffs_test_util_create_file("/log", "", 0);
+
+    nffs_test_conc_kick = 0;
+    nffs_test_conc_reads_during_write = 0;
+    nffs_test_conc_done = 0;
+    nffs_crc16_set_hw(nffs_test_conc_crc16);
+
+    os_init();
+
+    os_sem_init(&nffs_test_conc_reader_sem, 0);
+    os_sem_init(&nffs_test_conc_log_b_sem, 0);
+
+    os_task_init(&nffs_test_conc_reader_task, "reader",
+                 nffs_test_conc_reader_handler, NULL,
+                 NFFS_TEST_CONC_READER_PRIO, OS_WAIT_FOREVER,
+                 nffs_test_conc_reader_stack, NFFS_TEST_CONC_STACK_SIZE);
+    os_task_init(&nffs_test_conc_log_b_task, "log_b",
+                 nffs_test_conc_log_b_handler, NULL,
+                 NFFS_TEST_CONC_LOG_B_PRIO, OS_WAIT_FOREVER,
+                 nffs_test_conc_log_b_stack, NFFS_TEST_CONC_STACK_SIZE);
+    os_task_init(&nffs_test_conc_log_a_task, "log_a",
+                 nffs_test_conc_log_a_handler, NULL,
+                 NFFS_TEST_CONC_LOG_A_PRIO, OS_WAIT_FOREVER,
+                 nffs_test_conc_log_a_stack, NFFS_TEST_CONC_STACK_SIZE);
+
+    os_start();
+}
+
+/*** Asynchronous requests. */
+
+#define NFFS_TEST_ASYNC_PRIO        3
+#define NFFS_TEST_ASYNC_FS_PRIO     4
+#define NFFS_TEST_ASYNC_NUM_WRITES  5
+#define NFFS_TEST_ASYNC_WRITE_LEN   20
+
+static struct os_task nffs_test_async_task;
+static os_stack_t nffs_test_async_stack[NFFS_TEST_CONC_STACK_SIZE];
+static os_stack_t nffs_test_async_fs_stack[NFFS_TEST_CONC_STACK_SIZE];
+static struct os_eventq nffs_test_async_evq;
+static int nffs_test_async_cb_count;
+
+static void
+nffs_test_async_cb(struct fs_async_req *req, void *arg)
+{
+    TEST_ASSERT(arg == &nffs_test_async_cb_count);
+    TEST_ASSERT(req->far_rc == 0);
+    TEST_ASSERT(!req->far_pending);
+    nffs_test_async_cb_count++;
+}
+
+/**
+ * Waits for the specified request's completion event.
+ */
+static void
+nffs_test_async_wait(struct fs_async_req *req)
+{
+    struct os_event *ev;
+
+    ev = os_eventq_get(&nffs_test_async_evq);
+    TEST_ASSERT_FATAL(ev == &req->far_ev);
+    TEST_ASSERT(ev->ev_type == FS_ASYNC_EVENT_T_DONE);
+    TEST_ASSERT(ev->ev_arg == req);
+    TEST_ASSERT(!req->far_pending);
+}
+
+static void
+nffs_test_async_handler(void *arg)
+{
+    static struct fs_async_req writes[NFFS_TEST_ASYNC_NUM_WRITES];
+    static char data[NFFS_TEST_ASYNC_NUM_WRITES * NFFS_TEST_ASYNC_WRITE_LEN];
+    static char buf[sizeof data + 10];
+    struct fs_async_req req;
+    struct fs_file *file;
+    int rc;
+    int i;
+
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+
+    /*** Open. */
+    fs_async_req_init(&req, NULL, NULL, &nffs_test_async_evq);
+    rc = fs_async_open(&req, "/async.bin", FS_ACCESS_WRITE);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(req.far_pending);
+
+    /* A pending request cannot be resubmitted. */
+    rc = fs_async_open(&req, "/async.bin", FS_ACCESS_WRITE);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    nffs_test_async_wait(&req);
+    TEST_ASSERT_FATAL(req.far_rc == 0);
+    TEST_ASSERT_FATAL(req.far_file != NULL);
+    file = req.far_file;
+
+    /*** Queue several writes; the fs task combines them into one. */
+    nffs_test_async_cb_count = 0;
+    for (i = 0; i < NFFS_TEST_ASYNC_NUM_WRITES; i++) {
+        if (i < NFFS_TEST_ASYNC_NUM_WRITES - 1) {
+            fs_async_req_init(writes + i, nffs_test_async_cb,
+                              &nffs_test_async_cb_count, NULL);
+        } else {
+            fs_async_req_init(writes + i, NULL, NULL, &nffs_test_async_evq);
+        }
+        rc = fs_async_write(writes + i, file,
+                            data + i * NFFS_TEST_ASYNC_WRITE_LEN,
+                            NFFS_TEST_ASYNC_WRITE_LEN);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    nffs_test_async_wait(writes + NFFS_TEST_ASYNC_NUM_WRITES - 1);
+    TEST_ASSERT(writes[NFFS_TEST_ASYNC_NUM_WRITES - 1].far_rc == 0);
+    TEST_ASSERT(nffs_test_async_cb_count == NFFS_TEST_ASYNC_NUM_WRITES - 1);
+
+    /*** Close. */
+    rc = fs_async_close(&req, file);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_async_wait(&req);
+    TEST_ASSERT(req.far_rc == 0);
+
+    nffs_test_util_assert_contents("/async.bin", data, sizeof data);
+    TEST_ASSERT(nffs_test_util_block_count("/async.bin") == 1);
+
+    /*** Read. */
+    rc = fs_open("/async.bin", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_async_read(&req, file, buf, sizeof buf);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_async_wait(&req);
+    TEST_ASSERT(req.far_rc == 0);
+    TEST_ASSERT(req.far_out_len == sizeof data);
+    TEST_ASSERT(memcmp(buf, data, sizeof data) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Unlink. */
+    rc = fs_async_unlink(&req, "/async.bin");
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_async_wait(&req);
+    TEST_ASSERT(req.far_rc == 0);
+
+    rc = fs_open("/async.bin", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /*** Errors are reported through the request. */
+    rc = fs_async_unlink(&req, "/async.bin");
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_async_wait(&req);
+    TEST_ASSERT(req.far_rc == FS_ENOENT);
+
+    tu_restart();
+}
+
+TEST_CASE(nffs_test_async)
+{
+    struct fs_async_req req;
+    int rc;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    os_init();
+
+    /* A request needs a means of completion. */
+    fs_async_req_init(&req, NULL, NULL, NULL);
+    rc = fs_async_task_init(NFFS_TEST_ASYNC_FS_PRIO, nffs_test_async_fs_stack,
+                            NFFS_TEST_CONC_STACK_SIZE, 256);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_async_unlink(&req, "/x");
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    os_eventq_init(&nffs_test_async_evq);
+    os_task_init(&nffs_test_async_task, "async", nffs_test_async_handler, NULL,
+                 NFFS_TEST_ASYNC_PRIO, OS_WAIT_FOREVER, nffs_test_async_stack,
+                 NFFS_TEST_CONC_STACK_SIZE);
+
+    os_start();
+}
+
+/**
+ * Reports the RAM taken by the inode and block entry pools and the hash
+ * index for a few pool sizes, and checks that the index stays compact.
+ */
+TEST_CASE(nffs_test_footprint)
+{
+    static const uint32_t sizes[][2] = {
+        { 100, 100 },
+        { 256, 1024 },
+        { 1024, 4096 },
+    };
+    uint32_t saved_inodes;
+    uint32_t saved_blocks;
+    uint32_t inode_bytes;
+    uint32_t block_bytes;
+    uint32_t index_bytes;
+    uint32_t objects;
+    uint32_t total;
+    int rc;
+    int i;
+
+    /* A block entry is just its ID and flash location. */
+    TEST_ASSERT(sizeof (struct nffs_hash_entry) == 8);
+
+    saved_inodes = nffs_config.nc_num_inodes;
+    saved_blocks = nffs_config.nc_num_blocks;
+
+    printf("inode entry: %d bytes; block entry: %d bytes\n",
+           (int)OS_MEMPOOL_BYTES(1, sizeof (struct nffs_inode_entry)),
+           (int)OS_MEMPOOL_BYTES(1, sizeof (struct nffs_hash_entry)));
+    printf("%6s %6s %8s %8s %8s %8s %10s\n", "inodes", "blocks", "inode-B",
+           "block-B", "index-B", "total-B", "B/object");
+
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        nffs_config.nc_num_inodes = sizes[i][0];
+        nffs_config.nc_num_blocks = sizes[i][1];
+        rc = nffs_init();
+        TEST_ASSERT_FATAL(rc == 0);
+
+        objects = sizes[i][0] + sizes[i][1];
+        inode_bytes = OS_MEMPOOL_BYTES(sizes[i][0],
+                                       sizeof (struct nffs_inode_entry));
+        block_bytes = OS_MEMPOOL_BYTES(sizes[i][1],
+                                       sizeof (struct nffs_hash_entry));
+        index_bytes = nffs_hash_num_slots * sizeof *nffs_hash +
+                      nffs_hash_max_handle / 8 + 1;
+        total = inode_bytes + block_bytes + index_bytes;
+
+        /* 1.25 16-bit slots per object, plus one liveness bit. */
+        TEST_ASSERT(nffs_hash_num_slots <= objects + objects / 4 + 1);
+        TEST_ASSERT(index_bytes <= objects * 21 / 8 + 4);
+
+        printf("%6lu %6lu %8lu %8lu %8lu %8lu %10.1f\n",
+               (unsigned long)sizes[i][0], (unsigned long)sizes[i][1],
+               (unsigned long)inode_bytes, (unsigned long)block_bytes,
+               (unsigned long)index_bytes, (unsigned long)total,
+               (double)total / objects);
+    }
+
+    nffs_config.nc_num_inodes = saved_inodes;
+    nffs_config.nc_num_blocks = saved_blocks;
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_SUITE(nffs_suite_footprint)
+{
+    nffs_test_footprint();
+}
+
 TEST_SUITE(nffs_suite_cache)
 {
     int rc;
@@ -2373,6 +4313,7 @@ TEST_SUITE(nffs_suite_cache)
     TEST_ASSERT(rc == 0);
 
     nffs_test_cache_large_file();
+    nffs_test_cache_data();
 }
 
 static void
@@ -2396,9 +4337,18 @@ nffs_test_gen(void)
     nffs_test_overwrite_many();
     nffs_test_long_filename();
     nffs_test_large_write();
+    nffs_test_large_blocks();
     nffs_test_many_children();
+    nffs_test_hash();
+    nffs_test_compress();
     nffs_test_gc();
+    nffs_test_gc_select();
+    nffs_test_gc_incr();
+    nffs_test_gc_overwrite();
     nffs_test_wear_level();
+    nffs_test_wear_stats();
+    nffs_test_statvfs();
+    nffs_test_cached_len();
     nffs_test_corrupt_scratch();
     nffs_test_incomplete_block();
     nffs_test_corrupt_block();
@@ -2406,12 +4356,18 @@ nffs_test_gen(void)
     nffs_test_large_system();
     nffs_test_lost_found();
     nffs_test_readdir();
+    nffs_test_dir_lookup();
+    nffs_test_mbuf();
+    nffs_test_crc16();
+    nffs_test_concurrent();
+    nffs_test_async();
 }
 
 TEST_SUITE(gen_1_1)
 {
     nffs_config.nc_num_cache_inodes = 1;
     nffs_config.nc_num_cache_blocks = 1;
+    nffs_config.nc_num_cache_names = 0;
     nffs_test_gen();
 }
 
@@ -2419,6 +4375,7 @@ TEST_SUITE(gen_4_32)
 {
     nffs_config.nc_num_cache_inodes = 4;
     nffs_config.nc_num_cache_blocks = 32;
+    nffs_config.nc_num_cache_names = 4;
     nffs_test_gen();
 }
 
@@ -2426,6 +4383,7 @@ TEST_SUITE(gen_32_1024)
 {
     nffs_config.nc_num_cache_inodes = 32;
     nffs_config.nc_num_cache_blocks = 1024;
+    nffs_config.nc_num_cache_names = 32;
     nffs_test_gen();
 }
 
@@ -2436,6 +4394,7 @@ nffs_test_all(void)
     gen_4_32();
     gen_32_1024();
     nffs_suite_cache();
+    nffs_suite_footprint();
 
     return tu_any_failed;
 }
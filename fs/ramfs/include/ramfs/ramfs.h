@@ -0,0 +1,40 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_RAMFS_
+#define H_RAMFS_
+
+#include <inttypes.h>
+
+#define RAMFS_FILENAME_MAX_LEN  255
+
+struct ramfs_config {
+    /**
+     * Maximum number of bytes of file data held in RAM; 0=unlimited;
+     * default=0.  Writes that would exceed the limit fail with FS_EFULL.
+     */
+    uint32_t rc_max_bytes;
+};
+
+extern struct ramfs_config ramfs_config;
+
+int ramfs_init(const char *mount_point);
+uint32_t ramfs_bytes_used(void);
+
+#endif
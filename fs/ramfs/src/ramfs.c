@@ -0,0 +1,1061 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * A RAM-backed filesystem for transient data: temporary uploads, caches and
+ * the like.  Files and directories are heap-allocated nodes; file contents
+ * live in a single buffer per file which grows as data is written.  Nothing
+ * survives a reset, and nothing ever touches flash.
+ *
+ * ramfs is meant to be mounted beside a persistent filesystem; e.g.,
+ * ramfs_init("/tmp") with nffs at the root.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "os/os.h"
+#include "os/queue.h"
+#include "fs/fs.h"
+#include "fs/fs_if.h"
+#include "ramfs/ramfs.h"
+
+#define RAMFS_MIN_CAP           64
+
+struct ramfs_node {
+    SLIST_ENTRY(ramfs_node) rn_next;
+    SLIST_HEAD(, ramfs_node) rn_children;
+
+    /* NULL for the root and for unlinked nodes. */
+    struct ramfs_node *rn_parent;
+
+    char *rn_name;
+    uint8_t *rn_data;
+    uint32_t rn_len;
+    uint32_t rn_cap;
+
+    /* Open files, directories and directory entries referring to this node.
+     * An unlinked node is freed when its last reference is dropped.
+     */
+    uint16_t rn_refcnt;
+    uint8_t rn_name_len;
+    uint8_t rn_is_dir;
+};
+
+struct ramfs_file {
+    const struct fs_ops *rf_fops;   /* Must be first; see FS_HANDLE_OPS. */
+    struct ramfs_node *rf_node;
+    uint32_t rf_offset;
+    uint8_t rf_access_flags;
+};
+
+struct ramfs_dirent {
+    const struct fs_ops *rde_fops;  /* Must be first; see FS_HANDLE_OPS. */
+    struct ramfs_node *rde_node;
+};
+
+struct ramfs_dir {
+    const struct fs_ops *rd_fops;   /* Must be first; see FS_HANDLE_OPS. */
+    struct ramfs_node *rd_node;
+    uint32_t rd_idx;                /* Index of the next child to read. */
+    struct ramfs_dirent rd_dirent;
+};
+
+struct ramfs_config ramfs_config;
+
+static struct ramfs_node *ramfs_root;
+static uint32_t ramfs_used;
+static struct os_mutex ramfs_mutex;
+static char ramfs_mount_point[FS_MOUNT_POINT_MAX_LEN + 1];
+
+static int ramfs_open(const char *path, uint8_t access_flags,
+  struct fs_file **out_file);
+static int ramfs_close(struct fs_file *fs_file);
+static int ramfs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
+  uint32_t *out_len);
+static int ramfs_write(struct fs_file *fs_file, const void *data, int len);
+static int ramfs_read_mbuf(struct fs_file *fs_file, uint32_t len,
+  struct os_mbuf *om, uint32_t *out_len);
+static int ramfs_write_mbuf(struct fs_file *fs_file, const struct os_mbuf *om,
+  int off, int len);
+static int ramfs_seek(struct fs_file *fs_file, uint32_t offset);
+static uint32_t ramfs_getpos(const struct fs_file *fs_file);
+static int ramfs_file_len(const struct fs_file *fs_file, uint32_t *out_len);
+static int ramfs_unlink(const char *path);
+static int ramfs_rename(const char *from, const char *to);
+static int ramfs_mkdir(const char *path);
+static int ramfs_opendir(const char *path, struct fs_dir **out_fs_dir);
+static int ramfs_readdir(struct fs_dir *fs_dir,
+  struct fs_dirent **out_fs_dirent);
+static int ramfs_closedir(struct fs_dir *fs_dir);
+static int ramfs_dirent_name(const struct fs_dirent *fs_dirent,
+  size_t max_len, char *out_name, uint8_t *out_name_len);
+static int ramfs_dirent_is_dir(const struct fs_dirent *fs_dirent);
+static int ramfs_statvfs(struct fs_statvfs *out_stat);
+
+static const struct fs_ops ramfs_ops = {
+    .f_open = ramfs_open,
+    .f_close = ramfs_close,
+    .f_read = ramfs_read,
+    .f_write = ramfs_write,
+    .f_read_mbuf = ramfs_read_mbuf,
+    .f_write_mbuf = ramfs_write_mbuf,
+
+    .f_seek = ramfs_seek,
+    .f_getpos = ramfs_getpos,
+    .f_filelen = ramfs_file_len,
+
+    .f_unlink = ramfs_unlink,
+    .f_rename = ramfs_rename,
+    .f_mkdir = ramfs_mkdir,
+
+    .f_opendir = ramfs_opendir,
+    .f_readdir = ramfs_readdir,
+    .f_closedir = ramfs_closedir,
+
+    .f_dirent_name = ramfs_dirent_name,
+    .f_dirent_is_dir = ramfs_dirent_is_dir,
+
+    .f_statvfs = ramfs_statvfs,
+
+    .f_name = "ramfs"
+};
+
+static void
+ramfs_lock(void)
+{
+    int rc;
+
+    rc = os_mutex_pend(&ramfs_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static void
+ramfs_unlock(void)
+{
+    int rc;
+
+    rc = os_mutex_release(&ramfs_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static struct ramfs_node *
+ramfs_node_alloc(const char *name, int name_len, int is_dir)
+{
+    struct ramfs_node *node;
+
+    node = malloc(sizeof *node);
+    if (node == NULL) {
+        return NULL;
+    }
+    memset(node, 0, sizeof *node);
+
+    node->rn_name = malloc(name_len + 1);
+    if (node->rn_name == NULL) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->rn_name, name, name_len);
+    node->rn_name[name_len] = '\0';
+    node->rn_name_len = name_len;
+    node->rn_is_dir = is_dir;
+    SLIST_INIT(&node->rn_children);
+
+    return node;
+}
+
+static void
+ramfs_node_free(struct ramfs_node *node)
+{
+    ramfs_used -= node->rn_cap;
+    free(node->rn_data);
+    free(node->rn_name);
+    free(node);
+}
+
+static void
+ramfs_node_add_child(struct ramfs_node *parent, struct ramfs_node *child)
+{
+    child->rn_parent = parent;
+    SLIST_INSERT_HEAD(&parent->rn_children, child, rn_next);
+}
+
+/**
+ * Detaches a node from the tree.  Directories are emptied recursively.
+ * Nodes without references are freed immediately; the rest are freed when
+ * their last reference goes away.
+ */
+static void
+ramfs_node_unlink(struct ramfs_node *node)
+{
+    struct ramfs_node *child;
+
+    while ((child = SLIST_FIRST(&node->rn_children)) != NULL) {
+        ramfs_node_unlink(child);
+    }
+
+    if (node->rn_parent != NULL) {
+        SLIST_REMOVE(&node->rn_parent->rn_children, node, ramfs_node,
+                     rn_next);
+        node->rn_parent = NULL;
+    }
+
+    if (node->rn_refcnt == 0) {
+        ramfs_node_free(node);
+    }
+}
+
+static void
+ramfs_node_release(struct ramfs_node *node)
+{
+    assert(node->rn_refcnt > 0);
+    node->rn_refcnt--;
+
+    if (node->rn_refcnt == 0 && node->rn_parent == NULL &&
+        node != ramfs_root) {
+
+        ramfs_node_free(node);
+    }
+}
+
+static struct ramfs_node *
+ramfs_node_find_child(const struct ramfs_node *dir, const char *name,
+                      int name_len)
+{
+    struct ramfs_node *child;
+
+    SLIST_FOREACH(child, &dir->rn_children, rn_next) {
+        if (child->rn_name_len == name_len &&
+            memcmp(child->rn_name, name, name_len) == 0) {
+
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Resolves a path.
+ *
+ * @param path                  The absolute path to resolve.
+ * @param out_node              On success, the node the path refers to.
+ * @param out_parent            The directory containing the final path
+ *                                  component, if that directory exists;
+ *                                  NULL otherwise, and for the root.
+ * @param out_leaf              The final path component; not
+ *                                  null-terminated.
+ * @param out_leaf_len          The length of the final path component.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if the path does not exist;
+ *                              FS_EINVAL if the path is malformed.
+ */
+static int
+ramfs_path_find(const char *path, struct ramfs_node **out_node,
+                struct ramfs_node **out_parent, const char **out_leaf,
+                int *out_leaf_len)
+{
+    struct ramfs_node *child;
+    struct ramfs_node *cur;
+    const char *end;
+    int len;
+
+    *out_node = NULL;
+    *out_parent = NULL;
+    *out_leaf = NULL;
+    *out_leaf_len = 0;
+
+    if (path[0] != '/') {
+        return FS_EINVAL;
+    }
+    if (path[1] == '\0') {
+        *out_node = ramfs_root;
+        return 0;
+    }
+
+    cur = ramfs_root;
+    path++;
+    while (1) {
+        end = strchr(path, '/');
+        if (end == NULL) {
+            end = path + strlen(path);
+        }
+        len = end - path;
+        if (len == 0 || len > RAMFS_FILENAME_MAX_LEN) {
+            return FS_EINVAL;
+        }
+
+        child = ramfs_node_find_child(cur, path, len);
+        if (*end == '\0') {
+            *out_parent = cur;
+            *out_leaf = path;
+            *out_leaf_len = len;
+            if (child == NULL) {
+                return FS_ENOENT;
+            }
+            *out_node = child;
+            return 0;
+        }
+
+        if (child == NULL || !child->rn_is_dir) {
+            return FS_ENOENT;
+        }
+        cur = child;
+        path = end + 1;
+    }
+}
+
+/**
+ * Ensures a file's buffer can hold the specified number of bytes.  The
+ * buffer grows geometrically so that a series of small writes is cheap.
+ *
+ * @return                      0 on success;
+ *                              FS_EFULL if the ramfs size limit would be
+ *                                  exceeded;
+ *                              FS_ENOMEM if the heap is exhausted.
+ */
+static int
+ramfs_node_reserve(struct ramfs_node *node, uint32_t len)
+{
+    uint32_t new_cap;
+    uint8_t *data;
+
+    if (len <= node->rn_cap) {
+        return 0;
+    }
+
+    new_cap = node->rn_cap * 2;
+    if (new_cap < RAMFS_MIN_CAP) {
+        new_cap = RAMFS_MIN_CAP;
+    }
+    if (new_cap < len) {
+        new_cap = len;
+    }
+
+    if (ramfs_config.rc_max_bytes != 0 &&
+        ramfs_used - node->rn_cap + new_cap > ramfs_config.rc_max_bytes) {
+
+        new_cap = len;
+        if (ramfs_used - node->rn_cap + new_cap > ramfs_config.rc_max_bytes) {
+            return FS_EFULL;
+        }
+    }
+
+    data = realloc(node->rn_data, new_cap);
+    if (data == NULL) {
+        return FS_ENOMEM;
+    }
+
+    ramfs_used += new_cap - node->rn_cap;
+    node->rn_data = data;
+    node->rn_cap = new_cap;
+
+    return 0;
+}
+
+/**
+ * Opens a file, creating it if it does not exist and write access was
+ * requested.  Access flags are interpreted as they are by nffs.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+ramfs_open(const char *path, uint8_t access_flags, struct fs_file **out_file)
+{
+    struct ramfs_node *parent;
+    struct ramfs_node *node;
+    struct ramfs_file *file;
+    const char *leaf;
+    int leaf_len;
+    int rc;
+
+    *out_file = NULL;
+
+    if (!(access_flags & (FS_ACCESS_READ | FS_ACCESS_WRITE))) {
+        return FS_EINVAL;
+    }
+    if (access_flags & (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE) &&
+        !(access_flags & FS_ACCESS_WRITE)) {
+
+        return FS_EINVAL;
+    }
+    if (access_flags & FS_ACCESS_APPEND &&
+        access_flags & FS_ACCESS_TRUNCATE) {
+
+        return FS_EINVAL;
+    }
+
+    file = malloc(sizeof *file);
+    if (file == NULL) {
+        return FS_ENOMEM;
+    }
+
+    ramfs_lock();
+
+    rc = ramfs_path_find(path, &node, &parent, &leaf, &leaf_len);
+    if (rc == FS_ENOENT && parent != NULL) {
+        if (!(access_flags & FS_ACCESS_WRITE)) {
+            goto err;
+        }
+        node = ramfs_node_alloc(leaf, leaf_len, 0);
+        if (node == NULL) {
+            rc = FS_ENOMEM;
+            goto err;
+        }
+        ramfs_node_add_child(parent, node);
+    } else if (rc == 0) {
+        if (node->rn_is_dir) {
+            rc = FS_EINVAL;
+            goto err;
+        }
+        if (access_flags & FS_ACCESS_TRUNCATE) {
+            node->rn_len = 0;
+        }
+    } else {
+        goto err;
+    }
+
+    node->rn_refcnt++;
+    file->rf_fops = &ramfs_ops;
+    file->rf_node = node;
+    file->rf_access_flags = access_flags;
+    if (access_flags & FS_ACCESS_APPEND) {
+        file->rf_offset = node->rn_len;
+    } else {
+        file->rf_offset = 0;
+    }
+
+    ramfs_unlock();
+
+    *out_file = (struct fs_file *)file;
+    return 0;
+
+err:
+    ramfs_unlock();
+    free(file);
+    return rc;
+}
+
+static int
+ramfs_close(struct fs_file *fs_file)
+{
+    struct ramfs_file *file;
+
+    file = (struct ramfs_file *)fs_file;
+    if (file == NULL) {
+        return 0;
+    }
+
+    ramfs_lock();
+    ramfs_node_release(file->rf_node);
+    ramfs_unlock();
+
+    free(file);
+    return 0;
+}
+
+static int
+ramfs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
+           uint32_t *out_len)
+{
+    struct ramfs_file *file;
+    struct ramfs_node *node;
+
+    file = (struct ramfs_file *)fs_file;
+    if (!(file->rf_access_flags & FS_ACCESS_READ)) {
+        return FS_EACCESS;
+    }
+
+    ramfs_lock();
+
+    node = file->rf_node;
+    if (file->rf_offset >= node->rn_len) {
+        len = 0;
+    } else if (len > node->rn_len - file->rf_offset) {
+        len = node->rn_len - file->rf_offset;
+    }
+    memcpy(out_data, node->rn_data + file->rf_offset, len);
+    file->rf_offset += len;
+
+    ramfs_unlock();
+
+    if (out_len != NULL) {
+        *out_len = len;
+    }
+    return 0;
+}
+
+/**
+ * Prepares a file for a write of the specified length: positions the file
+ * for append mode and grows its buffer.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+ramfs_write_prep(struct ramfs_file *file, uint32_t len)
+{
+    struct ramfs_node *node;
+    int rc;
+
+    if (!(file->rf_access_flags & FS_ACCESS_WRITE)) {
+        return FS_EACCESS;
+    }
+
+    node = file->rf_node;
+    if (file->rf_access_flags & FS_ACCESS_APPEND) {
+        file->rf_offset = node->rn_len;
+    }
+
+    rc = ramfs_node_reserve(node, file->rf_offset + len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+static void
+ramfs_write_done(struct ramfs_file *file, uint32_t len)
+{
+    file->rf_offset += len;
+    if (file->rf_offset > file->rf_node->rn_len) {
+        file->rf_node->rn_len = file->rf_offset;
+    }
+}
+
+static int
+ramfs_write(struct fs_file *fs_file, const void *data, int len)
+{
+    struct ramfs_file *file;
+    int rc;
+
+    if (len < 0) {
+        return FS_EINVAL;
+    }
+
+    file = (struct ramfs_file *)fs_file;
+
+    ramfs_lock();
+
+    rc = ramfs_write_prep(file, len);
+    if (rc == 0) {
+        memcpy(file->rf_node->rn_data + file->rf_offset, data, len);
+        ramfs_write_done(file, len);
+    }
+
+    ramfs_unlock();
+
+    return rc;
+}
+
+static int
+ramfs_read_mbuf(struct fs_file *fs_file, uint32_t len, struct os_mbuf *om,
+                uint32_t *out_len)
+{
+    struct ramfs_file *file;
+    struct ramfs_node *node;
+    int rc;
+
+    file = (struct ramfs_file *)fs_file;
+    if (!(file->rf_access_flags & FS_ACCESS_READ)) {
+        return FS_EACCESS;
+    }
+
+    ramfs_lock();
+
+    node = file->rf_node;
+    if (file->rf_offset >= node->rn_len) {
+        len = 0;
+    } else if (len > node->rn_len - file->rf_offset) {
+        len = node->rn_len - file->rf_offset;
+    }
+
+    rc = os_mbuf_append(om, node->rn_data + file->rf_offset, len);
+    if (rc != 0) {
+        rc = FS_ENOMEM;
+        len = 0;
+    } else {
+        file->rf_offset += len;
+    }
+
+    ramfs_unlock();
+
+    if (out_len != NULL) {
+        *out_len = len;
+    }
+    return rc;
+}
+
+static int
+ramfs_write_mbuf(struct fs_file *fs_file, const struct os_mbuf *om, int off,
+                 int len)
+{
+    struct ramfs_file *file;
+    int rc;
+
+    if (off < 0 || len < 0) {
+        return FS_EINVAL;
+    }
+
+    file = (struct ramfs_file *)fs_file;
+
+    ramfs_lock();
+
+    rc = ramfs_write_prep(file, len);
+    if (rc == 0) {
+        rc = os_mbuf_copydata(om, off, len,
+                              file->rf_node->rn_data + file->rf_offset);
+        if (rc != 0) {
+            rc = FS_EINVAL;
+        } else {
+            ramfs_write_done(file, len);
+        }
+    }
+
+    ramfs_unlock();
+
+    return rc;
+}
+
+static int
+ramfs_seek(struct fs_file *fs_file, uint32_t offset)
+{
+    struct ramfs_file *file;
+    int rc;
+
+    file = (struct ramfs_file *)fs_file;
+
+    ramfs_lock();
+    if (offset > file->rf_node->rn_len) {
+        rc = FS_ERANGE;
+    } else {
+        file->rf_offset = offset;
+        rc = 0;
+    }
+    ramfs_unlock();
+
+    return rc;
+}
+
+static uint32_t
+ramfs_getpos(const struct fs_file *fs_file)
+{
+    return ((const struct ramfs_file *)fs_file)->rf_offset;
+}
+
+static int
+ramfs_file_len(const struct fs_file *fs_file, uint32_t *out_len)
+{
+    const struct ramfs_file *file;
+
+    file = (const struct ramfs_file *)fs_file;
+
+    ramfs_lock();
+    *out_len = file->rf_node->rn_len;
+    ramfs_unlock();
+
+    return 0;
+}
+
+/**
+ * Unlinks a file or directory; directories are removed along with their
+ * contents.  Open handles remain usable until they are closed.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+ramfs_unlink(const char *path)
+{
+    struct ramfs_node *parent;
+    struct ramfs_node *node;
+    const char *leaf;
+    int leaf_len;
+    int rc;
+
+    ramfs_lock();
+
+    rc = ramfs_path_find(path, &node, &parent, &leaf, &leaf_len);
+    if (rc == 0) {
+        if (node == ramfs_root) {
+            rc = FS_EINVAL;
+        } else {
+            ramfs_node_unlink(node);
+        }
+    }
+
+    ramfs_unlock();
+
+    return rc;
+}
+
+/**
+ * Renames a file or directory.  An existing destination of the same type is
+ * replaced.
+ *
+ * @return                      0 on success;
+ *                              FS_EINVAL if the source and destination are
+ *                                  of different types, or if a directory
+ *                                  would be moved into itself;
+ *                              other nonzero on failure.
+ */
+static int
+ramfs_rename(const char *from, const char *to)
+{
+    struct ramfs_node *from_parent;
+    struct ramfs_node *to_parent;
+    struct ramfs_node *from_node;
+    struct ramfs_node *to_node;
+    struct ramfs_node *cur;
+    const char *leaf;
+    char *name;
+    int leaf_len;
+    int rc;
+
+    ramfs_lock();
+
+    rc = ramfs_path_find(from, &from_node, &from_parent, &leaf, &leaf_len);
+    if (rc != 0) {
+        goto done;
+    }
+    if (from_node == ramfs_root) {
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    rc = ramfs_path_find(to, &to_node, &to_parent, &leaf, &leaf_len);
+    if (rc == FS_ENOENT && to_parent == NULL) {
+        goto done;
+    }
+    if (rc != 0 && rc != FS_ENOENT) {
+        goto done;
+    }
+    if (to_node == from_node) {
+        rc = 0;
+        goto done;
+    }
+    if (to_node == ramfs_root ||
+        (to_node != NULL && to_node->rn_is_dir != from_node->rn_is_dir)) {
+
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    /* Neither node may contain the other. */
+    for (cur = to_parent; cur != NULL; cur = cur->rn_parent) {
+        if (cur == from_node) {
+            rc = FS_EINVAL;
+            goto done;
+        }
+    }
+    for (cur = from_parent; cur != NULL && to_node != NULL;
+         cur = cur->rn_parent) {
+
+        if (cur == to_node) {
+            rc = FS_EINVAL;
+            goto done;
+        }
+    }
+
+    name = malloc(leaf_len + 1);
+    if (name == NULL) {
+        rc = FS_ENOMEM;
+        goto done;
+    }
+    memcpy(name, leaf, leaf_len);
+    name[leaf_len] = '\0';
+
+    if (to_node != NULL) {
+        ramfs_node_unlink(to_node);
+    }
+
+    SLIST_REMOVE(&from_parent->rn_children, from_node, ramfs_node, rn_next);
+    free(from_node->rn_name);
+    from_node->rn_name = name;
+    from_node->rn_name_len = leaf_len;
+    ramfs_node_add_child(to_parent, from_node);
+    rc = 0;
+
+done:
+    ramfs_unlock();
+    return rc;
+}
+
+static int
+ramfs_mkdir(const char *path)
+{
+    struct ramfs_node *parent;
+    struct ramfs_node *node;
+    const char *leaf;
+    int leaf_len;
+    int rc;
+
+    ramfs_lock();
+
+    rc = ramfs_path_find(path, &node, &parent, &leaf, &leaf_len);
+    if (rc == 0) {
+        rc = FS_EEXIST;
+    } else if (rc == FS_ENOENT && parent != NULL) {
+        node = ramfs_node_alloc(leaf, leaf_len, 1);
+        if (node == NULL) {
+            rc = FS_ENOMEM;
+        } else {
+            ramfs_node_add_child(parent, node);
+            rc = 0;
+        }
+    }
+
+    ramfs_unlock();
+
+    return rc;
+}
+
+static int
+ramfs_opendir(const char *path, struct fs_dir **out_fs_dir)
+{
+    struct ramfs_node *parent;
+    struct ramfs_node *node;
+    struct ramfs_dir *dir;
+    const char *leaf;
+    int leaf_len;
+    int rc;
+
+    *out_fs_dir = NULL;
+
+    dir = malloc(sizeof *dir);
+    if (dir == NULL) {
+        return FS_ENOMEM;
+    }
+
+    ramfs_lock();
+
+    rc = ramfs_path_find(path, &node, &parent, &leaf, &leaf_len);
+    if (rc == 0 && !node->rn_is_dir) {
+        rc = FS_EINVAL;
+    }
+    if (rc == 0) {
+        node->rn_refcnt++;
+    }
+
+    ramfs_unlock();
+
+    if (rc != 0) {
+        free(dir);
+        return rc;
+    }
+
+    dir->rd_fops = &ramfs_ops;
+    dir->rd_node = node;
+    dir->rd_idx = 0;
+    dir->rd_dirent.rde_fops = &ramfs_ops;
+    dir->rd_dirent.rde_node = NULL;
+
+    *out_fs_dir = (struct fs_dir *)dir;
+    return 0;
+}
+
+/**
+ * Reads the next entry in an open directory.  Entries are located by
+ * position, so the directory may be modified while it is being read.
+ */
+static int
+ramfs_readdir(struct fs_dir *fs_dir, struct fs_dirent **out_fs_dirent)
+{
+    struct ramfs_node *child;
+    struct ramfs_dir *dir;
+    uint32_t i;
+
+    dir = (struct ramfs_dir *)fs_dir;
+
+    ramfs_lock();
+
+    if (dir->rd_dirent.rde_node != NULL) {
+        ramfs_node_release(dir->rd_dirent.rde_node);
+        dir->rd_dirent.rde_node = NULL;
+    }
+
+    i = 0;
+    SLIST_FOREACH(child, &dir->rd_node->rn_children, rn_next) {
+        if (i++ == dir->rd_idx) {
+            break;
+        }
+    }
+    if (child != NULL) {
+        child->rn_refcnt++;
+        dir->rd_dirent.rde_node = child;
+        dir->rd_idx++;
+    }
+
+    ramfs_unlock();
+
+    if (child == NULL) {
+        *out_fs_dirent = NULL;
+        return FS_ENOENT;
+    }
+
+    *out_fs_dirent = (struct fs_dirent *)&dir->rd_dirent;
+    return 0;
+}
+
+static int
+ramfs_closedir(struct fs_dir *fs_dir)
+{
+    struct ramfs_dir *dir;
+
+    dir = (struct ramfs_dir *)fs_dir;
+    if (dir == NULL) {
+        return 0;
+    }
+
+    ramfs_lock();
+    if (dir->rd_dirent.rde_node != NULL) {
+        ramfs_node_release(dir->rd_dirent.rde_node);
+    }
+    ramfs_node_release(dir->rd_node);
+    ramfs_unlock();
+
+    free(dir);
+    return 0;
+}
+
+static int
+ramfs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
+                  char *out_name, uint8_t *out_name_len)
+{
+    const struct ramfs_dirent *dirent;
+    const struct ramfs_node *node;
+    size_t len;
+
+    if (max_len == 0) {
+        return FS_EINVAL;
+    }
+
+    dirent = (const struct ramfs_dirent *)fs_dirent;
+
+    ramfs_lock();
+
+    node = dirent->rde_node;
+    len = node->rn_name_len;
+    if (len > max_len - 1) {
+        len = max_len - 1;
+    }
+    memcpy(out_name, node->rn_name, len);
+    out_name[len] = '\0';
+    if (out_name_len != NULL) {
+        *out_name_len = node->rn_name_len;
+    }
+
+    ramfs_unlock();
+
+    return 0;
+}
+
+static int
+ramfs_dirent_is_dir(const struct fs_dirent *fs_dirent)
+{
+    return ((const struct ramfs_dirent *)fs_dirent)->rde_node->rn_is_dir;
+}
+
+/**
+ * Reports the file data allocated so far against the configured limit.  With
+ * no limit, the total is reported as UINT32_MAX.  Nothing is ever dead.
+ */
+static int
+ramfs_statvfs(struct fs_statvfs *out_stat)
+{
+    uint32_t total;
+
+    ramfs_lock();
+
+    total = ramfs_config.rc_max_bytes;
+    if (total == 0) {
+        total = UINT32_MAX;
+    }
+
+    memset(out_stat, 0, sizeof *out_stat);
+    out_stat->fsv_total = total;
+    out_stat->fsv_live = ramfs_used;
+    if (ramfs_used < total) {
+        out_stat->fsv_free = total - ramfs_used;
+    }
+    out_stat->fsv_avail = out_stat->fsv_free;
+
+    ramfs_unlock();
+
+    return 0;
+}
+
+/**
+ * @return                      The number of bytes of file data currently
+ *                                  allocated.
+ */
+uint32_t
+ramfs_bytes_used(void)
+{
+    return ramfs_used;
+}
+
+/**
+ * Initializes ramfs and mounts it at the specified path.  Calling this again
+ * discards all existing files and remounts; any open handles must have been
+ * closed first.
+ *
+ * @param mount_point           Where to mount the filesystem; e.g., "/tmp".
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+ramfs_init(const char *mount_point)
+{
+    struct ramfs_node *child;
+    int rc;
+
+    if (strlen(mount_point) > FS_MOUNT_POINT_MAX_LEN) {
+        return FS_EINVAL;
+    }
+
+    if (ramfs_root != NULL) {
+        fs_unmount(ramfs_mount_point);
+        while ((child = SLIST_FIRST(&ramfs_root->rn_children)) != NULL) {
+            ramfs_node_unlink(child);
+        }
+        ramfs_node_free(ramfs_root);
+        ramfs_root = NULL;
+    }
+
+    rc = os_mutex_init(&ramfs_mutex);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    ramfs_root = ramfs_node_alloc("", 0, 1);
+    if (ramfs_root == NULL) {
+        return FS_ENOMEM;
+    }
+
+    rc = fs_mount(mount_point, &ramfs_ops);
+    if (rc != 0) {
+        ramfs_node_free(ramfs_root);
+        ramfs_root = NULL;
+        return rc;
+    }
+    strcpy(ramfs_mount_point, mount_point);
+
+    return 0;
+}
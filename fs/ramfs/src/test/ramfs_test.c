@@ -0,0 +1,355 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include "testutil/testutil.h"
+#include "fs/fs.h"
+#include "fs/fs_if.h"
+#include "ramfs/ramfs.h"
+
+static void
+ramfs_test_write_file(const char *path, const void *data, int len)
+{
+    struct fs_file *file;
+    int rc;
+
+    rc = fs_open(path, FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, data, len);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+static void
+ramfs_test_assert_contents(const char *path, const void *data, int len)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t file_len;
+    uint8_t buf[256];
+    int rc;
+
+    TEST_ASSERT_FATAL(len <= sizeof buf);
+
+    rc = fs_open(path, FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_filelen(file, &file_len);
+    TEST_ASSERT(rc == 0 && file_len == len);
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT(rc == 0 && bytes_read == len);
+    TEST_ASSERT(memcmp(buf, data, len) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(ramfs_test_rw)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint8_t buf[8];
+    int rc;
+
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    ramfs_test_write_file("/tmp/a", "abcdef", 6);
+    ramfs_test_assert_contents("/tmp/a", "abcdef", 6);
+
+    rc = fs_open("/tmp/a", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, "gh", 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    ramfs_test_assert_contents("/tmp/a", "abcdefgh", 8);
+
+    /* Overwrite in the middle. */
+    rc = fs_open("/tmp/a", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "XY", 2);
+    TEST_ASSERT(rc == 0 && fs_getpos(file) == 4);
+    rc = fs_seek(file, 9);
+    TEST_ASSERT(rc == FS_ERANGE);
+    rc = fs_seek(file, 6);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT(rc == 0 && bytes_read == 2 && memcmp(buf, "gh", 2) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    ramfs_test_assert_contents("/tmp/a", "abXYefgh", 8);
+
+    /* Read-only handles cannot write, and missing files are not created. */
+    rc = fs_open("/tmp/a", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, "z", 1);
+    TEST_ASSERT(rc == FS_EACCESS);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/tmp/b", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    ramfs_test_write_file("/tmp/a", "q", 1);
+    ramfs_test_assert_contents("/tmp/a", "q", 1);
+}
+
+TEST_CASE(ramfs_test_dirs)
+{
+    struct fs_dirent *dirent;
+    struct fs_file *file;
+    struct fs_dir *dir;
+    uint8_t name_len;
+    char name[8];
+    int seen;
+    int rc;
+
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_mkdir("/tmp/d");
+    TEST_ASSERT(rc == 0);
+    rc = fs_mkdir("/tmp/d");
+    TEST_ASSERT(rc == FS_EEXIST);
+    rc = fs_mkdir("/tmp/x/y");
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_open("/tmp/d", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    ramfs_test_write_file("/tmp/d/f1", "1", 1);
+    ramfs_test_write_file("/tmp/d/f2", "2", 1);
+    rc = fs_mkdir("/tmp/d/sub");
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_opendir("/tmp/d", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+    seen = 0;
+    while (fs_readdir(dir, &dirent) == 0) {
+        rc = fs_dirent_name(dirent, sizeof name, name, &name_len);
+        TEST_ASSERT(rc == 0 && name_len == strlen(name));
+        if (strcmp(name, "f1") == 0) {
+            TEST_ASSERT(!fs_dirent_is_dir(dirent));
+            seen |= 1;
+        } else if (strcmp(name, "f2") == 0) {
+            TEST_ASSERT(!fs_dirent_is_dir(dirent));
+            seen |= 2;
+        } else if (strcmp(name, "sub") == 0) {
+            TEST_ASSERT(fs_dirent_is_dir(dirent));
+            seen |= 4;
+        } else {
+            TEST_ASSERT(0);
+        }
+    }
+    TEST_ASSERT(seen == 7);
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /* The mount point itself is the ramfs root. */
+    rc = fs_opendir("/tmp", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT(rc == 0);
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /* Unlinking a directory removes its contents. */
+    rc = fs_unlink("/tmp/d");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/tmp/d/f1", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(ramfs_bytes_used() == 0);
+}
+
+TEST_CASE(ramfs_test_rename)
+{
+    struct fs_file *file;
+    int rc;
+
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    ramfs_test_write_file("/tmp/a", "aaa", 3);
+    ramfs_test_write_file("/tmp/b", "b", 1);
+    rc = fs_mkdir("/tmp/d");
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_rename("/tmp/a", "/tmp/d/c");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/tmp/a", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    ramfs_test_assert_contents("/tmp/d/c", "aaa", 3);
+
+    /* An existing file is replaced. */
+    rc = fs_rename("/tmp/b", "/tmp/d/c");
+    TEST_ASSERT(rc == 0);
+    ramfs_test_assert_contents("/tmp/d/c", "b", 1);
+
+    rc = fs_rename("/tmp/d/c", "/tmp/d");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/tmp/d", "/tmp/d/e");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/tmp/d", "/tmp");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/tmp/d", "/tmp/e");
+    TEST_ASSERT(rc == 0);
+    ramfs_test_assert_contents("/tmp/e/c", "b", 1);
+}
+
+TEST_CASE(ramfs_test_unlink_open)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint8_t buf[4];
+    int rc;
+
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    ramfs_test_write_file("/tmp/a", "abc", 3);
+    rc = fs_open("/tmp/a", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_unlink("/tmp/a");
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(ramfs_bytes_used() != 0);
+
+    /* The open handle still refers to the unlinked data. */
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT(rc == 0 && bytes_read == 3 && memcmp(buf, "abc", 3) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(ramfs_bytes_used() == 0);
+}
+
+TEST_CASE(ramfs_test_limit)
+{
+    static uint8_t data[1024];
+    struct fs_statvfs stat;
+    struct fs_file *file;
+    int rc;
+
+    ramfs_config.rc_max_bytes = 1000;
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_open("/tmp/a", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, data, 600);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data, 400);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data, 1);
+    TEST_ASSERT(rc == FS_EFULL);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(ramfs_bytes_used() <= 1000);
+
+    rc = fs_statvfs("/tmp", &stat);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(stat.fsv_total == 1000);
+    TEST_ASSERT(stat.fsv_live == ramfs_bytes_used());
+    TEST_ASSERT(stat.fsv_avail == 1000 - ramfs_bytes_used());
+
+    ramfs_config.rc_max_bytes = 0;
+}
+
+TEST_CASE(ramfs_test_mount)
+{
+    struct fs_area_info info;
+    struct fs_statvfs stat;
+    struct fs_file *file;
+    int rc;
+
+    rc = ramfs_init("/tmp");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Nothing is mounted at the root. */
+    rc = fs_open("/a", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /* Prefixes only match whole path components. */
+    rc = fs_open("/tmpx", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_open("/tmp/x", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_rename("/tmp/x", "/x");
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /* Usage queries go to the file system that holds the path. */
+    rc = fs_statvfs("/", &stat);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_statvfs("/tmp/x", &stat);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(stat.fsv_live == ramfs_bytes_used());
+    rc = fs_area_info("/tmp", 0, &info);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    rc = fs_mount("/tmp", NULL);
+    TEST_ASSERT(rc == FS_EEXIST);
+    rc = fs_mount("tmp", NULL);
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_mount("/tmp/", NULL);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    /* Remounting elsewhere discards the old contents. */
+    rc = ramfs_init("/scratch");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_open("/tmp/x", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_open("/scratch/x", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+}
+
+TEST_SUITE(ramfs_test_suite)
+{
+    ramfs_test_rw();
+    ramfs_test_dirs();
+    ramfs_test_rename();
+    ramfs_test_unlink_open();
+    ramfs_test_limit();
+    ramfs_test_mount();
+}
+
+int
+ramfs_test_all(void)
+{
+    ramfs_test_suite();
+    return tu_any_failed;
+}
+
+#ifdef PKG_TEST
+
+int
+main(int argc, char **argv)
+{
+    tu_config.tc_print_results = 1;
+    tu_init();
+
+    ramfs_test_all();
+
+    return tu_any_failed;
+}
+
+#endif
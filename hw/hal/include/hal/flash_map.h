@@ -77,6 +77,36 @@ int flash_area_write(const struct flash_area *, uint32_t off, void *src,
   uint32_t len);
 int flash_area_erase(const struct flash_area *, uint32_t off, uint32_t len);
 
+/*
+ * Write-combining writer for sequential writes into a flash area.  Data is
+ * collected into bursts of up to FLASH_AREA_WRITER_BUF_SZ bytes (rounded down
+ * to the device's write alignment) and programmed one burst at a time, so
+ * callers may write arbitrary-length chunks regardless of the alignment the
+ * device requires.  Close flushes the tail, padded with 0xff to the
+ * alignment.  The writer does not erase; the target range must be erased.
+ */
+#ifndef FLASH_AREA_WRITER_BUF_SZ
+#define FLASH_AREA_WRITER_BUF_SZ        256
+#endif
+
+struct flash_area_writer {
+    const struct flash_area *faw_fa;
+    uint32_t faw_off;           /* Area offset of faw_buf[0]. */
+    uint32_t faw_written;       /* Bytes programmed, including padding. */
+    uint32_t faw_progs;         /* Number of program operations. */
+    uint16_t faw_buf_len;
+    uint16_t faw_burst;         /* Program size; multiple of faw_align. */
+    uint8_t faw_align;
+    uint8_t faw_buf[FLASH_AREA_WRITER_BUF_SZ];
+};
+
+int flash_area_writer_open(struct flash_area_writer *,
+  const struct flash_area *, uint32_t off);
+int flash_area_writer_write(struct flash_area_writer *, const void *data,
+  uint32_t len);
+int flash_area_writer_flush(struct flash_area_writer *);
+int flash_area_writer_close(struct flash_area_writer *);
+
 /*
  * Given flash map index, return info about sectors within the area.
  */
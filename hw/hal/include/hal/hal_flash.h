@@ -28,8 +28,28 @@ int hal_flash_write(uint8_t flash_id, uint32_t address, const void *src,
   uint32_t num_bytes);
 int hal_flash_erase_sector(uint8_t flash_id, uint32_t sector_address);
 int hal_flash_erase(uint8_t flash_id, uint32_t address, uint32_t num_bytes);
+int hal_flash_erase_range(uint8_t flash_id, uint32_t address,
+  uint32_t num_bytes);
 uint8_t hal_flash_align(uint8_t flash_id);
 int hal_flash_init(void);
 
+/*
+ * Non-blocking writes and erases.  The callback reports the result once the
+ * operation finishes; it runs from hal_flash_poll(), which the caller must
+ * keep calling until it returns 0.  If the driver has no asynchronous
+ * support, the operation is performed immediately and the callback runs
+ * before the start function returns.  Synchronous calls on a device wait
+ * for any outstanding asynchronous operation first.
+ */
+typedef void hal_flash_done_fn(uint8_t flash_id, int status, void *arg);
+
+int hal_flash_write_async(uint8_t flash_id, uint32_t address,
+  const void *src, uint32_t num_bytes, hal_flash_done_fn *cb, void *arg);
+int hal_flash_erase_sector_async(uint8_t flash_id, uint32_t sector_address,
+  hal_flash_done_fn *cb, void *arg);
+int hal_flash_erase_async(uint8_t flash_id, uint32_t address,
+  uint32_t num_bytes, hal_flash_done_fn *cb, void *arg);
+int hal_flash_poll(uint8_t flash_id);
+
 #endif
 
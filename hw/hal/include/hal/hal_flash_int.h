@@ -30,6 +30,21 @@ struct hal_flash_funcs {
     int (*hff_erase_sector)(uint32_t sector_address);
     int (*hff_sector_info)(int idx, uint32_t *address, uint32_t *size);
     int (*hff_init)(void);
+
+    /*
+     * Optional asynchronous operations.  A start function kicks off a write
+     * or sector erase and returns without waiting for it; the source buffer
+     * of a write must stay valid until the operation completes.  hff_poll
+     * returns 1 while the device is busy and 0 once it is done, after which
+     * hff_complete finishes the operation and returns its result.  At most
+     * one operation is outstanding per device.  Drivers that leave these NULL
+     * are driven synchronously.
+     */
+    int (*hff_write_start)(uint32_t address, const void *src,
+                           uint32_t num_bytes);
+    int (*hff_erase_sector_start)(uint32_t sector_address);
+    int (*hff_poll)(void);
+    int (*hff_complete)(void);
 };
 
 struct hal_flash {
@@ -45,6 +60,15 @@ struct hal_flash {
  */
 uint32_t hal_flash_sector_size(const struct hal_flash *hf, int sec_idx);
 
+/*
+ * Sector lookups backed by the per-device table built in hal_flash_init().
+ * hal_flash_sector_lookup() returns the index of the first sector ending
+ * after the address, or -1.
+ */
+int hal_flash_sector_info(uint8_t flash_id, int idx, uint32_t *start,
+  uint32_t *size);
+int hal_flash_sector_lookup(uint8_t flash_id, uint32_t address);
+
 /* External function prototype supplied by BSP */
 const struct hal_flash *bsp_flash_dev(uint8_t flash_id);
 
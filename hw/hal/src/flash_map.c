@@ -69,9 +69,13 @@ flash_area_to_sectors(int idx, int *cnt, struct flash_area *ret)
     fa = &flash_map[idx];
 
     hf = bsp_flash_dev(fa->fa_flash_id);
-    for (i = 0; i < hf->hf_sector_cnt; i++) {
-        hf->hf_itf->hff_sector_info(i, &start, &size);
-        if (start >= fa->fa_off && start < fa->fa_off + fa->fa_size) {
+    i = hal_flash_sector_lookup(fa->fa_flash_id, fa->fa_off);
+    for (; i >= 0 && i < hf->hf_sector_cnt; i++) {
+        hal_flash_sector_info(fa->fa_flash_id, i, &start, &size);
+        if (start >= fa->fa_off + fa->fa_size) {
+            break;
+        }
+        if (start >= fa->fa_off) {
             if (ret) {
                 ret->fa_flash_id = fa->fa_flash_id;
                 ret->fa_off = start;
@@ -113,9 +117,13 @@ flash_area_to_nffs_desc(int idx, int *cnt, struct nffs_area_desc *nad)
     fa = &flash_map[idx];
 
     hf = bsp_flash_dev(fa->fa_flash_id);
-    for (i = 0; i < hf->hf_sector_cnt; i++) {
-        hf->hf_itf->hff_sector_info(i, &start, &size);
-        if (start >= fa->fa_off && start < fa->fa_off + fa->fa_size) {
+    i = hal_flash_sector_lookup(fa->fa_flash_id, fa->fa_off);
+    for (; i >= 0 && i < hf->hf_sector_cnt; i++) {
+        hal_flash_sector_info(fa->fa_flash_id, i, &start, &size);
+        if (start >= fa->fa_off + fa->fa_size) {
+            break;
+        }
+        if (start >= fa->fa_off) {
             if (first_idx == -1) {
                 first_idx = i;
             }
@@ -132,7 +140,7 @@ flash_area_to_nffs_desc(int idx, int *cnt, struct nffs_area_desc *nad)
 
     move_on = 1;
     for (i = first_idx, j = 0; i < last_idx + 1; i++) {
-        hf->hf_itf->hff_sector_info(i, &start, &size);
+        hal_flash_sector_info(fa->fa_flash_id, i, &start, &size);
         if (move_on) {
             nad[j].nad_flash_id = fa->fa_flash_id;
             nad[j].nad_offset = start;
@@ -178,5 +186,158 @@ flash_area_erase(const struct flash_area *fa, uint32_t off, uint32_t len)
     if (off > fa->fa_size || off + len > fa->fa_size) {
         return -1;
     }
-    return hal_flash_erase(fa->fa_flash_id, fa->fa_off + off, len);
+    return hal_flash_erase_range(fa->fa_flash_id, fa->fa_off + off, len);
+}
+
+/*
+ * Programs len bytes at the writer's current offset.
+ */
+static int
+flash_area_writer_prog(struct flash_area_writer *faw, const void *data,
+  uint32_t len)
+{
+    const struct flash_area *fa;
+    int rc;
+
+    fa = faw->faw_fa;
+    if (faw->faw_off + len > fa->fa_size) {
+        return -1;
+    }
+    rc = hal_flash_write(fa->fa_flash_id, fa->fa_off + faw->faw_off, data,
+      len);
+    if (rc) {
+        return rc;
+    }
+    faw->faw_off += len;
+    faw->faw_written += len;
+    faw->faw_progs++;
+    return 0;
+}
+
+/**
+ * Prepares a writer for sequential writes starting at the specified area
+ * offset, which must be aligned to the device's write alignment.
+ *
+ * @return                      0 on success; -1 on invalid arguments.
+ */
+int
+flash_area_writer_open(struct flash_area_writer *faw,
+  const struct flash_area *fa, uint32_t off)
+{
+    uint32_t align;
+
+    /*
+     * Held in a uint32_t: against a uint8_t, the check below is always false
+     * with the default 256-byte buffer, but not with a smaller one.
+     */
+    align = hal_flash_align(fa->fa_flash_id);
+    if (align == 0 || align > FLASH_AREA_WRITER_BUF_SZ ||
+      off % align != 0 || off > fa->fa_size) {
+        return -1;
+    }
+
+    memset(faw, 0, sizeof(*faw));
+    faw->faw_fa = fa;
+    faw->faw_off = off;
+    faw->faw_align = align;
+    faw->faw_burst = FLASH_AREA_WRITER_BUF_SZ -
+      FLASH_AREA_WRITER_BUF_SZ % align;
+    return 0;
+}
+
+/**
+ * Appends data.  Full bursts are programmed as they accumulate; when the
+ * buffer is empty, whole bursts are programmed straight from the caller's
+ * memory.
+ *
+ * @return                      0 on success; -1 on flash error or if the
+ *                              data would run past the end of the area.
+ */
+int
+flash_area_writer_write(struct flash_area_writer *faw, const void *data,
+  uint32_t len)
+{
+    const uint8_t *src;
+    uint32_t chunk;
+    int rc;
+
+    src = data;
+    while (len > 0) {
+        if (faw->faw_buf_len == 0 && len >= faw->faw_burst) {
+            chunk = len - len % faw->faw_burst;
+            rc = flash_area_writer_prog(faw, src, chunk);
+            if (rc) {
+                return rc;
+            }
+        } else {
+            chunk = faw->faw_burst - faw->faw_buf_len;
+            if (chunk > len) {
+                chunk = len;
+            }
+            if (faw->faw_off + faw->faw_buf_len + chunk >
+              faw->faw_fa->fa_size) {
+                return -1;
+            }
+            memcpy(faw->faw_buf + faw->faw_buf_len, src, chunk);
+            faw->faw_buf_len += chunk;
+            if (faw->faw_buf_len == faw->faw_burst) {
+                rc = flash_area_writer_prog(faw, faw->faw_buf,
+                  faw->faw_buf_len);
+                if (rc) {
+                    return rc;
+                }
+                faw->faw_buf_len = 0;
+            }
+        }
+        src += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * Programs the aligned part of the buffered data.  Up to faw_align - 1
+ * bytes may remain buffered.
+ *
+ * @return                      0 on success; -1 on flash error.
+ */
+int
+flash_area_writer_flush(struct flash_area_writer *faw)
+{
+    uint32_t len;
+    int rc;
+
+    len = faw->faw_buf_len - faw->faw_buf_len % faw->faw_align;
+    if (len == 0) {
+        return 0;
+    }
+    rc = flash_area_writer_prog(faw, faw->faw_buf, len);
+    if (rc) {
+        return rc;
+    }
+    faw->faw_buf_len -= len;
+    memmove(faw->faw_buf, faw->faw_buf + len, faw->faw_buf_len);
+    return 0;
+}
+
+/**
+ * Flushes all buffered data, padding the final write with 0xff up to the
+ * device's write alignment.
+ *
+ * @return                      0 on success; -1 on flash error.
+ */
+int
+flash_area_writer_close(struct flash_area_writer *faw)
+{
+    uint32_t pad;
+
+    if (faw->faw_buf_len % faw->faw_align) {
+        pad = faw->faw_align - faw->faw_buf_len % faw->faw_align;
+        if (faw->faw_off + faw->faw_buf_len + pad > faw->faw_fa->fa_size) {
+            return -1;
+        }
+        memset(faw->faw_buf + faw->faw_buf_len, 0xff, pad);
+        faw->faw_buf_len += pad;
+    }
+    return flash_area_writer_flush(faw);
 }
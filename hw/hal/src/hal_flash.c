@@ -16,6 +16,9 @@
  * specific language governing permissions and limitations
  * under the License.
  */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <bsp/bsp.h>
@@ -23,6 +26,110 @@
 #include "hal/hal_flash.h"
 #include "hal/hal_flash_int.h"
 
+#ifndef HAL_FLASH_MAX_DEVS
+#define HAL_FLASH_MAX_DEVS      4
+#endif
+
+#define HAL_FLASH_OP_NONE       0
+#define HAL_FLASH_OP_WRITE      1
+#define HAL_FLASH_OP_ERASE      2
+
+/* State of the outstanding asynchronous operation on each device. */
+struct hal_flash_async {
+    hal_flash_done_fn *hfa_cb;
+    void *hfa_arg;
+    uint32_t hfa_next;          /* Erase: start of the remaining range. */
+    uint32_t hfa_end;           /* Erase: end of the range. */
+    uint8_t hfa_op;
+};
+
+static struct hal_flash_async hal_flash_async[HAL_FLASH_MAX_DEVS];
+
+/*
+ * Sector geometry of each device, gathered at hal_flash_init() so lookups
+ * need not call hff_sector_info() for every sector.  Devices with uniform,
+ * contiguous sectors need only the base and size; others get sorted start
+ * and size arrays which are binary searched.  A device without a table
+ * (hfs_cnt == 0) falls back to scanning hff_sector_info().
+ */
+struct hal_flash_sectors {
+    uint32_t *hfs_start;
+    uint32_t *hfs_size;
+    uint32_t hfs_base;
+    uint32_t hfs_uniform_size;  /* 0 if sectors differ in size. */
+    int hfs_cnt;
+};
+
+static struct hal_flash_sectors hal_flash_sectors[HAL_FLASH_MAX_DEVS];
+
+static void hal_flash_wait(uint8_t id);
+
+static void
+hal_flash_sectors_free(struct hal_flash_sectors *hfs)
+{
+    free(hfs->hfs_start);
+    free(hfs->hfs_size);
+    memset(hfs, 0, sizeof *hfs);
+}
+
+/*
+ * Builds the sector table of a device.  On failure the device is left
+ * without a table and lookups use the slow path.
+ */
+static void
+hal_flash_sectors_build(const struct hal_flash *hf,
+  struct hal_flash_sectors *hfs)
+{
+    uint32_t start, size;
+    uint32_t base, usize;
+    int uniform;
+    int i;
+
+    hal_flash_sectors_free(hfs);
+    if (hf->hf_sector_cnt <= 0) {
+        return;
+    }
+
+    uniform = 1;
+    base = usize = 0;
+    for (i = 0; i < hf->hf_sector_cnt; i++) {
+        if (hf->hf_itf->hff_sector_info(i, &start, &size)) {
+            return;
+        }
+        if (i == 0) {
+            base = start;
+            usize = size;
+        } else if (size != usize || start != base + i * usize) {
+            uniform = 0;
+            break;
+        }
+    }
+    if (uniform) {
+        hfs->hfs_base = base;
+        hfs->hfs_uniform_size = usize;
+        hfs->hfs_cnt = hf->hf_sector_cnt;
+        return;
+    }
+
+    hfs->hfs_start = malloc(hf->hf_sector_cnt * sizeof(uint32_t));
+    hfs->hfs_size = malloc(hf->hf_sector_cnt * sizeof(uint32_t));
+    if (!hfs->hfs_start || !hfs->hfs_size) {
+        hal_flash_sectors_free(hfs);
+        return;
+    }
+    for (i = 0; i < hf->hf_sector_cnt; i++) {
+        if (hf->hf_itf->hff_sector_info(i, &hfs->hfs_start[i],
+            &hfs->hfs_size[i]) ||
+          (i > 0 && hfs->hfs_start[i] < hfs->hfs_start[i - 1] +
+            hfs->hfs_size[i - 1])) {
+            /* Binary search needs sorted, non-overlapping sectors. */
+            hal_flash_sectors_free(hfs);
+            return;
+        }
+    }
+    hfs->hfs_cnt = hf->hf_sector_cnt;
+}
+
 int
 hal_flash_init(void)
 {
@@ -38,10 +145,97 @@ hal_flash_init(void)
         if (hf->hf_itf->hff_init()) {
             rc = -1;
         }
+        if (i < HAL_FLASH_MAX_DEVS) {
+            hal_flash_sectors_build(hf, &hal_flash_sectors[i]);
+        }
     }
     return rc;
 }
 
+/**
+ * Retrieves the location and size of a sector.
+ *
+ * @return                      0 on success; -1 if there is no such sector.
+ */
+int
+hal_flash_sector_info(uint8_t id, int idx, uint32_t *start, uint32_t *size)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_sectors *hfs;
+
+    hf = bsp_flash_dev(id);
+    if (!hf || idx < 0 || idx >= hf->hf_sector_cnt) {
+        return -1;
+    }
+    if (id < HAL_FLASH_MAX_DEVS && hal_flash_sectors[id].hfs_cnt) {
+        hfs = &hal_flash_sectors[id];
+        if (hfs->hfs_uniform_size) {
+            *start = hfs->hfs_base + idx * hfs->hfs_uniform_size;
+            *size = hfs->hfs_uniform_size;
+        } else {
+            *start = hfs->hfs_start[idx];
+            *size = hfs->hfs_size[idx];
+        }
+        return 0;
+    }
+    return hf->hf_itf->hff_sector_info(idx, start, size);
+}
+
+/**
+ * Finds the first sector which ends after the specified address; i.e., the
+ * sector containing the address, or the next one if the address falls in a
+ * gap.
+ *
+ * @return                      The sector index; -1 if there is none.
+ */
+int
+hal_flash_sector_lookup(uint8_t id, uint32_t address)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_sectors *hfs;
+    uint32_t start, size;
+    int lo, hi, mid;
+    int i;
+
+    hf = bsp_flash_dev(id);
+    if (!hf) {
+        return -1;
+    }
+
+    if (id >= HAL_FLASH_MAX_DEVS || !hal_flash_sectors[id].hfs_cnt) {
+        for (i = 0; i < hf->hf_sector_cnt; i++) {
+            if (hf->hf_itf->hff_sector_info(i, &start, &size)) {
+                return -1;
+            }
+            if (address < start + size) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    hfs = &hal_flash_sectors[id];
+    if (hfs->hfs_uniform_size) {
+        if (address < hfs->hfs_base) {
+            return 0;
+        }
+        i = (address - hfs->hfs_base) / hfs->hfs_uniform_size;
+        return i < hfs->hfs_cnt ? i : -1;
+    }
+
+    lo = 0;
+    hi = hfs->hfs_cnt;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (address < hfs->hfs_start[mid] + hfs->hfs_size[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo < hfs->hfs_cnt ? lo : -1;
+}
+
 uint8_t
 hal_flash_align(uint8_t flash_id)
 {
@@ -84,6 +278,7 @@ hal_flash_read(uint8_t id, uint32_t address, void *dst, uint32_t num_bytes)
     if (!hf) {
         return -1;
     }
+    hal_flash_wait(id);
     if (hal_flash_check_addr(hf, address) ||
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
@@ -101,6 +296,7 @@ hal_flash_write(uint8_t id, uint32_t address, const void *src,
     if (!hf) {
         return -1;
     }
+    hal_flash_wait(id);
     if (hal_flash_check_addr(hf, address) ||
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
@@ -117,21 +313,27 @@ hal_flash_erase_sector(uint8_t id, uint32_t sector_address)
     if (!hf) {
         return -1;
     }
+    hal_flash_wait(id);
     if (hal_flash_check_addr(hf, sector_address)) {
         return -1;
     }
     return hf->hf_itf->hff_erase_sector(sector_address);
 }
 
+/**
+ * Erases every sector which overlaps the specified range.  Only the covered
+ * sectors are visited, so the cost is proportional to the number of sectors
+ * erased rather than the size of the device.
+ *
+ * @return                      0 on success; -1 on failure.
+ */
 int
-hal_flash_erase(uint8_t id, uint32_t address, uint32_t num_bytes)
+hal_flash_erase_range(uint8_t id, uint32_t address, uint32_t num_bytes)
 {
     const struct hal_flash *hf;
     uint32_t start, size;
     uint32_t end;
-    uint32_t end_area;
     int i;
-    int rc;
 
     hf = bsp_flash_dev(id);
     if (!hf) {
@@ -150,19 +352,240 @@ hal_flash_erase(uint8_t id, uint32_t address, uint32_t num_bytes)
         return -1;
     }
 
-    for (i = 0; i < hf->hf_sector_cnt; i++) {
-        rc = hf->hf_itf->hff_sector_info(i, &start, &size);
-        assert(rc == 0);
-        end_area = start + size;
-        if (address < end_area && end > start) {
-            /*
-             * If some region of eraseable area falls inside sector,
-             * erase the sector.
-             */
-            if (hf->hf_itf->hff_erase_sector(start)) {
-                return -1;
-            }
+    hal_flash_wait(id);
+
+    i = hal_flash_sector_lookup(id, address);
+    if (i < 0) {
+        return 0;
+    }
+    for (; i < hf->hf_sector_cnt; i++) {
+        if (hal_flash_sector_info(id, i, &start, &size)) {
+            return -1;
+        }
+        if (start >= end) {
+            break;
+        }
+        if (hf->hf_itf->hff_erase_sector(start)) {
+            return -1;
         }
     }
     return 0;
 }
+
+int
+hal_flash_erase(uint8_t id, uint32_t address, uint32_t num_bytes)
+{
+    return hal_flash_erase_range(id, address, num_bytes);
+}
+
+/**
+ * Finds the first sector which overlaps the range [addr, end).
+ *
+ * @return                      0 on success; -1 if no sector overlaps.
+ */
+static int
+hal_flash_next_sector(uint8_t id, uint32_t addr, uint32_t end,
+  uint32_t *out_start, uint32_t *out_size)
+{
+    int idx;
+
+    idx = hal_flash_sector_lookup(id, addr);
+    if (idx < 0 || hal_flash_sector_info(id, idx, out_start, out_size)) {
+        return -1;
+    }
+    if (*out_start >= end) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+hal_flash_has_async(const struct hal_flash *hf)
+{
+    return hf->hf_itf->hff_poll && hf->hf_itf->hff_complete;
+}
+
+/*
+ * Looks up the device and its async state for a new asynchronous operation.
+ * Fails if the device is unknown or already has an operation outstanding.
+ */
+static struct hal_flash_async *
+hal_flash_async_get(uint8_t id, const struct hal_flash **out_hf)
+{
+    const struct hal_flash *hf;
+
+    hf = bsp_flash_dev(id);
+    if (!hf || id >= HAL_FLASH_MAX_DEVS) {
+        return NULL;
+    }
+    if (hal_flash_async[id].hfa_op != HAL_FLASH_OP_NONE) {
+        return NULL;
+    }
+    *out_hf = hf;
+    return &hal_flash_async[id];
+}
+
+static void
+hal_flash_async_done(uint8_t id, struct hal_flash_async *hfa, int status)
+{
+    hal_flash_done_fn *cb;
+
+    cb = hfa->hfa_cb;
+    hfa->hfa_op = HAL_FLASH_OP_NONE;
+    if (cb) {
+        cb(id, status, hfa->hfa_arg);
+    }
+}
+
+/**
+ * Starts a write without waiting for it to complete.  The source buffer must
+ * remain valid until the callback runs.
+ *
+ * @return                      0 if the operation was started; -1 if the
+ *                              arguments are invalid or the device is busy.
+ */
+int
+hal_flash_write_async(uint8_t id, uint32_t address, const void *src,
+  uint32_t num_bytes, hal_flash_done_fn *cb, void *arg)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_async *hfa;
+    int rc;
+
+    hfa = hal_flash_async_get(id, &hf);
+    if (!hfa) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes)) {
+        return -1;
+    }
+
+    hfa->hfa_cb = cb;
+    hfa->hfa_arg = arg;
+    hfa->hfa_op = HAL_FLASH_OP_WRITE;
+
+    if (!hal_flash_has_async(hf) || !hf->hf_itf->hff_write_start) {
+        rc = hf->hf_itf->hff_write(address, src, num_bytes);
+        hal_flash_async_done(id, hfa, rc);
+        return 0;
+    }
+
+    rc = hf->hf_itf->hff_write_start(address, src, num_bytes);
+    if (rc) {
+        hfa->hfa_op = HAL_FLASH_OP_NONE;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Starts erasing every sector which overlaps the specified range.  Sectors
+ * are erased one at a time as hal_flash_poll() is called; the callback runs
+ * once after the last one.
+ *
+ * @return                      0 if the operation was started; -1 if the
+ *                              arguments are invalid or the device is busy.
+ */
+int
+hal_flash_erase_async(uint8_t id, uint32_t address, uint32_t num_bytes,
+  hal_flash_done_fn *cb, void *arg)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_async *hfa;
+    uint32_t start, size;
+    int rc;
+
+    hfa = hal_flash_async_get(id, &hf);
+    if (!hfa) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes) ||
+      address + num_bytes <= address) {
+        return -1;
+    }
+
+    if (!hal_flash_has_async(hf) || !hf->hf_itf->hff_erase_sector_start) {
+        hfa->hfa_cb = cb;
+        hfa->hfa_arg = arg;
+        rc = hal_flash_erase_range(id, address, num_bytes);
+        hfa->hfa_op = HAL_FLASH_OP_ERASE;
+        hal_flash_async_done(id, hfa, rc);
+        return 0;
+    }
+
+    if (hal_flash_next_sector(id, address, address + num_bytes,
+        &start, &size)) {
+        return -1;
+    }
+    rc = hf->hf_itf->hff_erase_sector_start(start);
+    if (rc) {
+        return -1;
+    }
+
+    hfa->hfa_cb = cb;
+    hfa->hfa_arg = arg;
+    hfa->hfa_next = start + size;
+    hfa->hfa_end = address + num_bytes;
+    hfa->hfa_op = HAL_FLASH_OP_ERASE;
+    return 0;
+}
+
+int
+hal_flash_erase_sector_async(uint8_t id, uint32_t sector_address,
+  hal_flash_done_fn *cb, void *arg)
+{
+    return hal_flash_erase_async(id, sector_address, 1, cb, arg);
+}
+
+/**
+ * Advances the outstanding asynchronous operation on a device.  When the
+ * operation finishes, its callback is called from here.
+ *
+ * @return                      1 if an operation is still in progress;
+ *                              0 if the device is idle.
+ */
+int
+hal_flash_poll(uint8_t id)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_async *hfa;
+    uint32_t start, size;
+    int rc;
+
+    if (id >= HAL_FLASH_MAX_DEVS) {
+        return 0;
+    }
+    hfa = &hal_flash_async[id];
+    if (hfa->hfa_op == HAL_FLASH_OP_NONE) {
+        return 0;
+    }
+
+    hf = bsp_flash_dev(id);
+    if (hf->hf_itf->hff_poll()) {
+        return 1;
+    }
+    rc = hf->hf_itf->hff_complete();
+
+    if (rc == 0 && hfa->hfa_op == HAL_FLASH_OP_ERASE &&
+      hfa->hfa_next < hfa->hfa_end &&
+      hal_flash_next_sector(id, hfa->hfa_next, hfa->hfa_end,
+        &start, &size) == 0) {
+        rc = hf->hf_itf->hff_erase_sector_start(start);
+        if (rc == 0) {
+            hfa->hfa_next = start + size;
+            return 1;
+        }
+    }
+
+    hal_flash_async_done(id, hfa, rc);
+    return 0;
+}
+
+static void
+hal_flash_wait(uint8_t id)
+{
+    while (hal_flash_poll(id)) {
+    }
+}
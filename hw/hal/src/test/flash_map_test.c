@@ -147,10 +147,209 @@ TEST_CASE(flash_map_test_case_2)
     }
 }
 
+static int flash_map_test_async_cnt;
+static int flash_map_test_async_status;
+
+static void
+flash_map_test_async_cb(uint8_t flash_id, int status, void *arg)
+{
+    TEST_ASSERT(arg == &flash_map_test_async_cnt);
+    flash_map_test_async_cnt++;
+    flash_map_test_async_status = status;
+}
+
+/*
+ * Test asynchronous erase and write
+ */
+TEST_CASE(flash_map_test_case_3)
+{
+    const struct flash_area *fa;
+    uint8_t wd[64];
+    uint8_t rd[64];
+    uint32_t off;
+    int rc;
+
+    os_init();
+
+    rc = hal_flash_init();
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_init() failed");
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+
+    flash_map_test_async_cnt = 0;
+    rc = hal_flash_erase_async(fa->fa_flash_id, fa->fa_off, fa->fa_size,
+      flash_map_test_async_cb, &flash_map_test_async_cnt);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_erase_async() failed");
+
+    /* Only one operation may be outstanding. */
+    rc = hal_flash_write_async(fa->fa_flash_id, fa->fa_off, wd, sizeof(wd),
+      flash_map_test_async_cb, &flash_map_test_async_cnt);
+    TEST_ASSERT(rc == -1);
+
+    while (hal_flash_poll(fa->fa_flash_id)) {
+    }
+    TEST_ASSERT_FATAL(flash_map_test_async_cnt == 1 &&
+      flash_map_test_async_status == 0, "erase callback");
+
+    memset(wd, 0xff, sizeof(wd));
+    for (off = 0; off < fa->fa_size; off += sizeof(rd)) {
+        rc = flash_area_read(fa, off, rd, sizeof(rd));
+        TEST_ASSERT_FATAL(rc == 0 && memcmp(rd, wd, sizeof(rd)) == 0,
+          "area not erased");
+    }
+
+    /* A synchronous read waits for the outstanding write. */
+    memset(wd, 0x5a, sizeof(wd));
+    rc = hal_flash_write_async(fa->fa_flash_id, fa->fa_off + 128, wd,
+      sizeof(wd), flash_map_test_async_cb, &flash_map_test_async_cnt);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_write_async() failed");
+    rc = flash_area_read(fa, 128, rd, sizeof(rd));
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(flash_map_test_async_cnt == 2);
+    TEST_ASSERT(memcmp(rd, wd, sizeof(rd)) == 0);
+    TEST_ASSERT(hal_flash_poll(fa->fa_flash_id) == 0);
+}
+
+/*
+ * Test sector lookup and hal_flash_erase_range()
+ */
+TEST_CASE(flash_map_test_case_4)
+{
+    const struct hal_flash *hf;
+    uint32_t start, size;
+    uint32_t tbl_start, tbl_size;
+    uint32_t addr;
+    uint8_t wd[16];
+    uint8_t rd[16];
+    int expected;
+    int i;
+    int rc;
+
+    os_init();
+
+    rc = hal_flash_init();
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_init() failed");
+
+    hf = bsp_flash_dev(0);
+    TEST_ASSERT_FATAL(hf != NULL, "bsp_flash_dev");
+
+    /* The table must agree with the driver. */
+    for (i = 0; i < hf->hf_sector_cnt; i++) {
+        hf->hf_itf->hff_sector_info(i, &start, &size);
+        rc = hal_flash_sector_info(0, i, &tbl_start, &tbl_size);
+        TEST_ASSERT_FATAL(rc == 0 && tbl_start == start && tbl_size == size,
+          "sector table mismatch at %d", i);
+    }
+    TEST_ASSERT(hal_flash_sector_info(0, hf->hf_sector_cnt, &start,
+      &size) == -1);
+
+    for (addr = hf->hf_base_addr; addr < hf->hf_base_addr + hf->hf_size;
+      addr += 0x1000) {
+        expected = -1;
+        for (i = 0; i < hf->hf_sector_cnt; i++) {
+            hf->hf_itf->hff_sector_info(i, &start, &size);
+            if (addr < start + size) {
+                expected = i;
+                break;
+            }
+        }
+        TEST_ASSERT_FATAL(hal_flash_sector_lookup(0, addr) == expected,
+          "lookup of 0x%x", (unsigned int)addr);
+    }
+
+    /*
+     * Erasing two bytes which straddle a sector boundary erases exactly the
+     * two sectors.
+     */
+    memset(wd, 0xa5, sizeof(wd));
+    for (i = 0; i < 3; i++) {
+        hf->hf_itf->hff_sector_info(i, &start, &size);
+        rc = hal_flash_erase_sector(0, start);
+        TEST_ASSERT_FATAL(rc == 0, "hal_flash_erase_sector() failed");
+        rc = hal_flash_write(0, start, wd, sizeof(wd));
+        TEST_ASSERT_FATAL(rc == 0, "hal_flash_write() failed");
+    }
+
+    hf->hf_itf->hff_sector_info(1, &start, &size);
+    rc = hal_flash_erase_range(0, start - 1, 2);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_erase_range() failed");
+
+    for (i = 0; i < 3; i++) {
+        hf->hf_itf->hff_sector_info(i, &start, &size);
+        rc = hal_flash_read(0, start, rd, sizeof(rd));
+        TEST_ASSERT_FATAL(rc == 0, "hal_flash_read() failed");
+        if (i < 2) {
+            memset(wd, 0xff, sizeof(wd));
+        } else {
+            memset(wd, 0xa5, sizeof(wd));
+        }
+        TEST_ASSERT(memcmp(rd, wd, sizeof(rd)) == 0, "sector %d", i);
+    }
+}
+
+/*
+ * Test flash_area_writer
+ */
+TEST_CASE(flash_map_test_case_5)
+{
+    const struct flash_area *fa;
+    struct flash_area_writer faw;
+    static uint8_t wd[3000];
+    static uint8_t rd[3000];
+    uint32_t off;
+    uint32_t len;
+    int i;
+    int rc;
+
+    os_init();
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+    rc = flash_area_erase(fa, 0, fa->fa_size);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_erase() fail");
+
+    for (i = 0; i < sizeof(wd); i++) {
+        wd[i] = i * 7;
+    }
+
+    rc = flash_area_writer_open(&faw, fa, 0);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_writer_open() fail");
+
+    /* Odd-sized chunks, including one larger than a burst. */
+    off = 0;
+    for (len = 1; off + len <= sizeof(wd); len = len * 3 + 1) {
+        rc = flash_area_writer_write(&faw, wd + off, len);
+        TEST_ASSERT_FATAL(rc == 0, "flash_area_writer_write() fail");
+        off += len;
+    }
+    rc = flash_area_writer_write(&faw, wd + off, sizeof(wd) - off);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_writer_write() fail");
+    rc = flash_area_writer_close(&faw);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_writer_close() fail");
+
+    TEST_ASSERT(faw.faw_written >= sizeof(wd) &&
+      faw.faw_written < sizeof(wd) + faw.faw_align);
+    TEST_ASSERT(faw.faw_progs <= sizeof(wd) / faw.faw_burst + 2);
+
+    rc = flash_area_read(fa, 0, rd, sizeof(rd));
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(memcmp(rd, wd, sizeof(rd)) == 0);
+
+    /* Writes may not run past the end of the area. */
+    rc = flash_area_writer_open(&faw, fa, fa->fa_size - 8);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_writer_open() fail");
+    rc = flash_area_writer_write(&faw, wd, 16);
+    TEST_ASSERT(rc == -1);
+}
+
 TEST_SUITE(flash_map_test_suite)
 {
     flash_map_test_case_1();
     flash_map_test_case_2();
+    flash_map_test_case_3();
+    flash_map_test_case_4();
+    flash_map_test_case_5();
 }
 
 #ifdef PKG_TEST
@@ -19,9 +19,45 @@
 #ifndef __MCU_SIM_H__
 #define __MCU_SIM_H__
 
+#include <inttypes.h>
+
 extern char *native_flash_file;
 extern char *native_uart_log_file;
 
 void mcu_sim_parse_args(int argc, char **argv);
 
+/*
+ * Optional timing and wear model for the simulated flash.  When a model is
+ * set, every read, write and erase is charged its modeled duration, either
+ * against a virtual clock (native_flash_time_ns()) or, with
+ * NATIVE_FLASH_CLOCK_CPUTIME, by spinning the host CPU for that long.  The
+ * OS and cputime clocks are driven by process CPU time, so the latter makes
+ * flash operations visible to os_time_get() and cputime_get32().
+ * Asynchronous operations (hal_flash_*_async()) do not spin; they stay busy
+ * until their modeled duration has passed on the host's clock.  Erase and
+ * write-disturb counters are kept per sector and dumped to stderr on exit.
+ */
+#define NATIVE_FLASH_CLOCK_VIRTUAL      0
+#define NATIVE_FLASH_CLOCK_CPUTIME      1
+
+struct native_flash_model {
+    uint32_t nfm_write_ns;      /* Programming time per byte. */
+    uint32_t nfm_erase_us;      /* Erase time per sector. */
+    uint32_t nfm_read_ns;       /* Read time per byte. */
+    uint8_t nfm_clock;          /* NATIVE_FLASH_CLOCK_[...] */
+};
+
+struct native_flash_sector_stats {
+    uint32_t nss_erases;        /* Times this sector has been erased. */
+    uint32_t nss_progs;         /* Program operations since last erase. */
+    uint32_t nss_max_progs;     /* Most program operations between erases. */
+};
+
+void native_flash_model_set(const struct native_flash_model *model);
+int native_flash_model_parse(const char *spec);
+const struct native_flash_model *native_flash_model_get(void);
+uint64_t native_flash_time_ns(void);
+int native_flash_sector_stats(int idx, struct native_flash_sector_stats *nss);
+void native_flash_stats_dump(void);
+
 #endif /* __MCU_SIM_H__ */
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
 #include "hal/hal_flash_int.h"
 #include "mcu/mcu_sim.h"
 
@@ -36,13 +38,22 @@ static int native_flash_write(uint32_t address, const void *src,
   uint32_t length);
 static int native_flash_erase_sector(uint32_t sector_address);
 static int native_flash_sector_info(int idx, uint32_t *address, uint32_t *size);
+static int native_flash_write_start(uint32_t address, const void *src,
+  uint32_t length);
+static int native_flash_erase_sector_start(uint32_t sector_address);
+static int native_flash_poll(void);
+static int native_flash_complete(void);
 
 static const struct hal_flash_funcs native_flash_funcs = {
     .hff_read = native_flash_read,
     .hff_write = native_flash_write,
     .hff_erase_sector = native_flash_erase_sector,
     .hff_sector_info = native_flash_sector_info,
-    .hff_init = native_flash_init
+    .hff_init = native_flash_init,
+    .hff_write_start = native_flash_write_start,
+    .hff_erase_sector_start = native_flash_erase_sector_start,
+    .hff_poll = native_flash_poll,
+    .hff_complete = native_flash_complete
 };
 
 static const uint32_t native_flash_sectors[] = {
@@ -71,6 +82,32 @@ const struct hal_flash native_flash_dev = {
     .hf_align = 1
 };
 
+static struct native_flash_model native_flash_model_cur;
+static int native_flash_model_on;
+static uint64_t native_flash_time;
+static uint64_t native_flash_read_bytes;
+static uint64_t native_flash_write_bytes;
+static struct native_flash_sector_stats native_flash_stats[FLASH_NUM_AREAS];
+
+#define NATIVE_FLASH_OP_NONE    0
+#define NATIVE_FLASH_OP_WRITE   1
+#define NATIVE_FLASH_OP_ERASE   2
+
+/*
+ * The outstanding asynchronous operation.  Its effect on the flash contents
+ * is applied when it completes, once the modeled duration has elapsed on the
+ * host's clock.
+ */
+static struct {
+    uint64_t deadline;
+    const void *src;
+    uint32_t address;
+    uint32_t length;
+    uint8_t op;
+} native_flash_async;
+
+static int flash_sector_len(int sector);
+
 static void
 flash_native_erase(uint32_t addr, uint32_t len)
 {
@@ -81,7 +118,6 @@ static void
 flash_native_file_open(char *name)
 {
     int created = 0;
-    extern char *tmpnam(char *s);
     extern int ftruncate(int fd, off_t length);
 
     if (!name) {
@@ -112,6 +148,81 @@ flash_native_ensure_file_open(void)
     }
 }
 
+/**
+ * Finds the sector containing the specified flash address.
+ *
+ * @return                      The sector index;
+ *                              -1 if the address is outside the device.
+ */
+static int
+flash_native_sector_idx(uint32_t address)
+{
+    int i;
+
+    for (i = FLASH_NUM_AREAS - 1; i >= 0; i--) {
+        if (address >= native_flash_sectors[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Charges the modeled duration of a flash operation.  The time is always
+ * accumulated in the virtual clock; in cputime mode the host CPU is also
+ * kept busy for that long so the OS and cputime clocks advance with it.
+ */
+static void
+flash_native_charge(uint64_t ns)
+{
+    struct timespec ts;
+    uint64_t start;
+    uint64_t now;
+
+    if (!native_flash_model_on || ns == 0) {
+        return;
+    }
+
+    native_flash_time += ns;
+
+    if (native_flash_model_cur.nfm_clock == NATIVE_FLASH_CLOCK_CPUTIME) {
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        start = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        do {
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+            now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        } while (now - start < ns);
+    }
+}
+
+/**
+ * Accounts for a program operation.  Every sector touched by the write
+ * counts one more program since its last erase; cells sharing a sector are
+ * disturbed by each of them.  The caller charges the time.
+ */
+static void
+flash_native_account_write(uint32_t address, uint32_t length)
+{
+    struct native_flash_sector_stats *nss;
+    int first;
+    int last;
+    int i;
+
+    native_flash_write_bytes += length;
+
+    first = flash_native_sector_idx(address);
+    last = flash_native_sector_idx(address + length - 1);
+    for (i = first; i <= last; i++) {
+        nss = native_flash_stats + i;
+        nss->nss_progs++;
+        if (nss->nss_progs > nss->nss_max_progs) {
+            nss->nss_max_progs = nss->nss_progs;
+        }
+    }
+
+}
+
 static int
 flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
                             int allow_overwrite)
@@ -120,7 +231,6 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
     uint32_t cur;
     uint32_t end;
     int chunk_sz;
-    int rc;
     int i;
 
     if (length == 0) {
@@ -141,8 +251,7 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
 
         /* Ensure data is not being overwritten. */
         if (!allow_overwrite) {
-            rc = native_flash_read(cur, buf, chunk_sz);
-            assert(rc == 0);
+            memcpy(buf, (char *)file_loc + cur, chunk_sz);
             for (i = 0; i < chunk_sz; i++) {
                 assert(buf[i] == 0xff);
             }
@@ -152,6 +261,7 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
     }
 
     memcpy((char *)file_loc + address, src, length);
+    flash_native_account_write(address, length);
 
     return 0;
 }
@@ -159,8 +269,13 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
 static int
 native_flash_write(uint32_t address, const void *src, uint32_t length)
 {
+    int rc;
+
     assert(address % native_flash_dev.hf_align == 0);
-    return flash_native_write_internal(address, src, length, 0);
+    rc = flash_native_write_internal(address, src, length, 0);
+    flash_native_charge((uint64_t)length * native_flash_model_cur.nfm_write_ns);
+
+    return rc;
 }
 
 int
@@ -176,6 +291,9 @@ native_flash_read(uint32_t address, void *dst, uint32_t length)
     flash_native_ensure_file_open();
     memcpy(dst, (char *)file_loc + address, length);
 
+    native_flash_read_bytes += length;
+    flash_native_charge((uint64_t)length * native_flash_model_cur.nfm_read_ns);
+
     return 0;
 }
 
@@ -207,7 +325,7 @@ flash_sector_len(int sector)
 }
 
 static int
-native_flash_erase_sector(uint32_t sector_address)
+flash_native_erase_sector_internal(uint32_t sector_address)
 {
     int area_id;
     uint32_t len;
@@ -220,9 +338,114 @@ native_flash_erase_sector(uint32_t sector_address)
     }
     len = flash_sector_len(area_id);
     flash_native_erase(sector_address, len);
+
+    native_flash_stats[area_id].nss_erases++;
+    native_flash_stats[area_id].nss_progs = 0;
+
+    return 0;
+}
+
+static int
+native_flash_erase_sector(uint32_t sector_address)
+{
+    int rc;
+
+    rc = flash_native_erase_sector_internal(sector_address);
+    if (rc == 0) {
+        flash_native_charge(native_flash_model_cur.nfm_erase_us * 1000ull);
+    }
+    return rc;
+}
+
+static uint64_t
+flash_native_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Records an asynchronous operation.  Its modeled duration is added to the
+ * virtual clock, but rather than spinning, the operation stays busy until
+ * that much host time has passed, leaving the CPU to the caller meanwhile.
+ */
+static void
+flash_native_async_start(uint8_t op, uint32_t address, const void *src,
+                         uint32_t length, uint64_t ns)
+{
+    if (!native_flash_model_on) {
+        ns = 0;
+    }
+    native_flash_time += ns;
+
+    native_flash_async.op = op;
+    native_flash_async.address = address;
+    native_flash_async.src = src;
+    native_flash_async.length = length;
+    native_flash_async.deadline = flash_native_now_ns() + ns;
+}
+
+static int
+native_flash_write_start(uint32_t address, const void *src, uint32_t length)
+{
+    if (native_flash_async.op != NATIVE_FLASH_OP_NONE) {
+        return -1;
+    }
+    assert(address % native_flash_dev.hf_align == 0);
+
+    flash_native_async_start(NATIVE_FLASH_OP_WRITE, address, src, length,
+      (uint64_t)length * native_flash_model_cur.nfm_write_ns);
     return 0;
 }
 
+static int
+native_flash_erase_sector_start(uint32_t sector_address)
+{
+    if (native_flash_async.op != NATIVE_FLASH_OP_NONE) {
+        return -1;
+    }
+    if (find_area(sector_address) == -1) {
+        return -1;
+    }
+
+    flash_native_async_start(NATIVE_FLASH_OP_ERASE, sector_address, NULL, 0,
+      native_flash_model_cur.nfm_erase_us * 1000ull);
+    return 0;
+}
+
+static int
+native_flash_poll(void)
+{
+    if (native_flash_async.op == NATIVE_FLASH_OP_NONE) {
+        return 0;
+    }
+    return flash_native_now_ns() < native_flash_async.deadline;
+}
+
+static int
+native_flash_complete(void)
+{
+    int rc;
+
+    switch (native_flash_async.op) {
+    case NATIVE_FLASH_OP_WRITE:
+        rc = flash_native_write_internal(native_flash_async.address,
+          native_flash_async.src, native_flash_async.length, 0);
+        break;
+    case NATIVE_FLASH_OP_ERASE:
+        rc = flash_native_erase_sector_internal(native_flash_async.address);
+        break;
+    default:
+        rc = -1;
+        break;
+    }
+    native_flash_async.op = NATIVE_FLASH_OP_NONE;
+
+    return rc;
+}
+
 static int
 native_flash_sector_info(int idx, uint32_t *address, uint32_t *size)
 {
@@ -242,3 +465,120 @@ native_flash_init(void)
     return 0;
 }
 
+/**
+ * Enables the flash timing model.  The wear counters are dumped to stderr
+ * when the process exits.
+ *
+ * @param model                 The device parameters to use.
+ */
+void
+native_flash_model_set(const struct native_flash_model *model)
+{
+    if (!native_flash_model_on) {
+        atexit(native_flash_stats_dump);
+    }
+    native_flash_model_cur = *model;
+    native_flash_model_on = 1;
+}
+
+/**
+ * Parses a model specification of the form
+ * "write_ns,erase_us,read_ns[,cpu]" and enables the resulting model.
+ *
+ * @return                      0 on success; -1 on malformed input.
+ */
+int
+native_flash_model_parse(const char *spec)
+{
+    struct native_flash_model model;
+    unsigned int write_ns;
+    unsigned int erase_us;
+    unsigned int read_ns;
+    char clock[4];
+    int n;
+
+    n = sscanf(spec, "%u,%u,%u,%3s", &write_ns, &erase_us, &read_ns, clock);
+    if (n < 3) {
+        return -1;
+    }
+
+    memset(&model, 0, sizeof model);
+    model.nfm_write_ns = write_ns;
+    model.nfm_erase_us = erase_us;
+    model.nfm_read_ns = read_ns;
+    if (n == 4) {
+        if (strcmp(clock, "cpu") != 0) {
+            return -1;
+        }
+        model.nfm_clock = NATIVE_FLASH_CLOCK_CPUTIME;
+    } else {
+        model.nfm_clock = NATIVE_FLASH_CLOCK_VIRTUAL;
+    }
+
+    native_flash_model_set(&model);
+    return 0;
+}
+
+/**
+ * @return                      The active flash model;
+ *                              NULL if no model is set.
+ */
+const struct native_flash_model *
+native_flash_model_get(void)
+{
+    if (!native_flash_model_on) {
+        return NULL;
+    }
+    return &native_flash_model_cur;
+}
+
+/**
+ * @return                      The total modeled flash busy time, in
+ *                                  nanoseconds.
+ */
+uint64_t
+native_flash_time_ns(void)
+{
+    return native_flash_time;
+}
+
+/**
+ * Retrieves the wear counters of a single sector.
+ *
+ * @return                      0 on success; -1 if idx is out of range.
+ */
+int
+native_flash_sector_stats(int idx, struct native_flash_sector_stats *nss)
+{
+    if (idx < 0 || idx >= FLASH_NUM_AREAS) {
+        return -1;
+    }
+
+    *nss = native_flash_stats[idx];
+    return 0;
+}
+
+void
+native_flash_stats_dump(void)
+{
+    struct native_flash_sector_stats *nss;
+    uint32_t erases;
+    int i;
+
+    erases = 0;
+    for (i = 0; i < FLASH_NUM_AREAS; i++) {
+        erases += native_flash_stats[i].nss_erases;
+    }
+
+    fprintf(stderr, "flash: time_us=%" PRIu64 " read_bytes=%" PRIu64
+            " write_bytes=%" PRIu64 " erases=%" PRIu32 "\n",
+            native_flash_time / 1000, native_flash_read_bytes,
+            native_flash_write_bytes, erases);
+    for (i = 0; i < FLASH_NUM_AREAS; i++) {
+        nss = native_flash_stats + i;
+        fprintf(stderr, "flash: sector %2d addr=0x%06" PRIx32 " len=%6d "
+                "erases=%" PRIu32 " max_progs_per_erase=%" PRIu32 "\n",
+                i, native_flash_sectors[i], flash_sector_len(i),
+                nss->nss_erases, nss->nss_max_progs);
+    }
+}
@@ -39,10 +39,15 @@ static void
 usage(char *progname, int rc)
 {
     const char msg[] =
-      "Usage: %s [-f flash_file] [-u uart_log_file]\n"
+      "Usage: %s [-f flash_file] [-u uart_log_file] [-m flash_model]\n"
       "     -f flash_file tells where binary flash file is located. It gets\n"
       "        created if it doesn't already exist.\n"
-      "     -u uart_log_file puts all UART data exchanges into a logfile.\n";
+      "     -u uart_log_file puts all UART data exchanges into a logfile.\n"
+      "     -m write_ns,erase_us,read_ns[,cpu] enables the flash timing\n"
+      "        model: per-byte write time, per-sector erase time and\n"
+      "        per-byte read time.  With ',cpu' the time is spent spinning,\n"
+      "        advancing the OS clock; otherwise it is charged against a\n"
+      "        virtual clock.  Flash wear counters are dumped on exit.\n";
 
     write(2, msg, strlen(msg));
     exit(rc);
@@ -54,11 +59,16 @@ mcu_sim_parse_args(int argc, char **argv)
     int ch;
     char *progname = argv[0];
 
-    while ((ch = getopt(argc, argv, "hf:u:")) != -1) {
+    while ((ch = getopt(argc, argv, "hf:m:u:")) != -1) {
         switch (ch) {
         case 'f':
             native_flash_file = optarg;
             break;
+        case 'm':
+            if (native_flash_model_parse(optarg) != 0) {
+                usage(progname, -1);
+            }
+            break;
         case 'u':
             native_uart_log_file = optarg;
             break;
@@ -0,0 +1,97 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_IMAGE_DELTA_
+#define H_IMAGE_DELTA_
+
+#include <inttypes.h>
+#include "bootutil/image.h"
+#include "bootutil/image_verify.h"
+
+/*
+ * A delta describes a new image in terms of an existing (base) image.  It
+ * is a struct image_delta_hdr followed by a sequence of commands:
+ *
+ *     COPY     0x01 <src_off> <len>    Copy len bytes of the base image,
+ *                                      starting at src_off.
+ *     INSERT   0x02 <len> <data>       Write the len bytes of data.
+ *
+ * Offsets and lengths are unsigned LEB128 varints.  Base image offsets count
+ * from the start of the image header.  The commands produce the complete new
+ * image, header included, strictly in order, so it can be streamed into
+ * flash as the delta arrives.
+ */
+#define IMAGE_DELTA_MAGIC           0x96f3d17a
+
+#define IMAGE_DELTA_OP_COPY         0x01
+#define IMAGE_DELTA_OP_INSERT       0x02
+
+#define IMAGE_DELTA_EINVAL          1   /* Malformed delta. */
+#define IMAGE_DELTA_EBASE           2   /* Delta is for another base image. */
+#define IMAGE_DELTA_EFLASH          3   /* Read or write callback failed. */
+#define IMAGE_DELTA_EBADIMAGE       4   /* Result failed verification. */
+
+/** Delta header.  All fields are in little endian byte order. */
+struct image_delta_hdr {
+    uint32_t idh_magic;
+    uint32_t idh_base_crc32;    /* ih_crc32 of the base image. */
+    uint32_t idh_base_size;     /* Includes the base image's header. */
+    uint32_t idh_new_size;      /* Includes the new image's header. */
+};
+
+/** Reads len bytes of the base image at offset off. */
+typedef int image_delta_read_fn(void *arg, uint32_t off, void *dst, int len);
+
+/** Appends len bytes to the new image. */
+typedef int image_delta_write_fn(void *arg, const void *src, int len);
+
+/**
+ * State of a delta being applied.  The delta can be fed in arbitrarily sized
+ * pieces; apart from this structure, applying it needs only a small stack
+ * buffer for copies.
+ */
+struct image_delta {
+    image_delta_read_fn *id_read;
+    image_delta_write_fn *id_write;
+    void *id_arg;
+
+    uint32_t id_base_crc32;
+    uint32_t id_base_size;
+
+    struct image_delta_hdr id_hdr;
+    uint8_t id_hdr_len;
+
+    /* The new image, checked as it is written. */
+    struct image_verify id_verify;
+
+    uint8_t id_state;
+    uint8_t id_op;
+    uint8_t id_arg_idx;
+    uint8_t id_shift;
+    uint32_t id_args[2];
+    uint32_t id_remaining;
+};
+
+void image_delta_init(struct image_delta *id, uint32_t base_crc32,
+                      uint32_t base_size, image_delta_read_fn *read_cb,
+                      image_delta_write_fn *write_cb, void *arg);
+int image_delta_feed(struct image_delta *id, const void *data, int len);
+int image_delta_finish(struct image_delta *id);
+
+#endif
@@ -0,0 +1,42 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_IMAGE_VERIFY_
+#define H_IMAGE_VERIFY_
+
+#include <inttypes.h>
+#include "bootutil/image.h"
+
+/**
+ * Checks an image as it is written, so it never has to be read back: the
+ * header is captured from the first bytes and the CRC is computed over the
+ * rest.
+ */
+struct image_verify {
+    struct image_header iv_hdr;
+    uint32_t iv_off;            /* Number of image bytes seen so far. */
+    uint32_t iv_crc;
+};
+
+void image_verify_init(struct image_verify *iv);
+void image_verify_update(struct image_verify *iv, const void *data,
+                         uint32_t len);
+int image_verify_finish(const struct image_verify *iv);
+
+#endif
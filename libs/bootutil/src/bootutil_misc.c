@@ -22,7 +22,7 @@
 #include "hal/hal_flash.h"
 #include "fs/fs.h"
 #include "fs/fsutil.h"
-#include "bootutil/crc32.h"
+#include "util/crc32.h"
 #include "bootutil/image.h"
 #include "bootutil_priv.h"
 
@@ -201,6 +201,14 @@ boot_read_status(struct boot_status *out_status,
     if (out_status->bs_img2_length == 0xffffffff) {
         out_status->bs_img2_length = 0;
     }
+    if (out_status->bs_copy_from == BOOT_AREA_IDX_NONE ||
+        out_status->bs_copy_to == BOOT_AREA_IDX_NONE ||
+        out_status->bs_copy_off == 0xffffffff) {
+
+        out_status->bs_copy_from = BOOT_AREA_IDX_NONE;
+        out_status->bs_copy_to = BOOT_AREA_IDX_NONE;
+        out_status->bs_copy_off = 0;
+    }
 
     for (i = 0; i < num_areas; i++) {
         if (out_entries[i].bse_image_num == 0 &&
@@ -31,14 +31,26 @@ struct image_header;
 #define BOOT_ENOMEM     6
 
 #define BOOT_IMAGE_NUM_NONE     0xff
+#define BOOT_AREA_IDX_NONE      0xff
 
 #define BOOT_PATH_MAIN      "/boot/main"
 #define BOOT_PATH_TEST      "/boot/test"
 #define BOOT_PATH_STATUS    "/boot/status"
 
 struct boot_status {
+    /* Lengths include the image header. */
     uint32_t bs_img1_length;
     uint32_t bs_img2_length;
+
+    /* Progress of the area copy in progress, if any.  bs_copy_off is the
+     * number of bytes of the destination area that are known to be complete;
+     * it always falls on a sector boundary.
+     */
+    uint8_t bs_copy_from;
+    uint8_t bs_copy_to;
+    uint16_t _pad;
+    uint32_t bs_copy_off;
+
     /* Followed by sequence of boot status entries; file size indicates number
      * of entries.
      */
@@ -0,0 +1,277 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "os/os.h"
+#include "bootutil/image.h"
+#include "bootutil/image_delta.h"
+#include "bootutil/image_verify.h"
+
+/** Size of the stack buffer used to copy base image data. */
+#ifndef IMAGE_DELTA_COPY_BUF_SZ
+#define IMAGE_DELTA_COPY_BUF_SZ     64
+#endif
+
+#define IMAGE_DELTA_STATE_HDR       0
+#define IMAGE_DELTA_STATE_OP        1
+#define IMAGE_DELTA_STATE_ARG       2
+#define IMAGE_DELTA_STATE_INSERT    3
+#define IMAGE_DELTA_STATE_ERR       4
+
+/**
+ * Initializes a delta application.
+ *
+ * @param id                    The state to initialize.
+ * @param base_crc32            The ih_crc32 field of the base image.
+ * @param base_size             The length of the base image, including its
+ *                                  header.
+ * @param read_cb               Reads from the base image.
+ * @param write_cb              Appends to the new image.
+ * @param arg                   Passed to both callbacks.
+ */
+void
+image_delta_init(struct image_delta *id, uint32_t base_crc32,
+                 uint32_t base_size, image_delta_read_fn *read_cb,
+                 image_delta_write_fn *write_cb, void *arg)
+{
+    memset(id, 0, sizeof *id);
+    id->id_read = read_cb;
+    id->id_write = write_cb;
+    id->id_arg = arg;
+    id->id_base_crc32 = base_crc32;
+    id->id_base_size = base_size;
+    id->id_state = IMAGE_DELTA_STATE_HDR;
+    image_verify_init(&id->id_verify);
+}
+
+static int
+image_delta_fail(struct image_delta *id, int rc)
+{
+    id->id_state = IMAGE_DELTA_STATE_ERR;
+    return rc;
+}
+
+/**
+ * Appends data to the new image, keeping track of its header and CRC.
+ */
+static int
+image_delta_out(struct image_delta *id, const uint8_t *data, int len)
+{
+    int rc;
+
+    if (len > id->id_hdr.idh_new_size - id->id_verify.iv_off) {
+        return IMAGE_DELTA_EINVAL;
+    }
+
+    rc = id->id_write(id->id_arg, data, len);
+    if (rc != 0) {
+        return IMAGE_DELTA_EFLASH;
+    }
+
+    image_verify_update(&id->id_verify, data, len);
+    return 0;
+}
+
+static int
+image_delta_copy(struct image_delta *id, uint32_t src_off, uint32_t len)
+{
+    uint8_t buf[IMAGE_DELTA_COPY_BUF_SZ];
+    uint32_t chunk_sz;
+    int rc;
+
+    if (src_off > id->id_base_size || len > id->id_base_size - src_off) {
+        return IMAGE_DELTA_EINVAL;
+    }
+
+    while (len > 0) {
+        chunk_sz = min(len, sizeof buf);
+
+        rc = id->id_read(id->id_arg, src_off, buf, chunk_sz);
+        if (rc != 0) {
+            return IMAGE_DELTA_EFLASH;
+        }
+        rc = image_delta_out(id, buf, chunk_sz);
+        if (rc != 0) {
+            return rc;
+        }
+
+        src_off += chunk_sz;
+        len -= chunk_sz;
+    }
+
+    return 0;
+}
+
+/**
+ * Executes the current command once all of its arguments have been parsed.
+ */
+static int
+image_delta_run_op(struct image_delta *id)
+{
+    switch (id->id_op) {
+    case IMAGE_DELTA_OP_COPY:
+        id->id_state = IMAGE_DELTA_STATE_OP;
+        return image_delta_copy(id, id->id_args[0], id->id_args[1]);
+
+    case IMAGE_DELTA_OP_INSERT:
+        if (id->id_args[0] > id->id_hdr.idh_new_size - id->id_verify.iv_off) {
+            return IMAGE_DELTA_EINVAL;
+        }
+        id->id_remaining = id->id_args[0];
+        if (id->id_remaining == 0) {
+            id->id_state = IMAGE_DELTA_STATE_OP;
+        } else {
+            id->id_state = IMAGE_DELTA_STATE_INSERT;
+        }
+        return 0;
+
+    default:
+        return IMAGE_DELTA_EINVAL;
+    }
+}
+
+/**
+ * Feeds the next piece of a delta.  Output is produced as soon as the
+ * corresponding commands are complete.
+ *
+ * @param id                    The delta being applied.
+ * @param data                  The next bytes of the delta.
+ * @param len                   The number of bytes to feed.
+ *
+ * @return                      0 on success; IMAGE_DELTA_E[...] on failure.
+ *                                  Once a call fails, the delta cannot be
+ *                                  continued.
+ */
+int
+image_delta_feed(struct image_delta *id, const void *data, int len)
+{
+    const uint8_t *u8p;
+    uint8_t nargs;
+    uint8_t b;
+    int chunk_sz;
+    int rc;
+
+    u8p = data;
+    while (len > 0) {
+        chunk_sz = 1;
+
+        switch (id->id_state) {
+        case IMAGE_DELTA_STATE_HDR:
+            chunk_sz = min(len, sizeof id->id_hdr - id->id_hdr_len);
+            memcpy((uint8_t *)&id->id_hdr + id->id_hdr_len, u8p, chunk_sz);
+            id->id_hdr_len += chunk_sz;
+            if (id->id_hdr_len == sizeof id->id_hdr) {
+                if (id->id_hdr.idh_magic != IMAGE_DELTA_MAGIC ||
+                    id->id_hdr.idh_new_size < sizeof(struct image_header)) {
+
+                    return image_delta_fail(id, IMAGE_DELTA_EINVAL);
+                }
+                if (id->id_hdr.idh_base_crc32 != id->id_base_crc32 ||
+                    id->id_hdr.idh_base_size != id->id_base_size) {
+
+                    return image_delta_fail(id, IMAGE_DELTA_EBASE);
+                }
+                id->id_state = IMAGE_DELTA_STATE_OP;
+            }
+            break;
+
+        case IMAGE_DELTA_STATE_OP:
+            id->id_op = *u8p;
+            if (id->id_op != IMAGE_DELTA_OP_COPY &&
+                id->id_op != IMAGE_DELTA_OP_INSERT) {
+
+                return image_delta_fail(id, IMAGE_DELTA_EINVAL);
+            }
+            id->id_args[0] = 0;
+            id->id_args[1] = 0;
+            id->id_arg_idx = 0;
+            id->id_shift = 0;
+            id->id_state = IMAGE_DELTA_STATE_ARG;
+            break;
+
+        case IMAGE_DELTA_STATE_ARG:
+            b = *u8p;
+            if (id->id_shift > 28 || (id->id_shift == 28 && (b & 0x70))) {
+                /* Varint does not fit in 32 bits. */
+                return image_delta_fail(id, IMAGE_DELTA_EINVAL);
+            }
+            id->id_args[id->id_arg_idx] |= (uint32_t)(b & 0x7f) << id->id_shift;
+            id->id_shift += 7;
+            if (!(b & 0x80)) {
+                id->id_arg_idx++;
+                id->id_shift = 0;
+
+                nargs = id->id_op == IMAGE_DELTA_OP_COPY ? 2 : 1;
+                if (id->id_arg_idx == nargs) {
+                    rc = image_delta_run_op(id);
+                    if (rc != 0) {
+                        return image_delta_fail(id, rc);
+                    }
+                }
+            }
+            break;
+
+        case IMAGE_DELTA_STATE_INSERT:
+            chunk_sz = min(len, id->id_remaining);
+            rc = image_delta_out(id, u8p, chunk_sz);
+            if (rc != 0) {
+                return image_delta_fail(id, rc);
+            }
+            id->id_remaining -= chunk_sz;
+            if (id->id_remaining == 0) {
+                id->id_state = IMAGE_DELTA_STATE_OP;
+            }
+            break;
+
+        default:
+            return IMAGE_DELTA_EINVAL;
+        }
+
+        u8p += chunk_sz;
+        len -= chunk_sz;
+    }
+
+    return 0;
+}
+
+/**
+ * Completes a delta application and verifies the new image: it must be
+ * exactly the size the delta header promised, carry a valid image header,
+ * and match that header's CRC.
+ *
+ * @return                      0 if the new image is valid;
+ *                              IMAGE_DELTA_EINVAL if the delta is truncated;
+ *                              IMAGE_DELTA_EBADIMAGE if verification fails.
+ */
+int
+image_delta_finish(struct image_delta *id)
+{
+    if (id->id_state != IMAGE_DELTA_STATE_OP ||
+        id->id_verify.iv_off != id->id_hdr.idh_new_size) {
+
+        return image_delta_fail(id, IMAGE_DELTA_EINVAL);
+    }
+
+    if (image_verify_finish(&id->id_verify) != 0) {
+        return image_delta_fail(id, IMAGE_DELTA_EBADIMAGE);
+    }
+
+    return 0;
+}
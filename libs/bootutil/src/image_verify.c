@@ -0,0 +1,83 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "os/os.h"
+#include "util/crc32.h"
+#include "bootutil/image.h"
+#include "bootutil/image_verify.h"
+
+/** The image CRC covers everything after the header's CRC field. */
+#define IMAGE_VERIFY_CRC_START      (IMAGE_HEADER_CRC_OFFSET + 4)
+
+void
+image_verify_init(struct image_verify *iv)
+{
+    memset(iv, 0, sizeof *iv);
+}
+
+/**
+ * Accounts for the next len bytes of the image.
+ */
+void
+image_verify_update(struct image_verify *iv, const void *data, uint32_t len)
+{
+    const uint8_t *u8p;
+    uint32_t skip;
+    uint32_t cnt;
+
+    u8p = data;
+
+    if (iv->iv_off < sizeof iv->iv_hdr) {
+        cnt = min(len, sizeof iv->iv_hdr - iv->iv_off);
+        memcpy((uint8_t *)&iv->iv_hdr + iv->iv_off, u8p, cnt);
+    }
+
+    skip = 0;
+    if (iv->iv_off < IMAGE_VERIFY_CRC_START) {
+        skip = min(len, IMAGE_VERIFY_CRC_START - iv->iv_off);
+    }
+    iv->iv_crc = crc32(iv->iv_crc, u8p + skip, len - skip);
+
+    iv->iv_off += len;
+}
+
+/**
+ * Checks the image once all of it has been seen: it must carry a valid
+ * header, be exactly as long as that header says, and match the header's CRC.
+ *
+ * @return                      0 if the image is valid; nonzero otherwise.
+ */
+int
+image_verify_finish(const struct image_verify *iv)
+{
+    const struct image_header *hdr;
+
+    hdr = &iv->iv_hdr;
+    if (iv->iv_off < sizeof *hdr ||
+        hdr->ih_magic != IMAGE_MAGIC ||
+        hdr->ih_hdr_size + hdr->ih_img_size != iv->iv_off ||
+        hdr->ih_crc32 != iv->iv_crc) {
+
+        return 1;
+    }
+
+    return 0;
+}
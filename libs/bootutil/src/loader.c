@@ -22,6 +22,8 @@
 #include <inttypes.h>
 #include <string.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_flash_int.h"
+#include "os/os.h"
 #include "os/os_malloc.h"
 #include "nffs/nffs.h"
 #include "fs/fs.h"
@@ -32,6 +34,14 @@
 /** Number of image slots in flash; currently limited to two. */
 #define BOOT_NUM_SLOTS              2
 
+/**
+ * Size of the buffer used to copy and compare image data.  Larger buffers mean
+ * fewer, larger flash transfers.
+ */
+#ifndef BOOT_COPY_BUF_SZ
+#define BOOT_COPY_BUF_SZ            4096
+#endif
+
 /** The request object provided by the client. */
 static const struct boot_req *boot_req;
 
@@ -48,6 +58,8 @@ struct boot_status boot_status;
 /** The entries associated with the boot status header. */
 struct boot_status_entry *boot_status_entries;
 
+static uint8_t boot_copy_buf[BOOT_COPY_BUF_SZ];
+
 /**
  * Calculates the flash offset of the specified image slot.
  *
@@ -200,89 +212,341 @@ boot_find_image_area_idx(int area_idx)
     return -1;
 }
 
+/**
+ * Calculates the number of bytes of an image part that hold image data.  The
+ * remainder of the area containing the part is unused and never gets copied.
+ *
+ * @param img_num               The image the part belongs to.
+ * @param part_num              The part number within the image.
+ *
+ * @return                      The length of the part's data; 0 if the
+ *                              image does not extend into the part.
+ */
+static uint32_t
+boot_part_length(int img_num, int part_num)
+{
+    const struct nffs_area_desc *area_desc;
+    uint32_t img_length;
+    uint32_t off;
+    int i;
+
+    switch (img_num) {
+    case 0:
+        img_length = boot_status.bs_img1_length;
+        break;
+
+    case 1:
+        img_length = boot_status.bs_img2_length;
+        break;
+
+    default:
+        return 0;
+    }
+
+    /* Parts are laid out identically in both slots. */
+    area_desc = boot_req->br_area_descs + boot_slot_to_area_idx(0);
+    off = 0;
+    for (i = 0; i < part_num; i++) {
+        off += area_desc[i].nad_length;
+    }
+
+    if (off >= img_length) {
+        return 0;
+    }
+    if (img_length - off < area_desc[part_num].nad_length) {
+        return img_length - off;
+    }
+    return area_desc[part_num].nad_length;
+}
+
+/**
+ * Determines the end of the flash sector containing the specified address.
+ *
+ * @param flash_id              The flash device to look up.
+ * @param addr                  The address to look up.
+ * @param limit                 The end of the range being processed; the
+ *                                  result is clipped to this value.
+ * @param out_end               On success, the end of the sector gets
+ *                                  written here.
+ *
+ * @return                      0 on success; BOOT_EFLASH on failure.
+ */
+static int
+boot_sector_end(uint8_t flash_id, uint32_t addr, uint32_t limit,
+                uint32_t *out_end)
+{
+    uint32_t start;
+    uint32_t size;
+    int idx;
+
+    idx = hal_flash_sector_lookup(flash_id, addr);
+    if (idx == -1) {
+        return BOOT_EFLASH;
+    }
+    if (hal_flash_sector_info(flash_id, idx, &start, &size) != 0) {
+        return BOOT_EFLASH;
+    }
+
+    if (start + size < limit) {
+        *out_end = start + size;
+    } else {
+        *out_end = limit;
+    }
+    return 0;
+}
+
+/**
+ * Indicates whether a region of flash is in the erased state.
+ *
+ * @return                      0 on success; BOOT_EFLASH on failure.
+ */
+static int
+boot_flash_is_erased(uint8_t flash_id, uint32_t addr, uint32_t len,
+                     int *out_erased)
+{
+    uint32_t chunk_sz;
+    uint32_t i;
+    int rc;
+
+    while (len > 0) {
+        chunk_sz = min(len, sizeof boot_copy_buf);
+        rc = hal_flash_read(flash_id, addr, boot_copy_buf, chunk_sz);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+        for (i = 0; i < chunk_sz; i++) {
+            if (boot_copy_buf[i] != 0xff) {
+                *out_erased = 0;
+                return 0;
+            }
+        }
+
+        addr += chunk_sz;
+        len -= chunk_sz;
+    }
+
+    *out_erased = 1;
+    return 0;
+}
+
+/**
+ * Compares the same region of two flash areas.
+ *
+ * @param off                   The offset within each area to compare at.
+ * @param len                   The number of bytes to compare.
+ * @param out_same              On success, set to 1 if the regions are
+ *                                  identical; 0 otherwise.
+ *
+ * @return                      0 on success; BOOT_EFLASH on failure.
+ */
+static int
+boot_area_cmp(int area_idx_1, int area_idx_2, uint32_t off, uint32_t len,
+              int *out_same)
+{
+    const struct nffs_area_desc *area_desc_1;
+    const struct nffs_area_desc *area_desc_2;
+    uint32_t chunk_sz;
+    uint8_t *buf2;
+    int rc;
+
+    area_desc_1 = boot_req->br_area_descs + area_idx_1;
+    area_desc_2 = boot_req->br_area_descs + area_idx_2;
+    buf2 = boot_copy_buf + sizeof boot_copy_buf / 2;
+
+    while (len > 0) {
+        chunk_sz = min(len, sizeof boot_copy_buf / 2);
+
+        rc = hal_flash_read(area_desc_1->nad_flash_id,
+                            area_desc_1->nad_offset + off, boot_copy_buf,
+                            chunk_sz);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+        rc = hal_flash_read(area_desc_2->nad_flash_id,
+                            area_desc_2->nad_offset + off, buf2, chunk_sz);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+        if (memcmp(boot_copy_buf, buf2, chunk_sz) != 0) {
+            *out_same = 0;
+            return 0;
+        }
+
+        off += chunk_sz;
+        len -= chunk_sz;
+    }
+
+    *out_same = 1;
+    return 0;
+}
+
+/**
+ * Erases every sector of an area which is not already erased.
+ *
+ * @param area_idx              The index of the area to erase.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 static int
 boot_erase_area(int area_idx)
 {
     const struct nffs_area_desc *area_desc;
+    uint32_t area_end;
+    uint32_t addr;
+    uint32_t end;
+    int erased;
     int rc;
 
     area_desc = boot_req->br_area_descs + area_idx;
-    rc = hal_flash_erase(area_desc->nad_flash_id, area_desc->nad_offset,
-                         area_desc->nad_length);
-    if (rc != 0) {
-        return BOOT_EFLASH;
+    area_end = area_desc->nad_offset + area_desc->nad_length;
+
+    for (addr = area_desc->nad_offset; addr < area_end; addr = end) {
+        rc = boot_sector_end(area_desc->nad_flash_id, addr, area_end, &end);
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = boot_flash_is_erased(area_desc->nad_flash_id, addr, end - addr,
+                                  &erased);
+        if (rc != 0) {
+            return rc;
+        }
+        if (!erased) {
+            rc = hal_flash_erase(area_desc->nad_flash_id, addr, end - addr);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+        }
     }
 
     return 0;
 }
 
 /**
- * Copies the contents of one area to another.  The destination area must
- * be erased prior to this function being called.
+ * Copies the first len bytes of one area to another, one destination sector
+ * at a time.  Sectors which already hold the source data are skipped, and
+ * sectors are only erased if they are not already blank.  After each sector
+ * gets rewritten, the progress is recorded in the boot status so that an
+ * interrupted copy resumes at the first incomplete sector.
  *
- * @param from_area_idx       The index of the source area.
- * @param to_area_idx         The index of the destination area.
+ * @param from_area_idx         The index of the source area.
+ * @param to_area_idx           The index of the destination area.
+ * @param len                   The number of bytes to copy.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
-boot_copy_area(int from_area_idx, int to_area_idx)
+boot_copy_area(int from_area_idx, int to_area_idx, uint32_t len)
 {
     const struct nffs_area_desc *from_area_desc;
     const struct nffs_area_desc *to_area_desc;
-    uint32_t from_addr;
-    uint32_t to_addr;
+    uint32_t chunk_sz;
+    uint32_t sect_end;
+    uint32_t end;
     uint32_t off;
-    int chunk_sz;
+    int erased;
+    int same;
     int rc;
 
-    static uint8_t buf[1024];
-
     from_area_desc = boot_req->br_area_descs + from_area_idx;
     to_area_desc = boot_req->br_area_descs + to_area_idx;
 
-    assert(to_area_desc->nad_length >= from_area_desc->nad_length);
+    assert(len <= from_area_desc->nad_length);
+    assert(len <= to_area_desc->nad_length);
 
     off = 0;
-    while (off < from_area_desc->nad_length) {
-        if (from_area_desc->nad_length - off > sizeof buf) {
-            chunk_sz = sizeof buf;
-        } else {
-            chunk_sz = from_area_desc->nad_length - off;
+    if (boot_status.bs_copy_from == from_area_idx &&
+        boot_status.bs_copy_to == to_area_idx &&
+        boot_status.bs_copy_off < len) {
+
+        /* Resume an interrupted copy. */
+        off = boot_status.bs_copy_off;
+    }
+    boot_status.bs_copy_from = from_area_idx;
+    boot_status.bs_copy_to = to_area_idx;
+
+    while (off < len) {
+        rc = boot_sector_end(to_area_desc->nad_flash_id,
+                             to_area_desc->nad_offset + off,
+                             to_area_desc->nad_offset + len, &end);
+        if (rc != 0) {
+            return rc;
         }
+        sect_end = end - to_area_desc->nad_offset;
 
-        from_addr = from_area_desc->nad_offset + off;
-        rc = hal_flash_read(from_area_desc->nad_flash_id, from_addr, buf,
-                            chunk_sz);
+        rc = boot_area_cmp(from_area_idx, to_area_idx, off, sect_end - off,
+                           &same);
         if (rc != 0) {
             return rc;
         }
+        if (same) {
+            off = sect_end;
+            continue;
+        }
 
-        to_addr = to_area_desc->nad_offset + off;
-        rc = hal_flash_write(to_area_desc->nad_flash_id, to_addr, buf,
-                             chunk_sz);
+        rc = boot_flash_is_erased(to_area_desc->nad_flash_id,
+                                  to_area_desc->nad_offset + off,
+                                  sect_end - off, &erased);
         if (rc != 0) {
             return rc;
         }
+        if (!erased) {
+            rc = hal_flash_erase(to_area_desc->nad_flash_id,
+                                 to_area_desc->nad_offset + off,
+                                 sect_end - off);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+        }
 
-        off += chunk_sz;
+        while (off < sect_end) {
+            chunk_sz = min(sect_end - off, sizeof boot_copy_buf);
+
+            rc = hal_flash_read(from_area_desc->nad_flash_id,
+                                from_area_desc->nad_offset + off,
+                                boot_copy_buf, chunk_sz);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+
+            rc = hal_flash_write(to_area_desc->nad_flash_id,
+                                 to_area_desc->nad_offset + off,
+                                 boot_copy_buf, chunk_sz);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+
+            off += chunk_sz;
+        }
+
+        /* The caller records completion of the final sector when it updates
+         * the status entries.
+         */
+        if (off < len) {
+            boot_status.bs_copy_off = off;
+            rc = boot_write_status(&boot_status, boot_status_entries,
+                                   boot_req->br_num_image_areas);
+            if (rc != 0) {
+                return rc;
+            }
+        }
     }
 
+    boot_status.bs_copy_from = BOOT_AREA_IDX_NONE;
+    boot_status.bs_copy_to = BOOT_AREA_IDX_NONE;
+    boot_status.bs_copy_off = 0;
+
     return 0;
 }
 
 /**
- * Swaps the contents of two flash areas.
+ * Moves an image part from one area to an area which does not contain
+ * anything useful.
  *
- * @param area_idx_1            The index of one area to swap.  This area
- *                                  must be part of the first image slot.
- * @param part_num_1            The image part number stored in the first
- *                                  area.
- * @param area_idx_2            The index of the other area to swap.  This
- *                                  area must be part of the second image
- *                                  slot.
- * @param part_num_2            The image part number stored in the second
- *                                  area.
+ * @param from_area_idx         The index of the area containing the part.
+ * @param to_area_idx           The index of the area to move the part to.
+ * @param img_num               The image the part belongs to.
+ * @param part_num              The image part number.
  *
  * @return                      0 on success; nonzero on failure.
  */
@@ -300,12 +564,8 @@ boot_move_area(int from_area_idx, int to_area_idx,
     dst_image_idx = boot_find_image_area_idx(to_area_idx);
     assert(dst_image_idx != -1);
 
-    rc = boot_erase_area(to_area_idx);
-    if (rc != 0) {
-        return rc;
-    }
-
-    rc = boot_copy_area(from_area_idx, to_area_idx);
+    rc = boot_copy_area(from_area_idx, to_area_idx,
+                        boot_part_length(img_num, part_num));
     if (rc != 0) {
         return rc;
     }
@@ -347,9 +607,13 @@ static int
 boot_swap_areas(int area_idx_1, int img_num_1, uint8_t part_num_1,
                   int area_idx_2, int img_num_2, uint8_t part_num_2)
 {
+    struct boot_status_entry entry;
+    uint32_t length_1;
+    uint32_t length_2;
     int scratch_image_idx;
     int image_idx_1;
     int image_idx_2;
+    int same;
     int rc;
 
     assert(area_idx_1 != area_idx_2);
@@ -366,12 +630,28 @@ boot_swap_areas(int area_idx_1, int img_num_1, uint8_t part_num_1,
         boot_find_image_area_idx(boot_req->br_scratch_area_idx);
     assert(scratch_image_idx != -1);
 
-    rc = boot_erase_area(boot_req->br_scratch_area_idx);
+    length_1 = boot_part_length(boot_status_entries[image_idx_1].bse_image_num,
+                                boot_status_entries[image_idx_1].bse_part_num);
+    length_2 = boot_part_length(boot_status_entries[image_idx_2].bse_image_num,
+                                boot_status_entries[image_idx_2].bse_part_num);
+
+    /* If both areas already hold the same data, only the bookkeeping needs
+     * to change.
+     */
+    rc = boot_area_cmp(area_idx_1, area_idx_2, 0, max(length_1, length_2),
+                       &same);
     if (rc != 0) {
         return rc;
     }
+    if (same) {
+        entry = boot_status_entries[image_idx_1];
+        boot_status_entries[image_idx_1] = boot_status_entries[image_idx_2];
+        boot_status_entries[image_idx_2] = entry;
+        return boot_write_status(&boot_status, boot_status_entries,
+                                 boot_req->br_num_image_areas);
+    }
 
-    rc = boot_copy_area(area_idx_2, boot_req->br_scratch_area_idx);
+    rc = boot_copy_area(area_idx_2, boot_req->br_scratch_area_idx, length_2);
     if (rc != 0) {
         return rc;
     }
@@ -386,12 +666,7 @@ boot_swap_areas(int area_idx_1, int img_num_1, uint8_t part_num_1,
         return rc;
     }
 
-    rc = boot_erase_area(area_idx_2);
-    if (rc != 0) {
-        return rc;
-    }
-
-    rc = boot_copy_area(area_idx_1, area_idx_2);
+    rc = boot_copy_area(area_idx_1, area_idx_2, length_1);
     if (rc != 0) {
         return rc;
     }
@@ -405,12 +680,7 @@ boot_swap_areas(int area_idx_1, int img_num_1, uint8_t part_num_1,
         return rc;
     }
 
-    rc = boot_erase_area(area_idx_1);
-    if (rc != 0) {
-        return rc;
-    }
-
-    rc = boot_copy_area(boot_req->br_scratch_area_idx, area_idx_1);
+    rc = boot_copy_area(boot_req->br_scratch_area_idx, area_idx_1, length_2);
     if (rc != 0) {
         return rc;
     }
@@ -491,8 +761,10 @@ boot_fill_slot(int img_num, uint32_t img_length, int start_area_idx)
  * Swaps the two images in flash.  If a prior copy operation was interrupted
  * by a system reset, this function completes that operation.
  *
- * @param img1_length           The length, in bytes, of the slot 1 image.
- * @param img2_length           The length, in bytes, of the slot 2 image.
+ * @param img1_length           The length, in bytes, of the slot 1 image,
+ *                                  including its header.
+ * @param img2_length           The length, in bytes, of the slot 2 image,
+ *                                  including its header.
  *
  * @return                      0 on success; nonzero on failure.
  */
@@ -567,20 +839,26 @@ boot_build_status(void)
     memset(boot_status_entries, 0xff,
            boot_req->br_num_image_areas * sizeof *boot_status_entries);
 
+    boot_status.bs_copy_from = BOOT_AREA_IDX_NONE;
+    boot_status.bs_copy_to = BOOT_AREA_IDX_NONE;
+    boot_status.bs_copy_off = 0;
+
     if (boot_img_hdrs[0].ih_magic == IMAGE_MAGIC) {
-        boot_status.bs_img1_length = boot_img_hdrs[0].ih_img_size;
+        boot_status.bs_img1_length = boot_img_hdrs[0].ih_hdr_size +
+                                     boot_img_hdrs[0].ih_img_size;
         boot_slot_addr(0, &flash_id, &address);
         boot_build_status_one(0, flash_id, address,
-                              boot_img_hdrs[0].ih_img_size);
+                              boot_status.bs_img1_length);
     } else {
         boot_status.bs_img1_length = 0;
     }
 
     if (boot_img_hdrs[1].ih_magic == IMAGE_MAGIC) {
-        boot_status.bs_img2_length = boot_img_hdrs[1].ih_img_size;
+        boot_status.bs_img2_length = boot_img_hdrs[1].ih_hdr_size +
+                                     boot_img_hdrs[1].ih_img_size;
         boot_slot_addr(1, &flash_id, &address);
         boot_build_status_one(1, flash_id, address,
-                              boot_img_hdrs[1].ih_img_size);
+                              boot_status.bs_img2_length);
     } else {
         boot_status.bs_img2_length = 0;
     }
@@ -28,7 +28,10 @@
 #include "fs/fs.h"
 #include "fs/fsutil.h"
 #include "nffs/nffs.h"
+#include "util/crc32.h"
 #include "bootutil/image.h"
+#include "bootutil/image_delta.h"
+#include "bootutil/image_verify.h"
 #include "bootutil/loader.h"
 #include "../src/bootutil_priv.h"
 
@@ -68,6 +71,29 @@ static uint8_t boot_test_slot_areas[] = {
     5, 8,
 };
 
+/** Layout in which the first area of each slot spans two flash sectors. */
+static struct nffs_area_desc boot_test_area_descs_2sect[] = {
+    [0] =  { 0x00000000, 16 * 1024 },
+    [1] =  { 0x00004000, 16 * 1024 },
+    [2] =  { 0x00008000, 16 * 1024 },
+    [3] =  { 0x0000c000, 16 * 1024 },
+    [4] =  { 0x00010000, 64 * 1024 },
+    [5] =  { 0x00020000, 256 * 1024 },
+    [6] =  { 0x00060000, 128 * 1024 },
+    [7] =  { 0x00080000, 256 * 1024 },
+    [8] =  { 0x000c0000, 128 * 1024 },
+    [9] =  { 0x000e0000, 128 * 1024 },
+    { 0, 0 },
+};
+
+static uint8_t boot_test_img_areas_2sect[] = {
+    5, 6, 7, 8, 9
+};
+
+static uint8_t boot_test_slot_areas_2sect[] = {
+    5, 7,
+};
+
 /** Flash offsets of the two image slots. */
 static struct {
     uint8_t flash_id;
@@ -736,7 +762,7 @@ TEST_CASE(boot_test_nv_bs_10)
                                 BOOT_TEST_AREA_IDX_SCRATCH);
 
     memset(&status, 0xff, sizeof status);
-    status.bs_img2_length = hdr.ih_img_size;
+    status.bs_img2_length = hdr.ih_hdr_size + hdr.ih_img_size;
 
     memset(entries, 0xff, sizeof entries);
     entries[BOOT_TEST_IMG_AREA_IDX_SCRATCH].bse_image_num = 1;
@@ -796,8 +822,8 @@ TEST_CASE(boot_test_nv_bs_11)
                              BOOT_TEST_AREA_IDX_SCRATCH);
 
     memset(&status, 0xff, sizeof status);
-    status.bs_img1_length = hdr0.ih_img_size;
-    status.bs_img2_length = hdr1.ih_img_size;
+    status.bs_img1_length = hdr0.ih_hdr_size + hdr0.ih_img_size;
+    status.bs_img2_length = hdr1.ih_hdr_size + hdr1.ih_img_size;
 
     memset(entries, 0xff, sizeof entries);
     entries[3].bse_image_num = 1;
@@ -858,8 +884,8 @@ TEST_CASE(boot_test_nv_bs_11_2areas)
     boot_test_util_swap_areas(boot_test_img_areas[0], boot_test_img_areas[3]);
 
     memset(&status, 0xff, sizeof status);
-    status.bs_img1_length = hdr0.ih_img_size;
-    status.bs_img2_length = hdr1.ih_img_size;
+    status.bs_img1_length = hdr0.ih_hdr_size + hdr0.ih_img_size;
+    status.bs_img2_length = hdr1.ih_hdr_size + hdr1.ih_img_size;
 
     memset(entries, 0xff, sizeof entries);
     entries[0].bse_image_num = 1;
@@ -952,6 +978,363 @@ TEST_CASE(boot_test_vb_ns_11)
     }
 }
 
+TEST_CASE(boot_test_nv_bs_resume)
+{
+    struct boot_status_entry entries[5];
+    struct boot_status status;
+    struct boot_rsp rsp;
+    void *buf;
+    int rc;
+
+    struct image_header hdr = {
+        .ih_magic = IMAGE_MAGIC,
+        .ih_crc32 = 0,
+        .ih_hdr_size = BOOT_TEST_HEADER_SIZE,
+        .ih_img_size = 300 * 1024,
+        .ih_flags = 0,
+        .ih_ver = { 1, 2, 3, 432 },
+    };
+
+    struct boot_req req = {
+        .br_area_descs = boot_test_area_descs_2sect,
+        .br_image_areas = boot_test_img_areas_2sect,
+        .br_slot_areas = boot_test_slot_areas_2sect,
+        .br_scratch_area_idx = 9,
+        .br_num_image_areas = 5,
+    };
+
+    boot_test_util_init_flash();
+    boot_test_util_write_image(&hdr, 1);
+
+    /* Simulate a move of the image's first part that was interrupted after
+     * the first sector of the destination had been written.
+     */
+    buf = malloc(128 * 1024);
+    TEST_ASSERT(buf != NULL);
+    rc = hal_flash_read(0, 0x80000, buf, 128 * 1024);
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_write(0, 0x20000, buf, 128 * 1024);
+    TEST_ASSERT(rc == 0);
+    free(buf);
+
+    /* Clobber the source's copy of the completed sector; the boot loader
+     * must not copy it again.
+     */
+    rc = hal_flash_erase(0, 0x80000, 128 * 1024);
+    TEST_ASSERT(rc == 0);
+
+    memset(&status, 0xff, sizeof status);
+    status.bs_img2_length = hdr.ih_hdr_size + hdr.ih_img_size;
+    status.bs_copy_from = 7;
+    status.bs_copy_to = 5;
+    status.bs_copy_off = 128 * 1024;
+
+    memset(entries, 0xff, sizeof entries);
+    entries[2].bse_image_num = 1;
+    entries[2].bse_part_num = 0;
+    entries[3].bse_image_num = 1;
+    entries[3].bse_part_num = 1;
+
+    rc = boot_write_status(&status, entries, 5);
+    TEST_ASSERT(rc == 0);
+
+    rc = boot_go(&req, &rsp);
+    TEST_ASSERT(rc == 0);
+
+    TEST_ASSERT(memcmp(rsp.br_hdr, &hdr, sizeof hdr) == 0);
+    TEST_ASSERT(rsp.br_flash_id == 0);
+    TEST_ASSERT(rsp.br_image_addr == 0x20000);
+
+    boot_test_util_verify_area(boot_test_area_descs_2sect + 5, &hdr,
+                               0x20000, 1);
+    boot_test_util_verify_area(boot_test_area_descs_2sect + 6, &hdr,
+                               0x20000, 1);
+    boot_test_util_verify_area(boot_test_area_descs_2sect + 7, NULL,
+                               0x80000, 0xff);
+    boot_test_util_verify_area(boot_test_area_descs_2sect + 8, NULL,
+                               0x80000, 0xff);
+    boot_test_util_verify_status_clear();
+}
+
+#define BOOT_TEST_DELTA_BASE_SZ     1024
+#define BOOT_TEST_DELTA_MAX         2048
+
+static uint8_t boot_test_delta_base[BOOT_TEST_DELTA_BASE_SZ];
+static uint8_t boot_test_delta_new[BOOT_TEST_DELTA_MAX];
+static uint8_t boot_test_delta_out[BOOT_TEST_DELTA_MAX];
+static uint8_t boot_test_delta_patch[BOOT_TEST_DELTA_MAX];
+static int boot_test_delta_new_len;
+static int boot_test_delta_out_len;
+static int boot_test_delta_patch_len;
+
+static int
+boot_test_util_delta_read(void *arg, uint32_t off, void *dst, int len)
+{
+    TEST_ASSERT(off + len <= sizeof boot_test_delta_base);
+    memcpy(dst, boot_test_delta_base + off, len);
+    return 0;
+}
+
+static int
+boot_test_util_delta_write(void *arg, const void *src, int len)
+{
+    TEST_ASSERT(boot_test_delta_out_len + len <= sizeof boot_test_delta_out);
+    memcpy(boot_test_delta_out + boot_test_delta_out_len, src, len);
+    boot_test_delta_out_len += len;
+    return 0;
+}
+
+static void
+boot_test_util_delta_varint(uint32_t val)
+{
+    do {
+        boot_test_delta_patch[boot_test_delta_patch_len] = val & 0x7f;
+        val >>= 7;
+        if (val != 0) {
+            boot_test_delta_patch[boot_test_delta_patch_len] |= 0x80;
+        }
+        boot_test_delta_patch_len++;
+    } while (val != 0);
+}
+
+static void
+boot_test_util_delta_copy(uint32_t src_off, uint32_t len)
+{
+    boot_test_delta_patch[boot_test_delta_patch_len++] = IMAGE_DELTA_OP_COPY;
+    boot_test_util_delta_varint(src_off);
+    boot_test_util_delta_varint(len);
+
+    memcpy(boot_test_delta_new + boot_test_delta_new_len,
+           boot_test_delta_base + src_off, len);
+    boot_test_delta_new_len += len;
+}
+
+static void
+boot_test_util_delta_insert(const void *data, uint32_t len)
+{
+    boot_test_delta_patch[boot_test_delta_patch_len++] = IMAGE_DELTA_OP_INSERT;
+    boot_test_util_delta_varint(len);
+
+    memcpy(boot_test_delta_patch + boot_test_delta_patch_len, data, len);
+    boot_test_delta_patch_len += len;
+
+    memcpy(boot_test_delta_new + boot_test_delta_new_len, data, len);
+    boot_test_delta_new_len += len;
+}
+
+static uint32_t
+boot_test_util_img_crc(const uint8_t *img, uint32_t len)
+{
+    return crc32(0, img + IMAGE_HEADER_CRC_OFFSET + 4,
+                 len - IMAGE_HEADER_CRC_OFFSET - 4);
+}
+
+/**
+ * Builds a base image and a delta which turns it into a new image with a
+ * different header, an inserted run of bytes, and a dropped run of bytes.
+ */
+static void
+boot_test_util_delta_build(void)
+{
+    struct image_delta_hdr dhdr;
+    struct image_header hdr;
+    uint8_t ins[40];
+    int i;
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.ih_magic = IMAGE_MAGIC;
+    hdr.ih_hdr_size = sizeof hdr;
+    hdr.ih_img_size = BOOT_TEST_DELTA_BASE_SZ - sizeof hdr;
+    hdr.ih_ver.iv_major = 1;
+    memcpy(boot_test_delta_base, &hdr, sizeof hdr);
+    for (i = sizeof hdr; i < BOOT_TEST_DELTA_BASE_SZ; i++) {
+        boot_test_delta_base[i] = boot_test_util_byte_at(0, i);
+    }
+    hdr.ih_crc32 = boot_test_util_img_crc(boot_test_delta_base,
+                                          BOOT_TEST_DELTA_BASE_SZ);
+    memcpy(boot_test_delta_base, &hdr, sizeof hdr);
+
+    for (i = 0; i < sizeof ins; i++) {
+        ins[i] = 0xa0 + i;
+    }
+
+    boot_test_delta_new_len = 0;
+    boot_test_delta_patch_len = sizeof dhdr;
+
+    /* Header; its size and CRC get patched in below. */
+    boot_test_util_delta_insert(&hdr, sizeof hdr);
+    boot_test_util_delta_copy(sizeof hdr, 300);
+    boot_test_util_delta_insert(ins, sizeof ins);
+    boot_test_util_delta_copy(400, BOOT_TEST_DELTA_BASE_SZ - 400);
+    boot_test_util_delta_copy(sizeof hdr, 200);
+
+    hdr.ih_img_size = boot_test_delta_new_len - sizeof hdr;
+    hdr.ih_ver.iv_major = 2;
+    memcpy(boot_test_delta_new, &hdr, sizeof hdr);
+    hdr.ih_crc32 = boot_test_util_img_crc(boot_test_delta_new,
+                                          boot_test_delta_new_len);
+    memcpy(boot_test_delta_new, &hdr, sizeof hdr);
+
+    /* The header INSERT's data follows its opcode and one-byte length. */
+    memcpy(boot_test_delta_patch + sizeof dhdr + 2, &hdr, sizeof hdr);
+
+    dhdr.idh_magic = IMAGE_DELTA_MAGIC;
+    dhdr.idh_base_crc32 =
+        ((struct image_header *)boot_test_delta_base)->ih_crc32;
+    dhdr.idh_base_size = BOOT_TEST_DELTA_BASE_SZ;
+    dhdr.idh_new_size = boot_test_delta_new_len;
+    memcpy(boot_test_delta_patch, &dhdr, sizeof dhdr);
+}
+
+static int
+boot_test_util_delta_apply(int chunk_sz, uint32_t base_crc32)
+{
+    struct image_delta id;
+    int off;
+    int rc;
+
+    boot_test_delta_out_len = 0;
+    image_delta_init(&id, base_crc32, BOOT_TEST_DELTA_BASE_SZ,
+                     boot_test_util_delta_read, boot_test_util_delta_write,
+                     NULL);
+
+    for (off = 0; off < boot_test_delta_patch_len; off += chunk_sz) {
+        rc = image_delta_feed(&id, boot_test_delta_patch + off,
+                              min(chunk_sz, boot_test_delta_patch_len - off));
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return image_delta_finish(&id);
+}
+
+TEST_CASE(boot_test_delta_apply)
+{
+    uint32_t base_crc32;
+    int chunk_sz;
+    int rc;
+
+    boot_test_util_delta_build();
+    base_crc32 = ((struct image_header *)boot_test_delta_base)->ih_crc32;
+
+    TEST_ASSERT(boot_test_delta_patch_len < boot_test_delta_new_len / 10);
+
+    for (chunk_sz = 1; chunk_sz <= boot_test_delta_patch_len; chunk_sz *= 3) {
+        rc = boot_test_util_delta_apply(chunk_sz, base_crc32);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(boot_test_delta_out_len == boot_test_delta_new_len);
+        TEST_ASSERT(memcmp(boot_test_delta_out, boot_test_delta_new,
+                           boot_test_delta_new_len) == 0);
+    }
+}
+
+TEST_CASE(boot_test_delta_bad)
+{
+    uint32_t base_crc32;
+    int rc;
+
+    boot_test_util_delta_build();
+    base_crc32 = ((struct image_header *)boot_test_delta_base)->ih_crc32;
+
+    /* Wrong base image. */
+    rc = boot_test_util_delta_apply(16, base_crc32 + 1);
+    TEST_ASSERT(rc == IMAGE_DELTA_EBASE);
+    TEST_ASSERT(boot_test_delta_out_len == 0);
+
+    /* Truncated delta. */
+    boot_test_delta_patch_len--;
+    rc = boot_test_util_delta_apply(16, base_crc32);
+    TEST_ASSERT(rc == IMAGE_DELTA_EINVAL);
+    boot_test_delta_patch_len++;
+
+    /* Result does not match its CRC. */
+    boot_test_delta_base[500] ^= 0x01;
+    rc = boot_test_util_delta_apply(16, base_crc32);
+    TEST_ASSERT(rc == IMAGE_DELTA_EBADIMAGE);
+    boot_test_delta_base[500] ^= 0x01;
+
+    /* Copy past the end of the base image. */
+    boot_test_delta_patch_len = sizeof (struct image_delta_hdr);
+    boot_test_delta_patch[boot_test_delta_patch_len++] = IMAGE_DELTA_OP_COPY;
+    boot_test_util_delta_varint(BOOT_TEST_DELTA_BASE_SZ - 10);
+    boot_test_util_delta_varint(20);
+    rc = boot_test_util_delta_apply(16, base_crc32);
+    TEST_ASSERT(rc == IMAGE_DELTA_EINVAL);
+}
+
+/**
+ * Runs image_verify over an image delivered in pieces; ends[] holds the
+ * offset each piece but the last stops at.
+ */
+static int
+boot_test_util_verify_pieces(const uint8_t *img, uint32_t len,
+                             const uint32_t *ends, int num_ends)
+{
+    struct image_verify iv;
+    uint32_t off;
+    int i;
+
+    image_verify_init(&iv);
+    off = 0;
+    for (i = 0; i < num_ends; i++) {
+        image_verify_update(&iv, img + off, ends[i] - off);
+        off = ends[i];
+    }
+    image_verify_update(&iv, img + off, len - off);
+
+    return image_verify_finish(&iv);
+}
+
+TEST_CASE(boot_test_verify_split)
+{
+    uint32_t ends[3];
+    uint32_t off;
+    uint32_t len;
+    int rc;
+
+    boot_test_util_delta_build();
+    len = boot_test_delta_new_len;
+
+    /* Every split in and just past the header. */
+    for (off = 0; off <= IMAGE_HEADER_SIZE + 4; off++) {
+        ends[0] = off;
+        rc = boot_test_util_verify_pieces(boot_test_delta_new, len, ends, 1);
+        TEST_ASSERT(rc == 0);
+    }
+
+    /* The CRC field arriving a byte or two at a time. */
+    ends[0] = IMAGE_HEADER_CRC_OFFSET + 1;
+    ends[1] = IMAGE_HEADER_CRC_OFFSET + 3;
+    ends[2] = IMAGE_HEADER_CRC_OFFSET + 4;
+    rc = boot_test_util_verify_pieces(boot_test_delta_new, len, ends, 3);
+    TEST_ASSERT(rc == 0);
+
+    ends[0] = 1;
+    ends[1] = IMAGE_HEADER_CRC_OFFSET + 2;
+    ends[2] = IMAGE_HEADER_SIZE - 1;
+    rc = boot_test_util_verify_pieces(boot_test_delta_new, len, ends, 3);
+    TEST_ASSERT(rc == 0);
+
+    /* The same splits catch a corrupt CRC, and a corrupt byte it covers. */
+    boot_test_delta_new[IMAGE_HEADER_CRC_OFFSET + 2] ^= 0x01;
+    rc = boot_test_util_verify_pieces(boot_test_delta_new, len, ends, 3);
+    TEST_ASSERT(rc != 0);
+    boot_test_delta_new[IMAGE_HEADER_CRC_OFFSET + 2] ^= 0x01;
+
+    boot_test_delta_new[IMAGE_HEADER_CRC_OFFSET + 4] ^= 0x01;
+    rc = boot_test_util_verify_pieces(boot_test_delta_new, len, ends, 3);
+    TEST_ASSERT(rc != 0);
+    boot_test_delta_new[IMAGE_HEADER_CRC_OFFSET + 4] ^= 0x01;
+
+    /* Truncated image, and one cut off inside its header. */
+    rc = boot_test_util_verify_pieces(boot_test_delta_new, len - 1, ends, 3);
+    TEST_ASSERT(rc != 0);
+    rc = boot_test_util_verify_pieces(boot_test_delta_new,
+                                      IMAGE_HEADER_SIZE - 1, ends, 2);
+    TEST_ASSERT(rc != 0);
+}
+
 TEST_SUITE(boot_test_main)
 {
     boot_test_nv_ns_10();
@@ -966,6 +1349,10 @@ TEST_SUITE(boot_test_main)
     boot_test_nv_bs_11();
     boot_test_nv_bs_11_2areas();
     boot_test_vb_ns_11();
+    boot_test_nv_bs_resume();
+    boot_test_delta_apply();
+    boot_test_delta_bad();
+    boot_test_verify_split();
 }
 
 int
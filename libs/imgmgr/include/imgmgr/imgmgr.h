@@ -24,6 +24,8 @@
 #define IMGMGR_NMGR_OP_UPLOAD	1
 #define IMGMGR_NMGR_OP_BOOT	2
 #define IMGMGR_NMGR_OP_FILE	3
+#define IMGMGR_NMGR_OP_DELTA	4
+#define IMGMGR_NMGR_OP_BIN_UPLOAD	5
 
 #define IMGMGR_NMGR_MAX_MSG	120
 #define IMGMGR_NMGR_MAX_NAME	64
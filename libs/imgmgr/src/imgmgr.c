@@ -23,18 +23,29 @@
 #include <assert.h>
 #include <string.h>
 #include <hal/flash_map.h>
+#include <hal/hal_flash_int.h>
 #include <newtmgr/newtmgr.h>
 #include <json/json.h>
 #include <util/base64.h>
 
 #include <bootutil/image.h>
+#include <bootutil/image_verify.h>
+#ifdef FS_PRESENT
+#include <fs/fs.h>
+#endif
 
 #include "imgmgr/imgmgr.h"
 #include "imgmgr_priv.h"
 
 static int imgr_list(struct nmgr_jbuf *);
 static int imgr_noop(struct nmgr_jbuf *);
-static int imgr_upload(struct nmgr_jbuf *);
+
+/*
+ * Size of the stack buffer binary upload data is copied through.
+ */
+#ifndef IMGMGR_BIN_UPLOAD_BUF_SZ
+#define IMGMGR_BIN_UPLOAD_BUF_SZ	64
+#endif
 
 static const struct nmgr_handler imgr_nmgr_handlers[] = {
     [IMGMGR_NMGR_OP_LIST] = {
@@ -56,15 +67,21 @@ static const struct nmgr_handler imgr_nmgr_handlers[] = {
         .nh_write = imgr_file_upload
     }
 #endif
+    ,
+    [IMGMGR_NMGR_OP_DELTA] = {
+        .nh_read = imgr_noop,
+        .nh_write = imgr_delta_upload
+    },
+    [IMGMGR_NMGR_OP_BIN_UPLOAD] = {
+        .nh_read = imgr_noop,
+        .nh_write = imgr_bin_upload
+    }
 };
 
 static struct nmgr_group imgr_nmgr_group = {
     .ng_handlers = (struct nmgr_handler *)imgr_nmgr_handlers,
-#ifndef FS_PRESENT
-    .ng_handlers_count = 2,
-#else
-    .ng_handlers_count = 4,
-#endif
+    .ng_handlers_count =
+      sizeof(imgr_nmgr_handlers) / sizeof(imgr_nmgr_handlers[0]),
     .ng_group_id = NMGR_GROUP_ID_IMAGE,
 };
 
@@ -146,7 +163,263 @@ imgr_noop(struct nmgr_jbuf *njb)
     return 0;
 }
 
+/*
+ * Pick the slot to upload a new image to: an empty or incomplete slot if
+ * there is one, otherwise a slot with a valid image which is not the active
+ * one. Returns -1 if there is no such slot.
+ */
+static int
+imgr_upload_slot(void)
+{
+    struct image_version ver;
+    int active;
+    int best;
+    int rc;
+    int i;
+
+    active = bsp_imgr_current_slot();
+    best = -1;
+
+    for (i = FLASH_AREA_IMAGE_0; i <= FLASH_AREA_IMAGE_1; i++) {
+        rc = imgr_read_ver(i, &ver);
+        if (rc < 0) {
+            continue;
+        }
+        if (rc == 0) {
+            /*
+             * Image in slot is ok.
+             */
+            if (active == i) {
+                /*
+                 * Slot is currently active one. Can't upload to this.
+                 */
+                continue;
+            } else {
+                /*
+                 * Not active slot, but image is ok. Use it if there are
+                 * no better candidates.
+                 */
+                /*
+                 * XXX reject if trying to upload image which is present
+                 * already.
+                 */
+                best = i;
+            }
+            continue;
+        }
+        break;
+    }
+    if (i <= FLASH_AREA_IMAGE_1) {
+        best = i;
+    }
+    return best;
+}
+
+/*
+ * Start writing a new image to the given slot. Nothing is erased yet; see
+ * imgr_upload_write(). The writer starts past the image header, which is
+ * only programmed once the image has verified; see imgr_upload_close().
+ */
+static int
+imgr_upload_open(int slot)
+{
+    int rc;
+
+    rc = flash_area_open(slot, &imgr_state.upload.fa);
+    if (rc) {
+        return OS_EINVAL;
+    }
+    rc = flash_area_writer_open(&imgr_state.upload.writer,
+      imgr_state.upload.fa, IMAGE_HEADER_SIZE);
+    if (rc) {
+        return OS_EINVAL;
+    }
+    imgr_state.upload.wr_off = 0;
+    imgr_state.upload.erased = 0;
+    return 0;
+}
+
+/*
+ * Append to the image being written, erasing the sectors the data goes to
+ * first. Sectors are erased just ahead of the write cursor, so that no
+ * single request has to wait for the whole slot to be erased.
+ */
 static int
+imgr_upload_write(const void *data, uint32_t len)
+{
+    const struct flash_area *fa;
+    const uint8_t *u8p;
+    uint32_t start;
+    uint32_t cnt;
+    uint32_t size;
+    uint32_t end;
+    int idx;
+    int rc;
+
+    fa = imgr_state.upload.fa;
+    if (len > fa->fa_size - imgr_state.upload.wr_off) {
+        return OS_EINVAL;
+    }
+
+    while (imgr_state.upload.erased < imgr_state.upload.wr_off + len) {
+        idx = hal_flash_sector_lookup(fa->fa_flash_id,
+          fa->fa_off + imgr_state.upload.erased);
+        if (idx < 0 ||
+          hal_flash_sector_info(fa->fa_flash_id, idx, &start, &size)) {
+            return OS_EINVAL;
+        }
+        end = min(start + size - fa->fa_off, fa->fa_size);
+        rc = flash_area_erase(fa, imgr_state.upload.erased,
+          end - imgr_state.upload.erased);
+        if (rc) {
+            return OS_EINVAL;
+        }
+        imgr_state.upload.erased = end;
+    }
+
+    u8p = data;
+    if (imgr_state.upload.wr_off < IMAGE_HEADER_SIZE) {
+        cnt = min(len, IMAGE_HEADER_SIZE - imgr_state.upload.wr_off);
+        memcpy(imgr_state.upload.hdr + imgr_state.upload.wr_off, u8p, cnt);
+        imgr_state.upload.wr_off += cnt;
+        u8p += cnt;
+        len -= cnt;
+    }
+
+    rc = flash_area_writer_write(&imgr_state.upload.writer, u8p, len);
+    if (rc) {
+        return OS_EINVAL;
+    }
+    imgr_state.upload.wr_off += len;
+    return 0;
+}
+
+/*
+ * Writing the image is over, successfully or not. Only an image which
+ * verified gets its header, so an upload which failed, or was abandoned
+ * halfway, never gets listed or booted. Should programming the header
+ * fail, erase what there is of it.
+ */
+static int
+imgr_upload_close(int rc)
+{
+    if (!imgr_state.upload.fa) {
+        return rc;
+    }
+    if (!rc) {
+        rc = flash_area_writer_close(&imgr_state.upload.writer);
+    }
+    if (!rc) {
+        rc = flash_area_write(imgr_state.upload.fa, 0, imgr_state.upload.hdr,
+          IMAGE_HEADER_SIZE);
+        if (rc) {
+            flash_area_erase(imgr_state.upload.fa, 0, 1);
+        }
+    }
+    flash_area_close(imgr_state.upload.fa);
+    imgr_state.upload.fa = NULL;
+    return rc;
+}
+
+/*
+ * Abandon the upload in progress, whatever its kind, and release what it
+ * holds.
+ */
+void
+imgr_upload_abandon(void)
+{
+    imgr_upload_close(OS_EINVAL);
+    if (imgr_state.upload.base_fa) {
+        flash_area_close(imgr_state.upload.base_fa);
+        imgr_state.upload.base_fa = NULL;
+    }
+#ifdef FS_PRESENT
+    if (imgr_state.upload.file) {
+        fs_close(imgr_state.upload.file);
+        imgr_state.upload.file = NULL;
+    }
+#endif
+    imgr_state.upload.kind = IMGR_UPLOAD_NONE;
+}
+
+/*
+ * Whether chunks of the given kind of upload can be taken.
+ */
+static int
+imgr_upload_is_open(int kind)
+{
+    return imgr_state.upload.kind == kind && imgr_state.upload.fa != NULL;
+}
+
+/*
+ * Offset to acknowledge in response to a chunk of the given kind of upload.
+ * If an upload of another kind has started since, the host has to start
+ * over.
+ */
+uint32_t
+imgr_upload_ack(int kind)
+{
+    if (imgr_state.upload.kind != kind) {
+        return 0;
+    }
+    return imgr_state.upload.rx.off;
+}
+
+/*
+ * Start a new full image upload, abandoning any upload in progress.
+ */
+static int
+imgr_upload_start(void)
+{
+    int slot;
+    int rc;
+
+    imgr_upload_abandon();
+    imgr_state.upload.kind = IMGR_UPLOAD_FULL;
+
+    slot = imgr_upload_slot();
+    if (slot < 0) {
+        return OS_EINVAL;
+    }
+    rc = imgr_upload_open(slot);
+    if (rc) {
+        return rc;
+    }
+    image_verify_init(&imgr_state.upload.verify);
+    return 0;
+}
+
+/*
+ * Add the next piece of the image being uploaded. Sets *done once the
+ * upload is over; the return code then tells whether the image verified.
+ * The CRC is computed as the data comes in, so the image need not be read
+ * back to check it.
+ */
+static int
+imgr_upload_data(const void *data, uint32_t len, int *done)
+{
+    int rc;
+
+    if (len > imgr_state.upload.rx.size - imgr_state.upload.rx.off) {
+        rc = OS_EINVAL;
+    } else {
+        rc = imgr_upload_write(data, len);
+    }
+    if (rc) {
+        *done = 1;
+        return imgr_upload_close(rc);
+    }
+    image_verify_update(&imgr_state.upload.verify, data, len);
+
+    if (imgr_rx_advance(&imgr_state.upload.rx, len)) {
+        *done = 1;
+        rc = image_verify_finish(&imgr_state.upload.verify);
+        return imgr_upload_close(rc ? OS_EINVAL : 0);
+    }
+    return 0;
+}
+
+int
 imgr_upload(struct nmgr_jbuf *njb)
 {
     char img_data[BASE64_ENCODE_SIZE(IMGMGR_NMGR_MAX_MSG)];
@@ -172,14 +445,12 @@ imgr_upload(struct nmgr_jbuf *njb)
             .nodefault = true
         }
     };
-    struct image_version ver;
     struct json_encoder *enc;
     struct json_value jv;
-    int active;
-    int best;
+    int done = 0;
+    int act;
     int rc;
     int len;
-    int i;
 
     rc = json_read_object(&njb->njb_buf, off_attr);
     if (rc || off == UINT_MAX) {
@@ -193,63 +464,22 @@ imgr_upload(struct nmgr_jbuf *njb)
         }
     }
 
-    if (off == 0) {
+    act = imgr_rx_chunk(&imgr_state.upload.rx,
+      imgr_upload_is_open(IMGR_UPLOAD_FULL), off, size);
+    if (act == IMGR_RX_START) {
         /*
          * New upload.
          */
-        imgr_state.upload.off = 0;
-        imgr_state.upload.size = size;
-        active = bsp_imgr_current_slot();
-        best = -1;
-
-        for (i = FLASH_AREA_IMAGE_0; i <= FLASH_AREA_IMAGE_1; i++) {
-            rc = imgr_read_ver(i, &ver);
-            if (rc < 0) {
-                continue;
-            }
-            if (rc == 0) {
-                /*
-                 * Image in slot is ok.
-                 */
-                if (active == i) {
-                    /*
-                     * Slot is currently active one. Can't upload to this.
-                     */
-                    continue;
-                } else {
-                    /*
-                     * Not active slot, but image is ok. Use it if there are
-                     * no better candidates.
-                     */
-                    /*
-                     * XXX reject if trying to upload image which is present
-                     * already.
-                     */
-                    best = i;
-                }
-                continue;
-            }
-            break;
-        }
-        if (i <= FLASH_AREA_IMAGE_1) {
-            best = i;
-        }
-        if (best >= 0) {
-            rc = flash_area_open(best, &imgr_state.upload.fa);
-            assert(rc == 0);
-            /*
-             * XXXX only erase if needed.
-             */
-            rc = flash_area_erase(imgr_state.upload.fa, 0,
-              imgr_state.upload.fa->fa_size);
-        } else {
+        rc = imgr_upload_start();
+        if (rc) {
             /*
-             * No slot where to upload!
+             * No slot where to upload. The upload is over before it
+             * started; report why.
              */
-            assert(0);
+            done = 1;
             goto out;
         }
-    } else if (off != imgr_state.upload.off) {
+    } else if (act == IMGR_RX_DROP) {
         /*
          * Invalid offset. Drop the data, and respond with the offset we're
          * expecting data for.
@@ -258,23 +488,247 @@ imgr_upload(struct nmgr_jbuf *njb)
         goto out;
     }
 
-    if (len && imgr_state.upload.fa) {
-        rc = flash_area_write(imgr_state.upload.fa, imgr_state.upload.off,
-          img_data, len);
-        assert(rc == 0);
-        imgr_state.upload.off += len;
-        if (imgr_state.upload.size == imgr_state.upload.off) {
-            /* Done */
-            imgr_state.upload.fa = NULL;
+    if (len) {
+        rc = imgr_upload_data(img_data, len, &done);
+    }
+out:
+    enc = &njb->njb_enc;
+
+    json_encode_object_start(enc);
+
+    JSON_VALUE_UINT(&jv, imgr_upload_ack(IMGR_UPLOAD_FULL));
+    json_encode_object_entry(enc, "off", &jv);
+    if (done) {
+        JSON_VALUE_INT(&jv, rc);
+        json_encode_object_entry(enc, "rc", &jv);
+    }
+    json_encode_object_finish(enc);
+
+    return 0;
+}
+
+/*
+ * Image upload with raw data instead of base64 inside JSON; see
+ * struct imgmgr_upload_cmd. The data is copied out of the request mbuf a
+ * piece at a time, so the chunk size is limited only by the transport.
+ */
+int
+imgr_bin_upload(struct nmgr_jbuf *njb)
+{
+    struct imgmgr_upload_cmd cmd;
+    struct imgmgr_upload_rsp rsp;
+    uint8_t buf[IMGMGR_BIN_UPLOAD_BUF_SZ];
+    uint16_t data_off;
+    uint16_t len;
+    int done = 0;
+    int act;
+    int rc;
+
+    if (njb->njb_end - njb->njb_off < sizeof(cmd)) {
+        return OS_EINVAL;
+    }
+    rc = os_mbuf_copydata(njb->njb_in_m, njb->njb_off, sizeof(cmd), &cmd);
+    if (rc) {
+        return OS_EINVAL;
+    }
+    cmd.iuc_off = ntohl(cmd.iuc_off);
+    cmd.iuc_len = ntohl(cmd.iuc_len);
+    data_off = njb->njb_off + sizeof(cmd);
+
+    rc = 0;
+    act = imgr_rx_chunk(&imgr_state.upload.rx,
+      imgr_upload_is_open(IMGR_UPLOAD_FULL), cmd.iuc_off, cmd.iuc_len);
+    if (act == IMGR_RX_START) {
+        rc = imgr_upload_start();
+        if (rc) {
+            done = 1;
+            goto out;
+        }
+    } else if (act == IMGR_RX_DROP) {
+        /*
+         * A chunk following one which was lost, a resent one we already
+         * have, or one of an upload which a delta or file upload has
+         * replaced. Drop it; the response tells the host where to resume.
+         */
+        goto out;
+    }
+
+    while (!done && data_off < njb->njb_end) {
+        len = min(njb->njb_end - data_off, sizeof(buf));
+        rc = os_mbuf_copydata(njb->njb_in_m, data_off, len, buf);
+        if (rc) {
+            return OS_EINVAL;
+        }
+        rc = imgr_upload_data(buf, len, &done);
+        data_off += len;
+    }
+out:
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.iur_off = htonl(imgr_upload_ack(IMGR_UPLOAD_FULL));
+    rsp.iur_done = done;
+    rsp.iur_rc = rc;
+    rsp.iur_window = IMGMGR_BIN_UPLOAD_WINDOW;
+
+    return nmgr_rsp_extend(njb->njb_hdr, njb->njb_out_m, &rsp, sizeof(rsp));
+}
+
+static int
+imgr_delta_read(void *arg, uint32_t off, void *dst, int len)
+{
+    return flash_area_read(imgr_state.upload.base_fa, off, dst, len);
+}
+
+static int
+imgr_delta_write(void *arg, const void *src, int len)
+{
+    return imgr_upload_write(src, len);
+}
+
+/*
+ * Start rebuilding an image from a delta against the active image,
+ * abandoning any upload in progress.
+ */
+static int
+imgr_delta_start(void)
+{
+    struct image_header hdr;
+    int slot;
+    int rc;
+
+    imgr_upload_abandon();
+    imgr_state.upload.kind = IMGR_UPLOAD_DELTA;
+
+    rc = flash_area_open(bsp_imgr_current_slot(), &imgr_state.upload.base_fa);
+    if (rc) {
+        return OS_EINVAL;
+    }
+    rc = flash_area_read(imgr_state.upload.base_fa, 0, &hdr, sizeof(hdr));
+    if (rc || hdr.ih_magic != IMAGE_MAGIC) {
+        return OS_EINVAL;
+    }
+
+    slot = imgr_upload_slot();
+    if (slot < 0) {
+        return OS_EINVAL;
+    }
+    rc = imgr_upload_open(slot);
+    if (rc) {
+        return rc;
+    }
+
+    image_delta_init(&imgr_state.upload.delta, hdr.ih_crc32,
+      hdr.ih_hdr_size + hdr.ih_img_size, imgr_delta_read, imgr_delta_write,
+      NULL);
+    return 0;
+}
+
+/*
+ * Delta upload is over, successfully or not. The new image is kept only if
+ * it verified.
+ */
+static int
+imgr_delta_done(int rc)
+{
+    if (imgr_state.upload.fa) {
+        if (!rc) {
+            rc = image_delta_finish(&imgr_state.upload.delta);
+        }
+        rc = imgr_upload_close(rc);
+    }
+    if (imgr_state.upload.base_fa) {
+        flash_area_close(imgr_state.upload.base_fa);
+        imgr_state.upload.base_fa = NULL;
+    }
+    return rc;
+}
+
+int
+imgr_delta_upload(struct nmgr_jbuf *njb)
+{
+    char img_data[BASE64_ENCODE_SIZE(IMGMGR_NMGR_MAX_MSG)];
+    unsigned int off = UINT_MAX;
+    unsigned int size = UINT_MAX;
+    const struct json_attr_t off_attr[4] = {
+        [0] = {
+            .attribute = "off",
+            .type = t_uinteger,
+            .addr.uinteger = &off,
+            .nodefault = true
+        },
+        [1] = {
+            .attribute = "data",
+            .type = t_string,
+            .addr.string = img_data,
+            .len = sizeof(img_data)
+        },
+        [2] = {
+            .attribute = "len",
+            .type = t_uinteger,
+            .addr.uinteger = &size,
+            .nodefault = true
+        }
+    };
+    struct json_encoder *enc;
+    struct json_value jv;
+    int done = 0;
+    int act;
+    int rc;
+    int len;
+
+    rc = json_read_object(&njb->njb_buf, off_attr);
+    if (rc || off == UINT_MAX) {
+        return OS_EINVAL;
+    }
+    len = strlen(img_data);
+    if (len) {
+        len = base64_decode(img_data, img_data);
+        if (len < 0) {
+            return OS_EINVAL;
+        }
+    }
+
+    act = imgr_rx_chunk(&imgr_state.upload.rx,
+      imgr_upload_is_open(IMGR_UPLOAD_DELTA), off, size);
+    if (act == IMGR_RX_START) {
+        /*
+         * New delta upload.
+         */
+        rc = imgr_delta_start();
+        if (rc) {
+            imgr_delta_done(rc);
+            return rc;
+        }
+    } else if (act == IMGR_RX_DROP) {
+        /*
+         * Invalid offset. Drop the data, and respond with the offset we're
+         * expecting data for.
+         */
+        goto out;
+    }
+
+    if (len) {
+        rc = image_delta_feed(&imgr_state.upload.delta, img_data, len);
+        if (rc) {
+            done = 1;
+            rc = imgr_delta_done(rc);
+            goto out;
         }
     }
+    if (imgr_rx_advance(&imgr_state.upload.rx, len)) {
+        done = 1;
+        rc = imgr_delta_done(0);
+    }
 out:
     enc = &njb->njb_enc;
 
     json_encode_object_start(enc);
 
-    JSON_VALUE_UINT(&jv, imgr_state.upload.off);
+    JSON_VALUE_UINT(&jv, imgr_upload_ack(IMGR_UPLOAD_DELTA));
     json_encode_object_entry(enc, "off", &jv);
+    if (done) {
+        JSON_VALUE_INT(&jv, rc);
+        json_encode_object_entry(enc, "rc", &jv);
+    }
     json_encode_object_finish(enc);
 
     return 0;
@@ -31,6 +31,7 @@
 #include <json/json.h>
 #include <util/base64.h>
 #include <bsp/bsp.h>
+#include <hal/flash_map.h>
 
 #include "imgmgr/imgmgr.h"
 #include "imgmgr_priv.h"
@@ -132,7 +133,9 @@ imgr_boot_write(struct nmgr_jbuf *njb)
         }
     };
     int rc;
+    int i;
     struct image_version ver;
+    struct image_version slot_ver;
 
     rc = json_read_object(&njb->njb_buf, boot_write_attr);
     if (rc) {
@@ -144,6 +147,20 @@ imgr_boot_write(struct nmgr_jbuf *njb)
         return OS_EINVAL;
     }
 
+    /*
+     * Only point the boot vector at an image which is present. An uploaded
+     * image gets its header only once it has verified.
+     */
+    for (i = FLASH_AREA_IMAGE_0; i <= FLASH_AREA_IMAGE_1; i++) {
+        if (imgr_read_ver(i, &slot_ver) == 0 &&
+          !memcmp(&ver, &slot_ver, sizeof(ver))) {
+            break;
+        }
+    }
+    if (i > FLASH_AREA_IMAGE_1) {
+        return OS_EINVAL;
+    }
+
     fs_mkdir(BOOT_PATH);
     rc = imgr_write_file(BOOT_PATH_TEST, &ver);
     return rc;
@@ -272,8 +289,10 @@ imgr_file_upload(struct nmgr_jbuf *njb)
         /*
          * New upload.
          */
-        imgr_state.upload.off = 0;
-        imgr_state.upload.size = size;
+        imgr_upload_abandon();
+        imgr_state.upload.kind = IMGR_UPLOAD_FILE;
+        imgr_state.upload.rx.off = 0;
+        imgr_state.upload.rx.size = size;
 
         if (!strlen(file_name)) {
             return OS_EINVAL;
@@ -283,10 +302,11 @@ imgr_file_upload(struct nmgr_jbuf *njb)
         if (rc) {
             return OS_EINVAL;
         }
-    } else if (off != imgr_state.upload.off) {
+    } else if (imgr_state.upload.kind != IMGR_UPLOAD_FILE ||
+      off != imgr_state.upload.rx.off) {
         /*
-         * Invalid offset. Drop the data, and respond with the offset we're
-         * expecting data for.
+         * Invalid offset, or an image upload has taken over. Drop the data,
+         * and respond with the offset we're expecting data for.
          */
         rc = 0;
         goto out;
@@ -301,8 +321,8 @@ imgr_file_upload(struct nmgr_jbuf *njb)
             imgr_state.upload.file = NULL;
             return OS_EINVAL;
         }
-        imgr_state.upload.off += len;
-        if (imgr_state.upload.size == imgr_state.upload.off) {
+        imgr_state.upload.rx.off += len;
+        if (imgr_state.upload.rx.size == imgr_state.upload.rx.off) {
             /* Done */
             fs_close(imgr_state.upload.file);
             imgr_state.upload.file = NULL;
@@ -313,7 +333,7 @@ out:
 
     json_encode_object_start(enc);
 
-    JSON_VALUE_UINT(&jv, imgr_state.upload.off);
+    JSON_VALUE_UINT(&jv, imgr_upload_ack(IMGR_UPLOAD_FILE));
     json_encode_object_entry(enc, "off", &jv);
     json_encode_object_finish(enc);
 
@@ -21,15 +21,72 @@
 #define __IMGMGR_PRIV_H_
 
 #include <stdint.h>
+#include <hal/flash_map.h>
+#include <bootutil/image_delta.h>
+#include <bootutil/image_verify.h>
 
 /*
- * When accompanied by image, it's this structure followed by data.
- * Response contains just the offset.
+ * Binary image upload request: this structure followed by raw image data,
+ * up to the end of the newtmgr message. All fields are in network byte
+ * order.
  */
 struct imgmgr_upload_cmd {
     uint32_t iuc_off;
+    uint32_t iuc_len;		/* Image size; inspected when off = 0 */
 };
 
+/*
+ * Binary image upload response. Acknowledgements are cumulative: iur_off
+ * is the offset of the first byte not yet received, so one response covers
+ * every chunk before it. A chunk which does not start at iur_off is
+ * dropped; the host resends from iur_off.
+ *
+ * The host can have up to iur_window chunks outstanding. The limit bounds
+ * the number of mbufs requests can hold while queued for the newtmgr task.
+ */
+struct imgmgr_upload_rsp {
+    uint32_t iur_off;
+    uint8_t iur_done;		/* 1 once the upload is over */
+    uint8_t iur_rc;		/* If done, 0 if the image verified */
+    uint8_t iur_window;
+    uint8_t _pad;
+};
+
+/*
+ * Number of binary upload chunks the host may send without waiting for a
+ * response.
+ */
+#ifndef IMGMGR_BIN_UPLOAD_WINDOW
+#define IMGMGR_BIN_UPLOAD_WINDOW	4
+#endif
+
+/*
+ * Receive side of an upload. Uploads are go-back-N: only the chunk which
+ * starts at off, the first byte not yet received, is taken, and every
+ * response acknowledges off. A chunk at offset 0 starts a new upload.
+ * No flash is touched here; see imgmgr_rx.c.
+ */
+struct imgr_rx {
+    uint32_t off;
+    uint32_t size;		/* From the chunk at offset 0. */
+};
+
+/*
+ * What to do with a chunk; returned by imgr_rx_chunk().
+ */
+#define IMGR_RX_DROP		0	/* Lost one before it, or a resend. */
+#define IMGR_RX_START		1	/* First chunk of a new upload. */
+#define IMGR_RX_DATA		2	/* Next chunk of the upload. */
+
+/*
+ * What the upload in imgr_state is writing. Chunks of one kind never touch
+ * an upload of another.
+ */
+#define IMGR_UPLOAD_NONE	0
+#define IMGR_UPLOAD_FULL	1	/* Image, from JSON or binary chunks. */
+#define IMGR_UPLOAD_DELTA	2	/* Image, rebuilt from a delta. */
+#define IMGR_UPLOAD_FILE	3
+
 /*
  * Response to list:
  * {
@@ -61,11 +118,32 @@ struct imgmgr_upload_cmd {
  *
  * Response to upload:
  * {
- *      "off":<offset>
+ *      "off":<offset>,
+ *      "rc":<result>			once all of the image has arrived,
+ *					or if the upload could not start;
+ *					0 if the image verified
  * }
  *
  *
- * Request to image upload:
+ * Request to delta image upload:
+ * {
+ *      "off":<offset>,
+ *      "len":<delta_size>		inspected when off = 0
+ *      "data":<base64encoded binary>
+ * }
+ * The delta (see bootutil/image_delta.h) is against the image in the active
+ * slot; the new image is rebuilt into the other slot as the data arrives.
+ *
+ *
+ * Response to delta upload:
+ * {
+ *      "off":<offset>,
+ *      "rc":<result>			once all of the delta has arrived;
+ *					0 if the new image verified
+ * }
+ *
+ *
+ * Request to file upload:
  * {
  *      "off":<offset>
  *	"name":<filename>		inspected when off = 0
@@ -80,9 +158,16 @@ struct fs_file;
 
 struct imgr_state {
     struct {
-        uint32_t off;
-        uint32_t size;
+        struct imgr_rx rx;
+        uint8_t kind;			/* IMGR_UPLOAD_*, set at start. */
         const struct flash_area *fa;
+        struct flash_area_writer writer;
+        uint32_t wr_off;		/* Bytes written to the slot. */
+        uint32_t erased;		/* Slot is erased below this offset. */
+        uint8_t hdr[IMAGE_HEADER_SIZE];	/* Programmed once verified. */
+        struct image_verify verify;	/* Full image uploads only. */
+        const struct flash_area *base_fa;	/* Delta uploads only. */
+        struct image_delta delta;
 #ifdef FS_PRESENT
         struct fs_file *file;
 #endif
@@ -91,11 +176,19 @@ struct imgr_state {
 
 extern struct imgr_state imgr_state;
 
+int imgr_upload(struct nmgr_jbuf *);
+int imgr_delta_upload(struct nmgr_jbuf *);
+int imgr_bin_upload(struct nmgr_jbuf *);
 int imgr_boot_read(struct nmgr_jbuf *);
 int imgr_boot_write(struct nmgr_jbuf *);
 int imgr_file_upload(struct nmgr_jbuf *);
 int imgr_file_download(struct nmgr_jbuf *);
 
 int imgr_read_ver(int area_id, struct image_version *ver);
+void imgr_upload_abandon(void);
+uint32_t imgr_upload_ack(int kind);
+
+int imgr_rx_chunk(struct imgr_rx *rx, int open, uint32_t off, uint32_t size);
+int imgr_rx_advance(struct imgr_rx *rx, uint32_t len);
 
 #endif /* __IMGMGR_PRIV_H */
@@ -0,0 +1,55 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stdint.h>
+#include <newtmgr/newtmgr.h>
+
+#include "imgmgr_priv.h"
+
+/*
+ * Decide what to do with a chunk which starts at off; open tells whether
+ * the upload it belongs to is still in progress. A chunk at offset 0
+ * restarts the upload, even in the middle of one, and size is taken from
+ * it. Any other chunk is taken only if it continues where the last one
+ * taken ended.
+ */
+int
+imgr_rx_chunk(struct imgr_rx *rx, int open, uint32_t off, uint32_t size)
+{
+    if (off == 0) {
+        rx->off = 0;
+        rx->size = size;
+        return IMGR_RX_START;
+    }
+    if (!open || off != rx->off) {
+        return IMGR_RX_DROP;
+    }
+    return IMGR_RX_DATA;
+}
+
+/*
+ * Account for len bytes of a chunk having been stored. Returns 1 once the
+ * whole upload has arrived.
+ */
+int
+imgr_rx_advance(struct imgr_rx *rx, uint32_t len)
+{
+    rx->off += len;
+    return rx->off == rx->size;
+}
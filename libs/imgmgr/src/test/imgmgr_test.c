@@ -0,0 +1,745 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "os/os.h"
+#include "os/endian.h"
+#include "testutil/testutil.h"
+#include "hal/hal_flash.h"
+#include "hal/flash_map.h"
+#include "newtmgr/newtmgr.h"
+#include "util/base64.h"
+#include "util/crc32.h"
+#include "bootutil/image.h"
+#include "bootutil/image_delta.h"
+#include "../imgmgr_priv.h"
+
+#define IMGMGR_TEST_IMG_SZ          1000
+#define IMGMGR_TEST_CHUNK_SZ        64
+
+#define IMGMGR_TEST_MBUF_BUF_SIZE   256
+#define IMGMGR_TEST_MBUF_BUF_COUNT  4
+
+static uint8_t imgmgr_test_img[IMGMGR_TEST_IMG_SZ];
+static uint8_t imgmgr_test_slot[IMGMGR_TEST_IMG_SZ];
+static struct imgr_rx imgmgr_test_rx;
+static int imgmgr_test_open;
+static int imgmgr_test_writes;
+
+/** Image slots, at the same sectors as the native BSP uses. */
+static const struct flash_area imgmgr_test_areas[] = {
+    [FLASH_AREA_IMAGE_0] = {
+        .fa_flash_id = 0,
+        .fa_off = 0x00020000,
+        .fa_size = 128 * 1024,
+    },
+    [FLASH_AREA_IMAGE_1] = {
+        .fa_flash_id = 0,
+        .fa_off = 0x00040000,
+        .fa_size = 128 * 1024,
+    },
+};
+
+static uint8_t imgmgr_test_base[IMGMGR_TEST_IMG_SZ];
+static uint8_t imgmgr_test_delta[IMGMGR_TEST_CHUNK_SZ * 2];
+static int imgmgr_test_delta_len;
+
+static os_membuf_t imgmgr_test_mbuf_mem[
+    OS_MEMPOOL_SIZE(IMGMGR_TEST_MBUF_BUF_COUNT, IMGMGR_TEST_MBUF_BUF_SIZE)];
+static struct os_mempool imgmgr_test_mbuf_mempool;
+static struct os_mbuf_pool imgmgr_test_mbuf_pool;
+
+static char imgmgr_test_req[256];
+static int imgmgr_test_req_off;
+static char imgmgr_test_rsp[64];
+static int imgmgr_test_rsp_len;
+
+static void
+imgmgr_test_util_fill(int seed)
+{
+    int i;
+
+    for (i = 0; i < IMGMGR_TEST_IMG_SZ; i++) {
+        imgmgr_test_img[i] = i * 7 + seed;
+    }
+}
+
+static void
+imgmgr_test_util_init(int seed)
+{
+    imgmgr_test_util_fill(seed);
+    memset(&imgmgr_test_rx, 0, sizeof imgmgr_test_rx);
+    imgmgr_test_open = 0;
+    imgmgr_test_writes = 0;
+}
+
+/**
+ * Handles a chunk the way imgr_bin_upload() does, with a RAM buffer for
+ * the slot.
+ *
+ * @return                      The offset the response acknowledges.
+ */
+static uint32_t
+imgmgr_test_util_rx(uint32_t off, uint32_t size, int *done)
+{
+    uint32_t len;
+    int act;
+
+    *done = 0;
+    act = imgr_rx_chunk(&imgmgr_test_rx, imgmgr_test_open, off, size);
+    if (act == IMGR_RX_START) {
+        memset(imgmgr_test_slot, 0xff, sizeof imgmgr_test_slot);
+        imgmgr_test_open = 1;
+    }
+    if (act != IMGR_RX_DROP) {
+        len = min(IMGMGR_TEST_CHUNK_SZ, size - off);
+        memcpy(imgmgr_test_slot + off, imgmgr_test_img + off, len);
+        imgmgr_test_writes++;
+        if (imgr_rx_advance(&imgmgr_test_rx, len)) {
+            imgmgr_test_open = 0;
+            *done = 1;
+        }
+    }
+    return imgmgr_test_rx.off;
+}
+
+/**
+ * Sends the rest of the image from ack onwards, one chunk at a time, and
+ * checks that the receiver ends up with all of it.
+ */
+static void
+imgmgr_test_util_finish(uint32_t ack, uint32_t size)
+{
+    uint32_t off;
+    int done;
+
+    done = 0;
+    for (off = ack; !done; off += IMGMGR_TEST_CHUNK_SZ) {
+        TEST_ASSERT_FATAL(off < size);
+        ack = imgmgr_test_util_rx(off, size, &done);
+        TEST_ASSERT(ack == min(off + IMGMGR_TEST_CHUNK_SZ, size));
+    }
+    TEST_ASSERT(ack == size);
+    TEST_ASSERT(memcmp(imgmgr_test_slot, imgmgr_test_img, size) == 0);
+}
+
+TEST_CASE(imgmgr_test_rx_dropped)
+{
+    uint32_t ack;
+    int done;
+
+    imgmgr_test_util_init(0);
+
+    /* Nothing is taken before the upload has started. */
+    ack = imgmgr_test_util_rx(IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ,
+                              &done);
+    TEST_ASSERT(ack == 0 && !done);
+    TEST_ASSERT(imgmgr_test_writes == 0);
+
+    ack = imgmgr_test_util_rx(0, IMGMGR_TEST_IMG_SZ, &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+
+    /*
+     * The second chunk is lost; the rest of the window is dropped, and
+     * each response asks for the lost one again.
+     */
+    ack = imgmgr_test_util_rx(2 * IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ,
+                              &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    ack = imgmgr_test_util_rx(3 * IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ,
+                              &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    TEST_ASSERT(imgmgr_test_writes == 1);
+
+    /* Going back to the acknowledged offset completes the upload. */
+    imgmgr_test_util_finish(ack, IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT(imgmgr_test_writes ==
+                (IMGMGR_TEST_IMG_SZ + IMGMGR_TEST_CHUNK_SZ - 1) /
+                IMGMGR_TEST_CHUNK_SZ);
+}
+
+TEST_CASE(imgmgr_test_rx_duplicate)
+{
+    uint32_t ack;
+    int writes;
+    int done;
+
+    imgmgr_test_util_init(1);
+
+    ack = imgmgr_test_util_rx(0, IMGMGR_TEST_IMG_SZ, &done);
+    ack = imgmgr_test_util_rx(ack, IMGMGR_TEST_IMG_SZ, &done);
+    TEST_ASSERT(ack == 2 * IMGMGR_TEST_CHUNK_SZ && !done);
+
+    /* A resent chunk, whose response got lost, is not written again. */
+    writes = imgmgr_test_writes;
+    ack = imgmgr_test_util_rx(IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ,
+                              &done);
+    TEST_ASSERT(ack == 2 * IMGMGR_TEST_CHUNK_SZ && !done);
+    TEST_ASSERT(imgmgr_test_writes == writes);
+
+    imgmgr_test_util_finish(ack, IMGMGR_TEST_IMG_SZ);
+
+    /* Nor is the last one, once the upload is over. */
+    writes = imgmgr_test_writes;
+    ack = imgmgr_test_util_rx(IMGMGR_TEST_IMG_SZ / IMGMGR_TEST_CHUNK_SZ *
+                              IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ, &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_IMG_SZ && !done);
+    TEST_ASSERT(imgmgr_test_writes == writes);
+}
+
+TEST_CASE(imgmgr_test_rx_restart)
+{
+    uint32_t ack;
+    uint32_t off;
+    int done;
+
+    imgmgr_test_util_init(2);
+
+    ack = 0;
+    for (off = 0; off < 3 * IMGMGR_TEST_CHUNK_SZ;
+         off += IMGMGR_TEST_CHUNK_SZ) {
+
+        ack = imgmgr_test_util_rx(off, IMGMGR_TEST_IMG_SZ, &done);
+    }
+    TEST_ASSERT(ack == 3 * IMGMGR_TEST_CHUNK_SZ);
+
+    /*
+     * The host starts over with a smaller image. The chunk at offset 0
+     * resets the upload and its size even though one is in progress.
+     */
+    imgmgr_test_util_fill(3);
+    ack = imgmgr_test_util_rx(0, IMGMGR_TEST_IMG_SZ / 2, &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    TEST_ASSERT(imgmgr_test_rx.size == IMGMGR_TEST_IMG_SZ / 2);
+
+    /* A chunk of the old upload still in flight is dropped. */
+    ack = imgmgr_test_util_rx(3 * IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ,
+                              &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    TEST_ASSERT(imgmgr_test_writes == 4);
+
+    /* Writing the slot fails; nothing more is taken, not even at ack. */
+    imgmgr_test_open = 0;
+    ack = imgmgr_test_util_rx(ack, IMGMGR_TEST_IMG_SZ / 2, &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    TEST_ASSERT(imgmgr_test_writes == 4);
+
+    /* Until the host starts over again. */
+    ack = imgmgr_test_util_rx(0, IMGMGR_TEST_IMG_SZ / 2, &done);
+    TEST_ASSERT(ack == IMGMGR_TEST_CHUNK_SZ && !done);
+    imgmgr_test_util_finish(ack, IMGMGR_TEST_IMG_SZ / 2);
+}
+
+static char
+imgmgr_test_req_read_next(struct json_buffer *jb)
+{
+    char c;
+
+    c = imgmgr_test_req[imgmgr_test_req_off];
+    if (c != '\0') {
+        imgmgr_test_req_off++;
+    }
+    return c;
+}
+
+static char
+imgmgr_test_req_read_prev(struct json_buffer *jb)
+{
+    return imgmgr_test_req[--imgmgr_test_req_off];
+}
+
+static int
+imgmgr_test_req_readn(struct json_buffer *jb, char *buf, int n)
+{
+    int len;
+
+    len = strlen(imgmgr_test_req + imgmgr_test_req_off);
+    if (n > len) {
+        n = len;
+    }
+    memcpy(buf, imgmgr_test_req + imgmgr_test_req_off, n);
+    return n;
+}
+
+static int
+imgmgr_test_rsp_write(void *arg, char *data, int len)
+{
+    TEST_ASSERT_FATAL(imgmgr_test_rsp_len + len < sizeof imgmgr_test_rsp);
+    memcpy(imgmgr_test_rsp + imgmgr_test_rsp_len, data, len);
+    imgmgr_test_rsp_len += len;
+    imgmgr_test_rsp[imgmgr_test_rsp_len] = '\0';
+    return 0;
+}
+
+/**
+ * Passes the JSON request in imgmgr_test_req to a newtmgr handler.  The
+ * response ends up in imgmgr_test_rsp.
+ *
+ * @return                      The handler's return code.
+ */
+static int
+imgmgr_test_util_handle(nmgr_handler_func_t handler)
+{
+    struct nmgr_jbuf njb;
+
+    memset(&njb, 0, sizeof njb);
+    njb.njb_buf.jb_readn = imgmgr_test_req_readn;
+    njb.njb_buf.jb_read_next = imgmgr_test_req_read_next;
+    njb.njb_buf.jb_read_prev = imgmgr_test_req_read_prev;
+    njb.njb_enc.je_write = imgmgr_test_rsp_write;
+    imgmgr_test_req_off = 0;
+    imgmgr_test_rsp_len = 0;
+    imgmgr_test_rsp[0] = '\0';
+
+    return handler(&njb);
+}
+
+/**
+ * @return                      The value of the given key in the response;
+ *                                  -1 if the response has no such key.
+ */
+static int
+imgmgr_test_util_rsp_int(const char *key)
+{
+    const char *val;
+    char str[16];
+
+    snprintf(str, sizeof str, "\"%s\":", key);
+    val = strstr(imgmgr_test_rsp, str);
+    if (val == NULL) {
+        return -1;
+    }
+    return atoi(val + strlen(str));
+}
+
+/**
+ * Sends one chunk of an upload through the given handler.
+ *
+ * @return                      The "rc" of the response; -1 if the upload
+ *                                  is not over yet.
+ */
+static int
+imgmgr_test_util_upload(nmgr_handler_func_t handler, uint32_t off,
+                        uint32_t size, const void *data, int len)
+{
+    char data_str[(IMGMGR_TEST_CHUNK_SZ + 2) / 3 * 4 + 1];
+    int rc;
+
+    TEST_ASSERT_FATAL(len <= IMGMGR_TEST_CHUNK_SZ);
+    data_str[base64_encode(data, len, data_str, 1)] = '\0';
+    snprintf(imgmgr_test_req, sizeof imgmgr_test_req,
+             "{\"off\":%u,\"len\":%u,\"data\":\"%s\"}",
+             (unsigned int)off, (unsigned int)size, data_str);
+
+    rc = imgmgr_test_util_handle(handler);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    return imgmgr_test_util_rsp_int("rc");
+}
+
+/**
+ * Sends imgmgr_test_img as a full image upload, starting at the given
+ * offset, and checks that it ends up in the given slot.
+ */
+static void
+imgmgr_test_util_upload_rest(uint32_t off, int slot)
+{
+    const struct flash_area *fa;
+    uint32_t len;
+    int rc;
+
+    do {
+        len = min(IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ - off);
+        rc = imgmgr_test_util_upload(imgr_upload, off, IMGMGR_TEST_IMG_SZ,
+                                     imgmgr_test_img + off, len);
+        off += len;
+        TEST_ASSERT_FATAL(imgmgr_test_util_rsp_int("off") == off);
+    } while (off < IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT(rc == 0);
+
+    rc = flash_area_open(slot, &fa);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = flash_area_read(fa, 0, imgmgr_test_slot, IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(imgmgr_test_slot, imgmgr_test_img,
+                       IMGMGR_TEST_IMG_SZ) == 0);
+    flash_area_close(fa);
+}
+
+/**
+ * Sends one chunk of a full image upload through imgr_bin_upload().
+ *
+ * @return                      The offset the response acknowledges.
+ */
+static uint32_t
+imgmgr_test_util_bin_upload(uint32_t off, uint32_t size, const void *data,
+                            int len, int *done)
+{
+    struct imgmgr_upload_cmd cmd;
+    struct imgmgr_upload_rsp rsp;
+    struct nmgr_jbuf njb;
+    struct nmgr_hdr hdr;
+    int rc;
+
+    memset(&njb, 0, sizeof njb);
+    memset(&hdr, 0, sizeof hdr);
+    njb.njb_hdr = &hdr;
+    njb.njb_in_m = os_mbuf_get(&imgmgr_test_mbuf_pool, 0);
+    njb.njb_out_m = os_mbuf_get(&imgmgr_test_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(njb.njb_in_m != NULL && njb.njb_out_m != NULL);
+
+    cmd.iuc_off = htonl(off);
+    cmd.iuc_len = htonl(size);
+    rc = os_mbuf_append(njb.njb_in_m, &cmd, sizeof cmd);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_append(njb.njb_in_m, data, len);
+    TEST_ASSERT_FATAL(rc == 0);
+    njb.njb_end = sizeof cmd + len;
+
+    rc = imgr_bin_upload(&njb);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_copydata(njb.njb_out_m, 0, sizeof rsp, &rsp);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_mbuf_free_chain(njb.njb_in_m);
+    os_mbuf_free_chain(njb.njb_out_m);
+
+    *done = rsp.iur_done;
+    return ntohl(rsp.iur_off);
+}
+
+static void
+imgmgr_test_util_flash_init(void)
+{
+    int rc;
+    int i;
+
+    memset(&imgr_state, 0, sizeof imgr_state);
+
+    rc = os_mempool_init(&imgmgr_test_mbuf_mempool,
+                         IMGMGR_TEST_MBUF_BUF_COUNT, IMGMGR_TEST_MBUF_BUF_SIZE,
+                         imgmgr_test_mbuf_mem, "imgmgr_test_mbuf");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_pool_init(&imgmgr_test_mbuf_pool, &imgmgr_test_mbuf_mempool,
+                           IMGMGR_TEST_MBUF_BUF_SIZE,
+                           IMGMGR_TEST_MBUF_BUF_COUNT);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = hal_flash_init();
+    TEST_ASSERT_FATAL(rc == 0);
+    flash_area_init(imgmgr_test_areas,
+                    sizeof imgmgr_test_areas / sizeof imgmgr_test_areas[0]);
+
+    for (i = FLASH_AREA_IMAGE_0; i <= FLASH_AREA_IMAGE_1; i++) {
+        rc = hal_flash_erase(imgmgr_test_areas[i].fa_flash_id,
+                             imgmgr_test_areas[i].fa_off,
+                             imgmgr_test_areas[i].fa_size);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+}
+
+/**
+ * Gives the image in the buffer a valid header with the given build number.
+ */
+static void
+imgmgr_test_util_hdr(uint8_t *img, uint32_t build_num)
+{
+    struct image_header *hdr;
+
+    hdr = (struct image_header *)img;
+    memset(hdr, 0, sizeof *hdr);
+    hdr->ih_magic = IMAGE_MAGIC;
+    hdr->ih_hdr_size = IMAGE_HEADER_SIZE;
+    hdr->ih_img_size = IMGMGR_TEST_IMG_SZ - IMAGE_HEADER_SIZE;
+    hdr->ih_ver.iv_major = 1;
+    hdr->ih_ver.iv_minor = 2;
+    hdr->ih_ver.iv_revision = 3;
+    hdr->ih_ver.iv_build_num = build_num;
+    hdr->ih_crc32 = crc32(0, img + IMAGE_HEADER_CRC_OFFSET + 4,
+                          IMGMGR_TEST_IMG_SZ - IMAGE_HEADER_CRC_OFFSET - 4);
+}
+
+static void
+imgmgr_test_util_delta_varint(uint32_t val)
+{
+    do {
+        imgmgr_test_delta[imgmgr_test_delta_len] = val & 0x7f;
+        val >>= 7;
+        if (val != 0) {
+            imgmgr_test_delta[imgmgr_test_delta_len] |= 0x80;
+        }
+        imgmgr_test_delta_len++;
+    } while (val != 0);
+}
+
+static void
+imgmgr_test_util_delta_copy(uint32_t src_off, uint32_t len)
+{
+    imgmgr_test_delta[imgmgr_test_delta_len++] = IMAGE_DELTA_OP_COPY;
+    imgmgr_test_util_delta_varint(src_off);
+    imgmgr_test_util_delta_varint(len);
+}
+
+/**
+ * Puts a base image, version 1.2.3.1, in the active slot, and builds in
+ * imgmgr_test_img a new image, version 1.2.3.2, which differs from it only
+ * in its header.  The delta between the two ends up in imgmgr_test_delta.
+ */
+static void
+imgmgr_test_util_delta_setup(void)
+{
+    struct image_delta_hdr dhdr;
+    const struct flash_area *fa;
+    int rc;
+
+    imgmgr_test_util_fill(4);
+    imgmgr_test_util_hdr(imgmgr_test_img, 1);
+    memcpy(imgmgr_test_base, imgmgr_test_img, IMGMGR_TEST_IMG_SZ);
+    imgmgr_test_util_hdr(imgmgr_test_img, 2);
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fa);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = flash_area_write(fa, 0, imgmgr_test_base, IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT_FATAL(rc == 0);
+    flash_area_close(fa);
+
+    dhdr.idh_magic = IMAGE_DELTA_MAGIC;
+    dhdr.idh_base_crc32 = ((struct image_header *)imgmgr_test_base)->ih_crc32;
+    dhdr.idh_base_size = IMGMGR_TEST_IMG_SZ;
+    dhdr.idh_new_size = IMGMGR_TEST_IMG_SZ;
+    memcpy(imgmgr_test_delta, &dhdr, sizeof dhdr);
+    imgmgr_test_delta_len = sizeof dhdr;
+
+    imgmgr_test_delta[imgmgr_test_delta_len++] = IMAGE_DELTA_OP_INSERT;
+    imgmgr_test_util_delta_varint(IMAGE_HEADER_SIZE);
+    memcpy(imgmgr_test_delta + imgmgr_test_delta_len, imgmgr_test_img,
+           IMAGE_HEADER_SIZE);
+    imgmgr_test_delta_len += IMAGE_HEADER_SIZE;
+
+    /*
+     * Two copies, so the first one alone writes more than the flash
+     * writer buffers.
+     */
+    imgmgr_test_util_delta_copy(IMAGE_HEADER_SIZE,
+                                IMGMGR_TEST_IMG_SZ / 2 - IMAGE_HEADER_SIZE);
+    imgmgr_test_util_delta_copy(IMGMGR_TEST_IMG_SZ / 2,
+                                IMGMGR_TEST_IMG_SZ / 2);
+    TEST_ASSERT_FATAL(imgmgr_test_delta_len <= IMGMGR_TEST_CHUNK_SZ);
+}
+
+TEST_CASE(imgmgr_test_delta_interrupted)
+{
+    const struct flash_area *fa;
+    struct image_version ver;
+    int rc;
+
+    imgmgr_test_util_flash_init();
+    imgmgr_test_util_delta_setup();
+
+    /*
+     * All of the delta but its last byte arrives; the first copy is
+     * written to the slot, but the second one is still incomplete.
+     */
+    rc = imgmgr_test_util_upload(imgr_delta_upload, 0, imgmgr_test_delta_len,
+                                 imgmgr_test_delta, imgmgr_test_delta_len - 1);
+    TEST_ASSERT(rc == -1);
+    TEST_ASSERT(imgr_state.upload.rx.off == imgmgr_test_delta_len - 1);
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = flash_area_read(fa, IMAGE_HEADER_SIZE, imgmgr_test_slot,
+                         FLASH_AREA_WRITER_BUF_SZ - IMAGE_HEADER_SIZE);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(imgmgr_test_slot, imgmgr_test_img + IMAGE_HEADER_SIZE,
+                       FLASH_AREA_WRITER_BUF_SZ - IMAGE_HEADER_SIZE) == 0);
+
+    /* Until the image verifies, the slot holds no image to boot. */
+    TEST_ASSERT(imgr_read_ver(FLASH_AREA_IMAGE_1, &ver) == 1);
+#ifdef FS_PRESENT
+    strcpy(imgmgr_test_req, "{\"test\":\"1.2.3.2\"}");
+    rc = imgmgr_test_util_handle(imgr_boot_write);
+    TEST_ASSERT(rc == OS_EINVAL);
+#endif
+
+    /* The last byte completes the image, which then gets its header. */
+    rc = imgmgr_test_util_upload(imgr_delta_upload, imgmgr_test_delta_len - 1,
+                                 imgmgr_test_delta_len,
+                                 imgmgr_test_delta + imgmgr_test_delta_len - 1,
+                                 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(imgr_read_ver(FLASH_AREA_IMAGE_1, &ver) == 0);
+    TEST_ASSERT(ver.iv_build_num == 2);
+
+    rc = flash_area_read(fa, 0, imgmgr_test_slot, IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(imgmgr_test_slot, imgmgr_test_img,
+                       IMGMGR_TEST_IMG_SZ) == 0);
+    flash_area_close(fa);
+}
+
+TEST_CASE(imgmgr_test_upload_kind)
+{
+    struct image_version ver;
+    int rc;
+
+    imgmgr_test_util_flash_init();
+    imgmgr_test_util_delta_setup();
+
+    rc = imgmgr_test_util_upload(imgr_delta_upload, 0, imgmgr_test_delta_len,
+                                 imgmgr_test_delta, imgmgr_test_delta_len);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* A full upload starts, replacing the image the delta produced. */
+    imgmgr_test_util_hdr(imgmgr_test_img, 3);
+    rc = imgmgr_test_util_upload(imgr_upload, 0, IMGMGR_TEST_IMG_SZ,
+                                 imgmgr_test_img, IMGMGR_TEST_CHUNK_SZ);
+    TEST_ASSERT(rc == -1);
+    TEST_ASSERT(imgr_state.upload.rx.off == IMGMGR_TEST_CHUNK_SZ);
+
+    /*
+     * A delta chunk at the offset the full upload expects next is not
+     * part of it. It is dropped, and the host is told to start over.
+     */
+    rc = imgmgr_test_util_upload(imgr_delta_upload, IMGMGR_TEST_CHUNK_SZ,
+                                 2 * IMGMGR_TEST_CHUNK_SZ, imgmgr_test_delta,
+                                 IMGMGR_TEST_CHUNK_SZ / 2);
+    TEST_ASSERT(rc == -1);
+    TEST_ASSERT(imgmgr_test_util_rsp_int("off") == 0);
+    TEST_ASSERT(imgr_state.upload.rx.off == IMGMGR_TEST_CHUNK_SZ);
+
+    /* The full upload carries on regardless. */
+    imgmgr_test_util_upload_rest(IMGMGR_TEST_CHUNK_SZ, FLASH_AREA_IMAGE_1);
+    TEST_ASSERT(imgr_read_ver(FLASH_AREA_IMAGE_1, &ver) == 0);
+    TEST_ASSERT(ver.iv_build_num == 3);
+
+    /*
+     * A delta which starts while a full upload is in progress abandons it,
+     * and the full upload's chunks are dropped from then on.
+     */
+    imgmgr_test_util_hdr(imgmgr_test_img, 4);
+    rc = imgmgr_test_util_upload(imgr_upload, 0, IMGMGR_TEST_IMG_SZ,
+                                 imgmgr_test_img, IMGMGR_TEST_CHUNK_SZ);
+    TEST_ASSERT(rc == -1);
+    rc = imgmgr_test_util_upload(imgr_delta_upload, 0, imgmgr_test_delta_len,
+                                 imgmgr_test_delta, IMGMGR_TEST_CHUNK_SZ / 2);
+    TEST_ASSERT(rc == -1);
+    TEST_ASSERT(imgmgr_test_util_rsp_int("off") == IMGMGR_TEST_CHUNK_SZ / 2);
+
+    rc = imgmgr_test_util_upload(imgr_upload, IMGMGR_TEST_CHUNK_SZ / 2,
+                                 IMGMGR_TEST_IMG_SZ,
+                                 imgmgr_test_img + IMGMGR_TEST_CHUNK_SZ / 2,
+                                 IMGMGR_TEST_CHUNK_SZ);
+    TEST_ASSERT(rc == -1);
+    TEST_ASSERT(imgmgr_test_util_rsp_int("off") == 0);
+    TEST_ASSERT(imgr_state.upload.rx.off == IMGMGR_TEST_CHUNK_SZ / 2);
+
+    /* Once the host starts over, the full upload goes through. */
+    imgmgr_test_util_upload_rest(0, FLASH_AREA_IMAGE_1);
+    TEST_ASSERT(imgr_state.upload.base_fa == NULL);
+}
+
+TEST_CASE(imgmgr_test_bin_upload_kind)
+{
+    const struct flash_area *fa;
+    struct image_version ver;
+    uint32_t ack;
+    uint32_t off;
+    uint32_t len;
+    int done;
+    int rc;
+
+    imgmgr_test_util_flash_init();
+    imgmgr_test_util_delta_setup();
+
+    rc = imgmgr_test_util_upload(imgr_delta_upload, 0, imgmgr_test_delta_len,
+                                 imgmgr_test_delta, imgmgr_test_delta_len - 1);
+    TEST_ASSERT_FATAL(rc == -1);
+
+    /*
+     * A binary chunk at the offset the delta expects next must not go
+     * into the image the delta is rebuilding.
+     */
+    ack = imgmgr_test_util_bin_upload(imgmgr_test_delta_len - 1,
+                                      IMGMGR_TEST_IMG_SZ, imgmgr_test_img,
+                                      IMGMGR_TEST_CHUNK_SZ, &done);
+    TEST_ASSERT(ack == 0 && !done);
+    TEST_ASSERT(imgr_state.upload.rx.off == imgmgr_test_delta_len - 1);
+
+    rc = imgmgr_test_util_upload(imgr_delta_upload, imgmgr_test_delta_len - 1,
+                                 imgmgr_test_delta_len,
+                                 imgmgr_test_delta + imgmgr_test_delta_len - 1,
+                                 1);
+    TEST_ASSERT(rc == 0);
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = flash_area_read(fa, 0, imgmgr_test_slot, IMGMGR_TEST_IMG_SZ);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(imgmgr_test_slot, imgmgr_test_img,
+                       IMGMGR_TEST_IMG_SZ) == 0);
+    flash_area_close(fa);
+
+    /* A binary upload from the start replaces the delta's image. */
+    imgmgr_test_util_hdr(imgmgr_test_img, 3);
+    done = 0;
+    for (off = 0; !done; off += len) {
+        TEST_ASSERT_FATAL(off < IMGMGR_TEST_IMG_SZ);
+        len = min(IMGMGR_TEST_CHUNK_SZ, IMGMGR_TEST_IMG_SZ - off);
+        ack = imgmgr_test_util_bin_upload(off, IMGMGR_TEST_IMG_SZ,
+                                          imgmgr_test_img + off, len, &done);
+        TEST_ASSERT_FATAL(ack == off + len);
+    }
+    TEST_ASSERT(imgr_read_ver(FLASH_AREA_IMAGE_1, &ver) == 0);
+    TEST_ASSERT(ver.iv_build_num == 3);
+}
+
+TEST_SUITE(imgmgr_test_main)
+{
+    imgmgr_test_rx_dropped();
+    imgmgr_test_rx_duplicate();
+    imgmgr_test_rx_restart();
+    imgmgr_test_delta_interrupted();
+    imgmgr_test_upload_kind();
+    imgmgr_test_bin_upload_kind();
+}
+
+int
+imgmgr_test_all(void)
+{
+    imgmgr_test_main();
+    return tu_any_failed;
+}
+
+#ifdef PKG_TEST
+
+int
+main(void)
+{
+    tu_config.tc_print_results = 1;
+    tu_init();
+
+    imgmgr_test_all();
+
+    return tu_any_failed;
+}
+
+#endif
@@ -95,6 +95,8 @@ struct json_encoder {
     json_write_func_t je_write;
     void *je_arg;
     int je_has_objects:1;
+    /* Encode as CBOR (RFC 7049) instead of JSON text. */
+    uint8_t je_cbor;
     char je_encode_buf[64];
 };
 
@@ -187,11 +189,19 @@ struct json_buffer;
 typedef char (*json_buffer_read_next_byte_t)(struct json_buffer *);
 typedef char (*json_buffer_read_prev_byte_t)(struct json_buffer *);
 typedef int (*json_buffer_readn_t)(struct json_buffer *, char *buf, int n);
+typedef int (*json_buffer_read_t)(struct json_buffer *, char *buf, int n);
 
 struct json_buffer {
     json_buffer_readn_t jb_readn;
     json_buffer_read_next_byte_t jb_read_next;
     json_buffer_read_prev_byte_t jb_read_prev;
+    /*
+     * Optional. Like jb_readn(), but consumes the bytes it returns. Without
+     * it, CBOR input is consumed a byte at a time with jb_read_next().
+     */
+    json_buffer_read_t jb_read;
+    /* Input is a CBOR map rather than JSON text; see json_read_object(). */
+    uint8_t jb_cbor;
 };
 
 #define JSON_ATTR_MAX        31        /* max chars in JSON attribute name */
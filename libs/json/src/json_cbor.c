@@ -0,0 +1,733 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * CBOR (RFC 7049) encoding of the values described by struct json_value and
+ * struct json_attr_t.  The json_encode_object_*() and json_read_object()
+ * entry points switch here when je_cbor / jb_cbor is set, so callers are
+ * unchanged apart from selecting the encoding.
+ *
+ * Objects built with json_encode_object_start() / _finish() become
+ * indefinite length maps, as the number of entries isn't known up front.
+ * Composite json_values carry their length and use definite length arrays
+ * and maps.
+ *
+ * The decoder accepts a definite or indefinite length map with text string
+ * keys.  Attributes of type t_array, t_object and t_structobject are not
+ * supported; values of t_ignore attributes may be of any type.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <json/json.h>
+#include "json_priv.h"
+
+#define JSON_CBOR_MAJOR_UINT        0
+#define JSON_CBOR_MAJOR_NINT        1
+#define JSON_CBOR_MAJOR_BYTES       2
+#define JSON_CBOR_MAJOR_TEXT        3
+#define JSON_CBOR_MAJOR_ARRAY       4
+#define JSON_CBOR_MAJOR_MAP         5
+#define JSON_CBOR_MAJOR_TAG         6
+#define JSON_CBOR_MAJOR_SIMPLE      7
+
+/* Additional information: where the argument of a data item is. */
+#define JSON_CBOR_AI_1              24  /* In the following byte. */
+#define JSON_CBOR_AI_2              25
+#define JSON_CBOR_AI_4              26
+#define JSON_CBOR_AI_8              27
+#define JSON_CBOR_AI_INDEF          31  /* Indefinite length. */
+
+#define JSON_CBOR_AI_FALSE          20
+#define JSON_CBOR_AI_TRUE           21
+
+#define JSON_CBOR_FALSE             0xf4
+#define JSON_CBOR_TRUE              0xf5
+#define JSON_CBOR_MAP_INDEF         0xbf
+#define JSON_CBOR_BREAK             0xff
+
+/** Maximum nesting of values skipped for t_ignore attributes. */
+#ifndef JSON_CBOR_MAX_DEPTH
+#define JSON_CBOR_MAX_DEPTH         4
+#endif
+
+static int
+json_cbor_encode_byte(struct json_encoder *encoder, uint8_t b)
+{
+    encoder->je_encode_buf[0] = b;
+    return encoder->je_write(encoder->je_arg, encoder->je_encode_buf, 1);
+}
+
+/**
+ * Writes the initial byte of a data item, followed by its argument in the
+ * fewest bytes that hold it.
+ */
+static int
+json_cbor_encode_head(struct json_encoder *encoder, uint8_t major,
+                      uint64_t arg)
+{
+    uint8_t *buf;
+    int size;
+    int i;
+
+    buf = (uint8_t *)encoder->je_encode_buf;
+    if (arg < JSON_CBOR_AI_1) {
+        buf[0] = (major << 5) | arg;
+        size = 0;
+    } else if (arg <= UINT8_MAX) {
+        buf[0] = (major << 5) | JSON_CBOR_AI_1;
+        size = 1;
+    } else if (arg <= UINT16_MAX) {
+        buf[0] = (major << 5) | JSON_CBOR_AI_2;
+        size = 2;
+    } else if (arg <= UINT32_MAX) {
+        buf[0] = (major << 5) | JSON_CBOR_AI_4;
+        size = 4;
+    } else {
+        buf[0] = (major << 5) | JSON_CBOR_AI_8;
+        size = 8;
+    }
+
+    /* Big endian. */
+    for (i = 0; i < size; i++) {
+        buf[size - i] = arg >> (8 * i);
+    }
+
+    return encoder->je_write(encoder->je_arg, encoder->je_encode_buf,
+                             size + 1);
+}
+
+static int
+json_cbor_encode_text(struct json_encoder *encoder, char *str, int len)
+{
+    int rc;
+
+    rc = json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_TEXT, len);
+    if (rc != 0 || len == 0) {
+        return rc;
+    }
+
+    return encoder->je_write(encoder->je_arg, str, len);
+}
+
+static int
+json_cbor_encode_value(struct json_encoder *encoder, struct json_value *jv)
+{
+    int64_t i64;
+    int rc;
+    int i;
+
+    switch (jv->jv_type) {
+    case JSON_VALUE_TYPE_BOOL:
+        return json_cbor_encode_byte(encoder,
+          jv->jv_val.u > 0 ? JSON_CBOR_TRUE : JSON_CBOR_FALSE);
+
+    case JSON_VALUE_TYPE_UINT64:
+        return json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_UINT,
+          jv->jv_val.u);
+
+    case JSON_VALUE_TYPE_INT64:
+        i64 = jv->jv_val.u;
+        if (i64 < 0) {
+            return json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_NINT,
+              -1 - i64);
+        }
+        return json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_UINT, i64);
+
+    case JSON_VALUE_TYPE_STRING:
+        return json_cbor_encode_text(encoder, jv->jv_val.str, jv->jv_len);
+
+    case JSON_VALUE_TYPE_ARRAY:
+        rc = json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_ARRAY,
+          jv->jv_len);
+        for (i = 0; rc == 0 && i < jv->jv_len; i++) {
+            rc = json_cbor_encode_value(encoder,
+              jv->jv_val.composite.values[i]);
+        }
+        return rc;
+
+    case JSON_VALUE_TYPE_OBJECT:
+        rc = json_cbor_encode_head(encoder, JSON_CBOR_MAJOR_MAP, jv->jv_len);
+        for (i = 0; rc == 0 && i < jv->jv_len; i++) {
+            rc = json_cbor_encode_object_entry(encoder,
+              jv->jv_val.composite.keys[i], jv->jv_val.composite.values[i]);
+        }
+        return rc;
+
+    default:
+        return -1;
+    }
+}
+
+int
+json_cbor_encode_object_start(struct json_encoder *encoder)
+{
+    return json_cbor_encode_byte(encoder, JSON_CBOR_MAP_INDEF);
+}
+
+int
+json_cbor_encode_object_key(struct json_encoder *encoder, char *key)
+{
+    return json_cbor_encode_text(encoder, key, strlen(key));
+}
+
+int
+json_cbor_encode_object_entry(struct json_encoder *encoder, char *key,
+                              struct json_value *val)
+{
+    int rc;
+
+    rc = json_cbor_encode_object_key(encoder, key);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return json_cbor_encode_value(encoder, val);
+}
+
+int
+json_cbor_encode_object_finish(struct json_encoder *encoder)
+{
+    return json_cbor_encode_byte(encoder, JSON_CBOR_BREAK);
+}
+
+/**
+ * Reads exactly len bytes of input.  Unlike jb_read_next(), this tells a
+ * zero byte apart from the end of the input.  Buffers without jb_read()
+ * have their bytes read with jb_readn(), which does not consume them, and
+ * then skipped with jb_read_next().
+ */
+static int
+json_cbor_read(struct json_buffer *jb, void *buf, int len)
+{
+    int n;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (jb->jb_read != NULL) {
+        n = jb->jb_read(jb, buf, len);
+        return n == len ? 0 : JSON_ERR_MISC;
+    }
+
+    n = jb->jb_readn(jb, buf, len);
+    if (n != len) {
+        return JSON_ERR_MISC;
+    }
+    while (n-- > 0) {
+        jb->jb_read_next(jb);
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the next byte of input without consuming it.
+ */
+static int
+json_cbor_peek(struct json_buffer *jb, uint8_t *b)
+{
+    if (jb->jb_readn(jb, (char *)b, 1) != 1) {
+        return JSON_ERR_MISC;
+    }
+    return 0;
+}
+
+/**
+ * Reads the initial byte of a data item and its argument.  For indefinite
+ * length items, the argument is meaningless.
+ */
+static int
+json_cbor_read_head(struct json_buffer *jb, uint8_t *major, uint8_t *ai,
+                    uint64_t *arg)
+{
+    uint8_t buf[8];
+    uint8_t ib;
+    int size;
+    int rc;
+    int i;
+
+    rc = json_cbor_read(jb, &ib, 1);
+    if (rc != 0) {
+        return rc;
+    }
+    *major = ib >> 5;
+    *ai = ib & 0x1f;
+
+    if (*ai < JSON_CBOR_AI_1) {
+        *arg = *ai;
+        return 0;
+    }
+    if (*ai == JSON_CBOR_AI_INDEF) {
+        if (*major == JSON_CBOR_MAJOR_UINT || *major == JSON_CBOR_MAJOR_NINT ||
+            *major == JSON_CBOR_MAJOR_TAG) {
+
+            return JSON_ERR_MISC;
+        }
+        *arg = 0;
+        return 0;
+    }
+    if (*ai > JSON_CBOR_AI_8) {
+        return JSON_ERR_MISC;
+    }
+
+    size = 1 << (*ai - JSON_CBOR_AI_1);
+    rc = json_cbor_read(jb, buf, size);
+    if (rc != 0) {
+        return rc;
+    }
+    *arg = 0;
+    for (i = 0; i < size; i++) {
+        *arg = (*arg << 8) | buf[i];
+    }
+
+    return 0;
+}
+
+static int
+json_cbor_skip_bytes(struct json_buffer *jb, uint64_t len)
+{
+    char buf[16];
+    int chunk_sz;
+    int rc;
+
+    while (len > 0) {
+        chunk_sz = len > sizeof buf ? sizeof buf : len;
+        rc = json_cbor_read(jb, buf, chunk_sz);
+        if (rc != 0) {
+            return rc;
+        }
+        len -= chunk_sz;
+    }
+
+    return 0;
+}
+
+static int json_cbor_skip_value(struct json_buffer *jb, int depth);
+
+/**
+ * Skips the remainder of a data item whose head has already been read.
+ */
+static int
+json_cbor_skip_rest(struct json_buffer *jb, uint8_t major, uint8_t ai,
+                    uint64_t arg, int depth)
+{
+    uint8_t b;
+    int rc;
+
+    if (depth > JSON_CBOR_MAX_DEPTH) {
+        return JSON_ERR_MISC;
+    }
+
+    switch (major) {
+    case JSON_CBOR_MAJOR_UINT:
+    case JSON_CBOR_MAJOR_NINT:
+        return 0;
+
+    case JSON_CBOR_MAJOR_BYTES:
+    case JSON_CBOR_MAJOR_TEXT:
+        if (ai == JSON_CBOR_AI_INDEF) {
+            /* Chunked strings are not supported. */
+            return JSON_ERR_BADSTRING;
+        }
+        return json_cbor_skip_bytes(jb, arg);
+
+    case JSON_CBOR_MAJOR_ARRAY:
+    case JSON_CBOR_MAJOR_MAP:
+        if (major == JSON_CBOR_MAJOR_MAP) {
+            /* A key and a value per entry. */
+            arg *= 2;
+        }
+        while (1) {
+            if (ai == JSON_CBOR_AI_INDEF) {
+                rc = json_cbor_peek(jb, &b);
+                if (rc != 0) {
+                    return rc;
+                }
+                if (b == JSON_CBOR_BREAK) {
+                    return json_cbor_read(jb, &b, 1);
+                }
+            } else if (arg-- == 0) {
+                return 0;
+            }
+
+            rc = json_cbor_skip_value(jb, depth + 1);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+
+    case JSON_CBOR_MAJOR_TAG:
+        return json_cbor_skip_value(jb, depth + 1);
+
+    default:
+        /* Simple values and floats; the head included any argument.  A
+         * break is only valid where handled above.
+         */
+        if (ai == JSON_CBOR_AI_INDEF) {
+            return JSON_ERR_MISC;
+        }
+        return 0;
+    }
+}
+
+static int
+json_cbor_skip_value(struct json_buffer *jb, int depth)
+{
+    uint64_t arg;
+    uint8_t major;
+    uint8_t ai;
+    int rc;
+
+    rc = json_cbor_read_head(jb, &major, &ai, &arg);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return json_cbor_skip_rest(jb, major, ai, arg, depth);
+}
+
+/**
+ * Indicates whether a data item can be stored in an attribute.
+ */
+static int
+json_cbor_type_ok(const struct json_attr_t *cursor, uint8_t major,
+                  uint8_t ai)
+{
+    if (cursor->type == t_ignore) {
+        return 1;
+    }
+    if (cursor->map != NULL || cursor->type == t_string ||
+        cursor->type == t_character || cursor->type == t_check) {
+
+        return major == JSON_CBOR_MAJOR_TEXT && ai != JSON_CBOR_AI_INDEF;
+    }
+
+    switch (cursor->type) {
+    case t_integer:
+    case t_uinteger:
+        return major == JSON_CBOR_MAJOR_UINT || major == JSON_CBOR_MAJOR_NINT;
+    case t_real:
+        return major == JSON_CBOR_MAJOR_UINT ||
+               major == JSON_CBOR_MAJOR_NINT ||
+               (major == JSON_CBOR_MAJOR_SIMPLE &&
+                (ai == JSON_CBOR_AI_4 || ai == JSON_CBOR_AI_8));
+    case t_boolean:
+        return major == JSON_CBOR_MAJOR_SIMPLE &&
+               (ai == JSON_CBOR_AI_FALSE || ai == JSON_CBOR_AI_TRUE);
+    default:
+        return 0;
+    }
+}
+
+static int64_t
+json_cbor_int(uint8_t major, uint64_t arg)
+{
+    if (major == JSON_CBOR_MAJOR_NINT) {
+        return -1 - (int64_t)arg;
+    }
+    return arg;
+}
+
+/**
+ * Reads a text string of the given length and compares it against str,
+ * without buffering the whole string.
+ */
+static int
+json_cbor_text_eq(struct json_buffer *jb, uint64_t len, const char *str,
+                  int *out_eq)
+{
+    char buf[16];
+    int chunk_sz;
+    int rc;
+
+    *out_eq = strlen(str) == len;
+    if (!*out_eq) {
+        return json_cbor_skip_bytes(jb, len);
+    }
+
+    while (len > 0) {
+        chunk_sz = len > sizeof buf ? sizeof buf : len;
+        rc = json_cbor_read(jb, buf, chunk_sz);
+        if (rc != 0) {
+            return rc;
+        }
+        if (memcmp(buf, str, chunk_sz) != 0) {
+            *out_eq = 0;
+        }
+        str += chunk_sz;
+        len -= chunk_sz;
+    }
+
+    return 0;
+}
+
+/**
+ * Maps a text string to the value of an enumerated attribute.
+ */
+static int
+json_cbor_read_enum(struct json_buffer *jb, const struct json_attr_t *cursor,
+                    uint64_t len, int *out_val)
+{
+    const struct json_enum_t *mp;
+    char buf[JSON_ATTR_MAX + 1];
+    int rc;
+
+    if (len >= sizeof buf) {
+        return JSON_ERR_BADENUM;
+    }
+    rc = json_cbor_read(jb, buf, len);
+    if (rc != 0) {
+        return rc;
+    }
+    buf[len] = '\0';
+
+    for (mp = cursor->map; mp->name != NULL; mp++) {
+        if (strcmp(mp->name, buf) == 0) {
+            *out_val = mp->value;
+            return 0;
+        }
+    }
+
+    return JSON_ERR_BADENUM;
+}
+
+/**
+ * Reads the value of an attribute, whose head has already been read, into
+ * its target.
+ */
+static int
+json_cbor_read_value(struct json_buffer *jb, const struct json_attr_t *cursor,
+                     uint8_t major, uint8_t ai, uint64_t arg)
+{
+    char *lptr;
+    int ival;
+    int eq;
+    int rc;
+
+    switch (cursor->type) {
+    case t_object:
+    case t_structobject:
+    case t_array:
+        return JSON_ERR_SUBTYPE;
+    default:
+        break;
+    }
+
+    if (!json_cbor_type_ok(cursor, major, ai)) {
+        if (major == JSON_CBOR_MAJOR_TEXT) {
+            if (ai == JSON_CBOR_AI_INDEF) {
+                return JSON_ERR_BADSTRING;
+            }
+            return JSON_ERR_QNONSTRING;
+        }
+        if (cursor->map != NULL || cursor->type == t_string ||
+            cursor->type == t_character || cursor->type == t_check) {
+
+            return JSON_ERR_NONQSTRING;
+        }
+        if (cursor->type == t_boolean) {
+            return JSON_ERR_MISC;
+        }
+        return JSON_ERR_BADNUM;
+    }
+
+    if (cursor->type == t_ignore) {
+        return json_cbor_skip_rest(jb, major, ai, arg, 0);
+    }
+
+    if (cursor->type == t_check) {
+        rc = json_cbor_text_eq(jb, arg, cursor->dflt.check, &eq);
+        if (rc != 0) {
+            return rc;
+        }
+        return eq ? 0 : JSON_ERR_CHECKFAIL;
+    }
+
+    lptr = json_target_address(cursor, NULL, 0);
+
+    if (cursor->map != NULL) {
+        rc = json_cbor_read_enum(jb, cursor, arg, &ival);
+        if (rc != 0) {
+            return rc;
+        }
+        major = ival < 0 ? JSON_CBOR_MAJOR_NINT : JSON_CBOR_MAJOR_UINT;
+        arg = ival < 0 ? -1 - (int64_t)ival : ival;
+    }
+
+    switch (cursor->type) {
+    case t_integer: {
+            int tmp = json_cbor_int(major, arg);
+            if (lptr != NULL) {
+                memcpy(lptr, &tmp, sizeof(int));
+            }
+        }
+        break;
+    case t_uinteger: {
+            unsigned int tmp = json_cbor_int(major, arg);
+            if (lptr != NULL) {
+                memcpy(lptr, &tmp, sizeof(unsigned int));
+            }
+        }
+        break;
+    case t_real: {
+#ifdef FLOAT_SUPPORT
+            double tmp;
+            uint32_t u32;
+            float fl;
+
+            if (major == JSON_CBOR_MAJOR_SIMPLE && ai == JSON_CBOR_AI_4) {
+                u32 = arg;
+                memcpy(&fl, &u32, sizeof fl);
+                tmp = fl;
+            } else if (major == JSON_CBOR_MAJOR_SIMPLE) {
+                memcpy(&tmp, &arg, sizeof tmp);
+            } else {
+                tmp = json_cbor_int(major, arg);
+            }
+            if (lptr != NULL) {
+                memcpy(lptr, &tmp, sizeof(double));
+            }
+#else
+            return JSON_ERR_MISC;
+#endif
+        }
+        break;
+    case t_boolean: {
+            bool tmp = (ai == JSON_CBOR_AI_TRUE);
+            if (lptr != NULL) {
+                memcpy(lptr, &tmp, sizeof(bool));
+            }
+        }
+        break;
+    case t_string:
+        if (arg > cursor->len - 1) {
+            return JSON_ERR_STRLONG;
+        }
+        if (lptr == NULL) {
+            return json_cbor_skip_bytes(jb, arg);
+        }
+        rc = json_cbor_read(jb, lptr, arg);
+        if (rc != 0) {
+            return rc;
+        }
+        lptr[arg] = '\0';
+        break;
+    case t_character:
+        if (arg > 1) {
+            return JSON_ERR_STRLONG;
+        }
+        if (lptr == NULL) {
+            return json_cbor_skip_bytes(jb, arg);
+        }
+        lptr[0] = '\0';
+        return json_cbor_read(jb, lptr, arg);
+    default:
+        return JSON_ERR_MISC;
+    }
+
+    return 0;
+}
+
+/**
+ * CBOR counterpart of json_read_object(): reads a map into the attributes
+ * it describes.  As with JSON input, attributes missing from the map get
+ * their defaults, and an unknown key is an error.
+ */
+int
+json_cbor_read_object(struct json_buffer *jb, const struct json_attr_t *attrs)
+{
+    const struct json_attr_t *cursor;
+    char attrbuf[JSON_ATTR_MAX + 1];
+    uint64_t count;
+    uint64_t arg;
+    uint8_t major;
+    uint8_t ai;
+    uint8_t b;
+    int indef;
+    int rc;
+
+    rc = json_internal_set_defaults(attrs, NULL, 0);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = json_cbor_read_head(jb, &major, &ai, &count);
+    if (rc != 0 || major != JSON_CBOR_MAJOR_MAP) {
+        return JSON_ERR_OBSTART;
+    }
+    indef = ai == JSON_CBOR_AI_INDEF;
+
+    while (1) {
+        if (indef) {
+            rc = json_cbor_peek(jb, &b);
+            if (rc != 0) {
+                return rc;
+            }
+            if (b == JSON_CBOR_BREAK) {
+                return json_cbor_read(jb, &b, 1);
+            }
+        } else if (count-- == 0) {
+            return 0;
+        }
+
+        rc = json_cbor_read_head(jb, &major, &ai, &arg);
+        if (rc != 0) {
+            return rc;
+        }
+        if (major != JSON_CBOR_MAJOR_TEXT || ai == JSON_CBOR_AI_INDEF) {
+            return JSON_ERR_ATTRSTART;
+        }
+        if (arg >= JSON_ATTR_MAX) {
+            return JSON_ERR_ATTRLEN;
+        }
+        rc = json_cbor_read(jb, attrbuf, arg);
+        if (rc != 0) {
+            return rc;
+        }
+        attrbuf[arg] = '\0';
+
+        for (cursor = attrs; cursor->attribute != NULL; cursor++) {
+            if (strcmp(cursor->attribute, attrbuf) == 0) {
+                break;
+            }
+        }
+        if (cursor->attribute == NULL) {
+            return JSON_ERR_BADATTR;
+        }
+
+        rc = json_cbor_read_head(jb, &major, &ai, &arg);
+        if (rc != 0) {
+            return rc;
+        }
+
+        /* Several attributes may share a name, told apart by type. */
+        while (!json_cbor_type_ok(cursor, major, ai) &&
+               cursor[1].attribute != NULL &&
+               strcmp(cursor[1].attribute, attrbuf) == 0) {
+            cursor++;
+        }
+
+        rc = json_cbor_read_value(jb, cursor, major, ai, arg);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <json/json.h>
+#include "json_priv.h"
 
 /** 
  * This file is based upon microjson, from Eric S Raymond. 
@@ -98,7 +99,7 @@ PERMISSIONS
 #include <errno.h>
 #include <math.h>        /* for HUGE_VAL */
 
-static char *
+char *
 json_target_address(const struct json_attr_t *cursor, 
         const struct json_array_t *parent, int offset)
 {
@@ -140,32 +141,17 @@ json_target_address(const struct json_attr_t *cursor,
     return targetaddr;
 }
 
-static int 
-json_internal_read_object(struct json_buffer *jb, const struct json_attr_t *attrs, 
+/*
+ * Stuff fields with defaults in case they're omitted in the input.  Shared
+ * with the CBOR decoder.
+ */
+int
+json_internal_set_defaults(const struct json_attr_t *attrs,
         const struct json_array_t *parent, int offset)
 {
-    char c;
-    enum { 
-        init, await_attr, in_attr, await_value, in_val_string,
-        in_escape, in_val_token, post_val, post_array
-    } state = 0;
-    char attrbuf[JSON_ATTR_MAX + 1], *pattr = NULL;
-    char valbuf[JSON_VAL_MAX + 1], *pval = NULL;
-    bool value_quoted = false;
-    char uescape[5];                /* enough space for 4 hex digits and a NUL */
     const struct json_attr_t *cursor;
-    int substatus, n, maxlen = 0;
-    unsigned int u;
-    const struct json_enum_t *mp;
     char *lptr;
 
-#ifdef S_SPLINT_S
-    /* prevents gripes about buffers not being completely defined */
-    memset(valbuf, '\0', sizeof(valbuf));
-    memset(attrbuf, '\0', sizeof(attrbuf));
-#endif /* S_SPLINT_S */
-
-    /* stuff fields with defaults in case they're omitted in the JSON input */
     for (cursor = attrs; cursor->attribute != NULL; cursor++) {
         if (!cursor->nodefault) {
             lptr = json_target_address(cursor, parent, offset);
@@ -205,6 +191,40 @@ json_internal_read_object(struct json_buffer *jb, const struct json_attr_t *attr
         }
     }
 
+    return 0;
+}
+
+static int 
+json_internal_read_object(struct json_buffer *jb, const struct json_attr_t *attrs, 
+        const struct json_array_t *parent, int offset)
+{
+    char c;
+    enum { 
+        init, await_attr, in_attr, await_value, in_val_string,
+        in_escape, in_val_token, post_val, post_array
+    } state = 0;
+    char attrbuf[JSON_ATTR_MAX + 1], *pattr = NULL;
+    char valbuf[JSON_VAL_MAX + 1], *pval = NULL;
+    bool value_quoted = false;
+    char uescape[5];                /* enough space for 4 hex digits and a NUL */
+    const struct json_attr_t *cursor;
+    int substatus, n, maxlen = 0;
+    unsigned int u;
+    const struct json_enum_t *mp;
+    char *lptr;
+
+#ifdef S_SPLINT_S
+    /* prevents gripes about buffers not being completely defined */
+    memset(valbuf, '\0', sizeof(valbuf));
+    memset(attrbuf, '\0', sizeof(attrbuf));
+#endif /* S_SPLINT_S */
+
+    /* stuff fields with defaults in case they're omitted in the JSON input */
+    substatus = json_internal_set_defaults(attrs, parent, offset);
+    if (substatus != 0) {
+        return substatus;
+    }
+
     /* parse input JSON */
     for (c = jb->jb_read_next(jb); c != '\0'; c = jb->jb_read_next(jb)) {
         switch (state) {
@@ -660,6 +680,10 @@ json_read_object(struct json_buffer *jb, const struct json_attr_t *attrs)
 {
     int st;
 
+    if (jb->jb_cbor) {
+        return json_cbor_read_object(jb, attrs);
+    }
+
     st = json_internal_read_object(jb, attrs, NULL, 0);
     return st;
 }
@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include <json/json.h>
+#include "json_priv.h"
 
 #define JSON_ENCODE_OBJECT_START(__e) \
     (__e)->je_write((__e)->je_arg, "{", sizeof("{")-1);
@@ -39,6 +40,10 @@
 int 
 json_encode_object_start(struct json_encoder *encoder)
 {
+    if (encoder->je_cbor) {
+        return json_cbor_encode_object_start(encoder);
+    }
+
     JSON_ENCODE_OBJECT_START(encoder);
     encoder->je_has_objects = 0;
 
@@ -149,6 +154,10 @@ err:
 int 
 json_encode_object_key(struct json_encoder *encoder, char *key)
 {
+    if (encoder->je_cbor) {
+        return json_cbor_encode_object_key(encoder, key);
+    }
+
     if (encoder->je_has_objects) {
         encoder->je_write(encoder->je_arg, ",", sizeof(",")-1);
     }
@@ -167,6 +176,10 @@ json_encode_object_entry(struct json_encoder *encoder, char *key,
 {
     int rc;
 
+    if (encoder->je_cbor) {
+        return json_cbor_encode_object_entry(encoder, key, val);
+    }
+
     if (encoder->je_has_objects) {
         encoder->je_write(encoder->je_arg, ",", sizeof(",")-1);
     }
@@ -189,6 +202,10 @@ err:
 int 
 json_encode_object_finish(struct json_encoder *encoder)
 {
+    if (encoder->je_cbor) {
+        return json_cbor_encode_object_finish(encoder);
+    }
+
     JSON_ENCODE_OBJECT_END(encoder);
     /* Useful in case of nested objects. */
     encoder->je_has_objects = 1;
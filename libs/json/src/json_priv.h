@@ -0,0 +1,40 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __JSON_PRIV_H_
+#define __JSON_PRIV_H_
+
+#include <json/json.h>
+
+/* json_decode.c */
+char *json_target_address(const struct json_attr_t *cursor,
+        const struct json_array_t *parent, int offset);
+int json_internal_set_defaults(const struct json_attr_t *attrs,
+        const struct json_array_t *parent, int offset);
+
+/* json_cbor.c */
+int json_cbor_encode_object_start(struct json_encoder *encoder);
+int json_cbor_encode_object_key(struct json_encoder *encoder, char *key);
+int json_cbor_encode_object_entry(struct json_encoder *encoder, char *key,
+        struct json_value *val);
+int json_cbor_encode_object_finish(struct json_encoder *encoder);
+int json_cbor_read_object(struct json_buffer *jb,
+        const struct json_attr_t *attrs);
+
+#endif /* __JSON_PRIV_H_ */
@@ -0,0 +1,383 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testutil/testutil.h"
+#include "json/json.h"
+#include "json_test_priv.h"
+
+/** A json_buffer over a flat array. */
+struct json_cbor_test_buf {
+    struct json_buffer jtb_buf;     /* Must be first. */
+    const uint8_t *jtb_data;
+    int jtb_len;
+    int jtb_off;
+    int jtb_next_calls;
+};
+
+static uint8_t json_cbor_test_out[256];
+static int json_cbor_test_out_len;
+
+static unsigned int json_cbor_test_u;
+static int json_cbor_test_i;
+static bool json_cbor_test_b;
+static char json_cbor_test_s[40];
+
+static const struct json_attr_t json_cbor_test_attrs[] = {
+    {
+        .attribute = "u",
+        .type = t_uinteger,
+        .addr.uinteger = &json_cbor_test_u,
+    }, {
+        .attribute = "i",
+        .type = t_integer,
+        .addr.integer = &json_cbor_test_i,
+    }, {
+        .attribute = "b",
+        .type = t_boolean,
+        .addr.boolean = &json_cbor_test_b,
+    }, {
+        .attribute = "s",
+        .type = t_string,
+        .addr.string = json_cbor_test_s,
+        .len = sizeof json_cbor_test_s,
+    }, {
+        .attribute = NULL
+    }
+};
+
+static const struct json_attr_t json_cbor_test_ignore_attrs[] = {
+    {
+        .attribute = "x",
+        .type = t_ignore,
+    }, {
+        .attribute = "u",
+        .type = t_uinteger,
+        .addr.uinteger = &json_cbor_test_u,
+    }, {
+        .attribute = NULL
+    }
+};
+
+static int
+json_cbor_test_write(void *arg, char *data, int len)
+{
+    if (len > sizeof json_cbor_test_out - json_cbor_test_out_len) {
+        return -1;
+    }
+    memcpy(json_cbor_test_out + json_cbor_test_out_len, data, len);
+    json_cbor_test_out_len += len;
+    return 0;
+}
+
+static char
+json_cbor_test_read_next(struct json_buffer *jb)
+{
+    struct json_cbor_test_buf *tb;
+
+    tb = (struct json_cbor_test_buf *)jb;
+    tb->jtb_next_calls++;
+    if (tb->jtb_off >= tb->jtb_len) {
+        return '\0';
+    }
+    return tb->jtb_data[tb->jtb_off++];
+}
+
+static char
+json_cbor_test_read_prev(struct json_buffer *jb)
+{
+    struct json_cbor_test_buf *tb;
+
+    tb = (struct json_cbor_test_buf *)jb;
+    if (tb->jtb_off == 0) {
+        return '\0';
+    }
+    return tb->jtb_data[--tb->jtb_off];
+}
+
+static int
+json_cbor_test_readn(struct json_buffer *jb, char *buf, int n)
+{
+    struct json_cbor_test_buf *tb;
+
+    tb = (struct json_cbor_test_buf *)jb;
+    if (n > tb->jtb_len - tb->jtb_off) {
+        n = tb->jtb_len - tb->jtb_off;
+    }
+    memcpy(buf, tb->jtb_data + tb->jtb_off, n);
+    return n;
+}
+
+static int
+json_cbor_test_read(struct json_buffer *jb, char *buf, int n)
+{
+    struct json_cbor_test_buf *tb;
+
+    tb = (struct json_cbor_test_buf *)jb;
+    n = json_cbor_test_readn(jb, buf, n);
+    tb->jtb_off += n;
+    return n;
+}
+
+/**
+ * Decodes a CBOR map with the given attributes.  If consuming is set, the
+ * buffer provides jb_read(); otherwise the decoder has to fall back to
+ * jb_readn() and jb_read_next().
+ */
+static int
+json_cbor_test_util_read(struct json_cbor_test_buf *tb, const void *data,
+                         int len, const struct json_attr_t *attrs,
+                         int consuming)
+{
+    memset(tb, 0, sizeof *tb);
+    tb->jtb_buf.jb_readn = json_cbor_test_readn;
+    tb->jtb_buf.jb_read_next = json_cbor_test_read_next;
+    tb->jtb_buf.jb_read_prev = json_cbor_test_read_prev;
+    if (consuming) {
+        tb->jtb_buf.jb_read = json_cbor_test_read;
+    }
+    tb->jtb_buf.jb_cbor = 1;
+    tb->jtb_data = data;
+    tb->jtb_len = len;
+
+    return json_read_object(&tb->jtb_buf, attrs);
+}
+
+/**
+ * Decodes with and without jb_read(); both must give the same result.
+ */
+static int
+json_cbor_test_util_read_both(const void *data, int len,
+                              const struct json_attr_t *attrs)
+{
+    struct json_cbor_test_buf tb;
+    int rc1;
+    int rc2;
+
+    rc1 = json_cbor_test_util_read(&tb, data, len, attrs, 0);
+    rc2 = json_cbor_test_util_read(&tb, data, len, attrs, 1);
+    TEST_ASSERT(rc1 == rc2);
+
+    return rc2;
+}
+
+static void
+json_cbor_test_util_encode(unsigned int u, int i, bool b, char *s)
+{
+    struct json_encoder enc;
+    struct json_value jv;
+    int rc;
+
+    memset(&enc, 0, sizeof enc);
+    enc.je_write = json_cbor_test_write;
+    enc.je_cbor = 1;
+    json_cbor_test_out_len = 0;
+
+    rc = json_encode_object_start(&enc);
+    TEST_ASSERT_FATAL(rc == 0);
+    JSON_VALUE_UINT(&jv, u);
+    rc = json_encode_object_entry(&enc, "u", &jv);
+    TEST_ASSERT_FATAL(rc == 0);
+    JSON_VALUE_INT(&jv, i);
+    rc = json_encode_object_entry(&enc, "i", &jv);
+    TEST_ASSERT_FATAL(rc == 0);
+    JSON_VALUE_BOOL(&jv, b);
+    rc = json_encode_object_entry(&enc, "b", &jv);
+    TEST_ASSERT_FATAL(rc == 0);
+    JSON_VALUE_STRING(&jv, s);
+    rc = json_encode_object_entry(&enc, "s", &jv);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = json_encode_object_finish(&enc);
+    TEST_ASSERT_FATAL(rc == 0);
+}
+
+TEST_CASE(json_cbor_test_round_trip)
+{
+    static const struct {
+        unsigned int u;
+        int i;
+        bool b;
+        char *s;
+    } vals[] = {
+        { 0, 0, false, "" },
+        { 23, -1, true, "x" },
+        { 24, -24, false, "twenty-four characters.." },
+        { 65536, -65537, true, "abc" },
+        { UINT_MAX, INT_MIN, true, "the longest string which fits" },
+    };
+    struct json_cbor_test_buf tb;
+    int consuming;
+    int rc;
+    int i;
+
+    for (i = 0; i < sizeof vals / sizeof vals[0]; i++) {
+        json_cbor_test_util_encode(vals[i].u, vals[i].i, vals[i].b,
+                                   vals[i].s);
+
+        for (consuming = 0; consuming <= 1; consuming++) {
+            memset(json_cbor_test_s, 0xff, sizeof json_cbor_test_s);
+            rc = json_cbor_test_util_read(&tb, json_cbor_test_out,
+                                          json_cbor_test_out_len,
+                                          json_cbor_test_attrs, consuming);
+            TEST_ASSERT(rc == 0);
+            TEST_ASSERT(json_cbor_test_u == vals[i].u);
+            TEST_ASSERT(json_cbor_test_i == vals[i].i);
+            TEST_ASSERT(json_cbor_test_b == vals[i].b);
+            TEST_ASSERT(strcmp(json_cbor_test_s, vals[i].s) == 0);
+
+            /* All of the input is consumed, without byte-wise reads if the
+             * buffer can consume in bulk.
+             */
+            TEST_ASSERT(tb.jtb_off == json_cbor_test_out_len);
+            if (consuming) {
+                TEST_ASSERT(tb.jtb_next_calls == 0);
+            }
+        }
+    }
+}
+
+TEST_CASE(json_cbor_test_truncated)
+{
+    int len;
+    int rc;
+
+    json_cbor_test_util_encode(65536, -65537, true, "abc");
+
+    rc = json_cbor_test_util_read_both(json_cbor_test_out,
+                                       json_cbor_test_out_len,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == 0);
+
+    for (len = 0; len < json_cbor_test_out_len; len++) {
+        rc = json_cbor_test_util_read_both(json_cbor_test_out, len,
+                                           json_cbor_test_attrs);
+        TEST_ASSERT(rc != 0);
+    }
+}
+
+TEST_CASE(json_cbor_test_mistyped)
+{
+    /* {"u": "x"} */
+    static const uint8_t text_for_uint[] = {
+        0xa1, 0x61, 'u', 0x61, 'x'
+    };
+    /* {"s": 5} */
+    static const uint8_t uint_for_text[] = {
+        0xa1, 0x61, 's', 0x05
+    };
+    /* {"b": 1} */
+    static const uint8_t uint_for_bool[] = {
+        0xa1, 0x61, 'b', 0x01
+    };
+    /* {"i": true} */
+    static const uint8_t bool_for_int[] = {
+        0xa1, 0x61, 'i', 0xf5
+    };
+    /* {"s": <text too long for json_cbor_test_s>}; rejected on its head. */
+    static const uint8_t text_too_long[] = {
+        0xa1, 0x61, 's', 0x78, sizeof json_cbor_test_s
+    };
+    /* [] */
+    static const uint8_t array[] = {
+        0x80
+    };
+    /* {1: 1} */
+    static const uint8_t uint_key[] = {
+        0xa1, 0x01, 0x01
+    };
+    int rc;
+
+    rc = json_cbor_test_util_read_both(text_for_uint, sizeof text_for_uint,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_QNONSTRING);
+
+    rc = json_cbor_test_util_read_both(uint_for_text, sizeof uint_for_text,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_NONQSTRING);
+
+    rc = json_cbor_test_util_read_both(uint_for_bool, sizeof uint_for_bool,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_MISC);
+
+    rc = json_cbor_test_util_read_both(bool_for_int, sizeof bool_for_int,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_BADNUM);
+
+    rc = json_cbor_test_util_read_both(text_too_long, sizeof text_too_long,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_STRLONG);
+
+    rc = json_cbor_test_util_read_both(array, sizeof array,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_OBSTART);
+
+    rc = json_cbor_test_util_read_both(uint_key, sizeof uint_key,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_ATTRSTART);
+}
+
+TEST_CASE(json_cbor_test_unknown_key)
+{
+    /* {"zz": 1} */
+    static const uint8_t unknown[] = {
+        0xa1, 0x62, 'z', 'z', 0x01
+    };
+    /* {"x": [1, {"a": "bc"}, h'00', -1], "u": 7} */
+    static const uint8_t ignored[] = {
+        0xa2,
+        0x61, 'x',
+        0x84, 0x01, 0xa1, 0x61, 'a', 0x62, 'b', 'c', 0x41, 0x00, 0x20,
+        0x61, 'u', 0x07
+    };
+    /* {_ "x": [[[[[[0]]]]]], "u": 7} */
+    static const uint8_t too_deep[] = {
+        0xbf,
+        0x61, 'x',
+        0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0x00,
+        0x61, 'u', 0x07,
+        0xff
+    };
+    int rc;
+
+    rc = json_cbor_test_util_read_both(unknown, sizeof unknown,
+                                       json_cbor_test_attrs);
+    TEST_ASSERT(rc == JSON_ERR_BADATTR);
+
+    /* The value of an ignored key is skipped, whatever its type. */
+    json_cbor_test_u = 0;
+    rc = json_cbor_test_util_read_both(ignored, sizeof ignored,
+                                       json_cbor_test_ignore_attrs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(json_cbor_test_u == 7);
+
+    rc = json_cbor_test_util_read_both(too_deep, sizeof too_deep,
+                                       json_cbor_test_ignore_attrs);
+    TEST_ASSERT(rc != 0);
+}
+
+TEST_SUITE(json_cbor_test_suite)
+{
+    json_cbor_test_round_trip();
+    json_cbor_test_truncated();
+    json_cbor_test_mistyped();
+    json_cbor_test_unknown_key();
+}
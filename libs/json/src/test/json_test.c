@@ -17,10 +17,29 @@
  * under the License.
  */
 
-#ifndef H_CRC32_
-#define H_CRC32_
+#include <assert.h>
+#include <stddef.h>
+#include "testutil/testutil.h"
+#include "json_test_priv.h"
 
-uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+int
+json_test_all(void)
+{
+    json_cbor_test_suite();
+    return tu_case_failed;
+}
 
-#endif
+#ifdef PKG_TEST
+
+int
+main(int argc, char **argv)
+{
+    tu_config.tc_print_results = 1;
+    tu_init();
+
+    json_test_all();
 
+    return tu_any_failed;
+}
+
+#endif
@@ -17,9 +17,9 @@
  * under the License.
  */
 
-#ifndef H_CRC32_
-#define H_CRC32_
+#ifndef __JSON_TEST_PRIV_
+#define __JSON_TEST_PRIV_
 
-uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+int json_cbor_test_suite(void);
 
 #endif
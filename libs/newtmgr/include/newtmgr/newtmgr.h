@@ -31,6 +31,7 @@
 #define NMGR_GROUP_ID_IMAGE     (1)
 #define NMGR_GROUP_ID_STATS     (2) 
 #define NMGR_GROUP_ID_CONFIG    (3)
+#define NMGR_GROUP_ID_FS        (4)
 #define NMGR_GROUP_ID_PERUSER   (64)
 
 #define NMGR_OP_READ            (0)
@@ -38,6 +39,13 @@
 #define NMGR_OP_WRITE           (2)
 #define NMGR_OP_WRITE_RSP       (3)
 
+/*
+ * Header flags.  A request with NMGR_F_CBOR set carries a CBOR map instead
+ * of a JSON object, and gets its response encoded the same way; the flag
+ * is echoed in the response header.
+ */
+#define NMGR_F_CBOR             (0x01)
+
 
 /** 
  * Newtmgr JSON error codes
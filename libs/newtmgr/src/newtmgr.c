@@ -316,6 +316,22 @@ err:
     return (rc);
 }
 
+static int 
+nmgr_jbuf_read(struct json_buffer *jb, char *buf, int size)
+{
+    struct nmgr_jbuf *njb;
+    int read;
+
+    njb = (struct nmgr_jbuf *) jb;
+
+    read = nmgr_jbuf_readn(jb, buf, size);
+    if (read > 0) {
+        njb->njb_off += read;
+    }
+
+    return (read);
+}
+
 int 
 nmgr_jbuf_write(void *arg, char *data, int len)
 {
@@ -343,6 +359,7 @@ nmgr_jbuf_init(struct nmgr_jbuf *njb)
     njb->njb_buf.jb_read_next = nmgr_jbuf_read_next;
     njb->njb_buf.jb_read_prev = nmgr_jbuf_read_prev;
     njb->njb_buf.jb_readn = nmgr_jbuf_readn;
+    njb->njb_buf.jb_read = nmgr_jbuf_read;
     njb->njb_enc.je_write = nmgr_jbuf_write;
     njb->njb_enc.je_arg = njb; 
 
@@ -433,20 +450,22 @@ nmgr_handle_req(struct nmgr_transport *nt, struct os_mbuf *req)
             goto err;
         }
         rsp_hdr->nh_len = 0;
-        rsp_hdr->nh_flags = 0;
+        rsp_hdr->nh_flags = hdr.nh_flags & NMGR_F_CBOR;
         rsp_hdr->nh_op = (hdr.nh_op == NMGR_OP_READ) ? NMGR_OP_READ_RSP : 
             NMGR_OP_WRITE_RSP;
         rsp_hdr->nh_group = hdr.nh_group;
         rsp_hdr->nh_id = hdr.nh_id;
 
         /*
-         * Setup state for JSON encoding.
+         * Setup state for JSON (or CBOR) encoding.
          */
         rc = nmgr_jbuf_setibuf(&nmgr_task_jbuf, req, off + sizeof(hdr),
           hdr.nh_len);
         if (rc) {
             goto err;
         }
+        nmgr_task_jbuf.njb_buf.jb_cbor = !!(hdr.nh_flags & NMGR_F_CBOR);
+        nmgr_task_jbuf.njb_enc.je_cbor = nmgr_task_jbuf.njb_buf.jb_cbor;
         rc = nmgr_jbuf_setobuf(&nmgr_task_jbuf, rsp_hdr, rsp);
         if (rc) {
             goto err;
@@ -0,0 +1,37 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __UTIL_CRC32_H
+#define __UTIL_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A hardware CRC-32 implementation.  Takes and returns the same values as
+ * crc32_sw(); a CRC unit which works on whole words only should hand any
+ * leftover bytes to crc32_sw().
+ */
+typedef uint32_t crc32_func_t(uint32_t crc, const void *buf, size_t len);
+
+void crc32_set_hw(crc32_func_t *func);
+uint32_t crc32_sw(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif /* __UTIL_CRC32_H */
@@ -0,0 +1,125 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "testutil/testutil.h"
+#include "util/crc32.h"
+
+static uint8_t crc32_test_buf[256];
+static int crc32_test_hw_calls;
+
+/* Bit at a time; slow, but obviously correct. */
+static uint32_t
+crc32_test_ref(uint32_t crc, const uint8_t *p, size_t len)
+{
+    int i;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t
+crc32_test_hw(uint32_t crc, const void *buf, size_t len)
+{
+    crc32_test_hw_calls++;
+    return crc32_sw(crc, buf, len);
+}
+
+TEST_CASE(crc32_test_vectors)
+{
+    TEST_ASSERT(crc32(0, "", 0) == 0);
+    TEST_ASSERT(crc32(0, "123456789", 9) == 0xcbf43926);
+    TEST_ASSERT(crc32(0, "The quick brown fox jumps over the lazy dog", 43) ==
+                0x414fa339);
+}
+
+TEST_CASE(crc32_test_align)
+{
+    uint32_t expected;
+    uint32_t crc;
+    int start;
+    int len;
+    int i;
+
+    for (i = 0; i < sizeof crc32_test_buf; i++) {
+        crc32_test_buf[i] = i * 7 + 3;
+    }
+
+    /* Every alignment and tail length the word loop can see. */
+    for (start = 0; start < 8; start++) {
+        for (len = 0; len <= sizeof crc32_test_buf - start; len++) {
+            expected = crc32_test_ref(0, crc32_test_buf + start, len);
+            crc = crc32(0, crc32_test_buf + start, len);
+            TEST_ASSERT_FATAL(crc == expected,
+                              "start=%d len=%d crc=0x%08x expected=0x%08x",
+                              start, len, crc, expected);
+        }
+    }
+}
+
+TEST_CASE(crc32_test_piecewise)
+{
+    uint32_t expected;
+    uint32_t crc;
+    int split;
+
+    expected = crc32(0, crc32_test_buf, sizeof crc32_test_buf);
+    for (split = 0; split <= sizeof crc32_test_buf; split++) {
+        crc = crc32(0, crc32_test_buf, split);
+        crc = crc32(crc, crc32_test_buf + split,
+                    sizeof crc32_test_buf - split);
+        TEST_ASSERT(crc == expected);
+    }
+}
+
+TEST_CASE(crc32_test_hw_hook)
+{
+    uint32_t crc;
+
+    crc32_test_hw_calls = 0;
+    crc32_set_hw(crc32_test_hw);
+    crc = crc32(0, "123456789", 9);
+    TEST_ASSERT(crc == 0xcbf43926);
+    TEST_ASSERT(crc32_test_hw_calls == 1);
+
+    /* crc32_sw() never uses the hook. */
+    crc = crc32_sw(0, "123456789", 9);
+    TEST_ASSERT(crc == 0xcbf43926);
+    TEST_ASSERT(crc32_test_hw_calls == 1);
+
+    crc32_set_hw(NULL);
+    crc = crc32(0, "123456789", 9);
+    TEST_ASSERT(crc == 0xcbf43926);
+    TEST_ASSERT(crc32_test_hw_calls == 1);
+}
+
+TEST_SUITE(crc32_test_suite)
+{
+    crc32_test_vectors();
+    crc32_test_align();
+    crc32_test_piecewise();
+    crc32_test_hw_hook();
+}
@@ -26,6 +26,7 @@ int
 util_test_all(void)
 {
     cbmem_test_suite();
+    crc32_test_suite();
     return tu_case_failed;
 }
 
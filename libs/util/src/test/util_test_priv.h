@@ -21,5 +21,6 @@
 #define __UTIL_TEST_PRIV_
 
 int cbmem_test_suite(void);
+int crc32_test_suite(void);
 
 #endif
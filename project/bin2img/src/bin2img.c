@@ -26,7 +26,7 @@
 #include <sys/stat.h>
 #include "bootutil/image.h"
 #include "imgmgr/imgmgr.h"
-#include "crc32.h"
+#include "util/crc32.h"
 
 #if !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
 #error "Machine must be little endian"
@@ -0,0 +1,410 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Measures how long the boot loader takes to swap the two image slots on the
+ * native flash simulator, for a range of image sizes, and reports the results
+ * as a single JSON object on stdout.  The flash layout is the one the boot
+ * project derives from the native BSP's flash map.
+ *
+ * Each size is measured twice: once with two unrelated images, and once with
+ * images whose bodies are identical (as with a rebuild that only changes the
+ * version number), where unchanged sectors need not be rewritten.
+ *
+ * All durations are in microseconds.  With a flash timing model (-m),
+ * durations include the modeled device time.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/bootutil_priv.h"
+#include <os/os.h>
+#include <fs/fs.h>
+#include <fs/fsutil.h>
+#include <nffs/nffs.h>
+#include <hal/hal_flash.h>
+#include <hal/flash_map.h>
+#include <bootutil/image.h>
+#include <bootutil/loader.h>
+#include <json/json.h>
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#endif
+
+#define BOOTBENCH_MAX_AREAS         32
+#define BOOTBENCH_MAX_SIZES         16
+#define BOOTBENCH_HEADER_SIZE       32
+
+static const char *progname;
+
+static struct nffs_area_desc bootbench_areas[BOOTBENCH_MAX_AREAS + 1];
+static uint8_t bootbench_img_areas[BOOTBENCH_MAX_AREAS];
+static uint8_t bootbench_slot_areas[2];
+static struct boot_req bootbench_req;
+
+/** The nffs areas; these follow the image areas in bootbench_areas. */
+static struct nffs_area_desc *bootbench_fs_areas;
+
+/** Usable bytes in each image slot. */
+static uint32_t bootbench_slot_size;
+
+static uint32_t bootbench_sizes[BOOTBENCH_MAX_SIZES];
+static int bootbench_num_sizes;
+
+static struct json_encoder bootbench_enc;
+static uint8_t bootbench_buf[4096];
+
+static void usage(int rc);
+
+static uint32_t
+bootbench_now_us(void)
+{
+    const struct native_flash_model *model;
+    struct timespec ts;
+    uint64_t usecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    usecs = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+
+    /* In cputime mode the modeled time has already elapsed on the host. */
+    model = native_flash_model_get();
+    if (model != NULL && model->nfm_clock == NATIVE_FLASH_CLOCK_VIRTUAL) {
+        usecs += native_flash_time_ns() / 1000;
+    }
+
+    return usecs;
+}
+
+static int
+bootbench_json_write(void *arg, char *data, int len)
+{
+    fwrite(data, 1, len, stdout);
+    return 0;
+}
+
+static void
+bootbench_json_uint(char *key, uint64_t val)
+{
+    struct json_value jv;
+
+    JSON_VALUE_UINT(&jv, val);
+    json_encode_object_entry(&bootbench_enc, key, &jv);
+}
+
+static void
+bootbench_json_start(char *key)
+{
+    json_encode_object_key(&bootbench_enc, key);
+    json_encode_object_start(&bootbench_enc);
+}
+
+/** Sums the erase counts of all sectors. */
+static uint32_t
+bootbench_erase_cnt(void)
+{
+    struct native_flash_sector_stats nss;
+    uint32_t total;
+    int i;
+
+    total = 0;
+    for (i = 0; native_flash_sector_stats(i, &nss) == 0; i++) {
+        total += nss.nss_erases;
+    }
+    return total;
+}
+
+/**
+ * Builds the boot loader's view of flash the same way the boot project does:
+ * both image slots, then the scratch area, then the nffs areas.
+ */
+static void
+bootbench_build_layout(void)
+{
+    int total;
+    int cnt;
+    int rc;
+
+    cnt = BOOTBENCH_MAX_AREAS / 2 - 3;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_IMAGE_0, &cnt, bootbench_areas);
+    assert(rc == 0);
+    bootbench_slot_areas[0] = 0;
+    total = cnt;
+
+    cnt = BOOTBENCH_MAX_AREAS / 2 - 3;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_IMAGE_1, &cnt,
+                                 bootbench_areas + total);
+    assert(rc == 0);
+    bootbench_slot_areas[1] = total;
+    total += cnt;
+
+    cnt = 1;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_IMAGE_SCRATCH, &cnt,
+                                 bootbench_areas + total);
+    assert(rc == 0);
+    bootbench_req.br_scratch_area_idx = total;
+    total++;
+
+    bootbench_req.br_num_image_areas = total;
+    for (cnt = 0; cnt < total; cnt++) {
+        bootbench_img_areas[cnt] = cnt;
+    }
+
+    bootbench_fs_areas = bootbench_areas + total;
+    cnt = BOOTBENCH_MAX_AREAS - total;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_NFFS, &cnt, bootbench_fs_areas);
+    assert(rc == 0);
+
+    bootbench_slot_size = 0;
+    for (cnt = 0; cnt < bootbench_slot_areas[1]; cnt++) {
+        bootbench_slot_size += bootbench_areas[cnt].nad_length;
+    }
+
+    bootbench_req.br_area_descs = bootbench_areas;
+    bootbench_req.br_image_areas = bootbench_img_areas;
+    bootbench_req.br_slot_areas = bootbench_slot_areas;
+}
+
+static void
+bootbench_write_image(int slot, uint32_t img_size, uint32_t seed,
+                      const struct image_version *ver)
+{
+    const struct nffs_area_desc *area;
+    struct image_header hdr;
+    uint32_t addr;
+    uint32_t off;
+    int chunk_sz;
+    int rc;
+    int i;
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.ih_magic = IMAGE_MAGIC;
+    hdr.ih_hdr_size = BOOTBENCH_HEADER_SIZE;
+    hdr.ih_img_size = img_size;
+    hdr.ih_ver = *ver;
+
+    area = bootbench_areas + bootbench_slot_areas[slot];
+    addr = area->nad_offset;
+
+    rc = hal_flash_write(area->nad_flash_id, addr, &hdr, sizeof hdr);
+    assert(rc == 0);
+    addr += hdr.ih_hdr_size;
+
+    for (off = 0; off < img_size; off += chunk_sz) {
+        chunk_sz = img_size - off;
+        if (chunk_sz > sizeof bootbench_buf) {
+            chunk_sz = sizeof bootbench_buf;
+        }
+        for (i = 0; i < chunk_sz; i++) {
+            seed = seed * 1103515245 + 12345;
+            bootbench_buf[i] = seed >> 16;
+        }
+        rc = hal_flash_write(area->nad_flash_id, addr + off, bootbench_buf,
+                             chunk_sz);
+        assert(rc == 0);
+    }
+}
+
+/**
+ * Erases both slots, writes an image of the specified size to each, marks the
+ * second slot's image for testing, and times the resulting swap.
+ */
+static void
+bootbench_swap(uint32_t img_size, int same_body)
+{
+    static const struct image_version ver0 = { 1, 0, 0, 0 };
+    static const struct image_version ver1 = { 1, 0, 0, 1 };
+    struct boot_rsp rsp;
+    uint32_t erases;
+    uint32_t start;
+    uint32_t usecs;
+    char key[16];
+    int rc;
+    int i;
+
+    for (i = 0; i < bootbench_req.br_num_image_areas; i++) {
+        rc = hal_flash_erase(bootbench_areas[i].nad_flash_id,
+                             bootbench_areas[i].nad_offset,
+                             bootbench_areas[i].nad_length);
+        assert(rc == 0);
+    }
+
+    rc = nffs_format(bootbench_fs_areas);
+    assert(rc == 0);
+    rc = fs_mkdir("/boot");
+    assert(rc == 0);
+
+    bootbench_write_image(0, img_size, 1, &ver0);
+    bootbench_write_image(1, img_size, same_body ? 1 : 2, &ver1);
+
+    rc = fsutil_write_file(BOOT_PATH_TEST, &ver1, sizeof ver1);
+    assert(rc == 0);
+
+    erases = bootbench_erase_cnt();
+    start = bootbench_now_us();
+    rc = boot_go(&bootbench_req, &rsp);
+    usecs = bootbench_now_us() - start;
+    erases = bootbench_erase_cnt() - erases;
+
+    assert(rc == 0);
+    assert(memcmp(&rsp.br_hdr->ih_ver, &ver1, sizeof ver1) == 0);
+
+    snprintf(key, sizeof key, "%lu", (unsigned long)img_size);
+    bootbench_json_start(key);
+    bootbench_json_uint("swap_us", usecs);
+    bootbench_json_uint("erases", erases);
+    json_encode_object_finish(&bootbench_enc);
+}
+
+static void
+bootbench_config(void)
+{
+    const struct native_flash_model *model;
+    char key[16];
+    int i;
+
+    bootbench_json_start("config");
+    bootbench_json_uint("slot_bytes", bootbench_slot_size);
+    bootbench_json_start("areas");
+    for (i = 0; i < bootbench_req.br_num_image_areas; i++) {
+        snprintf(key, sizeof key, "0x%lx",
+                 (unsigned long)bootbench_areas[i].nad_offset);
+        bootbench_json_uint(key, bootbench_areas[i].nad_length);
+    }
+    json_encode_object_finish(&bootbench_enc);
+
+    model = native_flash_model_get();
+    if (model != NULL) {
+        bootbench_json_start("flash_model");
+        bootbench_json_uint("write_ns", model->nfm_write_ns);
+        bootbench_json_uint("erase_us", model->nfm_erase_us);
+        bootbench_json_uint("read_ns", model->nfm_read_ns);
+        json_encode_object_finish(&bootbench_enc);
+    }
+    json_encode_object_finish(&bootbench_enc);
+}
+
+static void
+usage(int rc)
+{
+    printf("%s [-s image_size]... [-f flash_file]\n"
+           "    [-m write_ns,erase_us,read_ns[,cpu]]\n",
+           progname);
+    printf("  Measures image swap time on simulated flash; prints JSON\n");
+    printf("   -s: add an image size to measure "
+           "(default: 4kB to a full slot)\n");
+    printf("   -f: flash_file is the name of the flash image file\n");
+    printf("   -m: flash timing model; see the native mcu's -m option\n");
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t size;
+    int rc;
+    int ch;
+    int i;
+
+    progname = argv[0];
+
+    while ((ch = getopt(argc, argv, "f:m:s:")) != -1) {
+        switch (ch) {
+        case 'f':
+            native_flash_file = optarg;
+            break;
+        case 'm':
+            if (native_flash_model_parse(optarg) != 0) {
+                usage(1);
+            }
+            break;
+        case 's':
+            if (bootbench_num_sizes >= BOOTBENCH_MAX_SIZES) {
+                usage(1);
+            }
+            bootbench_sizes[bootbench_num_sizes++] =
+                strtoul(optarg, NULL, 0);
+            break;
+        case '?':
+        default:
+            usage(0);
+        }
+    }
+
+    os_init();
+
+    rc = hal_flash_init();
+    assert(rc == 0);
+
+    bootbench_build_layout();
+
+    if (bootbench_num_sizes == 0) {
+        for (size = 4 * 1024;
+             size + BOOTBENCH_HEADER_SIZE <= bootbench_slot_size / 2;
+             size *= 2) {
+
+            bootbench_sizes[bootbench_num_sizes++] = size;
+        }
+        bootbench_sizes[bootbench_num_sizes++] =
+            bootbench_slot_size - BOOTBENCH_HEADER_SIZE;
+    }
+    for (i = 0; i < bootbench_num_sizes; i++) {
+        if (bootbench_sizes[i] + BOOTBENCH_HEADER_SIZE > bootbench_slot_size) {
+            fprintf(stderr, "image size %lu exceeds slot size %lu\n",
+                    (unsigned long)bootbench_sizes[i],
+                    (unsigned long)bootbench_slot_size);
+            exit(1);
+        }
+    }
+
+    nffs_config.nc_num_inodes = 50;
+    nffs_config.nc_num_blocks = 50;
+
+    rc = nffs_init();
+    if (rc != 0) {
+        fprintf(stderr, "nffs_init() failed; rc=%d\n", rc);
+        exit(1);
+    }
+
+    bootbench_enc.je_write = bootbench_json_write;
+    bootbench_enc.je_arg = NULL;
+    json_encode_object_start(&bootbench_enc);
+
+    bootbench_config();
+
+    bootbench_json_start("swap");
+    for (i = 0; i < bootbench_num_sizes; i++) {
+        bootbench_swap(bootbench_sizes[i], 0);
+    }
+    json_encode_object_finish(&bootbench_enc);
+
+    bootbench_json_start("swap_same_body");
+    for (i = 0; i < bootbench_num_sizes; i++) {
+        bootbench_swap(bootbench_sizes[i], 1);
+    }
+    json_encode_object_finish(&bootbench_enc);
+
+    json_encode_object_finish(&bootbench_enc);
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Measures CRC-32 throughput for a range of buffer sizes and reports the
+ * results as a single JSON object on stdout (sim) or the console.  The
+ * slicing-by-8 implementation in libs/util is compared against the
+ * byte-at-a-time table lookup it replaced.
+ *
+ * Durations come from cputime, so the same project measures the host and the
+ * target MCUs alike.  Throughput is in kB/s (1024 bytes); durations are in
+ * microseconds.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <os/os.h>
+#include <hal/hal_cputime.h>
+#include <util/crc32.h>
+#include <json/json.h>
+#ifdef ARCH_sim
+#include <unistd.h>
+#else
+#include <console/console.h>
+#endif
+
+#define CRC32BENCH_MAX_SIZES        16
+#define CRC32BENCH_TASK_PRIO        1
+
+#ifdef ARCH_sim
+#define CRC32BENCH_MAX_BUF          (256 * 1024)
+#define CRC32BENCH_STACK_SIZE       OS_STACK_ALIGN(16384)
+#else
+#define CRC32BENCH_MAX_BUF          (16 * 1024)
+#define CRC32BENCH_STACK_SIZE       OS_STACK_ALIGN(1024)
+#endif
+
+typedef uint32_t crc32bench_fn(uint32_t crc, const void *buf, size_t len);
+
+#ifdef ARCH_sim
+static const char *progname;
+#endif
+
+static struct os_task crc32bench_task;
+static os_stack_t crc32bench_stack[CRC32BENCH_STACK_SIZE];
+
+static uint8_t crc32bench_buf[CRC32BENCH_MAX_BUF];
+static uint32_t crc32bench_bytewise_tab[256];
+
+static uint32_t crc32bench_sizes[CRC32BENCH_MAX_SIZES];
+static int crc32bench_num_sizes;
+
+/** Each measurement repeats the CRC until at least this much time passes. */
+static uint32_t crc32bench_min_us = 200000;
+
+static struct json_encoder crc32bench_enc;
+
+static int
+crc32bench_json_write(void *arg, char *data, int len)
+{
+#ifdef ARCH_sim
+    fwrite(data, 1, len, stdout);
+#else
+    console_write(data, len);
+#endif
+    return 0;
+}
+
+static void
+crc32bench_json_uint(char *key, uint64_t val)
+{
+    struct json_value jv;
+
+    JSON_VALUE_UINT(&jv, val);
+    json_encode_object_entry(&crc32bench_enc, key, &jv);
+}
+
+static void
+crc32bench_json_start(char *key)
+{
+    json_encode_object_key(&crc32bench_enc, key);
+    json_encode_object_start(&crc32bench_enc);
+}
+
+/** The byte-at-a-time implementation, as a baseline. */
+static uint32_t
+crc32bench_bytewise(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p;
+
+    p = buf;
+    crc = ~crc;
+    while (len--) {
+        crc = crc32bench_bytewise_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void
+crc32bench_init(void)
+{
+    uint32_t seed;
+    uint32_t c;
+    int i;
+    int j;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++) {
+            c = (c >> 1) ^ (c & 1 ? 0xedb88320 : 0);
+        }
+        crc32bench_bytewise_tab[i] = c;
+    }
+
+    seed = 1;
+    for (i = 0; i < sizeof crc32bench_buf; i++) {
+        seed = seed * 1103515245 + 12345;
+        crc32bench_buf[i] = seed >> 16;
+    }
+}
+
+static void
+crc32bench_run(const char *name, crc32bench_fn *fn)
+{
+    uint32_t start;
+    uint32_t usecs;
+    uint32_t iters;
+    uint32_t size;
+    uint32_t crc;
+    char key[16];
+    int i;
+
+    crc32bench_json_start((char *)name);
+    for (i = 0; i < crc32bench_num_sizes; i++) {
+        size = crc32bench_sizes[i];
+
+        /* Make sure each implementation computes the same thing. */
+        crc = fn(0, crc32bench_buf, size);
+        assert(crc == crc32bench_bytewise(0, crc32bench_buf, size));
+
+        iters = 0;
+        start = cputime_get32();
+        do {
+            crc = fn(crc, crc32bench_buf, size);
+            iters++;
+            usecs = cputime_ticks_to_usecs(cputime_get32() - start);
+        } while (usecs < crc32bench_min_us || usecs == 0);
+
+        snprintf(key, sizeof key, "%lu", (unsigned long)size);
+        crc32bench_json_start(key);
+        crc32bench_json_uint("iters", iters);
+        crc32bench_json_uint("us", usecs);
+        crc32bench_json_uint("kb_per_s",
+                             (uint64_t)size * iters * 1000000 / 1024 / usecs);
+        json_encode_object_finish(&crc32bench_enc);
+    }
+    json_encode_object_finish(&crc32bench_enc);
+}
+
+static void
+crc32bench_task_handler(void *arg)
+{
+    crc32bench_init();
+
+    crc32bench_enc.je_write = crc32bench_json_write;
+    crc32bench_enc.je_arg = NULL;
+    json_encode_object_start(&crc32bench_enc);
+
+    crc32bench_run("bytewise", crc32bench_bytewise);
+    crc32bench_run("crc32", crc32);
+
+    json_encode_object_finish(&crc32bench_enc);
+    crc32bench_json_write(NULL, "\n", 1);
+
+#ifdef ARCH_sim
+    fflush(stdout);
+    exit(0);
+#endif
+    while (1) {
+        os_time_delay(OS_TICKS_PER_SEC);
+    }
+}
+
+#ifdef ARCH_sim
+static void
+usage(int rc)
+{
+    printf("%s [-s size]... [-t min_ms]\n", progname);
+    printf("  Measures CRC-32 throughput; prints JSON\n");
+    printf("   -s: add a buffer size to measure "
+           "(default: 1kB to %dkB)\n", CRC32BENCH_MAX_BUF / 1024);
+    printf("   -t: minimum duration of each measurement, in ms "
+           "(default: %lu)\n", (unsigned long)crc32bench_min_us / 1000);
+    exit(rc);
+}
+
+static void
+crc32bench_parse_args(int argc, char **argv)
+{
+    uint32_t size;
+    int ch;
+
+    progname = argv[0];
+
+    while ((ch = getopt(argc, argv, "s:t:")) != -1) {
+        switch (ch) {
+        case 's':
+            if (crc32bench_num_sizes >= CRC32BENCH_MAX_SIZES) {
+                usage(1);
+            }
+            size = strtoul(optarg, NULL, 0);
+            if (size == 0 || size > CRC32BENCH_MAX_BUF) {
+                usage(1);
+            }
+            crc32bench_sizes[crc32bench_num_sizes++] = size;
+            break;
+        case 't':
+            crc32bench_min_us = strtoul(optarg, NULL, 0) * 1000;
+            break;
+        case '?':
+        default:
+            usage(0);
+        }
+    }
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+    uint32_t size;
+    int rc;
+
+#ifdef ARCH_sim
+    crc32bench_parse_args(argc, argv);
+#endif
+
+    if (crc32bench_num_sizes == 0) {
+        for (size = 1024; size <= CRC32BENCH_MAX_BUF; size *= 4) {
+            crc32bench_sizes[crc32bench_num_sizes++] = size;
+        }
+    }
+
+    os_init();
+
+    /* Measurements are timed with cputime; 1 MHz is its lowest rate. */
+    rc = cputime_init(1000000);
+    assert(rc == 0);
+
+#ifndef ARCH_sim
+    rc = console_init(NULL);
+    assert(rc == 0);
+#endif
+
+    os_task_init(&crc32bench_task, "crc32bench", crc32bench_task_handler,
+                 NULL, CRC32BENCH_TASK_PRIO, OS_WAIT_FOREVER,
+                 crc32bench_stack, CRC32BENCH_STACK_SIZE);
+
+    os_start();
+
+    /* os_start() should never return. */
+    assert(0);
+
+    return rc;
+}
@@ -101,7 +101,7 @@ process_inode_entry(struct nffs_inode_entry *inode_entry, int indent)
     print_inode_entry(inode_entry, indent);
 
     if (nffs_hash_id_is_dir(inode_entry->nie_hash_entry.nhe_id)) {
-        SLIST_FOREACH(child, &inode_entry->nie_child_list, nie_sibling_next) {
+        NFFS_INODE_FOREACH_CHILD(inode_entry, child) {
             process_inode_entry(child, indent + 2);
         }
     }
@@ -135,8 +135,9 @@ print_nffs_block(int idx, uint32_t off)
     rc = nffs_flash_read(idx, off, &ndb, sizeof(ndb));
     assert(rc == 0);
 
-    printf("      %x-%d block %u/%u belongs to %u\n",
-      off, ndb.ndb_data_len, ndb.ndb_id, ndb.ndb_seq, ndb.ndb_inode_id);
+    printf("      %x-%d block %u/%u belongs to %u%s\n",
+      off, ndb.ndb_data_len, ndb.ndb_id, ndb.ndb_seq, ndb.ndb_inode_id,
+      ndb.ndb_magic == NFFS_BLOCK_MAGIC_LZ ? " (compressed)" : "");
     return sizeof(ndb) + ndb.ndb_data_len;
 }
 
@@ -154,6 +155,7 @@ print_nffs_object(int idx, uint32_t off)
         return print_nffs_inode(idx, off);
 
     case NFFS_BLOCK_MAGIC:
+    case NFFS_BLOCK_MAGIC_LZ:
         return print_nffs_block(idx, off);
         break;
 
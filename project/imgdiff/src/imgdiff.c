@@ -0,0 +1,301 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Generates a delta (see bootutil/image_delta.h) which turns one image into
+ * another.  Every run of at least IMGDIFF_MIN_MATCH bytes of the new image
+ * which also occurs in the base image becomes a COPY; everything else is
+ * sent as INSERT data.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bootutil/image.h"
+#include "bootutil/image_delta.h"
+
+#if !defined(__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#error "Machine must be little endian"
+#endif
+
+#define IMGDIFF_MIN_MATCH           12
+#define IMGDIFF_HASH_LEN            8
+#define IMGDIFF_HASH_BITS           16
+#define IMGDIFF_MAX_CHAIN           64
+
+static uint8_t *base;
+static uint32_t base_len;
+static uint8_t *img;
+static uint32_t img_len;
+
+/* Chains of base image positions with the same hash; -1 terminated. */
+static int32_t hash_head[1 << IMGDIFF_HASH_BITS];
+static int32_t *hash_next;
+
+static uint8_t *delta;
+static uint32_t delta_len;
+
+static void
+print_usage(FILE *stream)
+{
+    fprintf(stream,
+            "usage: imgdiff <base-filename> <new-filename> <delta-filename>\n");
+    fprintf(stream, "\n");
+    fprintf(stream, "both input files must be images produced by bin2img\n");
+}
+
+static uint8_t *
+read_image(const char *filename, uint32_t *out_len)
+{
+    struct image_header *hdr;
+    uint8_t *buf;
+    FILE *fp;
+    long len;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "* error: could not open %s (%s)\n", filename,
+                strerror(errno));
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    buf = malloc(len > 0 ? len : 1);
+    assert(buf != NULL);
+    if (len < sizeof *hdr || fread(buf, len, 1, fp) != 1) {
+        fprintf(stderr, "* error: file read error (file=%s)\n", filename);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    hdr = (struct image_header *)buf;
+    if (hdr->ih_magic != IMAGE_MAGIC ||
+        hdr->ih_hdr_size + hdr->ih_img_size > len) {
+
+        fprintf(stderr, "* error: not an image (file=%s)\n", filename);
+        return NULL;
+    }
+
+    *out_len = hdr->ih_hdr_size + hdr->ih_img_size;
+    return buf;
+}
+
+static uint32_t
+hash(const uint8_t *p)
+{
+    uint32_t h;
+    int i;
+
+    h = 0;
+    for (i = 0; i < IMGDIFF_HASH_LEN; i++) {
+        h = h * 31 + p[i];
+    }
+    return (h * 2654435761u) >> (32 - IMGDIFF_HASH_BITS);
+}
+
+static void
+index_base(void)
+{
+    uint32_t h;
+    uint32_t i;
+
+    memset(hash_head, 0xff, sizeof hash_head);
+    hash_next = malloc((base_len + 1) * sizeof *hash_next);
+    assert(hash_next != NULL);
+
+    for (i = 0; i + IMGDIFF_HASH_LEN <= base_len; i++) {
+        h = hash(base + i);
+        hash_next[i] = hash_head[h];
+        hash_head[h] = i;
+    }
+}
+
+static uint32_t
+match_len(uint32_t src_off, uint32_t dst_off)
+{
+    uint32_t len;
+
+    len = 0;
+    while (src_off + len < base_len && dst_off + len < img_len &&
+           base[src_off + len] == img[dst_off + len]) {
+
+        len++;
+    }
+    return len;
+}
+
+/**
+ * Finds the longest run of the base image matching the new image at dst_off.
+ * The position following the previous match is tried first, as unchanged
+ * code tends to continue where the last match ended.
+ */
+static uint32_t
+find_match(uint32_t dst_off, uint32_t hint, uint32_t *out_src)
+{
+    uint32_t best;
+    uint32_t len;
+    int32_t pos;
+    int chain;
+
+    best = 0;
+    if (hint < base_len) {
+        best = match_len(hint, dst_off);
+        *out_src = hint;
+    }
+
+    if (dst_off + IMGDIFF_HASH_LEN > img_len) {
+        return best;
+    }
+
+    pos = hash_head[hash(img + dst_off)];
+    for (chain = 0; pos != -1 && chain < IMGDIFF_MAX_CHAIN; chain++) {
+        len = match_len(pos, dst_off);
+        if (len > best) {
+            best = len;
+            *out_src = pos;
+        }
+        pos = hash_next[pos];
+    }
+
+    return best;
+}
+
+static void
+put_byte(uint8_t b)
+{
+    delta[delta_len++] = b;
+}
+
+static void
+put_varint(uint32_t val)
+{
+    do {
+        put_byte((val & 0x7f) | (val > 0x7f ? 0x80 : 0));
+        val >>= 7;
+    } while (val != 0);
+}
+
+static void
+put_insert(uint32_t off, uint32_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    put_byte(IMAGE_DELTA_OP_INSERT);
+    put_varint(len);
+    memcpy(delta + delta_len, img + off, len);
+    delta_len += len;
+}
+
+static void
+put_copy(uint32_t src_off, uint32_t len)
+{
+    put_byte(IMAGE_DELTA_OP_COPY);
+    put_varint(src_off);
+    put_varint(len);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct image_delta_hdr dhdr;
+    uint32_t lit_start;
+    uint32_t src_off;
+    uint32_t hint;
+    uint32_t off;
+    uint32_t len;
+    FILE *fpout;
+    int rc;
+
+    if (argc < 4) {
+        print_usage(stderr);
+        return 1;
+    }
+
+    base = read_image(argv[1], &base_len);
+    if (base == NULL) {
+        print_usage(stderr);
+        return 1;
+    }
+    img = read_image(argv[2], &img_len);
+    if (img == NULL) {
+        print_usage(stderr);
+        return 1;
+    }
+
+    /* Worst case: the whole image as INSERTs, plus one command header per
+     * byte of the input.
+     */
+    delta = malloc(sizeof dhdr + img_len * 2 + 16);
+    assert(delta != NULL);
+    delta_len = sizeof dhdr;
+
+    index_base();
+
+    hint = UINT32_MAX;
+    lit_start = 0;
+    off = 0;
+    while (off < img_len) {
+        len = find_match(off, hint, &src_off);
+        if (len < IMGDIFF_MIN_MATCH) {
+            off++;
+            hint = UINT32_MAX;
+            continue;
+        }
+
+        put_insert(lit_start, off - lit_start);
+        put_copy(src_off, len);
+        off += len;
+        lit_start = off;
+        hint = src_off + len;
+    }
+    put_insert(lit_start, img_len - lit_start);
+
+    dhdr.idh_magic = IMAGE_DELTA_MAGIC;
+    dhdr.idh_base_crc32 = ((struct image_header *)base)->ih_crc32;
+    dhdr.idh_base_size = base_len;
+    dhdr.idh_new_size = img_len;
+    memcpy(delta, &dhdr, sizeof dhdr);
+
+    fpout = fopen(argv[3], "wb");
+    if (fpout == NULL) {
+        fprintf(stderr, "* error: could not open output file %s\n", argv[3]);
+        print_usage(stderr);
+        return 1;
+    }
+    rc = fwrite(delta, delta_len, 1, fpout);
+    if (rc != 1) {
+        fprintf(stderr, "* error: file write error (file=%s)\n", argv[3]);
+        print_usage(stderr);
+        return 1;
+    }
+    fclose(fpout);
+
+    printf("%s: %lu bytes; delta is %lu bytes\n", argv[2],
+           (unsigned long)img_len, (unsigned long)delta_len);
+
+    return 0;
+}
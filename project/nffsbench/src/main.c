@@ -0,0 +1,828 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Measures nffs performance on the native flash simulator and reports the
+ * results as a single JSON object on stdout.  Runs against the same flash
+ * layout and configuration can be compared from release to release.
+ *
+ * All durations are in microseconds, throughputs in bytes per second.  Write
+ * amplification is the number of bytes nffs wrote to flash (including
+ * garbage collection and metadata) per 100 bytes of user data.
+ *
+ * With a flash timing model (-m), durations include the modeled device time,
+ * so results reflect the flash part rather than the host's memory speed.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/nffs_priv.h"
+#include "../src/crc16.h"
+#include <os/os.h>
+#include <fs/fs.h>
+#include <nffs/nffs.h>
+#include <hal/hal_flash.h>
+#include <hal/hal_flash_int.h>
+#include <hal/flash_map.h>
+#include <json/json.h>
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#endif
+
+#define NFFSBENCH_MAX_AREAS         16
+#define NFFSBENCH_MAX_SAMPLES       4096
+#define NFFSBENCH_MAX_CHUNK         4096
+#define NFFSBENCH_SEQ_MAX           (256 * 1024)
+#define NFFSBENCH_RECORD_SZ         64
+#define NFFSBENCH_CHURN_FILES       4   /* Default nc_num_files. */
+#define NFFSBENCH_MOUNT_REPEAT      3
+#define NFFSBENCH_CRC_BYTES         (4 * 1024 * 1024)
+
+static const char *progname;
+
+static struct nffs_area_desc nffsbench_areas[NFFSBENCH_MAX_AREAS + 1];
+static int nffsbench_num_areas;
+
+/** Usable bytes; i.e., all areas except the largest, which becomes scratch. */
+static uint32_t nffsbench_capacity;
+
+static int nffsbench_chunk_sz = 256;
+
+static struct json_encoder nffsbench_enc;
+static uint32_t nffsbench_samples[NFFSBENCH_MAX_SAMPLES];
+static uint8_t nffsbench_data[NFFSBENCH_MAX_CHUNK];
+static uint8_t nffsbench_buf[NFFSBENCH_MAX_CHUNK];
+
+static void usage(int rc);
+
+static uint32_t
+nffsbench_now_us(void)
+{
+    const struct native_flash_model *model;
+    struct timespec ts;
+    uint64_t usecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    usecs = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+
+    /* In cputime mode the modeled time has already elapsed on the host. */
+    model = native_flash_model_get();
+    if (model != NULL && model->nfm_clock == NATIVE_FLASH_CLOCK_VIRTUAL) {
+        usecs += native_flash_time_ns() / 1000;
+    }
+
+    return usecs;
+}
+
+static int
+nffsbench_json_write(void *arg, char *data, int len)
+{
+    fwrite(data, 1, len, stdout);
+    return 0;
+}
+
+static void
+nffsbench_json_uint(char *key, uint64_t val)
+{
+    struct json_value jv;
+
+    JSON_VALUE_UINT(&jv, val);
+    json_encode_object_entry(&nffsbench_enc, key, &jv);
+}
+
+static void
+nffsbench_json_start(char *key)
+{
+    json_encode_object_key(&nffsbench_enc, key);
+    json_encode_object_start(&nffsbench_enc);
+}
+
+/** Bytes per second, given a byte count and a duration in microseconds. */
+static uint32_t
+nffsbench_rate(uint32_t bytes, uint32_t usecs)
+{
+    if (usecs == 0) {
+        usecs = 1;
+    }
+    return (uint64_t)bytes * 1000000 / usecs;
+}
+
+static void
+nffsbench_json_wamp(uint32_t user_bytes, uint32_t flash_bytes)
+{
+    nffsbench_json_uint("user_bytes", user_bytes);
+    nffsbench_json_uint("flash_bytes", flash_bytes);
+    if (user_bytes != 0) {
+        nffsbench_json_uint("wamp_pct",
+                            (uint64_t)flash_bytes * 100 / user_bytes);
+    }
+}
+
+static int
+nffsbench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t ua;
+    uint32_t ub;
+
+    ua = *(const uint32_t *)a;
+    ub = *(const uint32_t *)b;
+    if (ua < ub) {
+        return -1;
+    }
+    return ua > ub;
+}
+
+/**
+ * Encodes the distribution of the first num_samples entries of the sample
+ * buffer as an object with the given key.  The samples get sorted.
+ */
+static void
+nffsbench_json_dist(char *key, int num_samples)
+{
+    uint64_t sum;
+    int i;
+
+    nffsbench_json_start(key);
+    nffsbench_json_uint("n", num_samples);
+    if (num_samples > 0) {
+        qsort(nffsbench_samples, num_samples, sizeof nffsbench_samples[0],
+              nffsbench_cmp_u32);
+        sum = 0;
+        for (i = 0; i < num_samples; i++) {
+            sum += nffsbench_samples[i];
+        }
+        nffsbench_json_uint("mean", sum / num_samples);
+        nffsbench_json_uint("p50", nffsbench_samples[(num_samples - 1) / 2]);
+        nffsbench_json_uint("p90",
+                            nffsbench_samples[(num_samples - 1) * 90 / 100]);
+        nffsbench_json_uint("p99",
+                            nffsbench_samples[(num_samples - 1) * 99 / 100]);
+        nffsbench_json_uint("max", nffsbench_samples[num_samples - 1]);
+    }
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/** Sums the erase counts of all areas. */
+static uint32_t
+nffsbench_erase_cnt(void)
+{
+    struct fs_area_info info;
+    uint32_t total;
+    int i;
+
+    total = 0;
+    for (i = 0; fs_area_info("/", i, &info) == 0; i++) {
+        total += info.fai_erase_cnt;
+    }
+    return total;
+}
+
+static void
+nffsbench_fill(uint8_t *buf, int len, uint32_t seed)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+static void
+nffsbench_format(void)
+{
+    int rc;
+
+    rc = nffs_format(nffsbench_areas);
+    assert(rc == 0);
+}
+
+/**
+ * Writes a file sequentially in chunk-sized writes, then reads it back the
+ * same way.  Running with a range of -b values shows the effect of the
+ * maximum block size on sequential throughput.
+ */
+static void
+nffsbench_seq(uint32_t file_len)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t flash_start;
+    uint32_t write_us;
+    uint32_t read_us;
+    uint32_t start;
+    uint32_t off;
+    int block_cnt;
+    int rc;
+
+    nffsbench_format();
+
+    flash_start = nffs_flash_bytes_written;
+    start = nffsbench_now_us();
+    rc = fs_open("/seq", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    assert(rc == 0);
+    for (off = 0; off < file_len; off += nffsbench_chunk_sz) {
+        rc = fs_write(file, nffsbench_data, nffsbench_chunk_sz);
+        assert(rc == 0);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+    write_us = nffsbench_now_us() - start;
+
+    start = nffsbench_now_us();
+    rc = fs_open("/seq", FS_ACCESS_READ, &file);
+    assert(rc == 0);
+    block_cnt = ((struct nffs_file *)file)->nf_inode_entry->nie_block_cnt;
+    for (off = 0; off < file_len; off += nffsbench_chunk_sz) {
+        rc = fs_read(file, nffsbench_chunk_sz, nffsbench_buf, &bytes_read);
+        assert(rc == 0 && bytes_read == nffsbench_chunk_sz);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+    read_us = nffsbench_now_us() - start;
+
+    nffsbench_json_start("seq");
+    nffsbench_json_uint("file_bytes", file_len);
+    nffsbench_json_uint("chunk_bytes", nffsbench_chunk_sz);
+    nffsbench_json_uint("blocks", block_cnt);
+    nffsbench_json_uint("write_Bps", nffsbench_rate(file_len, write_us));
+    nffsbench_json_uint("read_Bps", nffsbench_rate(file_len, read_us));
+    nffsbench_json_wamp(file_len, nffs_flash_bytes_written - flash_start);
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Overwrites and then reads chunks at random chunk-aligned offsets of the
+ * file left behind by the sequential test.
+ */
+static void
+nffsbench_random(uint32_t file_len)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t flash_start;
+    uint32_t num_chunks;
+    uint32_t write_us;
+    uint32_t read_us;
+    uint32_t start;
+    uint32_t i;
+    int rc;
+
+    num_chunks = file_len / nffsbench_chunk_sz;
+
+    flash_start = nffs_flash_bytes_written;
+    start = nffsbench_now_us();
+    rc = fs_open("/seq", FS_ACCESS_WRITE, &file);
+    assert(rc == 0);
+    for (i = 0; i < num_chunks; i++) {
+        rc = fs_seek(file, (rand() % num_chunks) * nffsbench_chunk_sz);
+        assert(rc == 0);
+        rc = fs_write(file, nffsbench_data, nffsbench_chunk_sz);
+        assert(rc == 0);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+    write_us = nffsbench_now_us() - start;
+
+    start = nffsbench_now_us();
+    rc = fs_open("/seq", FS_ACCESS_READ, &file);
+    assert(rc == 0);
+    for (i = 0; i < num_chunks; i++) {
+        rc = fs_seek(file, (rand() % num_chunks) * nffsbench_chunk_sz);
+        assert(rc == 0);
+        rc = fs_read(file, nffsbench_chunk_sz, nffsbench_buf, &bytes_read);
+        assert(rc == 0 && bytes_read == nffsbench_chunk_sz);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+    read_us = nffsbench_now_us() - start;
+
+    nffsbench_json_start("random");
+    nffsbench_json_uint("ops", num_chunks);
+    nffsbench_json_uint("chunk_bytes", nffsbench_chunk_sz);
+    nffsbench_json_uint("write_Bps",
+                        nffsbench_rate(num_chunks * nffsbench_chunk_sz,
+                                       write_us));
+    nffsbench_json_uint("read_Bps",
+                        nffsbench_rate(num_chunks * nffsbench_chunk_sz,
+                                       read_us));
+    nffsbench_json_wamp(num_chunks * nffsbench_chunk_sz,
+                        nffs_flash_bytes_written - flash_start);
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Appends fixed-size records to a log file through a single open handle,
+ * timing each append.
+ */
+static void
+nffsbench_append(void)
+{
+    struct fs_file *file;
+    uint32_t flash_start;
+    uint32_t start;
+    int num_records;
+    int rc;
+    int i;
+
+    nffsbench_format();
+
+    num_records = nffsbench_capacity / 4 / NFFSBENCH_RECORD_SZ;
+    if (num_records > NFFSBENCH_MAX_SAMPLES) {
+        num_records = NFFSBENCH_MAX_SAMPLES;
+    }
+
+    flash_start = nffs_flash_bytes_written;
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    assert(rc == 0);
+    for (i = 0; i < num_records; i++) {
+        start = nffsbench_now_us();
+        rc = fs_write(file, nffsbench_data, NFFSBENCH_RECORD_SZ);
+        nffsbench_samples[i] = nffsbench_now_us() - start;
+        assert(rc == 0);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+
+    nffsbench_json_start("append");
+    nffsbench_json_uint("record_bytes", NFFSBENCH_RECORD_SZ);
+    nffsbench_json_wamp(num_records * NFFSBENCH_RECORD_SZ,
+                        nffs_flash_bytes_written - flash_start);
+    nffsbench_json_dist("latency_us", num_records);
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Keeps half of the file system full of live data and overwrites random
+ * chunks of it until several times the file system's capacity has been
+ * written.  Writes that end up performing garbage collection are recorded as
+ * GC pauses.
+ */
+static void
+nffsbench_gc(void)
+{
+    struct fs_file *files[NFFSBENCH_CHURN_FILES];
+    char filename[16];
+    uint32_t flash_start;
+    uint32_t num_chunks;
+    uint32_t user_bytes;
+    uint32_t file_len;
+    uint32_t erases;
+    uint32_t start;
+    uint32_t usecs;
+    int num_pauses;
+    int num_writes;
+    int i;
+    int rc;
+
+    nffsbench_format();
+
+    file_len = nffsbench_capacity / 2 / NFFSBENCH_CHURN_FILES;
+    num_chunks = file_len / nffsbench_chunk_sz;
+    assert(num_chunks > 0);
+
+    for (i = 0; i < NFFSBENCH_CHURN_FILES; i++) {
+        snprintf(filename, sizeof filename, "/churn%d", i);
+        rc = fs_open(filename, FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE,
+                     files + i);
+        assert(rc == 0);
+        for (user_bytes = 0; user_bytes < file_len;
+             user_bytes += nffsbench_chunk_sz) {
+
+            rc = fs_write(files[i], nffsbench_data, nffsbench_chunk_sz);
+            assert(rc == 0);
+        }
+    }
+
+    flash_start = nffs_flash_bytes_written;
+    user_bytes = 0;
+    num_pauses = 0;
+    num_writes = 0;
+    while (user_bytes < nffsbench_capacity * 4) {
+        i = rand() % NFFSBENCH_CHURN_FILES;
+        rc = fs_seek(files[i], (rand() % num_chunks) * nffsbench_chunk_sz);
+        assert(rc == 0);
+
+        erases = nffsbench_erase_cnt();
+        start = nffsbench_now_us();
+        rc = fs_write(files[i], nffsbench_data, nffsbench_chunk_sz);
+        usecs = nffsbench_now_us() - start;
+        assert(rc == 0);
+
+        if (nffsbench_erase_cnt() != erases &&
+            num_pauses < NFFSBENCH_MAX_SAMPLES) {
+
+            nffsbench_samples[num_pauses++] = usecs;
+        }
+        user_bytes += nffsbench_chunk_sz;
+        num_writes++;
+    }
+
+    for (i = 0; i < NFFSBENCH_CHURN_FILES; i++) {
+        rc = fs_close(files[i]);
+        assert(rc == 0);
+    }
+
+    nffsbench_json_start("gc");
+    nffsbench_json_uint("live_bytes", file_len * NFFSBENCH_CHURN_FILES);
+    nffsbench_json_uint("writes", num_writes);
+    nffsbench_json_wamp(user_bytes, nffs_flash_bytes_written - flash_start);
+    nffsbench_json_dist("pause_us", num_pauses);
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Times nffs_detect() for file systems containing increasing numbers of
+ * single-block files.
+ */
+static void
+nffsbench_mount(void)
+{
+    struct fs_file *file;
+    char filename[16];
+    char key[16];
+    uint32_t best;
+    uint32_t start;
+    uint32_t usecs;
+    int num_files;
+    int i;
+    int rc;
+
+    nffsbench_json_start("mount_us");
+    for (num_files = 16;
+         num_files + 2 <= nffs_config.nc_num_inodes &&
+         num_files <= nffs_config.nc_num_blocks;
+         num_files *= 4) {
+
+        nffsbench_format();
+        for (i = 0; i < num_files; i++) {
+            snprintf(filename, sizeof filename, "/m%d", i);
+            rc = fs_open(filename, FS_ACCESS_WRITE, &file);
+            assert(rc == 0);
+            rc = fs_write(file, nffsbench_data, 32);
+            assert(rc == 0);
+            rc = fs_close(file);
+            assert(rc == 0);
+        }
+
+        /* Report the fastest of several runs to filter out host noise. */
+        best = UINT32_MAX;
+        for (i = 0; i < NFFSBENCH_MOUNT_REPEAT; i++) {
+            start = nffsbench_now_us();
+            rc = nffs_detect(nffsbench_areas);
+            usecs = nffsbench_now_us() - start;
+            assert(rc == 0);
+            if (usecs < best) {
+                best = usecs;
+            }
+        }
+
+        /* Each file is an inode and a data block. */
+        snprintf(key, sizeof key, "%d", num_files * 2);
+        nffsbench_json_uint(key, best);
+    }
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Compares the one-byte-per-iteration CRC16 with the sliced implementation
+ * nffs uses, for each power-of-two length up to a version 0 data block.
+ */
+static void
+nffsbench_crc16(void)
+{
+    volatile uint16_t crc;
+    uint32_t bytewise_us;
+    uint32_t sliced_us;
+    uint32_t start;
+    uint32_t iters;
+    uint32_t i;
+    char key[16];
+    int len;
+
+    nffsbench_json_start("crc16");
+    for (len = 16; len <= NFFS_BLOCK_MAX_DATA_SZ_V0; len *= 2) {
+        iters = NFFSBENCH_CRC_BYTES / len;
+
+        start = nffsbench_now_us();
+        for (i = 0; i < iters; i++) {
+            crc = crc16_ccitt_bytewise(0, nffsbench_data, len);
+        }
+        bytewise_us = nffsbench_now_us() - start;
+
+        start = nffsbench_now_us();
+        for (i = 0; i < iters; i++) {
+            crc = crc16_ccitt_sw(0, nffsbench_data, len);
+        }
+        sliced_us = nffsbench_now_us() - start;
+
+        snprintf(key, sizeof key, "%d", len);
+        nffsbench_json_start(key);
+        nffsbench_json_uint("bytewise_Bps",
+                            nffsbench_rate(NFFSBENCH_CRC_BYTES, bytewise_us));
+        nffsbench_json_uint("sliced_Bps",
+                            nffsbench_rate(NFFSBENCH_CRC_BYTES, sliced_us));
+        json_encode_object_finish(&nffsbench_enc);
+    }
+    json_encode_object_finish(&nffsbench_enc);
+    (void)crc;
+}
+
+/**
+ * Reports the RAM occupied by the object pools and the hash index, along with
+ * the pool cost of a single inode and block entry.  Running with -r and a
+ * range of -i and -k values shows how the footprint scales with the number of
+ * objects.
+ */
+static void
+nffsbench_ram(void)
+{
+    uint32_t inode_bytes;
+    uint32_t block_bytes;
+    uint32_t index_bytes;
+
+    inode_bytes = OS_MEMPOOL_BYTES(nffs_config.nc_num_inodes,
+                                   sizeof (struct nffs_inode_entry));
+    block_bytes = OS_MEMPOOL_BYTES(nffs_config.nc_num_blocks,
+                                   sizeof (struct nffs_hash_entry));
+    index_bytes = nffs_hash_num_slots * sizeof *nffs_hash +
+                  nffs_hash_max_handle / 8 + 1;
+
+    nffsbench_json_start("ram");
+    nffsbench_json_uint("inode_entry",
+                        OS_MEMPOOL_BYTES(1, sizeof (struct nffs_inode_entry)));
+    nffsbench_json_uint("block_entry",
+                        OS_MEMPOOL_BYTES(1, sizeof (struct nffs_hash_entry)));
+    nffsbench_json_uint("inode_pool", inode_bytes);
+    nffsbench_json_uint("block_pool", block_bytes);
+    nffsbench_json_uint("index", index_bytes);
+    nffsbench_json_uint("total", inode_bytes + block_bytes + index_bytes);
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+static void
+nffsbench_config(void)
+{
+    const struct native_flash_model *model;
+    char key[16];
+    int i;
+
+    nffsbench_json_start("config");
+    nffsbench_json_uint("inodes", nffs_config.nc_num_inodes);
+    nffsbench_json_uint("blocks", nffs_config.nc_num_blocks);
+    nffsbench_json_uint("block_max_data", nffs_block_max_data_sz);
+    nffsbench_json_uint("capacity", nffsbench_capacity);
+    nffsbench_json_start("areas");
+    for (i = 0; i < nffsbench_num_areas; i++) {
+        snprintf(key, sizeof key, "0x%lx",
+                 (unsigned long)nffsbench_areas[i].nad_offset);
+        nffsbench_json_uint(key, nffsbench_areas[i].nad_length);
+    }
+    json_encode_object_finish(&nffsbench_enc);
+
+    model = native_flash_model_get();
+    if (model != NULL) {
+        nffsbench_json_start("flash_model");
+        nffsbench_json_uint("write_ns", model->nfm_write_ns);
+        nffsbench_json_uint("erase_us", model->nfm_erase_us);
+        nffsbench_json_uint("read_ns", model->nfm_read_ns);
+        json_encode_object_finish(&nffsbench_enc);
+    }
+    json_encode_object_finish(&nffsbench_enc);
+}
+
+/**
+ * Indicates whether the specified address is a sector boundary of the
+ * specified flash device.
+ */
+static int
+nffsbench_is_sector_boundary(uint8_t flash_id, uint32_t addr)
+{
+    const struct hal_flash *hf;
+    uint32_t start;
+    uint32_t size;
+    int i;
+
+    hf = bsp_flash_dev(flash_id);
+    for (i = 0; i < hf->hf_sector_cnt; i++) {
+        hf->hf_itf->hff_sector_info(i, &start, &size);
+        if (addr == start || addr == start + size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Parses an "offset:length" area description and adds it to the layout.
+ */
+static void
+nffsbench_add_area(const char *arg)
+{
+    struct nffs_area_desc *area;
+    char *end;
+
+    if (nffsbench_num_areas >= NFFSBENCH_MAX_AREAS) {
+        fprintf(stderr, "too many areas\n");
+        usage(1);
+    }
+    area = nffsbench_areas + nffsbench_num_areas;
+    area->nad_flash_id = 0;
+    area->nad_offset = strtoul(arg, &end, 0);
+    if (*end != ':') {
+        usage(1);
+    }
+    area->nad_length = strtoul(end + 1, &end, 0);
+    if (*end != '\0' || area->nad_length == 0) {
+        usage(1);
+    }
+    nffsbench_num_areas++;
+}
+
+static void
+nffsbench_check_layout(void)
+{
+    const struct nffs_area_desc *area;
+    uint32_t largest;
+    uint32_t total;
+    int i;
+
+    if (nffsbench_num_areas < 2) {
+        fprintf(stderr, "at least two areas are required\n");
+        exit(1);
+    }
+
+    largest = 0;
+    total = 0;
+    for (i = 0; i < nffsbench_num_areas; i++) {
+        area = nffsbench_areas + i;
+        if (!nffsbench_is_sector_boundary(area->nad_flash_id,
+                                          area->nad_offset) ||
+            !nffsbench_is_sector_boundary(area->nad_flash_id,
+                                          area->nad_offset +
+                                          area->nad_length)) {
+
+            fprintf(stderr, "area 0x%lx:0x%lx is not sector aligned\n",
+                    (unsigned long)area->nad_offset,
+                    (unsigned long)area->nad_length);
+            exit(1);
+        }
+        if (area->nad_length > largest) {
+            largest = area->nad_length;
+        }
+        total += area->nad_length;
+    }
+    nffsbench_capacity = total - largest;
+}
+
+static void
+usage(int rc)
+{
+    printf("%s [-a offset:length]... [-b block_size] [-c chunk_size]\n"
+           "    [-i inodes] [-k blocks] [-r] [-s seed] [-f flash_file]\n"
+           "    [-m write_ns,erase_us,read_ns[,cpu]]\n",
+           progname);
+    printf("  Measures nffs performance on simulated flash; prints JSON\n");
+    printf("   -a: add an area to the layout (default: the 128kB sectors)\n");
+    printf("   -b: maximum block data size (default: nffs default)\n");
+    printf("   -c: size of each read and write (default: 256)\n");
+    printf("   -i: number of inodes (default: 1024)\n");
+    printf("   -k: number of data blocks (default: 4096)\n");
+    printf("   -r: only report the configuration and RAM footprint\n");
+    printf("   -s: random seed (default: 1)\n");
+    printf("   -f: flash_file is the name of the flash image file\n");
+    printf("   -m: flash timing model; see the native mcu's -m option\n");
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t seq_len;
+    int ram_only;
+    int rc;
+    int ch;
+    int i;
+
+    progname = argv[0];
+
+    nffs_config.nc_num_inodes = 1024;
+    nffs_config.nc_num_blocks = 4096;
+    ram_only = 0;
+    srand(1);
+
+    while ((ch = getopt(argc, argv, "a:b:c:f:i:k:m:rs:")) != -1) {
+        switch (ch) {
+        case 'a':
+            nffsbench_add_area(optarg);
+            break;
+        case 'b':
+            nffs_config.nc_block_max_data_sz = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            nffsbench_chunk_sz = strtoul(optarg, NULL, 0);
+            if (nffsbench_chunk_sz <= 0 ||
+                nffsbench_chunk_sz > NFFSBENCH_MAX_CHUNK) {
+
+                usage(1);
+            }
+            break;
+        case 'f':
+            native_flash_file = optarg;
+            break;
+        case 'i':
+            nffs_config.nc_num_inodes = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            nffs_config.nc_num_blocks = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (native_flash_model_parse(optarg) != 0) {
+                usage(1);
+            }
+            break;
+        case 'r':
+            ram_only = 1;
+            break;
+        case 's':
+            srand(strtoul(optarg, NULL, 0));
+            break;
+        case '?':
+        default:
+            usage(0);
+        }
+    }
+
+    if (nffsbench_num_areas == 0) {
+        for (i = 0; i < 7; i++) {
+            nffsbench_areas[i].nad_flash_id = 0;
+            nffsbench_areas[i].nad_offset = 0x00020000 + i * 128 * 1024;
+            nffsbench_areas[i].nad_length = 128 * 1024;
+        }
+        nffsbench_num_areas = 7;
+    }
+
+    os_init();
+
+    rc = hal_flash_init();
+    assert(rc == 0);
+
+    nffsbench_check_layout();
+
+    rc = nffs_init();
+    if (rc != 0) {
+        fprintf(stderr, "nffs_init() failed; rc=%d\n", rc);
+        exit(1);
+    }
+
+    /* nffs_format() settles the maximum block size for the layout. */
+    nffsbench_format();
+
+    seq_len = nffsbench_capacity / 4;
+    if (seq_len > NFFSBENCH_SEQ_MAX) {
+        seq_len = NFFSBENCH_SEQ_MAX;
+    }
+    seq_len -= seq_len % nffsbench_chunk_sz;
+
+    nffsbench_fill(nffsbench_data, sizeof nffsbench_data, 1);
+
+    nffsbench_enc.je_write = nffsbench_json_write;
+    nffsbench_enc.je_arg = NULL;
+    json_encode_object_start(&nffsbench_enc);
+
+    nffsbench_config();
+    nffsbench_ram();
+    if (!ram_only) {
+        nffsbench_seq(seq_len);
+        nffsbench_random(seq_len);
+        nffsbench_append();
+        nffsbench_gc();
+        nffsbench_mount();
+        nffsbench_crc16();
+    }
+
+    json_encode_object_finish(&nffsbench_enc);
+    printf("\n");
+
+    return 0;
+}